@@ -19,13 +19,18 @@ Status BuildTable(const std::string& dbname,
                   const Options& options,
                   TableCache* table_cache,
                   Iterator* iter,
+                  Iterator* range_del_iter,
                   FileMetaData* meta) {
   Status s;
   meta->file_size = 0;
+  meta->has_range_deletions = false;
   iter->SeekToFirst();
+  if (range_del_iter != NULL) {
+    range_del_iter->SeekToFirst();
+  }
 
   std::string fname = TableFileName(dbname, meta->number);
-  if (iter->Valid()) {
+  if (iter->Valid() || (range_del_iter != NULL && range_del_iter->Valid())) {
     WritableFile* file;
     s = env->NewWritableFile(fname, &file);
     if (!s.ok()) {
@@ -33,15 +38,49 @@ Status BuildTable(const std::string& dbname,
     }
 
     TableBuilder* builder = new TableBuilder(options, file);
-    meta->smallest.DecodeFrom(iter->key());
+    if (iter->Valid()) {
+      meta->smallest.DecodeFrom(iter->key());
+    }
     for (; iter->Valid(); iter->Next()) {
       Slice key = iter->key();
       meta->largest.DecodeFrom(key);
       builder->Add(key, iter->value());
     }
 
-    // Finish and check for builder errors
-    if (s.ok()) {
+    // The table also serves the keys covered by its range deletions, so
+    // they widen its key range: a range deletion [begin, end) at sequence
+    // number s spans the internal keys from (begin, s) to just before
+    // the first one of "end".
+    const InternalKeyComparator* icmp =
+        static_cast<const InternalKeyComparator*>(options.comparator);
+    for (; range_del_iter != NULL && range_del_iter->Valid();
+         range_del_iter->Next()) {
+      Slice key = range_del_iter->key();
+      Slice end_user_key = range_del_iter->value();
+      if (icmp->user_comparator()->Compare(ExtractUserKey(key),
+                                           end_user_key) >= 0) {
+        continue;  // Empty range
+      }
+      InternalKey begin, end(end_user_key, kMaxSequenceNumber,
+                             kValueTypeForSeek);
+      begin.DecodeFrom(key);
+      if (builder->NumEntries() == 0 && !meta->has_range_deletions) {
+        meta->smallest = begin;
+        meta->largest = end;
+      } else {
+        if (icmp->Compare(begin, meta->smallest) < 0) {
+          meta->smallest = begin;
+        }
+        if (icmp->Compare(end, meta->largest) > 0) {
+          meta->largest = end;
+        }
+      }
+      builder->AddRangeDeletion(key, end_user_key);
+      meta->has_range_deletions = true;
+    }
+    // Finish and check for builder errors.  If only empty ranges were
+    // deleted, no table is produced.
+    if (s.ok() && (builder->NumEntries() > 0 || meta->has_range_deletions)) {
       s = builder->Finish();
       if (s.ok()) {
         meta->file_size = builder->FileSize();
@@ -62,11 +101,12 @@ Status BuildTable(const std::string& dbname,
     delete file;
     file = NULL;
 
-    if (s.ok()) {
-      // Verify that the table is usable
+    if (s.ok() && meta->file_size > 0) {
+      // Verify that the table is usable.  New tables start in level 0.
       Iterator* it = table_cache->NewIterator(ReadOptions(),
                                               meta->number,
-                                              meta->file_size);
+                                              meta->file_size,
+                                              0);
       s = it->status();
       delete it;
     }
@@ -76,6 +116,9 @@ Status BuildTable(const std::string& dbname,
   if (!iter->status().ok()) {
     s = iter->status();
   }
+  if (range_del_iter != NULL && !range_del_iter->status().ok()) {
+    s = range_del_iter->status();
+  }
 
   if (s.ok() && meta->file_size > 0) {
     // Keep it
@@ -0,0 +1,330 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "db/compaction_pipeline.h"
+
+#include "leveldb/env.h"
+#include "leveldb/iterator.h"
+#include "util/mutexlock.h"
+
+namespace leveldb {
+
+void EntryBatch::Add(const Slice& key, const Slice& value) {
+  Entry e;
+  e.offset = data_.size();
+  e.key_size = static_cast<uint32_t>(key.size());
+  e.value_size = static_cast<uint32_t>(value.size());
+  data_.append(key.data(), key.size());
+  data_.append(value.data(), value.size());
+  entries_.push_back(e);
+}
+
+Slice EntryBatch::key(size_t i) const {
+  const Entry& e = entries_[i];
+  return Slice(data_.data() + e.offset, e.key_size);
+}
+
+Slice EntryBatch::value(size_t i) const {
+  const Entry& e = entries_[i];
+  return Slice(data_.data() + e.offset + e.key_size, e.value_size);
+}
+
+BackgroundTask::BackgroundTask(Env* env, void (*function)(void*), void* arg)
+    : function_(function),
+      arg_(arg),
+      started_(false),
+      cancelled_(false),
+      refs_(2) {
+  env->ScheduleWithPriority(&BackgroundTask::Run, this, Env::LOW);
+}
+
+void BackgroundTask::Run(void* arg) {
+  BackgroundTask* task = reinterpret_cast<BackgroundTask*>(arg);
+  bool run;
+  {
+    MutexLock l(&task->mu_);
+    run = !task->cancelled_;
+    task->started_ = run;
+  }
+  if (run) {
+    (*task->function_)(task->arg_);
+  }
+  task->Unref();
+}
+
+bool BackgroundTask::Cancel() {
+  MutexLock l(&mu_);
+  if (!started_) {
+    cancelled_ = true;
+  }
+  return cancelled_;
+}
+
+bool BackgroundTask::Idle() {
+  MutexLock l(&mu_);
+  return refs_ == 1;
+}
+
+void BackgroundTask::Release() {
+  Unref();
+}
+
+void BackgroundTask::Unref() {
+  bool last;
+  {
+    MutexLock l(&mu_);
+    assert(refs_ > 0);
+    last = (--refs_ == 0);
+  }
+  if (last) {
+    delete this;
+  }
+}
+
+BatchQueue::BatchQueue()
+    : cv_(&mu_),
+      producer_done_(false),
+      consumer_done_(false) {
+}
+
+BatchQueue::~BatchQueue() {
+  for (size_t i = 0; i < batches_.size(); i++) {
+    delete batches_[i];
+  }
+}
+
+bool BatchQueue::Push(EntryBatch* batch) {
+  MutexLock l(&mu_);
+  assert(!producer_done_);
+  while (batches_.size() >= kMaxBatches && !consumer_done_) {
+    cv_.Wait();
+  }
+  if (consumer_done_) {
+    delete batch;
+    return false;
+  }
+  batches_.push_back(batch);
+  cv_.SignalAll();
+  return true;
+}
+
+void BatchQueue::ProducerDone(const Status& s) {
+  MutexLock l(&mu_);
+  producer_done_ = true;
+  producer_status_ = s;
+  cv_.SignalAll();
+}
+
+EntryBatch* BatchQueue::Pop() {
+  MutexLock l(&mu_);
+  assert(!consumer_done_);
+  while (batches_.empty() && !producer_done_) {
+    cv_.Wait();
+  }
+  if (batches_.empty()) {
+    return NULL;
+  }
+  EntryBatch* batch = batches_.front();
+  batches_.pop_front();
+  cv_.SignalAll();
+  return batch;
+}
+
+void BatchQueue::ConsumerDone(const Status& s) {
+  MutexLock l(&mu_);
+  consumer_done_ = true;
+  consumer_status_ = s;
+  for (size_t i = 0; i < batches_.size(); i++) {
+    delete batches_[i];
+  }
+  batches_.clear();
+  cv_.SignalAll();
+}
+
+Status BatchQueue::WaitForProducer() {
+  MutexLock l(&mu_);
+  while (!producer_done_) {
+    cv_.Wait();
+  }
+  return producer_status_;
+}
+
+Status BatchQueue::WaitForConsumer() {
+  MutexLock l(&mu_);
+  while (!consumer_done_) {
+    cv_.Wait();
+  }
+  return consumer_status_;
+}
+
+namespace {
+
+class PipelinedIterator : public Iterator {
+ public:
+  PipelinedIterator(Env* env, Iterator* input)
+      : env_(env),
+        input_(input),
+        queue_(NULL),
+        producer_(NULL),
+        cancelled_(NULL),
+        batch_(NULL),
+        pos_(0) {
+  }
+
+  virtual ~PipelinedIterator() {
+    Stop();
+    delete input_;
+  }
+
+  virtual bool Valid() const {
+    return batch_ != NULL;
+  }
+  virtual void SeekToFirst() {
+    Stop();
+    input_->SeekToFirst();
+    Start();
+  }
+  virtual void SeekToLast() {
+    Stop();
+    status_ = Status::NotSupported("SeekToLast on pipelined iterator");
+  }
+  virtual void Seek(const Slice& target) {
+    Stop();
+    input_->Seek(target);
+    Start();
+  }
+  virtual void Next() {
+    assert(Valid());
+    pos_++;
+    if (pos_ == batch_->size()) {
+      Fetch();
+    }
+  }
+  virtual void Prev() {
+    Stop();
+    status_ = Status::NotSupported("Prev on pipelined iterator");
+  }
+  virtual Slice key() const {
+    assert(Valid());
+    return batch_->key(pos_);
+  }
+  virtual Slice value() const {
+    assert(Valid());
+    return batch_->value(pos_);
+  }
+  virtual Status status() const {
+    return status_;
+  }
+
+ private:
+  Env* const env_;
+  Iterator* const input_;   // Only touched by a producer that has started
+  BatchQueue* queue_;
+  BackgroundTask* producer_;
+  BackgroundTask* cancelled_;  // Cancelled producer the pool may still hold
+  EntryBatch* batch_;       // Current batch; NULL if !Valid()
+  size_t pos_;              // Position of the current entry in batch_
+  Status status_;
+
+  static void ProduceWork(void* arg) {
+    reinterpret_cast<PipelinedIterator*>(arg)->Produce();
+  }
+
+  // Move the entries of "input_" into "*batch" until it is full.
+  void FillBatch(EntryBatch* batch) {
+    for (; input_->Valid() && !batch->full(); input_->Next()) {
+      batch->Add(input_->key(), input_->value());
+    }
+  }
+
+  void Produce() {
+    bool stopped = false;
+    while (input_->Valid()) {
+      EntryBatch* batch = new EntryBatch;
+      FillBatch(batch);
+      if (!queue_->Push(batch)) {
+        stopped = true;
+        break;
+      }
+    }
+    queue_->ProducerDone(stopped ? Status::OK() : input_->status());
+  }
+
+  void Start() {
+    assert(queue_ == NULL);
+    status_ = Status::OK();
+    queue_ = new BatchQueue;
+    producer_ = new BackgroundTask(env_, &PipelinedIterator::ProduceWork,
+                                   this);
+    Fetch();
+  }
+
+  // Make the next queued batch current.
+  void Fetch() {
+    delete batch_;
+    batch_ = NULL;
+    pos_ = 0;
+    if (producer_ != NULL) {
+      if (!producer_->Cancel()) {
+        batch_ = queue_->Pop();
+        if (batch_ == NULL) {
+          status_ = queue_->WaitForProducer();
+        }
+        return;
+      }
+      // The pool has not started the producer, so nothing is queued
+      assert(cancelled_ == NULL);
+      cancelled_ = producer_;
+      producer_ = NULL;
+    }
+
+    // Read the next batch here
+    if (input_->Valid()) {
+      batch_ = new EntryBatch;
+      FillBatch(batch_);
+    }
+    if (batch_ == NULL) {
+      status_ = input_->status();
+    } else if (input_->Valid() && cancelled_->Idle()) {
+      // Try the pool again, but never queue more than one producer in it
+      cancelled_->Release();
+      cancelled_ = NULL;
+      producer_ = new BackgroundTask(env_, &PipelinedIterator::ProduceWork,
+                                     this);
+    }
+  }
+
+  // Stop the producer, if any, and discard its output.
+  void Stop() {
+    delete batch_;
+    batch_ = NULL;
+    pos_ = 0;
+    if (producer_ != NULL) {
+      if (!producer_->Cancel()) {
+        queue_->ConsumerDone(Status::OK());
+        queue_->WaitForProducer();
+      }
+      producer_->Release();
+      producer_ = NULL;
+    }
+    if (cancelled_ != NULL) {
+      cancelled_->Release();
+      cancelled_ = NULL;
+    }
+    delete queue_;
+    queue_ = NULL;
+  }
+
+  // No copying allowed
+  PipelinedIterator(const PipelinedIterator&);
+  void operator=(const PipelinedIterator&);
+};
+
+}  // namespace
+
+Iterator* NewPipelinedIterator(Env* env, Iterator* input) {
+  return new PipelinedIterator(env, input);
+}
+
+}  // namespace leveldb
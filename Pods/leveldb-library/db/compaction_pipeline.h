@@ -0,0 +1,170 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// Building blocks for running a compaction as a pipeline of stages that
+// each run on a thread of the Env's LOW priority pool and hand key/value
+// entries to the next stage in batches through bounded queues:
+//
+//   input stage:  read, decompress and merge the input tables
+//   merge stage:  decide which entries to keep and where to cut outputs
+//   output stage: build, compress and write the output tables
+//
+// A stage whose neighbour has not been started by the pool does the
+// neighbour's work itself, so a compaction never waits on a pool that
+// is busy with other work.
+
+#ifndef STORAGE_LEVELDB_DB_COMPACTION_PIPELINE_H_
+#define STORAGE_LEVELDB_DB_COMPACTION_PIPELINE_H_
+
+#include <stdint.h>
+#include <deque>
+#include <string>
+#include <vector>
+#include "leveldb/slice.h"
+#include "leveldb/status.h"
+#include "port/port.h"
+
+namespace leveldb {
+
+class Env;
+class Iterator;
+
+// A function scheduled on the LOW priority pool of an Env that can be
+// cancelled until a thread of the pool starts it.
+//
+// Thread-safe (provides internal synchronization)
+class BackgroundTask {
+ public:
+  // Schedule "(*function)(arg)" on the LOW priority pool of "env".
+  BackgroundTask(Env* env, void (*function)(void* arg), void* arg);
+
+  // If no thread has started the function yet, make sure that none ever
+  // will and return true.  Otherwise return false.
+  bool Cancel();
+
+  // True once the pool is done with the task: the function has returned,
+  // or a thread of the pool has dropped the task after Cancel().
+  bool Idle();
+
+  // Drop the reference of the creator.  The function may still be
+  // running; the task is deleted once it is done.
+  void Release();
+
+ private:
+  ~BackgroundTask() { }
+
+  static void Run(void* arg);
+  void Unref();
+
+  void (*const function_)(void*);
+  void* const arg_;
+  port::Mutex mu_;
+  bool started_;
+  bool cancelled_;
+  int refs_;    // The creator and the pool
+
+  // No copying allowed
+  BackgroundTask(const BackgroundTask&);
+  void operator=(const BackgroundTask&);
+};
+
+// A sequence of key/value entries that owns a copy of their contents.
+class EntryBatch {
+ public:
+  EntryBatch() : cut_before_(false) { }
+
+  void Add(const Slice& key, const Slice& value);
+
+  size_t size() const { return entries_.size(); }
+  bool empty() const { return entries_.empty(); }
+  Slice key(size_t i) const;
+  Slice value(size_t i) const;
+
+  // True once the batch holds enough data to be handed to the next stage.
+  bool full() const { return data_.size() >= kTargetSize; }
+
+  // True if the output stage should finish its current output file
+  // before adding the entries of this batch.
+  bool cut_before() const { return cut_before_; }
+  void set_cut_before() { cut_before_ = true; }
+
+ private:
+  static const size_t kTargetSize = 64 << 10;
+
+  struct Entry {
+    size_t offset;
+    uint32_t key_size;
+    uint32_t value_size;
+  };
+  std::string data_;
+  std::vector<Entry> entries_;
+  bool cut_before_;
+
+  // No copying allowed
+  EntryBatch(const EntryBatch&);
+  void operator=(const EntryBatch&);
+};
+
+// A bounded queue of batches between one producer and one consumer
+// thread.  Either side may stop early; the other side notices on its
+// next call.
+//
+// Thread-safe (provides internal synchronization)
+class BatchQueue {
+ public:
+  BatchQueue();
+  ~BatchQueue();
+
+  // Producer: append "batch", waiting while the queue is full.  Takes
+  // ownership of "batch".  Returns false if the consumer has stopped, in
+  // which case the producer should stop too.
+  bool Push(EntryBatch* batch);
+
+  // Producer: no more batches will be pushed.  "s" is reported to the
+  // consumer.
+  void ProducerDone(const Status& s);
+
+  // Consumer: remove and return the oldest batch, waiting while the queue
+  // is empty.  The caller takes ownership of the result.  Returns NULL
+  // once the producer is done and every batch has been consumed.
+  EntryBatch* Pop();
+
+  // Consumer: no more batches will be popped.  Batches still queued are
+  // discarded.  "s" is reported to the producer.
+  void ConsumerDone(const Status& s);
+
+  // Wait until the producer (resp. consumer) is done and return the
+  // status it reported.
+  Status WaitForProducer();
+  Status WaitForConsumer();
+
+ private:
+  // At most this many batches are buffered between the two threads
+  static const size_t kMaxBatches = 4;
+
+  port::Mutex mu_;
+  port::CondVar cv_;
+  std::deque<EntryBatch*> batches_;
+  bool producer_done_;
+  bool consumer_done_;
+  Status producer_status_;
+  Status consumer_status_;
+
+  // No copying allowed
+  BatchQueue(const BatchQueue&);
+  void operator=(const BatchQueue&);
+};
+
+// Return an iterator that walks "input" on a thread of the LOW priority
+// pool of "env" and yields the entries through a bounded queue, so that
+// reading and decompressing blocks overlaps with the work of the caller.
+// Batches the pool has not started reading are read by the caller.
+// Only forward iteration is supported: SeekToLast() and Prev() make the
+// result invalid with a NotSupported status.  Takes ownership of
+// "input" and deletes it when the result is deleted.
+extern Iterator* NewPipelinedIterator(Env* env, Iterator* input);
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_DB_COMPACTION_PIPELINE_H_
@@ -11,12 +11,15 @@
 #include <stdio.h>
 #include <vector>
 #include "db/builder.h"
+#include "db/compaction_pipeline.h"
 #include "db/db_iter.h"
 #include "db/dbformat.h"
 #include "db/filename.h"
 #include "db/log_reader.h"
 #include "db/log_writer.h"
 #include "db/memtable.h"
+#include "db/merge_helper.h"
+#include "db/range_del.h"
 #include "db/table_cache.h"
 #include "db/version_set.h"
 #include "db/write_batch_internal.h"
@@ -37,15 +40,48 @@ namespace leveldb {
 
 const int kNumNonTableCacheFiles = 10;
 
+// Longest a writer sleeps before re-checking the write rate
+static const uint64_t kMaxWriteDelayMicros = 100000;
+
 // Information kept for every waiting writer
 struct DBImpl::Writer {
   Status status;
   WriteBatch* batch;
   bool sync;
   bool done;
+  bool logged;                  // Logged by a pipelined group; not in writers_
+  bool log_sync;                // Only syncs what earlier groups logged
+  bool ingest;                  // Holds the queue for IngestExternalFile()
+  WriteGroup* insert_group;     // Set when asked to insert "batch"
   port::CondVar cv;
 
-  explicit Writer(port::Mutex* mu) : cv(mu) { }
+  // Set for writes queued by WriteAsync(); such writers have no thread
+  // waiting on "cv" and are deleted once the callback has run.
+  void (*callback)(void* arg, const Status& s);
+  void* callback_arg;
+
+  explicit Writer(port::Mutex* mu)
+      : logged(false), log_sync(false), ingest(false), insert_group(NULL),
+        cv(mu),
+        callback(NULL), callback_arg(NULL) { }
+};
+
+// A write group whose log record has been written and whose batches
+// still have to be inserted into the memtable.
+struct DBImpl::WriteGroup {
+  MemTable* mem;
+  std::vector<Writer*> writers;   // writers[0] is the group leader
+  SequenceNumber last_sequence;   // Sequence number of the group's last entry
+  int pending;                    // Number of followers still inserting
+  Status status;                  // First error reported by a follower
+};
+
+// The memtables and version a read has to search, each referenced
+// until the view is released.
+struct DBImpl::ReadView {
+  MemTable* mem;
+  std::vector<MemTable*> imm;     // Newest first
+  Version* current;
 };
 
 struct DBImpl::CompactionState {
@@ -62,6 +98,7 @@ struct DBImpl::CompactionState {
     uint64_t number;
     uint64_t file_size;
     InternalKey smallest, largest;
+    bool has_range_deletions;
   };
   std::vector<Output> outputs;
 
@@ -71,13 +108,115 @@ struct DBImpl::CompactionState {
 
   uint64_t total_bytes;
 
+  // Range of user keys compacted into "outputs".  A compaction split
+  // into subcompactions uses one CompactionState per range.
+  const Slice* start;   // NULL means beginning of key range (inclusive)
+  const Slice* end;     // NULL means end of key range (exclusive)
+  Compaction::Cursor cursor;
+
+  // The range deletions of the input files, shared by all subcompactions,
+  // or NULL if there are none.  Each output keeps the pieces that fall in
+  // its range of user keys, which starts at output_start (or at "start"
+  // for the first output).
+  const RangeTombstoneList* range_dels;
+  std::string output_start;
+  bool has_output_start;
+
   Output* current_output() { return &outputs[outputs.size()-1]; }
 
   explicit CompactionState(Compaction* c)
       : compaction(c),
         outfile(NULL),
         builder(NULL),
-        total_bytes(0) {
+        total_bytes(0),
+        start(NULL),
+        end(NULL),
+        range_dels(NULL),
+        has_output_start(false) {
+  }
+
+  // Stores in *pieces the range deletion entries, as pairs of internal
+  // key and end user key, that an output spanning the user keys from
+  // "*lower" up to (not including) "*upper" has to hold.  NULL bounds
+  // are unbounded.
+  void RangeDeletionPieces(const Comparator* ucmp,
+                           const Slice* lower, const Slice* upper,
+                           std::vector<std::pair<std::string, std::string> >*
+                               pieces);
+};
+
+void DBImpl::CompactionState::RangeDeletionPieces(
+    const Comparator* ucmp, const Slice* lower, const Slice* upper,
+    std::vector<std::pair<std::string, std::string> >* pieces) {
+  pieces->clear();
+  if (range_dels == NULL) {
+    return;
+  }
+  const std::vector<RangeTombstoneList::Fragment>& fragments =
+      range_dels->fragments();
+  size_t f = (lower != NULL) ? range_dels->FindFragment(*lower) : 0;
+  for (; f < fragments.size(); f++) {
+    const RangeTombstoneList::Fragment& fragment = fragments[f];
+    if (upper != NULL && ucmp->Compare(fragment.begin, *upper) >= 0) {
+      break;
+    }
+    const Slice begin = (lower != NULL &&
+                         ucmp->Compare(fragment.begin, *lower) < 0)
+                        ? *lower : fragment.begin;
+    const Slice end = (upper != NULL &&
+                       ucmp->Compare(fragment.end, *upper) > 0)
+                      ? *upper : fragment.end;
+    for (size_t i = 0; i < fragment.sequences.size(); i++) {
+      const SequenceNumber seq = fragment.sequences[i];
+      if (seq <= smallest_snapshot) {
+        // Every snapshot sees this deletion, so the older ones covering
+        // the piece are redundant.  The compaction drops the entries it
+        // covers, so it is obsolete too unless older data for the piece
+        // may exist in higher levels.
+        if (compaction->IsBaseLevelForRange(begin, end)) {
+          break;
+        }
+      }
+      std::string key;
+      AppendInternalKey(&key, ParsedInternalKey(begin, seq,
+                                                kTypeRangeDeletion));
+      pieces->push_back(std::make_pair(key, end.ToString()));
+      if (seq <= smallest_snapshot) {
+        break;
+      }
+    }
+  }
+}
+
+// A subcompaction that runs in a thread of the LOW priority pool, or in
+// the thread of the compaction if the pool has not started it.
+struct DBImpl::SubcompactionTask {
+  DBImpl* db;
+  CompactionState* compact;
+  Status status;
+  bool done;
+  BackgroundTask* task;
+};
+
+// The output stage of a pipelined compaction: a task in the LOW priority
+// pool that adds the entries handed over through "queue" to the outputs
+// of "compact".  Batches handed over while the pool has not started the
+// task are added by the merge stage itself.
+struct DBImpl::OutputStage {
+  DBImpl* const db;
+  CompactionState* const compact;
+  BatchQueue queue;
+  BackgroundTask* task;
+  BackgroundTask* cancelled;  // Cancelled task the pool may still hold
+  bool cut_pending;           // Cut once the current user key is written
+
+  OutputStage(DBImpl* d, CompactionState* c)
+      : db(d), compact(c), task(NULL), cancelled(NULL), cut_pending(false) {
+    task = new BackgroundTask(d->env_, &DBImpl::BGWorkCompactionOutput, this);
+  }
+  ~OutputStage() {
+    if (task != NULL) task->Release();
+    if (cancelled != NULL) cancelled->Release();
   }
 };
 
@@ -90,12 +229,17 @@ static void ClipToRange(T* ptr, V minvalue, V maxvalue) {
 Options SanitizeOptions(const std::string& dbname,
                         const InternalKeyComparator* icmp,
                         const InternalFilterPolicy* ipolicy,
+                        const InternalKeySliceTransform* iprefix,
                         const Options& src) {
   Options result = src;
   result.comparator = icmp;
   result.filter_policy = (src.filter_policy != NULL) ? ipolicy : NULL;
+  result.prefix_extractor = (src.prefix_extractor != NULL) ? iprefix : NULL;
   ClipToRange(&result.max_open_files,    64 + kNumNonTableCacheFiles, 50000);
+  ClipToRange(&result.max_background_compactions, 1,                  64);
+  ClipToRange(&result.max_subcompactions, 1,                          64);
   ClipToRange(&result.write_buffer_size, 64<<10,                      1<<30);
+  ClipToRange(&result.max_write_buffer_number, 2,                     64);
   ClipToRange(&result.max_file_size,     1<<20,                       1<<30);
   ClipToRange(&result.block_size,        1<<10,                       4<<20);
   if (result.info_log == NULL) {
@@ -109,7 +253,7 @@ Options SanitizeOptions(const std::string& dbname,
     }
   }
   if (result.block_cache == NULL) {
-    result.block_cache = NewLRUCache(8 << 20);
+    result.block_cache = NewLRUCache(8 << 20, 0.5);
   }
   return result;
 }
@@ -118,8 +262,10 @@ DBImpl::DBImpl(const Options& raw_options, const std::string& dbname)
     : env_(raw_options.env),
       internal_comparator_(raw_options.comparator),
       internal_filter_policy_(raw_options.filter_policy),
+      internal_prefix_extractor_(raw_options.prefix_extractor),
       options_(SanitizeOptions(dbname, &internal_comparator_,
-                               &internal_filter_policy_, raw_options)),
+                               &internal_filter_policy_,
+                               &internal_prefix_extractor_, raw_options)),
       owns_info_log_(options_.info_log != raw_options.info_log),
       owns_cache_(options_.block_cache != raw_options.block_cache),
       dbname_(dbname),
@@ -127,31 +273,59 @@ DBImpl::DBImpl(const Options& raw_options, const std::string& dbname)
       shutting_down_(NULL),
       bg_cv_(&mutex_),
       mem_(NULL),
-      imm_(NULL),
       logfile_(NULL),
       logfile_number_(0),
       log_(NULL),
       seed_(0),
+      read_view_(NULL),
+      last_sequence_(NULL),
       tmp_batch_(new WriteBatch),
-      bg_compaction_scheduled_(false),
+      write_controller_(options_.delayed_write_rate,
+                        options_.soft_pending_compaction_bytes_limit),
+      write_delay_micros_(0),
+      write_stall_micros_(0),
+      write_thread_started_(false),
+      write_cv_(&mutex_),
+      log_bytes_unsynced_(0),
+      log_syncs_completed_(0),
+      log_sync_waiters_(0),
+      log_sync_thread_started_(false),
+      log_sync_cv_(&mutex_),
+      bg_compactions_scheduled_(0),
+      bg_compactions_running_(0),
+      bg_flush_scheduled_(false),
+      installing_pushed_memtable_(0),
       manual_compaction_(NULL) {
-  has_imm_.Release_Store(NULL);
-
   // Reserve ten files or so for other uses and give the rest to TableCache.
   const int table_cache_size = options_.max_open_files - kNumNonTableCacheFiles;
   table_cache_ = new TableCache(dbname_, &options_, table_cache_size);
 
   versions_ = new VersionSet(dbname_, &options_, table_cache_,
                              &internal_comparator_);
+
+  // Give each compaction that may run at once a thread of the LOW pool
+  env_->IncBackgroundThreadsIfNeeded(options_.max_background_compactions,
+                                     Env::LOW);
 }
 
 DBImpl::~DBImpl() {
   // Wait for background work to finish
   mutex_.Lock();
   shutting_down_.Release_Store(this);  // Any non-NULL value is ok
-  while (bg_compaction_scheduled_) {
+  write_cv_.Signal();
+  log_sync_cv_.Signal();
+  bg_cv_.SignalAll();  // Wake writers waiting for a flush
+  while (bg_compactions_scheduled_ > 0 || bg_flush_scheduled_ ||
+         write_thread_started_ || log_sync_thread_started_) {
     bg_cv_.Wait();
   }
+  ReadView* view = reinterpret_cast<ReadView*>(read_view_.NoBarrier_Load());
+  if (view != NULL) {
+    read_view_.NoBarrier_Store(NULL);
+    retired_views_.push_back(view);
+  }
+  ReclaimReadViews();
+  assert(retired_views_.empty());
   mutex_.Unlock();
 
   if (db_lock_ != NULL) {
@@ -160,7 +334,9 @@ DBImpl::~DBImpl() {
 
   delete versions_;
   if (mem_ != NULL) mem_->Unref();
-  if (imm_ != NULL) imm_->Unref();
+  for (size_t i = 0; i < imm_.size(); i++) {
+    imm_[i].mem->Unref();
+  }
   delete tmp_batch_;
   delete log_;
   delete logfile_;
@@ -438,7 +614,13 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
     if (mem->ApproximateMemoryUsage() > options_.write_buffer_size) {
       compactions++;
       *save_manifest = true;
-      status = WriteLevel0Table(mem, edit, NULL);
+      uint64_t file_number;
+      int level;
+      status = WriteLevel0Table(std::vector<MemTable*>(1, mem), edit, NULL,
+                                &file_number, &level);
+      // No background work runs during recovery, so the table does not
+      // need protecting until the edit is applied.
+      pending_outputs_.erase(file_number);
       mem->Unref();
       mem = NULL;
       if (!status.ok()) {
@@ -477,7 +659,11 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
     // mem did not get reused; compact it.
     if (status.ok()) {
       *save_manifest = true;
-      status = WriteLevel0Table(mem, edit, NULL);
+      uint64_t file_number;
+      int level;
+      status = WriteLevel0Table(std::vector<MemTable*>(1, mem), edit, NULL,
+                                &file_number, &level);
+      pending_outputs_.erase(file_number);
     }
     mem->Unref();
   }
@@ -485,21 +671,40 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
   return status;
 }
 
-Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit,
-                                Version* base) {
+Status DBImpl::WriteLevel0Table(const std::vector<MemTable*>& mems,
+                                VersionEdit* edit, Version* base,
+                                uint64_t* file_number, int* level) {
   mutex_.AssertHeld();
   const uint64_t start_micros = env_->NowMicros();
   FileMetaData meta;
   meta.number = versions_->NewFileNumber();
   pending_outputs_.insert(meta.number);
-  Iterator* iter = mem->NewIterator();
-  Log(options_.info_log, "Level-0 table #%llu: started",
-      (unsigned long long) meta.number);
+  *file_number = meta.number;
+  Iterator* iter;
+  Iterator* range_del_iter;
+  if (mems.size() == 1) {
+    iter = mems[0]->NewIterator();
+    range_del_iter = mems[0]->NewRangeDeletionIterator();
+  } else {
+    std::vector<Iterator*> list;
+    std::vector<Iterator*> range_del_list;
+    for (size_t i = 0; i < mems.size(); i++) {
+      list.push_back(mems[i]->NewIterator());
+      range_del_list.push_back(mems[i]->NewRangeDeletionIterator());
+    }
+    iter = NewMergingIterator(&internal_comparator_, &list[0], list.size());
+    range_del_iter = NewMergingIterator(&internal_comparator_,
+                                        &range_del_list[0],
+                                        range_del_list.size());
+  }
+  Log(options_.info_log, "Level-0 table #%llu: started from %d memtables",
+      (unsigned long long) meta.number, static_cast<int>(mems.size()));
 
   Status s;
   {
     mutex_.Unlock();
-    s = BuildTable(dbname_, env_, options_, table_cache_, iter, &meta);
+    s = BuildTable(dbname_, env_, options_, table_cache_, iter,
+                   range_del_iter, &meta);
     mutex_.Lock();
   }
 
@@ -508,56 +713,82 @@ Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit,
       (unsigned long long) meta.file_size,
       s.ToString().c_str());
   delete iter;
-  pending_outputs_.erase(meta.number);
-
+  delete range_del_iter;
 
   // Note that if file_size is zero, the file has been deleted and
   // should not be added to the manifest.
-  int level = 0;
+  *level = 0;
   if (s.ok() && meta.file_size > 0) {
     const Slice min_user_key = meta.smallest.user_key();
     const Slice max_user_key = meta.largest.user_key();
-    if (base != NULL) {
-      level = base->PickLevelForMemTableOutput(min_user_key, max_user_key);
+    // Only push the output below level-0 if "base" is still current and
+    // no table compaction is in flight: a concurrent compaction may be
+    // producing files in the levels we would otherwise pick.
+    if (base != NULL && base == versions_->current() &&
+        bg_compactions_scheduled_ == 0) {
+      *level = base->PickLevelForMemTableOutput(min_user_key, max_user_key);
+      if (*level > 0) {
+        installing_pushed_memtable_++;
+      }
     }
-    edit->AddFile(level, meta.number, meta.file_size,
-                  meta.smallest, meta.largest);
+    if (*level > 0 && options_.pin_l0_filter_and_index_blocks_in_cache) {
+      // BuildTable() opened the table as a level-0 table
+      table_cache_->Evict(meta.number);
+    }
+    edit->AddFile(*level, meta.number, meta.file_size,
+                  meta.smallest, meta.largest, meta.has_range_deletions);
   }
 
   CompactionStats stats;
   stats.micros = env_->NowMicros() - start_micros;
   stats.bytes_written = meta.file_size;
-  stats_[level].Add(stats);
+  stats_[*level].Add(stats);
   return s;
 }
 
 void DBImpl::CompactMemTable() {
   mutex_.AssertHeld();
-  assert(imm_ != NULL);
+  assert(!imm_.empty());
 
-  // Save the contents of the memtable as a new Table
+  // Save the contents of every sealed memtable as a single new Table.
+  // Memtables sealed meanwhile are left for the next memtable compaction.
+  const size_t n = imm_.size();
+  std::vector<MemTable*> mems;
+  for (size_t i = 0; i < n; i++) {
+    mems.push_back(imm_[i].mem);
+  }
   VersionEdit edit;
   Version* base = versions_->current();
   base->Ref();
-  Status s = WriteLevel0Table(imm_, &edit, base);
+  uint64_t file_number;
+  int level;
+  Status s = WriteLevel0Table(mems, &edit, base, &file_number, &level);
   base->Unref();
 
   if (s.ok() && shutting_down_.Acquire_Load()) {
     s = Status::IOError("Deleting DB during memtable compaction");
   }
 
-  // Replace immutable memtable with the generated Table
+  // Replace immutable memtables with the generated Table
   if (s.ok()) {
     edit.SetPrevLogNumber(0);
-    edit.SetLogNumber(logfile_number_);  // Earlier logs no longer needed
+    // Logs older than the one holding the oldest remaining memtable are
+    // no longer needed
+    edit.SetLogNumber(n < imm_.size() ? imm_[n].log_number : logfile_number_);
     s = versions_->LogAndApply(&edit, &mutex_);
   }
+  if (level > 0) {
+    installing_pushed_memtable_--;
+  }
+  pending_outputs_.erase(file_number);
 
   if (s.ok()) {
     // Commit to the new state
-    imm_->Unref();
-    imm_ = NULL;
-    has_imm_.Release_Store(NULL);
+    for (size_t i = 0; i < n; i++) {
+      imm_[i].mem->Unref();
+    }
+    imm_.erase(imm_.begin(), imm_.begin() + n);
+    InstallReadView();
     DeleteObsoleteFiles();
   } else {
     RecordBackgroundError(s);
@@ -581,6 +812,357 @@ void DBImpl::CompactRange(const Slice* begin, const Slice* end) {
   }
 }
 
+Status DBImpl::DeleteFilesInRange(const Slice* begin, const Slice* end) {
+  MutexLock l(&mutex_);
+  if (!bg_error_.ok()) {
+    return bg_error_;
+  }
+  Version* base = versions_->current();
+  VersionEdit edit;
+  std::vector<FileMetaData*> deleted;
+  int64_t deleted_bytes = 0;
+  for (int level = 1; level < config::kNumLevels; level++) {
+    std::vector<FileMetaData*> files;
+    base->GetFilesInRange(level, begin, end, &files);
+    for (size_t i = 0; i < files.size(); i++) {
+      edit.DeleteFile(level, files[i]->number);
+      deleted_bytes += files[i]->file_size;
+    }
+    deleted.insert(deleted.end(), files.begin(), files.end());
+  }
+  if (deleted.empty()) {
+    return Status::OK();
+  }
+
+  // Keep compactions from picking the files while the edit is applied,
+  // which releases mutex_.  "base" keeps the files alive meanwhile.
+  base->Ref();
+  for (size_t i = 0; i < deleted.size(); i++) {
+    deleted[i]->being_compacted = true;
+  }
+  Status s = versions_->LogAndApply(&edit, &mutex_);
+  InstallReadView();
+  for (size_t i = 0; i < deleted.size(); i++) {
+    deleted[i]->being_compacted = false;
+  }
+  base->Unref();
+  if (s.ok()) {
+    Log(options_.info_log, "Deleted %d files in range, %lld bytes",
+        static_cast<int>(deleted.size()),
+        static_cast<long long>(deleted_bytes));
+    DeleteObsoleteFiles();
+    MaybeScheduleCompaction();
+  } else {
+    RecordBackgroundError(s);
+  }
+  return s;
+}
+
+// A table file written by an SstFileWriter, opened for ingestion
+struct DBImpl::ExternalFile {
+  std::string path;
+  RandomAccessFile* file;
+  Table* table;
+  std::string smallest;  // User keys of the first and last entries
+  std::string largest;
+
+  ExternalFile() : file(NULL), table(NULL) { }
+  ~ExternalFile() {
+    delete table;
+    delete file;
+  }
+};
+
+namespace {
+
+struct ExternalFileOrder {
+  const Comparator* ucmp;
+  template <typename T>
+  bool operator()(const T* a, const T* b) const {
+    return ucmp->Compare(a->smallest, b->smallest) < 0;
+  }
+};
+
+// Yields the entries of an external file with "sequence" as their
+// sequence number, once it has checked that they are values written at
+// sequence number 0 in increasing order.  Only scans forward, which is
+// all BuildTable() needs.
+class IngestIterator : public Iterator {
+ public:
+  IngestIterator(Iterator* iter, const Comparator* ucmp,
+                 SequenceNumber sequence)
+      : iter_(iter), ucmp_(ucmp), sequence_(sequence), has_last_(false) { }
+  virtual ~IngestIterator() { delete iter_; }
+
+  virtual bool Valid() const { return status_.ok() && iter_->Valid(); }
+  virtual void SeekToFirst() {
+    iter_->SeekToFirst();
+    has_last_ = false;
+    Update();
+  }
+  virtual void SeekToLast() { Unsupported(); }
+  virtual void Seek(const Slice& target) { Unsupported(); }
+  virtual void Next() {
+    iter_->Next();
+    Update();
+  }
+  virtual void Prev() { Unsupported(); }
+  virtual Slice key() const { return key_; }
+  virtual Slice value() const { return iter_->value(); }
+  virtual Status status() const {
+    return status_.ok() ? iter_->status() : status_;
+  }
+
+ private:
+  void Unsupported() {
+    status_ = Status::NotSupported("external files are only scanned forward");
+  }
+
+  void Update() {
+    if (!Valid()) {
+      return;
+    }
+    ParsedInternalKey ikey;
+    if (!ParseInternalKey(iter_->key(), &ikey) ||
+        ikey.type != kTypeValue || ikey.sequence != 0) {
+      status_ = Status::Corruption("external file not written by SstFileWriter");
+      return;
+    }
+    if (has_last_ && ucmp_->Compare(ikey.user_key, last_user_key_) <= 0) {
+      status_ = Status::Corruption("keys out of order in external file");
+      return;
+    }
+    last_user_key_.assign(ikey.user_key.data(), ikey.user_key.size());
+    has_last_ = true;
+    key_.clear();
+    AppendInternalKey(&key_,
+                      ParsedInternalKey(ikey.user_key, sequence_, kTypeValue));
+  }
+
+  Iterator* const iter_;
+  const Comparator* const ucmp_;
+  const SequenceNumber sequence_;
+  Status status_;
+  std::string key_;
+  std::string last_user_key_;
+  bool has_last_;
+};
+
+}  // namespace
+
+Status DBImpl::IngestExternalFile(const std::vector<std::string>& paths) {
+  // Open the files and find their key ranges
+  ReadOptions read_options;
+  read_options.verify_checksums = true;
+  read_options.fill_cache = false;
+  std::vector<ExternalFile*> files;
+  Status s;
+  for (size_t i = 0; i < paths.size() && s.ok(); i++) {
+    ExternalFile* f = new ExternalFile;
+    f->path = paths[i];
+    uint64_t file_size;
+    s = env_->GetFileSize(f->path, &file_size);
+    if (s.ok()) {
+      s = env_->NewRandomAccessFile(f->path, &f->file);
+    }
+    if (s.ok()) {
+      s = Table::Open(options_, f->file, file_size, &f->table);
+    }
+    bool empty = true;
+    if (s.ok()) {
+      Iterator* iter = f->table->NewIterator(read_options);
+      ParsedInternalKey ikey;
+      iter->SeekToFirst();
+      if (iter->Valid()) {
+        empty = false;
+        if (ParseInternalKey(iter->key(), &ikey)) {
+          f->smallest = ikey.user_key.ToString();
+        } else {
+          s = Status::Corruption("bad key in external file", f->path);
+        }
+        iter->SeekToLast();
+        if (s.ok() && iter->Valid() && ParseInternalKey(iter->key(), &ikey)) {
+          f->largest = ikey.user_key.ToString();
+        } else if (s.ok() && iter->status().ok()) {
+          s = Status::Corruption("bad key in external file", f->path);
+        }
+      }
+      if (s.ok()) {
+        s = iter->status();
+      }
+      delete iter;
+    }
+    if (s.ok() && !empty) {
+      files.push_back(f);
+    } else {
+      delete f;  // Nothing to ingest
+    }
+  }
+  if (s.ok()) {
+    ExternalFileOrder order;
+    order.ucmp = user_comparator();
+    std::sort(files.begin(), files.end(), order);
+    for (size_t i = 1; i < files.size() && s.ok(); i++) {
+      if (user_comparator()->Compare(files[i]->smallest,
+                                     files[i - 1]->largest) <= 0) {
+        s = Status::InvalidArgument("external files overlap",
+                                    files[i]->path);
+      }
+    }
+  }
+
+  if (s.ok() && !files.empty()) {
+    MutexLock l(&mutex_);
+    // Hold the front of the writer queue so that no write gets a
+    // sequence number or enters the memtable meanwhile
+    Writer w(&mutex_);
+    w.batch = NULL;
+    w.sync = false;
+    w.done = false;
+    w.ingest = true;
+    writers_.push_back(&w);
+    while (&w != writers_.front()) {
+      w.cv.Wait();
+    }
+    s = IngestFiles(files);
+    writers_.pop_front();
+    NotifyWriteQueueHead();
+  }
+
+  for (size_t i = 0; i < files.size(); i++) {
+    delete files[i];
+  }
+  return s;
+}
+
+Status DBImpl::IngestFiles(const std::vector<ExternalFile*>& files) {
+  mutex_.AssertHeld();
+  assert(!writers_.empty() && writers_.front()->ingest);
+  // Let earlier pipelined groups finish inserting into the memtable
+  while (!pending_groups_.empty()) {
+    bg_cv_.Wait();
+  }
+  Status s = bg_error_;
+  if (!s.ok()) {
+    return s;
+  }
+
+  // Reads look at the memtables before the tables, so the memtables
+  // must not hold older entries in the key ranges of the files.
+  bool flush_mem = false;
+  bool flush_imm = false;
+  for (size_t i = 0; i < files.size(); i++) {
+    const Slice smallest(files[i]->smallest);
+    const Slice largest(files[i]->largest);
+    if (mem_->OverlapsRange(smallest, largest)) {
+      flush_mem = true;
+    }
+    for (size_t j = 0; j < imm_.size(); j++) {
+      if (imm_[j].mem->OverlapsRange(smallest, largest)) {
+        flush_imm = true;
+      }
+    }
+  }
+  if (flush_mem) {
+    s = MakeRoomForWrite(true);
+  }
+  if (s.ok() && (flush_mem || flush_imm)) {
+    while (!imm_.empty() && bg_error_.ok()) {
+      bg_cv_.Wait();
+    }
+    s = bg_error_;
+  }
+  if (!s.ok()) {
+    return s;
+  }
+
+  // Every entry of the files gets the same sequence number, newer than
+  // any data in the database
+  const SequenceNumber sequence = versions_->LastSequence() + 1;
+  std::vector<FileMetaData> metas(files.size());
+  std::vector<CompactionStats> stats(files.size());
+  for (size_t i = 0; i < files.size(); i++) {
+    metas[i].number = versions_->NewFileNumber();
+    pending_outputs_.insert(metas[i].number);
+  }
+  {
+    mutex_.Unlock();
+    ReadOptions read_options;
+    read_options.verify_checksums = true;
+    read_options.fill_cache = false;
+    for (size_t i = 0; i < files.size() && s.ok(); i++) {
+      const uint64_t start_micros = env_->NowMicros();
+      Iterator* iter = new IngestIterator(
+          files[i]->table->NewIterator(read_options), user_comparator(),
+          sequence);
+      s = BuildTable(dbname_, env_, options_, table_cache_, iter, NULL,
+                     &metas[i]);
+      delete iter;
+      if (!s.ok()) {
+        Log(options_.info_log, "Ingesting %s: %s",
+            files[i]->path.c_str(), s.ToString().c_str());
+      }
+      stats[i].micros = env_->NowMicros() - start_micros;
+      stats[i].bytes_written = metas[i].file_size;
+    }
+    mutex_.Lock();
+  }
+
+  if (s.ok()) {
+    // Place each table as deep as possible, as WriteLevel0Table() does,
+    // unless a running compaction may produce files in its range
+    VersionEdit edit;
+    Version* base = versions_->current();
+    bool pushed = false;
+    for (size_t i = 0; i < files.size(); i++) {
+      const FileMetaData& meta = metas[i];
+      int level = 0;
+      if (bg_compactions_scheduled_ == 0) {
+        level = base->PickLevelForIngestedFile(meta.smallest.user_key(),
+                                               meta.largest.user_key());
+      }
+      if (level > 0) {
+        pushed = true;
+        if (options_.pin_l0_filter_and_index_blocks_in_cache) {
+          // BuildTable() opened the table as a level-0 table
+          table_cache_->Evict(meta.number);
+        }
+      }
+      edit.AddFile(level, meta.number, meta.file_size,
+                   meta.smallest, meta.largest);
+      stats_[level].Add(stats[i]);
+      Log(options_.info_log, "Ingested %s as table #%llu: %llu bytes at level %d",
+          files[i]->path.c_str(), (unsigned long long) meta.number,
+          (unsigned long long) meta.file_size, level);
+    }
+    if (pushed) {
+      installing_pushed_memtable_++;
+    }
+    // LogAndApply() releases mutex_, so the new sequence only reaches
+    // versions_ once the read view holding the files is installed: until
+    // then a snapshot must not cover the ingested entries.
+    edit.SetLastSequence(sequence);
+    s = versions_->LogAndApply(&edit, &mutex_);
+    if (pushed) {
+      installing_pushed_memtable_--;
+    }
+    if (s.ok()) {
+      InstallReadView();
+      versions_->SetLastSequence(sequence);
+      PublishLastSequence();
+    } else {
+      RecordBackgroundError(s);
+    }
+  }
+
+  for (size_t i = 0; i < files.size(); i++) {
+    pending_outputs_.erase(metas[i].number);
+  }
+  DeleteObsoleteFiles();
+  MaybeScheduleCompaction();
+  return s;
+}
+
 void DBImpl::TEST_CompactRange(int level, const Slice* begin,const Slice* end) {
   assert(level >= 0);
   assert(level + 1 < config::kNumLevels);
@@ -624,10 +1206,10 @@ Status DBImpl::TEST_CompactMemTable() {
   if (s.ok()) {
     // Wait until the compaction completes
     MutexLock l(&mutex_);
-    while (imm_ != NULL && bg_error_.ok()) {
+    while (!imm_.empty() && bg_error_.ok()) {
       bg_cv_.Wait();
     }
-    if (imm_ != NULL) {
+    if (!imm_.empty()) {
       s = bg_error_;
     }
   }
@@ -644,20 +1226,55 @@ void DBImpl::RecordBackgroundError(const Status& s) {
 
 void DBImpl::MaybeScheduleCompaction() {
   mutex_.AssertHeld();
-  if (bg_compaction_scheduled_) {
-    // Already scheduled
-  } else if (shutting_down_.Acquire_Load()) {
+  if (shutting_down_.Acquire_Load()) {
     // DB is being deleted; no more background compactions
+    return;
   } else if (!bg_error_.ok()) {
     // Already got an error; no more changes
-  } else if (imm_ == NULL &&
-             manual_compaction_ == NULL &&
+    return;
+  }
+
+  if (!imm_.empty() && !bg_flush_scheduled_) {
+    bg_flush_scheduled_ = true;
+    env_->ScheduleWithPriority(&DBImpl::BGWorkFlush, this, Env::HIGH);
+  }
+
+  if (bg_compactions_scheduled_ > bg_compactions_running_) {
+    // A compaction is already waiting to pick its inputs
+  } else if (bg_compactions_scheduled_ >=
+             options_.max_background_compactions) {
+    // Enough compactions are in flight
+  } else if (installing_pushed_memtable_ > 0) {
+    // Rescheduled once the memtable output has been installed
+  } else if (manual_compaction_ == NULL &&
              !versions_->NeedsCompaction()) {
     // No work to be done
   } else {
-    bg_compaction_scheduled_ = true;
-    env_->Schedule(&DBImpl::BGWork, this);
+    bg_compactions_scheduled_++;
+    env_->ScheduleWithPriority(&DBImpl::BGWork, this, Env::LOW);
+  }
+}
+
+void DBImpl::BGWorkFlush(void* db) {
+  reinterpret_cast<DBImpl*>(db)->BackgroundFlushCall();
+}
+
+void DBImpl::BackgroundFlushCall() {
+  MutexLock l(&mutex_);
+  assert(bg_flush_scheduled_);
+  if (shutting_down_.Acquire_Load()) {
+    // No more background work when shutting down.
+  } else if (!bg_error_.ok()) {
+    // No more background work after a background error.
+  } else if (!imm_.empty()) {
+    CompactMemTable();
   }
+
+  bg_flush_scheduled_ = false;
+
+  // The new level-0 file may trigger a table compaction.
+  MaybeScheduleCompaction();
+  bg_cv_.SignalAll();
 }
 
 void DBImpl::BGWork(void* db) {
@@ -666,29 +1283,35 @@ void DBImpl::BGWork(void* db) {
 
 void DBImpl::BackgroundCall() {
   MutexLock l(&mutex_);
-  assert(bg_compaction_scheduled_);
+  assert(bg_compactions_scheduled_ > 0);
+  bool made_progress = false;
   if (shutting_down_.Acquire_Load()) {
     // No more background work when shutting down.
   } else if (!bg_error_.ok()) {
     // No more background work after a background error.
   } else {
-    BackgroundCompaction();
+    made_progress = BackgroundCompaction();
   }
 
-  bg_compaction_scheduled_ = false;
+  bg_compactions_scheduled_--;
 
   // Previous compaction may have produced too many files in a level,
-  // so reschedule another compaction if needed.
-  MaybeScheduleCompaction();
+  // so reschedule another compaction if needed.  If every candidate
+  // was busy, the compaction holding them reschedules when it is done.
+  if (made_progress || bg_compactions_running_ == 0) {
+    MaybeScheduleCompaction();
+  }
   bg_cv_.SignalAll();
 }
 
-void DBImpl::BackgroundCompaction() {
+bool DBImpl::BackgroundCompaction() {
   mutex_.AssertHeld();
 
-  if (imm_ != NULL) {
-    CompactMemTable();
-    return;
+  if (manual_compaction_ != NULL && bg_compactions_running_ > 0) {
+    // A manual compaction may pick any file of its range, so it waits
+    // until the running compactions are done; the last one of them
+    // reschedules it.
+    return false;
   }
 
   Compaction* c;
@@ -711,6 +1334,20 @@ void DBImpl::BackgroundCompaction() {
     c = versions_->PickCompaction();
   }
 
+  if (c == NULL && !is_manual) {
+    // Nothing to do, or every candidate is being compacted already
+    return false;
+  }
+
+  if (c != NULL) {
+    // The inputs of "c" are reserved now, so another thread may look
+    // for more work while this compaction runs.
+    bg_compactions_running_++;
+    if (!is_manual) {
+      MaybeScheduleCompaction();
+    }
+  }
+
   Status status;
   if (c == NULL) {
     // Nothing to do
@@ -720,8 +1357,9 @@ void DBImpl::BackgroundCompaction() {
     FileMetaData* f = c->input(0, 0);
     c->edit()->DeleteFile(c->level(), f->number);
     c->edit()->AddFile(c->level() + 1, f->number, f->file_size,
-                       f->smallest, f->largest);
+                       f->smallest, f->largest, f->has_range_deletions);
     status = versions_->LogAndApply(c->edit(), &mutex_);
+    InstallReadView();
     if (!status.ok()) {
       RecordBackgroundError(status);
     }
@@ -742,7 +1380,10 @@ void DBImpl::BackgroundCompaction() {
     c->ReleaseInputs();
     DeleteObsoleteFiles();
   }
-  delete c;
+  if (c != NULL) {
+    delete c;
+    bg_compactions_running_--;
+  }
 
   if (status.ok()) {
     // Done
@@ -766,6 +1407,7 @@ void DBImpl::BackgroundCompaction() {
     }
     manual_compaction_ = NULL;
   }
+  return true;
 }
 
 void DBImpl::CleanupCompaction(CompactionState* compact) {
@@ -797,6 +1439,7 @@ Status DBImpl::OpenCompactionOutputFile(CompactionState* compact) {
     out.number = file_number;
     out.smallest.Clear();
     out.largest.Clear();
+    out.has_range_deletions = false;
     compact->outputs.push_back(out);
     mutex_.Unlock();
   }
@@ -811,22 +1454,56 @@ Status DBImpl::OpenCompactionOutputFile(CompactionState* compact) {
 }
 
 Status DBImpl::FinishCompactionOutputFile(CompactionState* compact,
-                                          Iterator* input) {
+                                          const Status& input_status,
+                                          const Slice* next_user_key) {
   assert(compact != NULL);
   assert(compact->outfile != NULL);
   assert(compact->builder != NULL);
 
-  const uint64_t output_number = compact->current_output()->number;
+  CompactionState::Output* out = compact->current_output();
+  const uint64_t output_number = out->number;
   assert(output_number != 0);
 
   // Check for iterator errors
-  Status s = input->status();
+  Status s = input_status;
   const uint64_t current_entries = compact->builder->NumEntries();
   if (s.ok()) {
+    // Add the range deletions of the user keys this output is responsible
+    // for, from where the previous output stopped up to "next_user_key".
+    const Slice output_start(compact->output_start);
+    std::vector<std::pair<std::string, std::string> > pieces;
+    compact->RangeDeletionPieces(
+        user_comparator(),
+        compact->has_output_start ? &output_start : compact->start,
+        (next_user_key != NULL) ? next_user_key : compact->end,
+        &pieces);
+    for (size_t i = 0; i < pieces.size(); i++) {
+      InternalKey begin, end_sentinel;
+      begin.DecodeFrom(pieces[i].first);
+      end_sentinel.SetFrom(ParsedInternalKey(pieces[i].second,
+                                             kMaxSequenceNumber,
+                                             kValueTypeForSeek));
+      const InternalKeyComparator& icmp = internal_comparator_;
+      if ((current_entries == 0 && !out->has_range_deletions) ||
+          icmp.Compare(begin, out->smallest) < 0) {
+        out->smallest = begin;
+      }
+      if ((current_entries == 0 && !out->has_range_deletions) ||
+          icmp.Compare(end_sentinel, out->largest) > 0) {
+        out->largest = end_sentinel;
+      }
+      out->has_range_deletions = true;
+      compact->builder->AddRangeDeletion(pieces[i].first, pieces[i].second);
+    }
     s = compact->builder->Finish();
   } else {
     compact->builder->Abandon();
   }
+  if (next_user_key != NULL) {
+    compact->output_start.assign(next_user_key->data(),
+                                 next_user_key->size());
+    compact->has_output_start = true;
+  }
   const uint64_t current_bytes = compact->builder->FileSize();
   compact->current_output()->file_size = current_bytes;
   compact->total_bytes += current_bytes;
@@ -843,11 +1520,12 @@ Status DBImpl::FinishCompactionOutputFile(CompactionState* compact,
   delete compact->outfile;
   compact->outfile = NULL;
 
-  if (s.ok() && current_entries > 0) {
+  if (s.ok() && (current_entries > 0 || out->has_range_deletions)) {
     // Verify that the table is usable
     Iterator* iter = table_cache_->NewIterator(ReadOptions(),
                                                output_number,
-                                               current_bytes);
+                                               current_bytes,
+                                               -1);
     s = iter->status();
     delete iter;
     if (s.ok()) {
@@ -862,6 +1540,30 @@ Status DBImpl::FinishCompactionOutputFile(CompactionState* compact,
   return s;
 }
 
+Status DBImpl::FinishLastCompactionOutput(CompactionState* compact,
+                                          const Status& input_status) {
+  if (input_status.ok() && compact->builder == NULL &&
+      compact->range_dels != NULL) {
+    // Every entry may have been dropped while range deletions of this
+    // key range still have to be kept
+    const Slice output_start(compact->output_start);
+    std::vector<std::pair<std::string, std::string> > pieces;
+    compact->RangeDeletionPieces(
+        user_comparator(),
+        compact->has_output_start ? &output_start : compact->start,
+        compact->end, &pieces);
+    if (!pieces.empty()) {
+      Status s = OpenCompactionOutputFile(compact);
+      if (!s.ok()) {
+        return s;
+      }
+    }
+  }
+  if (compact->builder == NULL) {
+    return input_status;
+  }
+  return FinishCompactionOutputFile(compact, input_status, NULL);
+}
 
 Status DBImpl::InstallCompactionResults(CompactionState* compact) {
   mutex_.AssertHeld();
@@ -879,14 +1581,16 @@ Status DBImpl::InstallCompactionResults(CompactionState* compact) {
     const CompactionState::Output& out = compact->outputs[i];
     compact->compaction->edit()->AddFile(
         level + 1,
-        out.number, out.file_size, out.smallest, out.largest);
+        out.number, out.file_size, out.smallest, out.largest,
+        out.has_range_deletions);
   }
-  return versions_->LogAndApply(compact->compaction->edit(), &mutex_);
+  Status s = versions_->LogAndApply(compact->compaction->edit(), &mutex_);
+  InstallReadView();
+  return s;
 }
 
 Status DBImpl::DoCompactionWork(CompactionState* compact) {
   const uint64_t start_micros = env_->NowMicros();
-  int64_t imm_micros = 0;  // Micros spent doing imm_ compactions
 
   Log(options_.info_log,  "Compacting %d@%d + %d@%d files",
       compact->compaction->num_input_files(0),
@@ -903,72 +1607,369 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
     compact->smallest_snapshot = snapshots_.oldest()->number_;
   }
 
+  // Split a level-0 compaction into key ranges that are compacted in
+  // parallel.  "compact" itself takes the first range.
+  std::vector<Slice> boundaries;
+  if (compact->compaction->level() == 0) {
+    compact->compaction->GetSubcompactionBoundaries(
+        options_.max_subcompactions, &boundaries);
+  }
+  std::vector<SubcompactionTask*> tasks;
+  for (size_t i = 0; i < boundaries.size(); i++) {
+    SubcompactionTask* task = new SubcompactionTask;
+    task->db = this;
+    task->compact = new CompactionState(compact->compaction);
+    task->compact->smallest_snapshot = compact->smallest_snapshot;
+    task->compact->start = &boundaries[i];
+    if (i + 1 < boundaries.size()) {
+      task->compact->end = &boundaries[i + 1];
+    }
+    task->done = false;
+    task->task = NULL;
+    tasks.push_back(task);
+  }
+  if (!boundaries.empty()) {
+    compact->end = &boundaries[0];
+    Log(options_.info_log, "Compacting in %d subcompactions",
+        static_cast<int>(boundaries.size() + 1));
+  }
+
   // Release mutex while we're actually doing the compaction work
   mutex_.Unlock();
 
-  Iterator* input = versions_->MakeInputIterator(compact->compaction);
-  input->SeekToFirst();
+  // The range deletions of all inputs, which every subcompaction applies
+  // to its entries and splits among its outputs
   Status status;
-  ParsedInternalKey ikey;
-  std::string current_user_key;
-  bool has_current_user_key = false;
-  SequenceNumber last_sequence_for_key = kMaxSequenceNumber;
-  for (; input->Valid() && !shutting_down_.Acquire_Load(); ) {
-    // Prioritize immutable compaction work
-    if (has_imm_.NoBarrier_Load() != NULL) {
-      const uint64_t imm_start = env_->NowMicros();
-      mutex_.Lock();
-      if (imm_ != NULL) {
-        CompactMemTable();
-        bg_cv_.SignalAll();  // Wakeup MakeRoomForWrite() if necessary
+  RangeTombstoneList* range_dels = NULL;
+  if (compact->compaction->HasRangeDeletions()) {
+    range_dels = new RangeTombstoneList(user_comparator());
+    for (int which = 0; which < 2 && status.ok(); which++) {
+      const int level = compact->compaction->level() + which;
+      for (int i = 0; i < compact->compaction->num_input_files(which) &&
+               status.ok(); i++) {
+        const FileMetaData* f = compact->compaction->input(which, i);
+        if (f->has_range_deletions) {
+          status = table_cache_->AddRangeDeletions(
+              f->number, f->file_size, level, kMaxSequenceNumber, range_dels);
+        }
       }
-      mutex_.Unlock();
-      imm_micros += (env_->NowMicros() - imm_start);
     }
+    range_dels->Finish();
+    compact->range_dels = range_dels;
+    for (size_t i = 0; i < tasks.size(); i++) {
+      tasks[i]->compact->range_dels = range_dels;
+    }
+  }
 
-    Slice key = input->key();
-    if (compact->compaction->ShouldStopBefore(key) &&
-        compact->builder != NULL) {
-      status = FinishCompactionOutputFile(compact, input);
-      if (!status.ok()) {
-        break;
+  if (status.ok()) {
+    for (size_t i = 0; i < tasks.size(); i++) {
+      tasks[i]->task = new BackgroundTask(env_, &DBImpl::BGWorkSubcompaction,
+                                          tasks[i]);
+    }
+    status = DoSubcompactionWork(compact);
+    for (size_t i = 0; i < tasks.size(); i++) {
+      if (tasks[i]->task->Cancel()) {
+        // Not started by the pool, which may be busy with other work
+        BGWorkSubcompaction(tasks[i]);
       }
     }
+  } else {
+    for (size_t i = 0; i < tasks.size(); i++) {
+      tasks[i]->done = true;
+    }
+  }
 
-    // Handle key/value, add to state, etc.
-    bool drop = false;
-    if (!ParseInternalKey(key, &ikey)) {
-      // Do not hide error keys
-      current_user_key.clear();
-      has_current_user_key = false;
-      last_sequence_for_key = kMaxSequenceNumber;
-    } else {
-      if (!has_current_user_key ||
-          user_comparator()->Compare(ikey.user_key,
-                                     Slice(current_user_key)) != 0) {
-        // First occurrence of this user key
-        current_user_key.assign(ikey.user_key.data(), ikey.user_key.size());
-        has_current_user_key = true;
-        last_sequence_for_key = kMaxSequenceNumber;
-      }
+  mutex_.Lock();
+  for (size_t i = 0; i < tasks.size(); i++) {
+    while (!tasks[i]->done) {
+      bg_cv_.Wait();
+    }
+  }
+  compact->range_dels = NULL;
+  delete range_dels;
 
-      if (last_sequence_for_key <= compact->smallest_snapshot) {
-        // Hidden by an newer entry for same user key
-        drop = true;    // (A)
-      } else if (ikey.type == kTypeDeletion &&
-                 ikey.sequence <= compact->smallest_snapshot &&
-                 compact->compaction->IsBaseLevelForKey(ikey.user_key)) {
-        // For this user key:
-        // (1) there is no data in higher levels
-        // (2) data in lower levels will have larger sequence numbers
+  // Gather the outputs of all ranges, in key order, so that they are
+  // installed with a single edit.
+  for (size_t i = 0; i < tasks.size(); i++) {
+    CompactionState* sub = tasks[i]->compact;
+    if (status.ok()) {
+      status = tasks[i]->status;
+    }
+    compact->outputs.insert(compact->outputs.end(),
+                            sub->outputs.begin(), sub->outputs.end());
+    compact->total_bytes += sub->total_bytes;
+    if (sub->builder != NULL) {
+      sub->builder->Abandon();
+      delete sub->builder;
+    }
+    delete sub->outfile;
+    delete sub;
+    if (tasks[i]->task != NULL) {
+      tasks[i]->task->Release();
+    }
+    delete tasks[i];
+  }
+
+  CompactionStats stats;
+  stats.micros = env_->NowMicros() - start_micros;
+  for (int which = 0; which < 2; which++) {
+    for (int i = 0; i < compact->compaction->num_input_files(which); i++) {
+      stats.bytes_read += compact->compaction->input(which, i)->file_size;
+    }
+  }
+  for (size_t i = 0; i < compact->outputs.size(); i++) {
+    stats.bytes_written += compact->outputs[i].file_size;
+  }
+
+  stats_[compact->compaction->level() + 1].Add(stats);
+  write_controller_.RecordCompaction(stats.bytes_written, stats.micros);
+  if (stats.micros > 0) {
+    Log(options_.info_log,
+        "Compaction throughput: %.1f MB/s read, %.1f MB/s written",
+        stats.bytes_read / 1048576.0 / (stats.micros / 1e6),
+        stats.bytes_written / 1048576.0 / (stats.micros / 1e6));
+  }
+
+  if (status.ok()) {
+    status = InstallCompactionResults(compact);
+  }
+  if (!status.ok()) {
+    RecordBackgroundError(status);
+  }
+  VersionSet::LevelSummaryStorage tmp;
+  Log(options_.info_log,
+      "compacted to: %s", versions_->LevelSummary(&tmp));
+  return status;
+}
+
+void DBImpl::BGWorkSubcompaction(void* arg) {
+  SubcompactionTask* task = reinterpret_cast<SubcompactionTask*>(arg);
+  DBImpl* db = task->db;
+  task->status = db->DoSubcompactionWork(task->compact);
+  MutexLock l(&db->mutex_);
+  task->done = true;
+  db->bg_cv_.SignalAll();
+}
+
+Status DBImpl::AddCompactionEntry(CompactionState* compact,
+                                  const Slice& key, const Slice& value) {
+  // Open output file if necessary
+  if (compact->builder == NULL) {
+    Status s = OpenCompactionOutputFile(compact);
+    if (!s.ok()) {
+      return s;
+    }
+  }
+  if (compact->builder->NumEntries() == 0) {
+    compact->current_output()->smallest.DecodeFrom(key);
+  }
+  compact->current_output()->largest.DecodeFrom(key);
+  compact->builder->Add(key, value);
+  return Status::OK();
+}
+
+void DBImpl::BGWorkCompactionOutput(void* arg) {
+  OutputStage* output = reinterpret_cast<OutputStage*>(arg);
+  output->db->WriteCompactionOutput(output);
+}
+
+void DBImpl::WriteCompactionOutput(OutputStage* output) {
+  Status status;
+  EntryBatch* batch;
+  while (status.ok() && (batch = output->queue.Pop()) != NULL) {
+    status = AddCompactionBatch(output, *batch);
+    delete batch;
+  }
+  if (status.ok()) {
+    // Only finish the last output if the whole input was read
+    Status input_status = output->queue.WaitForProducer();
+    if (input_status.ok()) {
+      status = FinishLastCompactionOutput(output->compact, input_status);
+    }
+  }
+  output->queue.ConsumerDone(status);
+}
+
+Status DBImpl::AddCompactionBatch(OutputStage* output,
+                                  const EntryBatch& batch) {
+  CompactionState* compact = output->compact;
+  Status status;
+  if (batch.cut_before() && compact->builder != NULL &&
+      batch.key(0).size() >= 8) {
+    const Slice next_user_key = ExtractUserKey(batch.key(0));
+    status = FinishCompactionOutputFile(compact, Status::OK(),
+                                        &next_user_key);
+    output->cut_pending = false;
+  }
+  for (size_t i = 0; status.ok() && i < batch.size(); i++) {
+    const Slice key = batch.key(i);
+    if (output->cut_pending && key.size() >= 8 &&
+        user_comparator()->Compare(
+            ExtractUserKey(key),
+            compact->current_output()->largest.user_key()) != 0) {
+      const Slice next_user_key = ExtractUserKey(key);
+      status = FinishCompactionOutputFile(compact, Status::OK(),
+                                          &next_user_key);
+      output->cut_pending = false;
+      if (!status.ok()) {
+        break;
+      }
+    }
+    status = AddCompactionEntry(compact, key, batch.value(i));
+
+    // Close output file if it is big enough
+    if (status.ok() && compact->builder->FileSize() >=
+        compact->compaction->MaxOutputFileSize()) {
+      output->cut_pending = true;
+    }
+  }
+  return status;
+}
+
+bool DBImpl::HandOverBatch(OutputStage* output, EntryBatch* batch,
+                           Status* status) {
+  if (output->task != NULL) {
+    if (!output->task->Cancel()) {
+      return output->queue.Push(batch);
+    }
+    // The pool has not started the output stage, so nothing is queued
+    assert(output->cancelled == NULL);
+    output->cancelled = output->task;
+    output->task = NULL;
+  }
+  *status = AddCompactionBatch(output, *batch);
+  delete batch;
+  if (status->ok() && output->cancelled->Idle()) {
+    // Try the pool again, but never queue more than one task in it
+    output->cancelled->Release();
+    output->cancelled = NULL;
+    output->task = new BackgroundTask(env_, &DBImpl::BGWorkCompactionOutput,
+                                      output);
+  }
+  return status->ok();
+}
+
+Status DBImpl::DoSubcompactionWork(CompactionState* compact) {
+  Iterator* input = versions_->MakeInputIterator(compact->compaction);
+  OutputStage* output = NULL;
+  EntryBatch* batch = NULL;
+  if (options_.pipelined_compaction) {
+    // Read the input and build the outputs in tasks of their own
+    input = NewPipelinedIterator(env_, input);
+    output = new OutputStage(this, compact);
+    batch = new EntryBatch;
+  }
+  if (compact->start != NULL) {
+    InternalKey start(*compact->start, kMaxSequenceNumber, kValueTypeForSeek);
+    input->Seek(start.Encode());
+  } else {
+    input->SeekToFirst();
+  }
+  Status status;
+  ParsedInternalKey ikey;
+  std::string current_user_key;
+  bool has_current_user_key = false;
+  SequenceNumber last_sequence_for_key = kMaxSequenceNumber;
+  // Outputs are only cut between user keys, so that the range deletions
+  // of a user key are kept in the same output as its entries
+  bool cut_pending = false;
+  MergeHelper merge(user_comparator(), options_.merge_operator,
+                    options_.info_log);
+  for (; input->Valid() && !shutting_down_.Acquire_Load(); ) {
+    // Memtable compactions run concurrently in the HIGH priority pool
+    // (see BackgroundFlushCall), so there is no need to yield to them here.
+    Slice key = input->key();
+    if (compact->end != NULL &&
+        user_comparator()->Compare(ExtractUserKey(key), *compact->end) >= 0) {
+      // The rest belongs to the next subcompaction
+      break;
+    }
+    if (compact->compaction->ShouldStopBefore(key, &compact->cursor)) {
+      cut_pending = true;
+    }
+
+    // Handle key/value, add to state, etc.
+    bool drop = false;
+    bool merged = false;
+    if (!ParseInternalKey(key, &ikey)) {
+      // Do not hide error keys
+      current_user_key.clear();
+      has_current_user_key = false;
+      last_sequence_for_key = kMaxSequenceNumber;
+    } else {
+      if (!has_current_user_key ||
+          user_comparator()->Compare(ikey.user_key,
+                                     Slice(current_user_key)) != 0) {
+        // First occurrence of this user key
+        current_user_key.assign(ikey.user_key.data(), ikey.user_key.size());
+        has_current_user_key = true;
+        last_sequence_for_key = kMaxSequenceNumber;
+
+        if (cut_pending) {
+          cut_pending = false;
+          if (output != NULL) {
+            if (!batch->empty()) {
+              if (!HandOverBatch(output, batch, &status)) {
+                batch = NULL;
+                break;
+              }
+              batch = new EntryBatch;
+            }
+            batch->set_cut_before();
+          } else if (compact->builder != NULL) {
+            status = FinishCompactionOutputFile(compact, input->status(),
+                                                &ikey.user_key);
+            if (!status.ok()) {
+              break;
+            }
+          }
+        }
+      }
+
+      if (last_sequence_for_key <= compact->smallest_snapshot) {
+        // Hidden by an newer entry for same user key
+        drop = true;    // (A)
+      } else if (compact->range_dels != NULL &&
+                 compact->range_dels->MaxCoveringSequence(
+                     ikey.user_key, compact->smallest_snapshot) >
+                 ikey.sequence) {
+        // Erased by a range deletion that every snapshot sees
+        drop = true;
+      } else if (ikey.type == kTypeDeletion &&
+                 ikey.sequence <= compact->smallest_snapshot &&
+                 compact->compaction->IsBaseLevelForKey(ikey.user_key,
+                                                       &compact->cursor)) {
+        // For this user key:
+        // (1) there is no data in higher levels
+        // (2) data in lower levels will have larger sequence numbers
         // (3) data in layers that are being compacted here and have
         //     smaller sequence numbers will be dropped in the next
         //     few iterations of this loop (by rule (A) above).
         // Therefore this deletion marker is obsolete and can be dropped.
         drop = true;
+      } else if (ikey.type == kTypeMerge &&
+                 ikey.sequence <= compact->smallest_snapshot &&
+                 options_.merge_operator != NULL) {
+        // Every snapshot sees this operand: combine it with the older
+        // entries of the key.  This advances the input past them.
+        status = merge.MergeUntil(
+            input, compact->smallest_snapshot, compact->range_dels,
+            compact->compaction->IsBaseLevelForKey(ikey.user_key,
+                                                   &compact->cursor));
+        if (!status.ok()) {
+          break;
+        }
+        merged = true;
       }
 
-      last_sequence_for_key = ikey.sequence;
+      if (ikey.type == kTypeMerge && !drop &&
+          options_.merge_operator == NULL) {
+        // Without a merge operator the operand is kept as it is, and it
+        // still needs the older entries of the key
+        last_sequence_for_key = kMaxSequenceNumber;
+      } else {
+        last_sequence_for_key = ikey.sequence;
+      }
     }
 #if 0
     Log(options_.info_log,
@@ -976,72 +1977,83 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
         "%d smallest_snapshot: %d",
         ikey.user_key.ToString().c_str(),
         (int)ikey.sequence, ikey.type, kTypeValue, drop,
-        compact->compaction->IsBaseLevelForKey(ikey.user_key),
+        compact->compaction->IsBaseLevelForKey(ikey.user_key,
+                                               &compact->cursor),
         (int)last_sequence_for_key, (int)compact->smallest_snapshot);
 #endif
 
-    if (!drop) {
-      // Open output file if necessary
-      if (compact->builder == NULL) {
-        status = OpenCompactionOutputFile(compact);
-        if (!status.ok()) {
-          break;
+    // The entries to output in place of the current one
+    const size_t num_entries =
+        drop ? 0 : (merged ? merge.keys().size() : 1);
+    bool stop = false;
+    for (size_t i = 0; i < num_entries && !stop; i++) {
+      const Slice entry_key = merged ? Slice(merge.keys()[i]) : key;
+      const Slice entry_value =
+          merged ? Slice(merge.values()[i]) : input->value();
+      if (output != NULL) {
+        // Hand the entry over to the output stage
+        batch->Add(entry_key, entry_value);
+        if (batch->full()) {
+          if (!HandOverBatch(output, batch, &status)) {
+            batch = NULL;
+            stop = true;
+          } else {
+            batch = new EntryBatch;
+          }
         }
-      }
-      if (compact->builder->NumEntries() == 0) {
-        compact->current_output()->smallest.DecodeFrom(key);
-      }
-      compact->current_output()->largest.DecodeFrom(key);
-      compact->builder->Add(key, input->value());
-
-      // Close output file if it is big enough
-      if (compact->builder->FileSize() >=
-          compact->compaction->MaxOutputFileSize()) {
-        status = FinishCompactionOutputFile(compact, input);
+      } else {
+        status = AddCompactionEntry(compact, entry_key, entry_value);
         if (!status.ok()) {
-          break;
+          stop = true;
+        } else if (compact->builder->FileSize() >=
+                   compact->compaction->MaxOutputFileSize()) {
+          // Close output file once it is big enough
+          cut_pending = true;
         }
       }
     }
+    if (stop) {
+      break;
+    }
 
-    input->Next();
+    if (!merged) {
+      input->Next();
+    }
   }
 
   if (status.ok() && shutting_down_.Acquire_Load()) {
     status = Status::IOError("Deleting DB during compaction");
   }
-  if (status.ok() && compact->builder != NULL) {
-    status = FinishCompactionOutputFile(compact, input);
-  }
-  if (status.ok()) {
-    status = input->status();
+  if (output != NULL) {
+    // The output stage finishes the last output if the input is fine
+    if (status.ok()) {
+      status = input->status();
+    }
+    if (status.ok() && batch != NULL && !batch->empty()) {
+      HandOverBatch(output, batch, &status);
+    } else {
+      delete batch;
+    }
+    output->queue.ProducerDone(status);
+    if (output->task == NULL || output->task->Cancel()) {
+      // Finish the last output here; nothing is left in the queue
+      WriteCompactionOutput(output);
+    }
+    Status output_status = output->queue.WaitForConsumer();
+    if (status.ok()) {
+      status = output_status;
+    }
+    delete output;
+  } else {
+    if (status.ok()) {
+      status = FinishLastCompactionOutput(compact, input->status());
+    }
+    if (status.ok()) {
+      status = input->status();
+    }
   }
   delete input;
   input = NULL;
-
-  CompactionStats stats;
-  stats.micros = env_->NowMicros() - start_micros - imm_micros;
-  for (int which = 0; which < 2; which++) {
-    for (int i = 0; i < compact->compaction->num_input_files(which); i++) {
-      stats.bytes_read += compact->compaction->input(which, i)->file_size;
-    }
-  }
-  for (size_t i = 0; i < compact->outputs.size(); i++) {
-    stats.bytes_written += compact->outputs[i].file_size;
-  }
-
-  mutex_.Lock();
-  stats_[compact->compaction->level() + 1].Add(stats);
-
-  if (status.ok()) {
-    status = InstallCompactionResults(compact);
-  }
-  if (!status.ok()) {
-    RecordBackgroundError(status);
-  }
-  VersionSet::LevelSummaryStorage tmp;
-  Log(options_.info_log,
-      "compacted to: %s", versions_->LevelSummary(&tmp));
   return status;
 }
 
@@ -1050,14 +2062,30 @@ struct IterState {
   port::Mutex* mu;
   Version* version;
   MemTable* mem;
-  MemTable* imm;
+  std::vector<MemTable*> imm;
+
+  // The read bounds of the iterator as internal keys
+  std::string lower_bound;
+  std::string upper_bound;
+  Slice lower_bound_slice;
+  Slice upper_bound_slice;
 };
 
+// Stores in "*ikey" the first internal key with user key "user_key"
+// and returns it.
+static Slice BoundToInternalKey(const Slice& user_key, std::string* ikey) {
+  AppendInternalKey(ikey, ParsedInternalKey(user_key, kMaxSequenceNumber,
+                                            kValueTypeForSeek));
+  return Slice(*ikey);
+}
+
 static void CleanupIteratorState(void* arg1, void* arg2) {
   IterState* state = reinterpret_cast<IterState*>(arg1);
   state->mu->Lock();
   state->mem->Unref();
-  if (state->imm != NULL) state->imm->Unref();
+  for (size_t i = 0; i < state->imm.size(); i++) {
+    state->imm[i]->Unref();
+  }
   state->version->Unref();
   state->mu->Unlock();
   delete state;
@@ -1066,39 +2094,88 @@ static void CleanupIteratorState(void* arg1, void* arg2) {
 
 Iterator* DBImpl::NewInternalIterator(const ReadOptions& options,
                                       SequenceNumber* latest_snapshot,
-                                      uint32_t* seed) {
+                                      uint32_t* seed,
+                                      RangeTombstoneList** range_dels) {
   IterState* cleanup = new IterState;
+
+  // The tables compare internal keys, so they are handed the first
+  // internal key of each bound.  The bounds are kept in "cleanup", which
+  // outlives the child iterators.
+  ReadOptions table_options = options;
+  if (options.iterate_lower_bound != NULL) {
+    cleanup->lower_bound_slice = BoundToInternalKey(
+        *options.iterate_lower_bound, &cleanup->lower_bound);
+    table_options.iterate_lower_bound = &cleanup->lower_bound_slice;
+  }
+  if (options.iterate_upper_bound != NULL) {
+    cleanup->upper_bound_slice = BoundToInternalKey(
+        *options.iterate_upper_bound, &cleanup->upper_bound);
+    table_options.iterate_upper_bound = &cleanup->upper_bound_slice;
+  }
+
   mutex_.Lock();
-  *latest_snapshot = versions_->LastSequence();
+  *latest_snapshot = PublishedSequence();
 
   // Collect together all needed child iterators
   std::vector<Iterator*> list;
   list.push_back(mem_->NewIterator());
   mem_->Ref();
-  if (imm_ != NULL) {
-    list.push_back(imm_->NewIterator());
-    imm_->Ref();
+  for (size_t i = 0; i < imm_.size(); i++) {
+    list.push_back(imm_[i].mem->NewIterator());
+    imm_[i].mem->Ref();
+    cleanup->imm.push_back(imm_[i].mem);
   }
-  versions_->current()->AddIterators(options, &list);
+  versions_->current()->AddIterators(table_options, &list);
   Iterator* internal_iter =
       NewMergingIterator(&internal_comparator_, &list[0], list.size());
   versions_->current()->Ref();
 
   cleanup->mu = &mutex_;
   cleanup->mem = mem_;
-  cleanup->imm = imm_;
   cleanup->version = versions_->current();
   internal_iter->RegisterCleanup(CleanupIteratorState, cleanup, NULL);
 
   *seed = ++seed_;
   mutex_.Unlock();
+
+  if (range_dels != NULL) {
+    // Gather the range deletions visible to the iterator from the same
+    // memtables and version, which "cleanup" keeps alive
+    const SequenceNumber snapshot =
+        (options.snapshot != NULL
+         ? reinterpret_cast<const SnapshotImpl*>(options.snapshot)->number_
+         : *latest_snapshot);
+    RangeTombstoneList* list = new RangeTombstoneList(user_comparator());
+    Iterator* iter = cleanup->mem->NewRangeDeletionIterator();
+    Status s = list->AddEntries(iter, snapshot);
+    delete iter;
+    for (size_t i = 0; s.ok() && i < cleanup->imm.size(); i++) {
+      iter = cleanup->imm[i]->NewRangeDeletionIterator();
+      s = list->AddEntries(iter, snapshot);
+      delete iter;
+    }
+    if (s.ok()) {
+      s = cleanup->version->AddRangeDeletions(table_options, snapshot, list);
+    }
+    if (!s.ok()) {
+      delete list;
+      delete internal_iter;
+      return NewErrorIterator(s);
+    }
+    list->Finish();
+    if (list->empty()) {
+      delete list;
+      list = NULL;
+    }
+    *range_dels = list;
+  }
   return internal_iter;
 }
 
 Iterator* DBImpl::TEST_NewInternalIterator() {
   SequenceNumber ignored;
   uint32_t ignored_seed;
-  return NewInternalIterator(ReadOptions(), &ignored, &ignored_seed);
+  return NewInternalIterator(ReadOptions(), &ignored, &ignored_seed, NULL);
 }
 
 int64_t DBImpl::TEST_MaxNextLevelOverlappingBytes() {
@@ -1106,63 +2183,384 @@ int64_t DBImpl::TEST_MaxNextLevelOverlappingBytes() {
   return versions_->MaxNextLevelOverlappingBytes();
 }
 
+// Apply the merge operands found by a lookup of "key" to its result
+// "s" and "*value".
+static Status ApplyMerge(const Options& db_options, const Slice& key,
+                         const MergeContext& merge, const Status& s,
+                         std::string* value) {
+  if (merge.empty() || !(s.ok() || s.IsNotFound())) {
+    return s;
+  }
+  if (s.IsNotFound()) {
+    return merge.Merge(db_options.merge_operator, db_options.info_log, key,
+                       NULL, value);
+  }
+  const Slice existing(*value);
+  return merge.Merge(db_options.merge_operator, db_options.info_log, key,
+                     &existing, value);
+}
+
+// Look "key" up as of "snapshot" in the memtable, then in the immutable
+// memtables (if any) from newest to oldest, then in "current".
+static Status GetFromView(const Options& db_options,
+                          const ReadOptions& options, const Slice& key,
+                          SequenceNumber snapshot, MemTable* mem,
+                          const std::vector<MemTable*>& imm, Version* current,
+                          std::string* value, Version::GetStats* stats,
+                          bool* have_stat_update) {
+  Status s;
+  LookupKey lkey(key, snapshot);
+  MergeContext merge;
+  bool done = mem->Get(lkey, value, &s, &merge);
+  for (size_t i = 0; !done && i < imm.size(); i++) {
+    done = imm[i]->Get(lkey, value, &s, &merge);
+  }
+  if (!done) {
+    s = current->Get(options, lkey, value, stats, &merge);
+    *have_stat_update = true;
+  }
+  return ApplyMerge(db_options, key, merge, s, value);
+}
+
+// Readers can only use a read view without holding mutex_ if they can
+// also read the last sequence number atomically.
+static const bool kLockFreeReads =
+    sizeof(void*) >= sizeof(SequenceNumber);
+
 Status DBImpl::Get(const ReadOptions& options,
                    const Slice& key,
                    std::string* value) {
   Status s;
+  Version::GetStats stats;
+  bool have_stat_update = false;
+
+  if (kLockFreeReads) {
+    // Load the sequence number before the view: a write is only
+    // published after the view holding its memtable was installed.
+    SequenceNumber snapshot;
+    if (options.snapshot != NULL) {
+      snapshot =
+          reinterpret_cast<const SnapshotImpl*>(options.snapshot)->number_;
+    } else {
+      snapshot = PublishedSequence();
+    }
+    port::AtomicPointer* slot;
+    ReadView* view = AcquireReadView(&slot);
+    if (view != NULL) {
+      s = GetFromView(options_, options, key, snapshot, view->mem, view->imm,
+                      view->current, value, &stats, &have_stat_update);
+      if (have_stat_update && stats.seek_file != NULL) {
+        MutexLock l(&mutex_);
+        if (view->current->UpdateStats(stats)) {
+          MaybeScheduleCompaction();
+        }
+      }
+      ReleaseReadView(slot, view);
+      return s;
+    }
+  }
+
+  // Every read view slot is busy: reference the state under mutex_
+  MutexLock l(&mutex_);
+  SequenceNumber snapshot;
+  if (options.snapshot != NULL) {
+    snapshot = reinterpret_cast<const SnapshotImpl*>(options.snapshot)->number_;
+  } else {
+    snapshot = PublishedSequence();
+  }
+
+  ReadView view;
+  view.mem = mem_;
+  for (size_t i = imm_.size(); i > 0; i--) {  // Newest first
+    view.imm.push_back(imm_[i - 1].mem);
+  }
+  view.current = versions_->current();
+  RefReadView(&view);
+
+  // Unlock while reading from files and memtables
+  {
+    mutex_.Unlock();
+    s = GetFromView(options_, options, key, snapshot, view.mem, view.imm,
+                    view.current, value, &stats, &have_stat_update);
+    mutex_.Lock();
+  }
+
+  if (have_stat_update && view.current->UpdateStats(stats)) {
+    MaybeScheduleCompaction();
+  }
+  UnrefReadView(&view);
+  return s;
+}
+
+void DBImpl::RefReadView(ReadView* view) {
+  mutex_.AssertHeld();
+  view->mem->Ref();
+  for (size_t i = 0; i < view->imm.size(); i++) {
+    view->imm[i]->Ref();
+  }
+  view->current->Ref();
+}
+
+void DBImpl::UnrefReadView(ReadView* view) {
+  mutex_.AssertHeld();
+  view->mem->Unref();
+  for (size_t i = 0; i < view->imm.size(); i++) {
+    view->imm[i]->Unref();
+  }
+  view->current->Unref();
+}
+
+// Publish a read view of the current memtables and version if they
+// have changed since the last one.
+void DBImpl::InstallReadView() {
+  mutex_.AssertHeld();
+  ReadView* old = reinterpret_cast<ReadView*>(read_view_.NoBarrier_Load());
+  if (old != NULL && old->mem == mem_ &&
+      old->current == versions_->current() &&
+      old->imm.size() == imm_.size()) {
+    bool same = true;
+    for (size_t i = 0; i < imm_.size(); i++) {
+      if (old->imm[i] != imm_[imm_.size() - 1 - i].mem) {
+        same = false;
+        break;
+      }
+    }
+    if (same) {
+      // Views retired while in use may have been released since
+      ReclaimReadViews();
+      return;
+    }
+  }
+
+  ReadView* view = new ReadView;
+  view->mem = mem_;
+  for (size_t i = imm_.size(); i > 0; i--) {  // Newest first
+    view->imm.push_back(imm_[i - 1].mem);
+  }
+  view->current = versions_->current();
+  RefReadView(view);
+
+  // Only holders of mutex_ replace the view, so this cannot fail.  It
+  // also acts as a full barrier between replacing the view and the
+  // scan of the reader slots in ReclaimReadViews().
+  bool swapped = read_view_.CompareAndSwap(old, view);
+  assert(swapped);
+  (void)swapped;
+  if (old != NULL) {
+    retired_views_.push_back(old);
+  }
+  ReclaimReadViews();
+}
+
+void DBImpl::PublishLastSequence() {
+  mutex_.AssertHeld();
+  last_sequence_.Release_Store(reinterpret_cast<void*>(
+      static_cast<uintptr_t>(versions_->LastSequence())));
+}
+
+SequenceNumber DBImpl::PublishedSequence() const {
+  return static_cast<SequenceNumber>(reinterpret_cast<uintptr_t>(
+      last_sequence_.Acquire_Load()));
+}
+
+// Free the retired read views that no reader has in its slot.
+void DBImpl::ReclaimReadViews() {
+  mutex_.AssertHeld();
+  size_t kept = 0;
+  for (size_t i = 0; i < retired_views_.size(); i++) {
+    ReadView* view = retired_views_[i];
+    bool in_use = false;
+    for (int j = 0; j < kNumReadViewSlots && !in_use; j++) {
+      in_use = (read_view_slots_[j].view.Acquire_Load() == view);
+    }
+    if (in_use) {
+      retired_views_[kept++] = view;
+    } else {
+      UnrefReadView(view);
+      delete view;
+    }
+  }
+  retired_views_.resize(kept);
+}
+
+// Return the current read view, protected from being reclaimed until
+// it is passed to ReleaseReadView().  Returns NULL if every slot is in
+// use.
+DBImpl::ReadView* DBImpl::AcquireReadView(port::AtomicPointer** slot) {
+  // Threads run on different stacks, so the address of a local variable
+  // spreads them over the slots.
+  const size_t start =
+      (reinterpret_cast<uintptr_t>(&slot) >> 12) % kNumReadViewSlots;
+  for (int i = 0; i < kNumReadViewSlots; i++) {
+    port::AtomicPointer* s =
+        &read_view_slots_[(start + i) % kNumReadViewSlots].view;
+    if (s->NoBarrier_Load() != NULL) {
+      continue;  // Used by another reader
+    }
+    ReadView* view = reinterpret_cast<ReadView*>(read_view_.Acquire_Load());
+    if (!s->CompareAndSwap(NULL, view)) {
+      continue;
+    }
+    // The view may have been retired before it was put in the slot, in
+    // which case the reclaimer may have missed it.  Only a view that is
+    // still current after it is in the slot is safe to use.
+    while (true) {
+      ReadView* latest =
+          reinterpret_cast<ReadView*>(read_view_.Acquire_Load());
+      if (latest == view) {
+        *slot = s;
+        return view;
+      }
+      s->CompareAndSwap(view, latest);
+      view = latest;
+    }
+  }
+  return NULL;
+}
+
+void DBImpl::ReleaseReadView(port::AtomicPointer* slot, ReadView* view) {
+  // The swap is a full barrier: either this thread sees that the view
+  // was retired, or the thread that retired it sees the slot empty.
+  bool released = slot->CompareAndSwap(view, NULL);
+  assert(released);
+  (void)released;
+  if (read_view_.Acquire_Load() != view) {
+    // Retired while in use: reclaim it now rather than at the next
+    // install, which may never come on an idle database.
+    MutexLock l(&mutex_);
+    ReclaimReadViews();
+  }
+}
+
+namespace {
+struct LookupKeyOrder {
+  const Comparator* ucmp;
+  const std::vector<Slice>* keys;
+  bool operator()(size_t a, size_t b) const {
+    return ucmp->Compare((*keys)[a], (*keys)[b]) < 0;
+  }
+};
+}  // namespace
+
+void DBImpl::MultiGet(const ReadOptions& options,
+                      const std::vector<Slice>& keys,
+                      std::vector<std::string>* values,
+                      std::vector<Status>* statuses) {
+  const size_t n = keys.size();
+  values->assign(n, std::string());
+  statuses->assign(n, Status());
+  if (n == 0) return;
+
   MutexLock l(&mutex_);
   SequenceNumber snapshot;
   if (options.snapshot != NULL) {
     snapshot = reinterpret_cast<const SnapshotImpl*>(options.snapshot)->number_;
   } else {
-    snapshot = versions_->LastSequence();
+    snapshot = PublishedSequence();
   }
 
   MemTable* mem = mem_;
-  MemTable* imm = imm_;
+  std::vector<MemTable*> imm;
+  for (size_t i = imm_.size(); i > 0; i--) {  // Newest first
+    imm.push_back(imm_[i - 1].mem);
+    imm.back()->Ref();
+  }
   Version* current = versions_->current();
   mem->Ref();
-  if (imm != NULL) imm->Ref();
   current->Ref();
 
-  bool have_stat_update = false;
-  Version::GetStats stats;
+  std::vector<Version::GetStats> stats;
 
   // Unlock while reading from files and memtables
   {
     mutex_.Unlock();
-    // First look in the memtable, then in the immutable memtable (if any).
-    LookupKey lkey(key, snapshot);
-    if (mem->Get(lkey, value, &s)) {
-      // Done
-    } else if (imm != NULL && imm->Get(lkey, value, &s)) {
-      // Done
-    } else {
-      s = current->Get(options, lkey, value, &stats);
-      have_stat_update = true;
+    // Look the keys up in sorted order so that keys stored close to
+    // each other are looked up together.
+    std::vector<size_t> order(n);
+    for (size_t i = 0; i < n; i++) {
+      order[i] = i;
+    }
+    LookupKeyOrder cmp;
+    cmp.ucmp = user_comparator();
+    cmp.keys = &keys;
+    std::stable_sort(order.begin(), order.end(), cmp);
+
+    std::vector<LookupKey*> lkeys;
+    std::vector<std::string*> vals;
+    std::vector<MergeContext*> merges;
+    std::vector<size_t> table_keys;  // Indices of the keys left for tables
+    for (size_t k = 0; k < n; k++) {
+      const size_t i = order[k];
+      LookupKey* lkey = new LookupKey(keys[i], snapshot);
+      MergeContext* merge = new MergeContext;
+      Status* s = &(*statuses)[i];
+      std::string* value = &(*values)[i];
+      bool done = mem->Get(*lkey, value, s, merge);
+      for (size_t m = 0; !done && m < imm.size(); m++) {
+        done = imm[m]->Get(*lkey, value, s, merge);
+      }
+      if (done) {
+        *s = ApplyMerge(options_, keys[i], *merge, *s, value);
+        delete merge;
+        delete lkey;
+      } else {
+        lkeys.push_back(lkey);
+        vals.push_back(value);
+        merges.push_back(merge);
+        table_keys.push_back(i);
+      }
+    }
+
+    if (!lkeys.empty()) {
+      const int num = static_cast<int>(lkeys.size());
+      std::vector<Status> table_statuses(num);
+      stats.resize(num);
+      current->MultiGet(options, num, &lkeys[0], &vals[0],
+                        &table_statuses[0], &stats[0], &merges[0]);
+      for (int k = 0; k < num; k++) {
+        const size_t i = table_keys[k];
+        (*statuses)[i] = ApplyMerge(options_, keys[i], *merges[k],
+                                    table_statuses[k], vals[k]);
+        delete merges[k];
+        delete lkeys[k];
+      }
     }
     mutex_.Lock();
   }
 
-  if (have_stat_update && current->UpdateStats(stats)) {
+  bool schedule = false;
+  for (size_t i = 0; i < stats.size(); i++) {
+    if (current->UpdateStats(stats[i])) {
+      schedule = true;
+    }
+  }
+  if (schedule) {
     MaybeScheduleCompaction();
   }
   mem->Unref();
-  if (imm != NULL) imm->Unref();
+  for (size_t i = 0; i < imm.size(); i++) {
+    imm[i]->Unref();
+  }
   current->Unref();
-  return s;
 }
 
 Iterator* DBImpl::NewIterator(const ReadOptions& options) {
   SequenceNumber latest_snapshot;
   uint32_t seed;
-  Iterator* iter = NewInternalIterator(options, &latest_snapshot, &seed);
+  RangeTombstoneList* range_dels = NULL;
+  Iterator* iter = NewInternalIterator(options, &latest_snapshot, &seed,
+                                       &range_dels);
+  const SliceTransform* prefix_extractor =
+      (options.prefix_same_as_start
+       ? internal_prefix_extractor_.user_transform() : NULL);
   return NewDBIterator(
       this, user_comparator(), iter,
       (options.snapshot != NULL
        ? reinterpret_cast<const SnapshotImpl*>(options.snapshot)->number_
        : latest_snapshot),
-      seed);
+      seed, prefix_extractor,
+      options.iterate_lower_bound, options.iterate_upper_bound, range_dels,
+      options_.merge_operator, options_.info_log);
 }
 
 void DBImpl::RecordReadSample(Slice key) {
@@ -1174,7 +2572,7 @@ void DBImpl::RecordReadSample(Slice key) {
 
 const Snapshot* DBImpl::GetSnapshot() {
   MutexLock l(&mutex_);
-  return snapshots_.New(versions_->LastSequence());
+  return snapshots_.New(PublishedSequence());
 }
 
 void DBImpl::ReleaseSnapshot(const Snapshot* s) {
@@ -1191,6 +2589,14 @@ Status DBImpl::Delete(const WriteOptions& options, const Slice& key) {
   return DB::Delete(options, key);
 }
 
+Status DBImpl::Merge(const WriteOptions& options, const Slice& key,
+                     const Slice& value) {
+  if (options_.merge_operator == NULL) {
+    return Status::NotSupported("Merge() requires options.merge_operator");
+  }
+  return DB::Merge(options, key, value);
+}
+
 Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
   Writer w(&mutex_);
   w.batch = my_batch;
@@ -1199,21 +2605,251 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
 
   MutexLock l(&mutex_);
   writers_.push_back(&w);
-  while (!w.done && &w != writers_.front()) {
+  while (!w.done && (w.logged || &w != writers_.front())) {
+    if (w.insert_group != NULL) {
+      InsertIntoMemTableAsFollower(&w);
+    } else {
+      w.cv.Wait();
+    }
+  }
+  if (w.done) {
+    return w.status;
+  }
+  return LeadWriteGroup(&w);
+}
+
+void DBImpl::WriteAsync(const WriteOptions& options, WriteBatch* updates,
+                        void (*callback)(void* arg, const Status& s),
+                        void* arg) {
+  assert(updates != NULL);
+  Writer* w = new Writer(&mutex_);
+  w->batch = updates;
+  w->sync = options.sync;
+  w->done = false;
+  w->callback = callback;
+  w->callback_arg = arg;
+
+  MutexLock l(&mutex_);
+  if (!write_thread_started_) {
+    write_thread_started_ = true;
+    env_->StartThread(&DBImpl::BGWorkWrite, this);
+  }
+  writers_.push_back(w);
+  if (writers_.front() == w) {
+    write_cv_.Signal();
+  }
+}
+
+void DBImpl::BGWorkWrite(void* db) {
+  reinterpret_cast<DBImpl*>(db)->BackgroundWriteCall();
+}
+
+void DBImpl::BackgroundWriteCall() {
+  MutexLock l(&mutex_);
+  while (true) {
+    if (!writers_.empty() && writers_.front()->callback != NULL) {
+      // No thread is waiting to lead this group, so lead it from here.
+      LeadWriteGroup(writers_.front());
+    } else if (shutting_down_.Acquire_Load()) {
+      break;
+    } else {
+      write_cv_.Wait();
+    }
+  }
+  write_thread_started_ = false;
+  bg_cv_.SignalAll();
+}
+
+Status DBImpl::WaitForLogSync() {
+  MutexLock l(&mutex_);
+  if (log_bytes_unsynced_ == 0 || !bg_error_.ok()) {
+    return bg_error_;
+  }
+  if (!log_sync_thread_started_) {
+    return SyncLog();
+  }
+  // Any sync that completes from now on covers every write that has
+  // returned: a sync holds the writer queue, so nothing it misses can
+  // have been logged before it started.
+  const uint64_t target = log_syncs_completed_ + 1;
+  log_sync_waiters_++;
+  log_sync_cv_.Signal();
+  while (log_syncs_completed_ < target && bg_error_.ok()) {
+    bg_cv_.Wait();
+  }
+  log_sync_waiters_--;
+  return bg_error_;
+}
+
+// Sync everything logged so far by queueing behind the current writers.
+Status DBImpl::SyncLog() {
+  mutex_.AssertHeld();
+  Writer w(&mutex_);
+  w.batch = NULL;
+  w.sync = true;
+  w.done = false;
+  w.log_sync = true;
+  writers_.push_back(&w);
+  while (!w.done && (w.logged || &w != writers_.front())) {
     w.cv.Wait();
   }
   if (w.done) {
+    // Included in a sync write group
     return w.status;
   }
+  return LeadWriteGroup(&w);
+}
+
+void DBImpl::RecordLogSynced() {
+  mutex_.AssertHeld();
+  log_bytes_unsynced_ = 0;
+  log_syncs_completed_++;
+  bg_cv_.SignalAll();
+}
+
+void DBImpl::BGWorkLogSync(void* db) {
+  reinterpret_cast<DBImpl*>(db)->BackgroundLogSyncCall();
+}
+
+void DBImpl::BackgroundLogSyncCall() {
+  MutexLock l(&mutex_);
+  const uint64_t interval = options_.log_sync_interval_micros;
+  uint64_t last_sync = env_->NowMicros();
+  while (!shutting_down_.Acquire_Load()) {
+    const uint64_t now = env_->NowMicros();
+    if (log_bytes_unsynced_ == 0) {
+      last_sync = now;
+    }
+    bool due = false;
+    if (log_bytes_unsynced_ > 0 && bg_error_.ok()) {
+      due = (interval > 0 && now >= last_sync + interval) ||
+            (interval == 0 && log_sync_waiters_ > 0) ||
+            (options_.log_sync_bytes > 0 &&
+             log_bytes_unsynced_ >= options_.log_sync_bytes);
+    }
+    if (due) {
+      SyncLog();
+      last_sync = env_->NowMicros();
+    } else if (interval > 0) {
+      log_sync_cv_.TimedWait(last_sync + interval > now
+                             ? last_sync + interval - now : interval);
+    } else {
+      log_sync_cv_.Wait();
+    }
+  }
+  // Do not leave the tail of the log unsynced on close
+  if (log_bytes_unsynced_ > 0 && bg_error_.ok()) {
+    SyncLog();
+  }
+  log_sync_thread_started_ = false;
+  bg_cv_.SignalAll();
+}
+
+// Wake up whoever has to lead the group at the front of the writer queue
+void DBImpl::NotifyWriteQueueHead() {
+  mutex_.AssertHeld();
+  if (!writers_.empty()) {
+    if (writers_.front()->callback != NULL) {
+      write_cv_.Signal();
+    } else {
+      writers_.front()->cv.Signal();
+    }
+  }
+}
+
+// Report "s" to "w".  Asynchronous writers are appended to *callbacks
+// instead; their callbacks must be run with mutex_ released.
+void DBImpl::CompleteWriter(Writer* w, const Status& s,
+                            std::vector<Writer*>* callbacks) {
+  w->status = s;
+  w->done = true;
+  if (w->callback != NULL) {
+    callbacks->push_back(w);
+  } else {
+    w->cv.Signal();
+  }
+}
+
+void DBImpl::RunWriteCallbacks(const std::vector<Writer*>& callbacks) {
+  mutex_.AssertHeld();
+  if (callbacks.empty()) return;
+  mutex_.Unlock();
+  for (size_t i = 0; i < callbacks.size(); i++) {
+    Writer* w = callbacks[i];
+    (*w->callback)(w->callback_arg, w->status);
+    delete w;
+  }
+  mutex_.Lock();
+}
+
+// REQUIRES: "w" is at the front of the writer queue
+Status DBImpl::LeadWriteGroup(Writer* leader) {
+  mutex_.AssertHeld();
+  assert(leader == writers_.front());
+  Writer& w = *leader;
+  WriteBatch* my_batch = w.batch;
+
+  if (w.log_sync) {
+    // Holding the front of the writer queue keeps other leaders from
+    // appending to the log while it is synced.
+    Status status = bg_error_;
+    if (status.ok() && log_bytes_unsynced_ > 0) {
+      mutex_.Unlock();
+      status = logfile_->Sync();
+      mutex_.Lock();
+      if (status.ok()) {
+        RecordLogSynced();
+      } else {
+        RecordBackgroundError(status);
+      }
+    }
+    writers_.pop_front();
+    NotifyWriteQueueHead();
+    return status;
+  }
 
   // May temporarily unlock and wait.
   Status status = MakeRoomForWrite(my_batch == NULL);
-  uint64_t last_sequence = versions_->LastSequence();
+  const bool pipelined = options_.enable_pipelined_write;
+  if (pipelined && my_batch == NULL) {
+    // Let earlier groups finish so that their updates are visible.
+    while (!pending_groups_.empty()) {
+      bg_cv_.Wait();
+    }
+  }
+  uint64_t last_sequence = pending_groups_.empty()
+      ? versions_->LastSequence()
+      : pending_groups_.back()->last_sequence;
   Writer* last_writer = &w;
   if (status.ok() && my_batch != NULL) {  // NULL batch is for compactions
     WriteBatch* updates = BuildBatchGroup(&last_writer);
     WriteBatchInternal::SetSequence(updates, last_sequence + 1);
+    WriteGroup group;
+    group.mem = mem_;
+    group.pending = 0;
+    for (std::deque<Writer*>::iterator iter = writers_.begin(); ; ++iter) {
+      group.writers.push_back(*iter);
+      if (*iter == last_writer) break;
+    }
+    // A pipelined group inserts after "updates" has been handed to the
+    // next group, so its writers insert their own batches.
+    const bool parallel_insert =
+        options_.allow_concurrent_memtable_write && last_writer != &w;
+    const bool per_writer_insert = parallel_insert || pipelined;
+    if (per_writer_insert) {
+      // Every writer's batch is inserted on its own, so each one needs
+      // the sequence number of its first entry.
+      SequenceNumber seq = last_sequence + 1;
+      for (size_t i = 0; i < group.writers.size(); i++) {
+        WriteBatch* batch = group.writers[i]->batch;
+        if (batch != NULL) {
+          WriteBatchInternal::SetSequence(batch, seq);
+          seq += WriteBatchInternal::Count(batch);
+        }
+      }
+    }
     last_sequence += WriteBatchInternal::Count(updates);
+    group.last_sequence = last_sequence;
 
     // Add to log and apply to memtable.  We can release the lock
     // during this phase since &w is currently responsible for logging
@@ -1223,13 +2859,16 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
       mutex_.Unlock();
       status = log_->AddRecord(WriteBatchInternal::Contents(updates));
       bool sync_error = false;
-      if (status.ok() && options.sync) {
+      bool synced = false;
+      if (status.ok() && w.sync) {
         status = logfile_->Sync();
         if (!status.ok()) {
           sync_error = true;
+        } else {
+          synced = true;
         }
       }
-      if (status.ok()) {
+      if (status.ok() && !per_writer_insert) {
         status = WriteBatchInternal::InsertInto(updates, mem_);
       }
       mutex_.Lock();
@@ -1238,32 +2877,158 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
         // just added may or may not show up when the DB is re-opened.
         // So we force the DB into a mode where all future writes fail.
         RecordBackgroundError(status);
+      } else if (synced) {
+        RecordLogSynced();
+      } else {
+        log_bytes_unsynced_ += WriteBatchInternal::ByteSize(updates);
+        if (options_.log_sync_bytes > 0 &&
+            log_bytes_unsynced_ >= options_.log_sync_bytes) {
+          log_sync_cv_.Signal();
+        }
       }
+      write_controller_.Charge(WriteBatchInternal::ByteSize(updates));
     }
     if (updates == tmp_batch_) tmp_batch_->Clear();
 
+    if (pipelined) {
+      return FinishPipelinedWrite(&group, status);
+    }
+    if (status.ok() && per_writer_insert) {
+      status = InsertGroupIntoMemTable(&group);
+    }
+
     versions_->SetLastSequence(last_sequence);
+    PublishLastSequence();
   }
 
+  std::vector<Writer*> callbacks;
   while (true) {
     Writer* ready = writers_.front();
     writers_.pop_front();
-    if (ready != &w) {
-      ready->status = status;
-      ready->done = true;
-      ready->cv.Signal();
+    if (ready != &w || ready->callback != NULL) {
+      CompleteWriter(ready, status, &callbacks);
     }
     if (ready == last_writer) break;
   }
 
   // Notify new head of write queue
-  if (!writers_.empty()) {
-    writers_.front()->cv.Signal();
+  NotifyWriteQueueHead();
+
+  RunWriteCallbacks(callbacks);
+  return status;
+}
+
+// REQUIRES: "group" has just been logged by its leader, which is still
+// at the front of the writer queue
+Status DBImpl::FinishPipelinedWrite(WriteGroup* group, Status status) {
+  mutex_.AssertHeld();
+  Writer* leader = group->writers[0];
+  assert(leader == writers_.front());
+
+  // Hand the writer queue to the next group so that it can write its
+  // log record while this group inserts into the memtable.
+  pending_groups_.push_back(group);
+  for (size_t i = 0; i < group->writers.size(); i++) {
+    assert(writers_.front() == group->writers[i]);
+    writers_.pop_front();
+    group->writers[i]->logged = true;
   }
+  NotifyWriteQueueHead();
 
+  // Groups are applied one at a time in log order, so the published
+  // sequence number only covers groups whose updates are all in mem_.
+  while (pending_groups_.front() != group) {
+    leader->cv.Wait();
+  }
+  if (status.ok()) {
+    status = InsertGroupIntoMemTable(group);
+  }
+  versions_->SetLastSequence(group->last_sequence);
+  PublishLastSequence();
+  pending_groups_.pop_front();
+  if (!pending_groups_.empty()) {
+    pending_groups_.front()->writers[0]->cv.Signal();
+  }
+  bg_cv_.SignalAll();  // Wake up MakeRoomForWrite() if it is waiting
+
+  std::vector<Writer*> callbacks;
+  for (size_t i = 0; i < group->writers.size(); i++) {
+    Writer* ready = group->writers[i];
+    if (i > 0 || ready->callback != NULL) {
+      CompleteWriter(ready, status, &callbacks);
+    }
+  }
+  RunWriteCallbacks(callbacks);
   return status;
 }
 
+// REQUIRES: the group's log record has been written
+// REQUIRES: no other thread is inserting into group->mem unless
+// allow_concurrent_memtable_write is set
+Status DBImpl::InsertGroupIntoMemTable(WriteGroup* group) {
+  mutex_.AssertHeld();
+  Writer* leader = group->writers[0];
+  if (!options_.allow_concurrent_memtable_write ||
+      group->writers.size() == 1) {
+    mutex_.Unlock();
+    Status s;
+    for (size_t i = 0; i < group->writers.size() && s.ok(); i++) {
+      if (group->writers[i]->batch != NULL) {
+        s = WriteBatchInternal::InsertInto(group->writers[i]->batch,
+                                           group->mem);
+      }
+    }
+    mutex_.Lock();
+    return s;
+  }
+
+  // Asynchronous followers have no thread of their own, so the leader
+  // inserts their batches along with its own.
+  std::vector<WriteBatch*> batches;
+  batches.push_back(leader->batch);
+  for (size_t i = 1; i < group->writers.size(); i++) {
+    Writer* writer = group->writers[i];
+    if (writer->batch == NULL) {
+      continue;
+    } else if (writer->callback != NULL) {
+      batches.push_back(writer->batch);
+    } else {
+      writer->insert_group = group;
+      group->pending++;
+      writer->cv.Signal();
+    }
+  }
+
+  mutex_.Unlock();
+  Status s;
+  for (size_t i = 0; i < batches.size() && s.ok(); i++) {
+    s = WriteBatchInternal::InsertIntoConcurrently(batches[i], group->mem);
+  }
+  mutex_.Lock();
+  while (group->pending > 0) {
+    leader->cv.Wait();
+  }
+  if (s.ok()) {
+    s = group->status;
+  }
+  return s;
+}
+
+void DBImpl::InsertIntoMemTableAsFollower(Writer* w) {
+  mutex_.AssertHeld();
+  WriteGroup* group = w->insert_group;
+  w->insert_group = NULL;
+  mutex_.Unlock();
+  Status s = WriteBatchInternal::InsertIntoConcurrently(w->batch, group->mem);
+  mutex_.Lock();
+  if (!s.ok() && group->status.ok()) {
+    group->status = s;
+  }
+  if (--group->pending == 0) {
+    group->writers[0]->cv.Signal();
+  }
+}
+
 // REQUIRES: Writer list must be non-empty
 // REQUIRES: First writer must have a non-NULL batch
 WriteBatch* DBImpl::BuildBatchGroup(Writer** last_writer) {
@@ -1287,6 +3052,11 @@ WriteBatch* DBImpl::BuildBatchGroup(Writer** last_writer) {
   ++iter;  // Advance past "first"
   for (; iter != writers_.end(); ++iter) {
     Writer* w = *iter;
+    if (w->ingest) {
+      // Waits for the front of the queue to ingest files
+      break;
+    }
+
     if (w->sync && !first->sync) {
       // Do not include a sync write into a batch handled by a non-sync write.
       break;
@@ -1318,38 +3088,52 @@ WriteBatch* DBImpl::BuildBatchGroup(Writer** last_writer) {
 Status DBImpl::MakeRoomForWrite(bool force) {
   mutex_.AssertHeld();
   assert(!writers_.empty());
-  bool allow_delay = !force;
+  const bool allow_delay = !force;
   Status s;
   while (true) {
+    uint64_t delay = 0;
+    if (allow_delay) {
+      const uint64_t now = env_->NowMicros();
+      write_controller_.Update(now, versions_->NumLevelFiles(0),
+                               versions_->PendingCompactionBytes());
+      delay = write_controller_.DelayMicros(now);
+    }
     if (!bg_error_.ok()) {
       // Yield previous error
       s = bg_error_;
       break;
-    } else if (
-        allow_delay &&
-        versions_->NumLevelFiles(0) >= config::kL0_SlowdownWritesTrigger) {
-      // We are getting close to hitting a hard limit on the number of
-      // L0 files.  Rather than delaying a single write by several
-      // seconds when we hit the hard limit, start delaying each
-      // individual write by 1ms to reduce latency variance.  Also,
-      // this delay hands over some CPU to the compaction thread in
-      // case it is sharing the same core as the writer.
+    } else if (delay > 0) {
+      // Compactions are falling behind.  Rather than stopping writes
+      // once they are too far behind, admit them at a rate that drops
+      // as the compaction debt grows.  The delay also hands over some
+      // CPU to the compaction threads in case they share a core with
+      // the writer.
+      if (delay > kMaxWriteDelayMicros) {
+        delay = kMaxWriteDelayMicros;  // Re-check the rate now and then
+      }
       mutex_.Unlock();
-      env_->SleepForMicroseconds(1000);
-      allow_delay = false;  // Do not delay a single write more than once
+      env_->SleepForMicroseconds(static_cast<int>(delay));
       mutex_.Lock();
+      write_delay_micros_ += delay;
     } else if (!force &&
                (mem_->ApproximateMemoryUsage() <= options_.write_buffer_size)) {
       // There is room in current memtable
       break;
-    } else if (imm_ != NULL) {
+    } else if (imm_.size() + 1 >=
+               static_cast<size_t>(options_.max_write_buffer_number)) {
       // We have filled up the current memtable, but the previous
-      // one is still being compacted, so we wait.
+      // ones are still being compacted, so we wait.
+      if (shutting_down_.Acquire_Load()) {
+        // No more flushes will run, so the wait would never end.
+        s = Status::IOError("Deleting DB during write");
+        break;
+      }
       Log(options_.info_log, "Current memtable full; waiting...\n");
+      const uint64_t start = env_->NowMicros();
       bg_cv_.Wait();
-    } else if (versions_->NumLevelFiles(0) >= config::kL0_StopWritesTrigger) {
-      // There are too many level-0 files.
-      Log(options_.info_log, "Too many L0 files; waiting...\n");
+      write_stall_micros_ += env_->NowMicros() - start;
+    } else if (!pending_groups_.empty()) {
+      // Earlier write groups are still inserting into mem_.
       bg_cv_.Wait();
     } else {
       // Attempt to switch to a new memtable and trigger compaction of old
@@ -1362,15 +3146,32 @@ Status DBImpl::MakeRoomForWrite(bool force) {
         versions_->ReuseFileNumber(new_log_number);
         break;
       }
+      if (log_bytes_unsynced_ > 0) {
+        // The old log holds the only copy of mem_ until it is flushed,
+        // and a later WaitForLogSync() only syncs the new log, so sync
+        // its tail before closing it.
+        mutex_.Unlock();
+        s = logfile_->Sync();
+        mutex_.Lock();
+        if (!s.ok()) {
+          delete lfile;
+          RecordBackgroundError(s);
+          break;
+        }
+        RecordLogSynced();
+      }
+      ImmutableMemTable sealed;
+      sealed.mem = mem_;
+      sealed.log_number = logfile_number_;
+      imm_.push_back(sealed);
       delete log_;
       delete logfile_;
       logfile_ = lfile;
       logfile_number_ = new_log_number;
       log_ = new log::Writer(lfile);
-      imm_ = mem_;
-      has_imm_.Release_Store(imm_);
       mem_ = new MemTable(internal_comparator_);
       mem_->Ref();
+      InstallReadView();
       force = false;   // Do not force another compaction if have room
       MaybeScheduleCompaction();
     }
@@ -1423,6 +3224,21 @@ bool DBImpl::GetProperty(const Slice& property, std::string* value) {
         value->append(buf);
       }
     }
+    snprintf(buf, sizeof(buf),
+             "Write stalls: %.3f sec delayed, %.3f sec stopped\n"
+             "Write rate limit (MB/s): %.1f; pending compaction (MB): %.1f\n",
+             write_delay_micros_ / 1e6,
+             write_stall_micros_ / 1e6,
+             write_controller_.rate() / 1048576.0,
+             versions_->PendingCompactionBytes() / 1048576.0);
+    value->append(buf);
+    return true;
+  } else if (in == "write-stall-micros") {
+    char buf[50];
+    snprintf(buf, sizeof(buf), "%llu",
+             static_cast<unsigned long long>(write_delay_micros_ +
+                                             write_stall_micros_));
+    value->append(buf);
     return true;
   } else if (in == "sstables") {
     *value = versions_->current()->DebugString();
@@ -1432,8 +3248,8 @@ bool DBImpl::GetProperty(const Slice& property, std::string* value) {
     if (mem_) {
       total_usage += mem_->ApproximateMemoryUsage();
     }
-    if (imm_) {
-      total_usage += imm_->ApproximateMemoryUsage();
+    for (size_t i = 0; i < imm_.size(); i++) {
+      total_usage += imm_[i].mem->ApproximateMemoryUsage();
     }
     char buf[50];
     snprintf(buf, sizeof(buf), "%llu",
@@ -1485,6 +3301,49 @@ Status DB::Delete(const WriteOptions& opt, const Slice& key) {
   return Write(opt, &batch);
 }
 
+Status DB::DeleteRange(const WriteOptions& opt,
+                       const Slice& begin, const Slice& end) {
+  WriteBatch batch;
+  batch.DeleteRange(begin, end);
+  return Write(opt, &batch);
+}
+
+Status DB::Merge(const WriteOptions& opt,
+                 const Slice& key, const Slice& value) {
+  WriteBatch batch;
+  batch.Merge(key, value);
+  return Write(opt, &batch);
+}
+
+void DB::WriteAsync(const WriteOptions& opt, WriteBatch* updates,
+                    void (*callback)(void* arg, const Status& s), void* arg) {
+  Status s = Write(opt, updates);
+  (*callback)(arg, s);
+}
+
+void DB::MultiGet(const ReadOptions& options,
+                  const std::vector<Slice>& keys,
+                  std::vector<std::string>* values,
+                  std::vector<Status>* statuses) {
+  values->assign(keys.size(), std::string());
+  statuses->assign(keys.size(), Status());
+  for (size_t i = 0; i < keys.size(); i++) {
+    (*statuses)[i] = Get(options, keys[i], &(*values)[i]);
+  }
+}
+
+Status DB::WaitForLogSync() {
+  return Status::NotSupported("WaitForLogSync");
+}
+
+Status DB::DeleteFilesInRange(const Slice* begin, const Slice* end) {
+  return Status::NotSupported("DeleteFilesInRange");
+}
+
+Status DB::IngestExternalFile(const std::vector<std::string>& paths) {
+  return Status::NotSupported("IngestExternalFile");
+}
+
 DB::~DB() { }
 
 Status DB::Open(const Options& options, const std::string& dbname,
@@ -1518,8 +3377,15 @@ Status DB::Open(const Options& options, const std::string& dbname,
     s = impl->versions_->LogAndApply(&edit, &impl->mutex_);
   }
   if (s.ok()) {
+    impl->InstallReadView();
+    impl->PublishLastSequence();
     impl->DeleteObsoleteFiles();
     impl->MaybeScheduleCompaction();
+    if (impl->options_.log_sync_interval_micros > 0 ||
+        impl->options_.log_sync_bytes > 0) {
+      impl->log_sync_thread_started_ = true;
+      impl->env_->StartThread(&DBImpl::BGWorkLogSync, impl);
+    }
   }
   impl->mutex_.Unlock();
   if (s.ok()) {
@@ -7,9 +7,11 @@
 
 #include <deque>
 #include <set>
+#include <vector>
 #include "db/dbformat.h"
 #include "db/log_writer.h"
 #include "db/snapshot.h"
+#include "db/write_controller.h"
 #include "leveldb/db.h"
 #include "leveldb/env.h"
 #include "port/port.h"
@@ -17,7 +19,9 @@
 
 namespace leveldb {
 
+class EntryBatch;
 class MemTable;
+class RangeTombstoneList;
 class TableCache;
 class Version;
 class VersionEdit;
@@ -31,16 +35,28 @@ class DBImpl : public DB {
   // Implementations of the DB interface
   virtual Status Put(const WriteOptions&, const Slice& key, const Slice& value);
   virtual Status Delete(const WriteOptions&, const Slice& key);
+  virtual Status Merge(const WriteOptions&, const Slice& key,
+                       const Slice& value);
   virtual Status Write(const WriteOptions& options, WriteBatch* updates);
+  virtual void WriteAsync(const WriteOptions& options, WriteBatch* updates,
+                          void (*callback)(void* arg, const Status& s),
+                          void* arg);
+  virtual Status WaitForLogSync();
   virtual Status Get(const ReadOptions& options,
                      const Slice& key,
                      std::string* value);
+  virtual void MultiGet(const ReadOptions& options,
+                        const std::vector<Slice>& keys,
+                        std::vector<std::string>* values,
+                        std::vector<Status>* statuses);
   virtual Iterator* NewIterator(const ReadOptions&);
   virtual const Snapshot* GetSnapshot();
   virtual void ReleaseSnapshot(const Snapshot* snapshot);
   virtual bool GetProperty(const Slice& property, std::string* value);
   virtual void GetApproximateSizes(const Range* range, int n, uint64_t* sizes);
   virtual void CompactRange(const Slice* begin, const Slice* end);
+  virtual Status DeleteFilesInRange(const Slice* begin, const Slice* end);
+  virtual Status IngestExternalFile(const std::vector<std::string>& paths);
 
   // Extra methods (for testing) that are not in the public DB interface
 
@@ -67,11 +83,20 @@ class DBImpl : public DB {
  private:
   friend class DB;
   struct CompactionState;
+  struct SubcompactionTask;
+  struct OutputStage;
   struct Writer;
+  struct WriteGroup;
+  struct ReadView;
+  struct ExternalFile;
 
+  // Unless "range_dels" is NULL, also sets "*range_dels" to the range
+  // deletions visible to the returned iterator, or to NULL if there are
+  // none.  The caller owns the result.
   Iterator* NewInternalIterator(const ReadOptions&,
                                 SequenceNumber* latest_snapshot,
-                                uint32_t* seed);
+                                uint32_t* seed,
+                                RangeTombstoneList** range_dels);
 
   Status NewDB();
 
@@ -95,26 +120,90 @@ class DBImpl : public DB {
                         VersionEdit* edit, SequenceNumber* max_sequence)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
-  Status WriteLevel0Table(MemTable* mem, VersionEdit* edit, Version* base)
+  // Build a table from the contents of "mems" and add it to *edit.  The
+  // table's number is stored in *file_number and stays in pending_outputs_
+  // so that it is not deleted as obsolete; the caller must erase it once
+  // *edit has been applied (or abandoned).  The level the table was
+  // placed at is stored in *level; if it is above zero the caller must
+  // decrement installing_pushed_memtable_ once *edit has been applied.
+  Status WriteLevel0Table(const std::vector<MemTable*>& mems,
+                          VersionEdit* edit, Version* base,
+                          uint64_t* file_number, int* level)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Copy "files" into tables of the database and install them.
+  // REQUIRES: the caller holds the front of the writer queue
+  Status IngestFiles(const std::vector<ExternalFile*>& files)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
   Status MakeRoomForWrite(bool force /* compact even if there is room? */)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  Status LeadWriteGroup(Writer* leader) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   WriteBatch* BuildBatchGroup(Writer** last_writer);
+  Status FinishPipelinedWrite(WriteGroup* group, Status status)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  Status InsertGroupIntoMemTable(WriteGroup* group)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void InsertIntoMemTableAsFollower(Writer* w) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void NotifyWriteQueueHead() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void CompleteWriter(Writer* w, const Status& s,
+                      std::vector<Writer*>* callbacks)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void RunWriteCallbacks(const std::vector<Writer*>& callbacks)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  static void BGWorkWrite(void* db);
+  void BackgroundWriteCall();
+  Status SyncLog() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void RecordLogSynced() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  static void BGWorkLogSync(void* db);
+  void BackgroundLogSyncCall();
 
   void RecordBackgroundError(const Status& s);
 
+  void RefReadView(ReadView* view) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void UnrefReadView(ReadView* view) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void InstallReadView() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void ReclaimReadViews() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  ReadView* AcquireReadView(port::AtomicPointer** slot);
+  void ReleaseReadView(port::AtomicPointer* slot, ReadView* view);
+  void PublishLastSequence() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  SequenceNumber PublishedSequence() const;
+
   void MaybeScheduleCompaction() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   static void BGWork(void* db);
   void BackgroundCall();
-  void  BackgroundCompaction() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  static void BGWorkFlush(void* db);
+  void BackgroundFlushCall();
+  // Returns false if no compaction could be started.
+  bool BackgroundCompaction() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   void CleanupCompaction(CompactionState* compact)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   Status DoCompactionWork(CompactionState* compact)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  static void BGWorkSubcompaction(void* arg);
+  // Compacts the key range of "compact" into its outputs.  Does not
+  // hold mutex_; several may run concurrently for disjoint ranges.
+  Status DoSubcompactionWork(CompactionState* compact);
 
   Status OpenCompactionOutputFile(CompactionState* compact);
-  Status FinishCompactionOutputFile(CompactionState* compact, Iterator* input);
+  // Finishes the current output of "compact".  "next_user_key" is the
+  // user key the next output starts at, or NULL if this is the last one.
+  Status FinishCompactionOutputFile(CompactionState* compact,
+                                    const Status& input_status,
+                                    const Slice* next_user_key);
+  // Finishes the last output of "compact" after the whole input was read,
+  // first opening one if only range deletions are left to write.
+  Status FinishLastCompactionOutput(CompactionState* compact,
+                                    const Status& input_status);
+  Status AddCompactionEntry(CompactionState* compact,
+                            const Slice& key, const Slice& value);
+  static void BGWorkCompactionOutput(void* arg);
+  void WriteCompactionOutput(OutputStage* output);
+  Status AddCompactionBatch(OutputStage* output, const EntryBatch& batch);
+  // Hands "batch" over to "output", or adds it to the outputs here if the
+  // pool has not started the output stage.  Returns false if the merge
+  // should stop, after storing any error in *status.
+  bool HandOverBatch(OutputStage* output, EntryBatch* batch, Status* status);
   Status InstallCompactionResults(CompactionState* compact)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
@@ -122,6 +211,7 @@ class DBImpl : public DB {
   Env* const env_;
   const InternalKeyComparator internal_comparator_;
   const InternalFilterPolicy internal_filter_policy_;
+  const InternalKeySliceTransform internal_prefix_extractor_;
   const Options options_;  // options_.comparator == &internal_comparator_
   bool owns_info_log_;
   bool owns_cache_;
@@ -138,25 +228,85 @@ class DBImpl : public DB {
   port::AtomicPointer shutting_down_;
   port::CondVar bg_cv_;          // Signalled when background work finishes
   MemTable* mem_;
-  MemTable* imm_;                // Memtable being compacted
-  port::AtomicPointer has_imm_;  // So bg thread can detect non-NULL imm_
+  // Sealed memtables waiting to be compacted, oldest first, each with
+  // the number of the log file that holds its contents.
+  struct ImmutableMemTable {
+    MemTable* mem;
+    uint64_t log_number;
+  };
+  std::vector<ImmutableMemTable> imm_;
   WritableFile* logfile_;
   uint64_t logfile_number_;
   log::Writer* log_;
   uint32_t seed_;                // For sampling.
 
+  // Get() reads the memtables and version through read_view_ without
+  // holding mutex_.  A reader protects the view it uses by storing it in
+  // one of read_view_slots_; a replaced view is reclaimed once no slot
+  // holds it, by the next install or by the reader that releases it
+  // last.  read_view_ and retired_views_ are changed under mutex_.
+  enum { kNumReadViewSlots = 64 };
+  struct ReadViewSlot {
+    port::AtomicPointer view;
+    char padding[64 - sizeof(port::AtomicPointer)];  // Own cache line
+    ReadViewSlot() : view(NULL) { }
+  };
+  port::AtomicPointer read_view_;
+  ReadViewSlot read_view_slots_[kNumReadViewSlots];
+  std::vector<ReadView*> retired_views_;
+
+  // versions_->LastSequence() as of the last published write, readable
+  // without holding mutex_.  Readers take their default snapshot from
+  // here, since versions_->LastSequence() may run ahead of the installed
+  // read view.
+  port::AtomicPointer last_sequence_;
+
   // Queue of writers.
   std::deque<Writer*> writers_;
   WriteBatch* tmp_batch_;
 
+  // Paces writes while compactions are behind
+  WriteController write_controller_;
+  uint64_t write_delay_micros_;  // Time writers spent paced
+  uint64_t write_stall_micros_;  // Time writers waited for a memtable
+
+  // Logged groups waiting to insert into mem_, in log order.  Only used
+  // with options_.enable_pipelined_write.
+  std::deque<WriteGroup*> pending_groups_;
+
+  // Thread that leads write groups whose first writer came from
+  // WriteAsync().  Started by the first such write.
+  bool write_thread_started_;
+  port::CondVar write_cv_;       // Signalled when it has a group to lead
+
+  // Periodic log syncing (options_.log_sync_interval_micros and
+  // options_.log_sync_bytes).
+  uint64_t log_bytes_unsynced_;  // Logged since the last sync
+  uint64_t log_syncs_completed_;
+  int log_sync_waiters_;         // Threads blocked in WaitForLogSync()
+  bool log_sync_thread_started_;
+  port::CondVar log_sync_cv_;    // Signalled when a sync may be due
+
   SnapshotList snapshots_;
 
   // Set of table files to protect from deletion because they are
   // part of ongoing compactions.
   std::set<uint64_t> pending_outputs_;
 
-  // Has a background compaction been scheduled or is running?
-  bool bg_compaction_scheduled_;
+  // Number of background table compactions that have been scheduled or
+  // are running, and how many of those have picked their inputs.
+  int bg_compactions_scheduled_;
+  int bg_compactions_running_;
+
+  // Has a background memtable compaction been scheduled or is running?
+  // These run in the Env's HIGH priority pool so that they are never
+  // queued behind a long table compaction.
+  bool bg_flush_scheduled_;
+
+  // Number of memtable compaction outputs and ingestions that are
+  // installing files placed below level-0.  No table compaction may be
+  // scheduled meanwhile since it could pick inputs that overlap them.
+  int installing_pushed_memtable_;
 
   // Information for a manual compaction
   struct ManualCompaction {
@@ -204,6 +354,7 @@ class DBImpl : public DB {
 extern Options SanitizeOptions(const std::string& db,
                                const InternalKeyComparator* icmp,
                                const InternalFilterPolicy* ipolicy,
+                               const InternalKeySliceTransform* iprefix,
                                const Options& src);
 
 }  // namespace leveldb
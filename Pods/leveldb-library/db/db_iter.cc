@@ -7,6 +7,8 @@
 #include "db/filename.h"
 #include "db/db_impl.h"
 #include "db/dbformat.h"
+#include "db/merge_helper.h"
+#include "db/range_del.h"
 #include "leveldb/env.h"
 #include "leveldb/iterator.h"
 #include "port/port.h"
@@ -43,33 +45,49 @@ class DBIter: public Iterator {
   //     the exact entry that yields this->key(), this->value()
   // (2) When moving backwards, the internal iterator is positioned
   //     just before all entries whose user key == this->key().
+  // When moving forward onto merge operands, the internal iterator
+  // is positioned past the operands (see merged_).
   enum Direction {
     kForward,
     kReverse
   };
 
   DBIter(DBImpl* db, const Comparator* cmp, Iterator* iter, SequenceNumber s,
-         uint32_t seed)
+         uint32_t seed, const SliceTransform* prefix_extractor,
+         const Slice* lower_bound, const Slice* upper_bound,
+         const RangeTombstoneList* range_dels,
+         const MergeOperator* merge_operator, Logger* info_log)
       : db_(db),
         user_comparator_(cmp),
         iter_(iter),
         sequence_(s),
+        prefix_extractor_(prefix_extractor),
+        lower_bound_(lower_bound),
+        upper_bound_(upper_bound),
+        range_dels_(range_dels),
+        merge_operator_(merge_operator),
+        info_log_(info_log),
         direction_(kForward),
         valid_(false),
+        merged_(false),
+        prefix_bound_(false),
         rnd_(seed),
         bytes_counter_(RandomPeriod()) {
   }
   virtual ~DBIter() {
     delete iter_;
+    delete range_dels_;
   }
   virtual bool Valid() const { return valid_; }
   virtual Slice key() const {
     assert(valid_);
-    return (direction_ == kForward) ? ExtractUserKey(iter_->key()) : saved_key_;
+    return (direction_ == kForward && !merged_) ?
+        ExtractUserKey(iter_->key()) : saved_key_;
   }
   virtual Slice value() const {
     assert(valid_);
-    return (direction_ == kForward) ? iter_->value() : saved_value_;
+    return (direction_ == kForward && !merged_) ?
+        iter_->value() : saved_value_;
   }
   virtual Status status() const {
     if (status_.ok()) {
@@ -88,8 +106,33 @@ class DBIter: public Iterator {
  private:
   void FindNextUserEntry(bool skipping, std::string* skip);
   void FindPrevUserEntry();
+  void MergeForward();
   bool ParseKey(ParsedInternalKey* key);
 
+  // True if "user_key" lies past the prefix the last Seek() started in.
+  inline bool OutOfPrefix(const Slice& user_key) const {
+    return prefix_bound_ &&
+        (!prefix_extractor_->InDomain(user_key) ||
+         prefix_extractor_->Transform(user_key) != Slice(prefix_));
+  }
+
+  inline bool BeforeLowerBound(const Slice& user_key) const {
+    return lower_bound_ != NULL &&
+        user_comparator_->Compare(user_key, *lower_bound_) < 0;
+  }
+
+  inline bool AtOrPastUpperBound(const Slice& user_key) const {
+    return upper_bound_ != NULL &&
+        user_comparator_->Compare(user_key, *upper_bound_) >= 0;
+  }
+
+  // True if a newer range deletion covers the entry "ikey"
+  inline bool RangeDeleted(const ParsedInternalKey& ikey) const {
+    return range_dels_ != NULL &&
+        range_dels_->MaxCoveringSequence(ikey.user_key, sequence_) >
+            ikey.sequence;
+  }
+
   inline void SaveKey(const Slice& k, std::string* dst) {
     dst->assign(k.data(), k.size());
   }
@@ -112,12 +155,21 @@ class DBIter: public Iterator {
   const Comparator* const user_comparator_;
   Iterator* const iter_;
   SequenceNumber const sequence_;
+  const SliceTransform* const prefix_extractor_;
+  const Slice* const lower_bound_;
+  const Slice* const upper_bound_;
+  const RangeTombstoneList* const range_dels_;
+  const MergeOperator* const merge_operator_;
+  Logger* const info_log_;
 
   Status status_;
   std::string saved_key_;     // == current key when direction_==kReverse
   std::string saved_value_;   // == current raw value when direction_==kReverse
   Direction direction_;
   bool valid_;
+  bool merged_;               // Forward, and the current entry was merged
+  bool prefix_bound_;         // Only yield keys that have prefix prefix_
+  std::string prefix_;
 
   Random rnd_;
   ssize_t bytes_counter_;
@@ -162,6 +214,15 @@ void DBIter::Next() {
       return;
     }
     // saved_key_ already contains the key to skip past.
+  } else if (merged_) {
+    // iter_ is already past the operands of saved_key_
+    if (!iter_->Valid()) {
+      valid_ = false;
+      merged_ = false;
+      saved_key_.clear();
+      ClearSavedValue();
+      return;
+    }
   } else {
     // Store in saved_key_ the current key so we skip it below.
     SaveKey(ExtractUserKey(iter_->key()), &saved_key_);
@@ -174,9 +235,15 @@ void DBIter::FindNextUserEntry(bool skipping, std::string* skip) {
   // Loop until we hit an acceptable entry to yield
   assert(iter_->Valid());
   assert(direction_ == kForward);
+  merged_ = false;
   do {
     ParsedInternalKey ikey;
-    if (ParseKey(&ikey) && ikey.sequence <= sequence_) {
+    if (!ParseKey(&ikey)) {
+      // Skip corrupted entry
+    } else if (OutOfPrefix(ikey.user_key) ||
+               AtOrPastUpperBound(ikey.user_key)) {
+      break;
+    } else if (ikey.sequence <= sequence_) {
       switch (ikey.type) {
         case kTypeDeletion:
           // Arrange to skip all upcoming entries for this key since
@@ -188,12 +255,30 @@ void DBIter::FindNextUserEntry(bool skipping, std::string* skip) {
           if (skipping &&
               user_comparator_->Compare(ikey.user_key, *skip) <= 0) {
             // Entry hidden
+          } else if (RangeDeleted(ikey)) {
+            // Like a deletion, hides the upcoming entries for this key
+            SaveKey(ikey.user_key, skip);
+            skipping = true;
           } else {
             valid_ = true;
             saved_key_.clear();
             return;
           }
           break;
+        case kTypeMerge:
+          if (skipping &&
+              user_comparator_->Compare(ikey.user_key, *skip) <= 0) {
+            // Entry hidden
+          } else if (RangeDeleted(ikey)) {
+            SaveKey(ikey.user_key, skip);
+            skipping = true;
+          } else {
+            MergeForward();
+            return;
+          }
+          break;
+        case kTypeRangeDeletion:
+          break;  // Not yielded by internal iterators
       }
     }
     iter_->Next();
@@ -202,14 +287,62 @@ void DBIter::FindNextUserEntry(bool skipping, std::string* skip) {
   valid_ = false;
 }
 
+// iter_ is positioned at the newest visible merge operand of a user key.
+// Combine it with the older operands of the key and the value they apply
+// to, store the result in saved_key_ and saved_value_, and leave iter_
+// past the operands.
+void DBIter::MergeForward() {
+  SaveKey(ExtractUserKey(iter_->key()), &saved_key_);
+  MergeContext merge;
+  merge.AddOlder(iter_->value());
+  std::string existing;
+  bool has_value = false;
+  for (iter_->Next(); iter_->Valid(); iter_->Next()) {
+    ParsedInternalKey ikey;
+    if (!ParseKey(&ikey) ||
+        user_comparator_->Compare(ikey.user_key, saved_key_) != 0 ||
+        RangeDeleted(ikey) || ikey.type == kTypeDeletion) {
+      break;
+    }
+    if (ikey.type == kTypeValue) {
+      existing.assign(iter_->value().data(), iter_->value().size());
+      has_value = true;
+      break;
+    }
+    merge.AddOlder(iter_->value());
+  }
+
+  const Slice existing_value(existing);
+  Status s = merge.Merge(merge_operator_, info_log_, saved_key_,
+                         has_value ? &existing_value : NULL, &saved_value_);
+  if (!s.ok()) {
+    status_ = s;
+    valid_ = false;
+    saved_key_.clear();
+    ClearSavedValue();
+    return;
+  }
+  valid_ = true;
+  merged_ = true;
+}
+
 void DBIter::Prev() {
   assert(valid_);
 
   if (direction_ == kForward) {  // Switch directions?
-    // iter_ is pointing at the current entry.  Scan backwards until
-    // the key changes so we can use the normal reverse scanning code.
-    assert(iter_->Valid());  // Otherwise valid_ would have been false
-    SaveKey(ExtractUserKey(iter_->key()), &saved_key_);
+    // iter_ is pointing at the current entry, or past it if the entry
+    // was merged.  Scan backwards until the key changes so we can use
+    // the normal reverse scanning code.
+    if (merged_) {
+      // saved_key_ already contains the current key
+      if (!iter_->Valid()) {
+        iter_->SeekToLast();
+      }
+    } else {
+      assert(iter_->Valid());  // Otherwise valid_ would have been false
+      SaveKey(ExtractUserKey(iter_->key()), &saved_key_);
+    }
+    merged_ = false;
     while (true) {
       iter_->Prev();
       if (!iter_->Valid()) {
@@ -231,21 +364,39 @@ void DBIter::Prev() {
 
 void DBIter::FindPrevUserEntry() {
   assert(direction_ == kReverse);
+  merged_ = false;
 
+  // Entries of a user key are visited from oldest to newest: collect the
+  // merge operands newer than its last value or deletion.
   ValueType value_type = kTypeDeletion;
+  MergeContext merge;
+  bool has_value = false;
   if (iter_->Valid()) {
     do {
       ParsedInternalKey ikey;
-      if (ParseKey(&ikey) && ikey.sequence <= sequence_) {
+      if (!ParseKey(&ikey)) {
+        // Skip corrupted entry
+      } else if (OutOfPrefix(ikey.user_key) ||
+                 BeforeLowerBound(ikey.user_key)) {
+        break;
+      } else if (AtOrPastUpperBound(ikey.user_key)) {
+        // Skip entries past the end of the range that SeekToLast()
+        // could not avoid
+      } else if (ikey.sequence <= sequence_) {
         if ((value_type != kTypeDeletion) &&
             user_comparator_->Compare(ikey.user_key, saved_key_) < 0) {
           // We encountered a non-deleted value in entries for previous keys,
           break;
         }
-        value_type = ikey.type;
+        value_type = RangeDeleted(ikey) ? kTypeDeletion : ikey.type;
         if (value_type == kTypeDeletion) {
           saved_key_.clear();
           ClearSavedValue();
+          merge.Clear();
+          has_value = false;
+        } else if (value_type == kTypeMerge) {
+          SaveKey(ExtractUserKey(iter_->key()), &saved_key_);
+          merge.AddNewer(iter_->value());
         } else {
           Slice raw_value = iter_->value();
           if (saved_value_.capacity() > raw_value.size() + 1048576) {
@@ -254,12 +405,24 @@ void DBIter::FindPrevUserEntry() {
           }
           SaveKey(ExtractUserKey(iter_->key()), &saved_key_);
           saved_value_.assign(raw_value.data(), raw_value.size());
+          merge.Clear();
+          has_value = true;
         }
       }
       iter_->Prev();
     } while (iter_->Valid());
   }
 
+  if (value_type == kTypeMerge) {
+    const Slice existing(saved_value_);
+    Status s = merge.Merge(merge_operator_, info_log_, saved_key_,
+                           has_value ? &existing : NULL, &saved_value_);
+    if (!s.ok()) {
+      status_ = s;
+      value_type = kTypeDeletion;
+    }
+  }
+
   if (value_type == kTypeDeletion) {
     // End
     valid_ = false;
@@ -273,10 +436,19 @@ void DBIter::FindPrevUserEntry() {
 
 void DBIter::Seek(const Slice& target) {
   direction_ = kForward;
+  merged_ = false;
   ClearSavedValue();
+  prefix_bound_ = (prefix_extractor_ != NULL &&
+                   prefix_extractor_->InDomain(target));
+  if (prefix_bound_) {
+    Slice prefix = prefix_extractor_->Transform(target);
+    prefix_.assign(prefix.data(), prefix.size());
+  }
   saved_key_.clear();
   AppendInternalKey(
-      &saved_key_, ParsedInternalKey(target, sequence_, kValueTypeForSeek));
+      &saved_key_,
+      ParsedInternalKey(BeforeLowerBound(target) ? *lower_bound_ : target,
+                        sequence_, kValueTypeForSeek));
   iter_->Seek(saved_key_);
   if (iter_->Valid()) {
     FindNextUserEntry(false, &saved_key_ /* temporary storage */);
@@ -287,8 +459,17 @@ void DBIter::Seek(const Slice& target) {
 
 void DBIter::SeekToFirst() {
   direction_ = kForward;
+  merged_ = false;
   ClearSavedValue();
-  iter_->SeekToFirst();
+  prefix_bound_ = false;
+  if (lower_bound_ != NULL) {
+    saved_key_.clear();
+    AppendInternalKey(&saved_key_, ParsedInternalKey(*lower_bound_, sequence_,
+                                                     kValueTypeForSeek));
+    iter_->Seek(saved_key_);
+  } else {
+    iter_->SeekToFirst();
+  }
   if (iter_->Valid()) {
     FindNextUserEntry(false, &saved_key_ /* temporary storage */);
   } else {
@@ -298,8 +479,25 @@ void DBIter::SeekToFirst() {
 
 void DBIter::SeekToLast() {
   direction_ = kReverse;
+  merged_ = false;
   ClearSavedValue();
-  iter_->SeekToLast();
+  prefix_bound_ = false;
+  if (upper_bound_ != NULL) {
+    // Move to the last entry before the first one at the upper bound
+    saved_key_.clear();
+    AppendInternalKey(&saved_key_,
+                      ParsedInternalKey(*upper_bound_, kMaxSequenceNumber,
+                                        kValueTypeForSeek));
+    iter_->Seek(saved_key_);
+    if (iter_->Valid()) {
+      iter_->Prev();
+    } else {
+      iter_->SeekToLast();
+    }
+    saved_key_.clear();
+  } else {
+    iter_->SeekToLast();
+  }
   FindPrevUserEntry();
 }
 
@@ -310,8 +508,16 @@ Iterator* NewDBIterator(
     const Comparator* user_key_comparator,
     Iterator* internal_iter,
     SequenceNumber sequence,
-    uint32_t seed) {
-  return new DBIter(db, user_key_comparator, internal_iter, sequence, seed);
+    uint32_t seed,
+    const SliceTransform* prefix_extractor,
+    const Slice* lower_bound,
+    const Slice* upper_bound,
+    const RangeTombstoneList* range_dels,
+    const MergeOperator* merge_operator,
+    Logger* info_log) {
+  return new DBIter(db, user_key_comparator, internal_iter, sequence, seed,
+                    prefix_extractor, lower_bound, upper_bound, range_dels,
+                    merge_operator, info_log);
 }
 
 }  // namespace leveldb
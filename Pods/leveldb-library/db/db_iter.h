@@ -12,16 +12,32 @@
 namespace leveldb {
 
 class DBImpl;
+class Logger;
+class MergeOperator;
+class RangeTombstoneList;
 
 // Return a new iterator that converts internal keys (yielded by
 // "*internal_iter") that were live at the specified "sequence" number
-// into appropriate user keys.
+// into appropriate user keys.  If "prefix_extractor" is non-NULL, the
+// result stops at the end of the prefix of the target of each Seek().
+// If "lower_bound" (resp. "upper_bound") is non-NULL, the result only
+// yields user keys at or after (resp. before) "*lower_bound"
+// (resp. "*upper_bound").  If "range_dels" is non-NULL, the entries
+// covered by its newer range deletions are treated as deleted; the
+// result takes ownership of it.  Merge operands are combined with
+// "merge_operator", which logs to "info_log".
 extern Iterator* NewDBIterator(
     DBImpl* db,
     const Comparator* user_key_comparator,
     Iterator* internal_iter,
     SequenceNumber sequence,
-    uint32_t seed);
+    uint32_t seed,
+    const SliceTransform* prefix_extractor = NULL,
+    const Slice* lower_bound = NULL,
+    const Slice* upper_bound = NULL,
+    const RangeTombstoneList* range_dels = NULL,
+    const MergeOperator* merge_operator = NULL,
+    Logger* info_log = NULL);
 
 }  // namespace leveldb
 
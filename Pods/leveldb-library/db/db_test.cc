@@ -0,0 +1,2489 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "leveldb/db.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+#include "leveldb/cache.h"
+#include "db/db_impl.h"
+#include "db/filename.h"
+#include "util/logging.h"
+#include "leveldb/env.h"
+#include "leveldb/filter_policy.h"
+#include "leveldb/merge_operator.h"
+#include "leveldb/slice_transform.h"
+#include "leveldb/sst_file_writer.h"
+#include "leveldb/write_batch.h"
+#include "port/port.h"
+#include "util/mutexlock.h"
+#include "util/random.h"
+#include "util/testharness.h"
+#include "util/testutil.h"
+
+namespace leveldb {
+
+typedef std::map<std::string, std::string> KVMap;
+
+static std::string Key(int i) {
+  char buf[100];
+  snprintf(buf, sizeof(buf), "key%06d", i);
+  return std::string(buf);
+}
+
+// Special Env used to track which log bytes have reached stable storage
+// and to hold back memtable compactions.
+class SpecialEnv : public EnvWrapper {
+ public:
+  port::Mutex mu_;
+
+  // Bytes appended to each log file since its last Sync()
+  std::map<std::string, uint64_t> unsynced_;
+
+  // Memtable compactions (HIGH pool jobs) held back while set
+  bool hold_flushes_;
+  std::vector<std::pair<void (*)(void*), void*> > held_;
+
+  // Table compactions (LOW pool jobs) held back while set
+  bool hold_compactions_;
+  std::vector<std::pair<void (*)(void*), void*> > held_compactions_;
+
+  // Largest LOW pool size asked for with IncBackgroundThreadsIfNeeded()
+  int low_threads_;
+
+  // Number of reads from table files
+  int table_reads_;
+
+  // If true, table reads are copied out of memory-mapped files, as they
+  // are by an Env that does not map them, so that blocks are cached
+  bool copy_table_reads_;
+
+  explicit SpecialEnv(Env* base)
+      : EnvWrapper(base),
+        hold_flushes_(false),
+        hold_compactions_(false),
+        low_threads_(0),
+        table_reads_(0),
+        copy_table_reads_(false) { }
+
+  Status NewWritableFile(const std::string& f, WritableFile** r) {
+    class LogFile : public WritableFile {
+     private:
+      SpecialEnv* env_;
+      std::string fname_;
+      WritableFile* base_;
+     public:
+      LogFile(SpecialEnv* env, const std::string& fname, WritableFile* base)
+          : env_(env), fname_(fname), base_(base) { }
+      ~LogFile() { delete base_; }
+      Status Append(const Slice& data) {
+        MutexLock l(&env_->mu_);
+        env_->unsynced_[fname_] += data.size();
+        return base_->Append(data);
+      }
+      Status Close() { return base_->Close(); }
+      Status Flush() { return base_->Flush(); }
+      Status Sync() {
+        Status s = base_->Sync();
+        MutexLock l(&env_->mu_);
+        env_->unsynced_[fname_] = 0;
+        return s;
+      }
+    };
+
+    Status s = target()->NewWritableFile(f, r);
+    if (s.ok() && strstr(f.c_str(), ".log") != NULL) {
+      *r = new LogFile(this, f, *r);
+    }
+    return s;
+  }
+
+  Status NewRandomAccessFile(const std::string& f, RandomAccessFile** r) {
+    class CountingFile : public RandomAccessFile {
+     private:
+      SpecialEnv* env_;
+      RandomAccessFile* base_;
+     public:
+      CountingFile(SpecialEnv* env, RandomAccessFile* base)
+          : env_(env), base_(base) { }
+      ~CountingFile() { delete base_; }
+      Status Read(uint64_t offset, size_t n, Slice* result,
+                  char* scratch) const {
+        bool copy;
+        {
+          MutexLock l(&env_->mu_);
+          env_->table_reads_++;
+          copy = env_->copy_table_reads_;
+        }
+        Status s = base_->Read(offset, n, result, scratch);
+        if (s.ok() && copy && result->data() != scratch) {
+          memcpy(scratch, result->data(), result->size());
+          *result = Slice(scratch, result->size());
+        }
+        return s;
+      }
+    };
+
+    Status s = target()->NewRandomAccessFile(f, r);
+    if (s.ok()) {
+      *r = new CountingFile(this, *r);
+    }
+    return s;
+  }
+
+  void CopyTableReads(bool copy) {
+    MutexLock l(&mu_);
+    copy_table_reads_ = copy;
+  }
+
+  int TableReads() {
+    MutexLock l(&mu_);
+    return table_reads_;
+  }
+
+  Status DeleteFile(const std::string& f) {
+    {
+      MutexLock l(&mu_);
+      unsynced_.erase(f);
+    }
+    return target()->DeleteFile(f);
+  }
+
+  void ScheduleWithPriority(void (*function)(void*), void* arg,
+                            Priority pri) {
+    {
+      MutexLock l(&mu_);
+      if (pri == HIGH && hold_flushes_) {
+        held_.push_back(std::make_pair(function, arg));
+        return;
+      }
+      if (pri == LOW && hold_compactions_) {
+        held_compactions_.push_back(std::make_pair(function, arg));
+        return;
+      }
+    }
+    target()->ScheduleWithPriority(function, arg, pri);
+  }
+
+  void IncBackgroundThreadsIfNeeded(int number, Priority pri) {
+    {
+      MutexLock l(&mu_);
+      if (pri == LOW && number > low_threads_) {
+        low_threads_ = number;
+      }
+    }
+    target()->IncBackgroundThreadsIfNeeded(number, pri);
+  }
+
+  void HoldFlushes() {
+    MutexLock l(&mu_);
+    hold_flushes_ = true;
+  }
+
+  void ReleaseFlushes() {
+    std::vector<std::pair<void (*)(void*), void*> > held;
+    {
+      MutexLock l(&mu_);
+      hold_flushes_ = false;
+      held.swap(held_);
+    }
+    for (size_t i = 0; i < held.size(); i++) {
+      target()->ScheduleWithPriority(held[i].first, held[i].second, HIGH);
+    }
+  }
+
+  void HoldCompactions() {
+    MutexLock l(&mu_);
+    hold_compactions_ = true;
+  }
+
+  void ReleaseCompactions() {
+    std::vector<std::pair<void (*)(void*), void*> > held;
+    {
+      MutexLock l(&mu_);
+      hold_compactions_ = false;
+      held.swap(held_compactions_);
+    }
+    for (size_t i = 0; i < held.size(); i++) {
+      target()->ScheduleWithPriority(held[i].first, held[i].second, LOW);
+    }
+  }
+
+  // Number of live log files that have bytes not yet synced
+  int UnsyncedLogs() {
+    MutexLock l(&mu_);
+    int n = 0;
+    for (std::map<std::string, uint64_t>::const_iterator it =
+             unsynced_.begin(); it != unsynced_.end(); ++it) {
+      if (it->second > 0) n++;
+    }
+    return n;
+  }
+
+  uint64_t MaxUnsyncedBytes() {
+    MutexLock l(&mu_);
+    uint64_t max = 0;
+    for (std::map<std::string, uint64_t>::const_iterator it =
+             unsynced_.begin(); it != unsynced_.end(); ++it) {
+      if (it->second > max) max = it->second;
+    }
+    return max;
+  }
+
+  int LogFiles() {
+    MutexLock l(&mu_);
+    return unsynced_.size();
+  }
+};
+
+// Logger that counts the messages logged with a given format
+class MessageCounter : public Logger {
+ public:
+  explicit MessageCounter(const char* format) : format_(format), count_(0) { }
+
+  virtual void Logv(const char* format, va_list ap) {
+    if (strcmp(format, format_) == 0) {
+      MutexLock l(&mu_);
+      count_++;
+    }
+  }
+
+  int Count() {
+    MutexLock l(&mu_);
+    return count_;
+  }
+
+ private:
+  const char* format_;
+  port::Mutex mu_;
+  int count_;
+};
+
+namespace {
+
+const int kWriterThreads = 4;
+const int kKeysPerWriter = 5000;
+
+struct WriterThread {
+  DB* db;
+  int id;
+  port::AtomicPointer done;
+};
+
+static std::string WriterKey(int id, int i) {
+  char buf[100];
+  snprintf(buf, sizeof(buf), "w%d.%06d", id, i);
+  return std::string(buf);
+}
+
+// Writes kKeysPerWriter keys of its own in batches of one to eight keys,
+// so that write groups gather batches of different sizes
+static void WriterBody(void* arg) {
+  WriterThread* t = reinterpret_cast<WriterThread*>(arg);
+  Random rnd(1000 + t->id);
+  int i = 0;
+  while (i < kKeysPerWriter) {
+    WriteBatch batch;
+    const int n = 1 + rnd.Uniform(8);
+    for (int j = 0; j < n && i < kKeysPerWriter; j++, i++) {
+      batch.Put(WriterKey(t->id, i), WriterKey(i, t->id));
+    }
+    ASSERT_OK(t->db->Write(WriteOptions(), &batch));
+  }
+  t->done.Release_Store(t);
+}
+
+// Counts the completions of asynchronous writes
+struct AsyncWrites {
+  port::Mutex mu;
+  int done;
+  int failed;
+  std::vector<WriteBatch*> batches;
+
+  AsyncWrites() : done(0), failed(0) { }
+  ~AsyncWrites() {
+    for (size_t i = 0; i < batches.size(); i++) {
+      delete batches[i];
+    }
+  }
+
+  // Queue an asynchronous write of "key" -> "value" to "db"
+  void Write(DB* db, const WriteOptions& options,
+             const std::string& key, const std::string& value) {
+    WriteBatch* batch = new WriteBatch;
+    batch->Put(key, value);
+    batches.push_back(batch);
+    db->WriteAsync(options, batch, &AsyncWrites::Done, this);
+  }
+
+  void WaitFor(int n) {
+    while (true) {
+      {
+        MutexLock l(&mu);
+        if (done >= n) {
+          return;
+        }
+      }
+      Env::Default()->SleepForMicroseconds(1000);
+    }
+  }
+
+  static void Done(void* arg, const Status& s) {
+    AsyncWrites* writes = reinterpret_cast<AsyncWrites*>(arg);
+    MutexLock l(&writes->mu);
+    writes->done++;
+    if (!s.ok()) {
+      writes->failed++;
+    }
+  }
+};
+
+const int kReaderThreads = 3;
+const int kReaderKeys = 1000;
+
+// Readers that check, while the keys are being overwritten with ever
+// larger counters, that no key ever goes missing or back in time
+struct ReaderState {
+  DB* db;
+  port::AtomicPointer stop;
+  port::Mutex mu;
+  int started;
+  int running;
+  int reads;
+  int failures;
+};
+
+// Merge operator that appends its operands to the value, separated by
+// commas.  An operand "FAIL" cannot be applied.
+class AppendOperator : public MergeOperator {
+ public:
+  explicit AppendOperator(bool partial)
+      : partial_(partial), full_merges_(0), partial_merges_(0) { }
+
+  virtual const char* Name() const { return "leveldb.test.Append"; }
+
+  virtual bool FullMerge(const Slice& key, const Slice* existing_value,
+                         const std::vector<Slice>& operands,
+                         std::string* new_value, Logger* logger) const {
+    {
+      MutexLock l(&mu_);
+      full_merges_++;
+    }
+    bool have = (existing_value != NULL);
+    std::string result = have ? existing_value->ToString() : "";
+    for (size_t i = 0; i < operands.size(); i++) {
+      if (operands[i] == Slice("FAIL")) {
+        return false;
+      }
+      if (have) result += ",";
+      result.append(operands[i].data(), operands[i].size());
+      have = true;
+    }
+    new_value->swap(result);
+    return true;
+  }
+
+  virtual bool PartialMerge(const Slice& key, const Slice& left_operand,
+                            const Slice& right_operand,
+                            std::string* new_value, Logger* logger) const {
+    if (!partial_ || left_operand == Slice("FAIL") ||
+        right_operand == Slice("FAIL")) {
+      return false;
+    }
+    {
+      MutexLock l(&mu_);
+      partial_merges_++;
+    }
+    *new_value = left_operand.ToString() + "," + right_operand.ToString();
+    return true;
+  }
+
+  int full_merges() const {
+    MutexLock l(&mu_);
+    return full_merges_;
+  }
+
+  int partial_merges() const {
+    MutexLock l(&mu_);
+    return partial_merges_;
+  }
+
+ private:
+  const bool partial_;
+  mutable port::Mutex mu_;
+  mutable int full_merges_;
+  mutable int partial_merges_;
+};
+
+// Apply a merge of "operand" to "key" in "model"
+static void ModelMerge(KVMap* model, const std::string& key,
+                       const std::string& operand) {
+  KVMap::iterator it = model->find(key);
+  if (it == model->end()) {
+    (*model)[key] = operand;
+  } else {
+    it->second += "," + operand;
+  }
+}
+
+static std::string Counter(uint64_t n) {
+  char buf[100];
+  snprintf(buf, sizeof(buf), "%016llu", static_cast<unsigned long long>(n));
+  return std::string(buf) + std::string(84, 'c');
+}
+
+static void ReaderBody(void* arg) {
+  ReaderState* state = reinterpret_cast<ReaderState*>(arg);
+  int id;
+  {
+    MutexLock l(&state->mu);
+    id = state->started++;
+  }
+  std::vector<uint64_t> seen(kReaderKeys, 0);
+  Random rnd(1000 + id);
+  int reads = 0;
+  int failures = 0;
+  while (state->stop.Acquire_Load() == NULL) {
+    if (rnd.OneIn(50)) {
+      // Every key is also seen by iterators, in order
+      Iterator* iter = state->db->NewIterator(ReadOptions());
+      int n = 0;
+      for (iter->SeekToFirst(); iter->Valid(); iter->Next(), n++) {
+        if (n >= kReaderKeys || iter->key() != Key(n)) {
+          failures++;
+          break;
+        }
+      }
+      if (n != kReaderKeys || !iter->status().ok()) {
+        failures++;
+      }
+      delete iter;
+    } else {
+      const int k = rnd.Uniform(kReaderKeys);
+      std::string value;
+      Status s = state->db->Get(ReadOptions(), Key(k), &value);
+      const uint64_t counter = strtoull(value.c_str(), NULL, 10);
+      if (!s.ok() || counter < seen[k]) {
+        failures++;
+      }
+      seen[k] = counter;
+    }
+    reads++;
+  }
+  MutexLock l(&state->mu);
+  state->reads += reads;
+  state->failures += failures;
+  state->running--;
+}
+
+// Takes snapshots in a loop and records whether "key" is visible in
+// each, until "stop" is set; clears "stop" on the way out.
+struct SnapshotProbe {
+  DB* db;
+  std::string key;
+  port::AtomicPointer stop;
+  std::vector<const Snapshot*> snapshots;
+  std::vector<bool> found;
+};
+
+static void SnapshotProbeBody(void* arg) {
+  SnapshotProbe* probe = reinterpret_cast<SnapshotProbe*>(arg);
+  while (probe->stop.Acquire_Load() == NULL) {
+    ReadOptions options;
+    options.snapshot = probe->db->GetSnapshot();
+    std::string value;
+    probe->found.push_back(probe->db->Get(options, probe->key, &value).ok());
+    probe->snapshots.push_back(options.snapshot);
+  }
+  probe->stop.Release_Store(NULL);
+}
+
+}  // namespace
+
+class DBTest {
+ public:
+  std::string dbname_;
+  SpecialEnv* env_;
+  DB* db_;
+
+  Options last_options_;
+
+  DBTest() : env_(new SpecialEnv(Env::Default())), db_(NULL) {
+    dbname_ = test::TmpDir() + "/db_test";
+    DestroyDB(dbname_, Options());
+    Reopen();
+  }
+
+  ~DBTest() {
+    delete db_;
+    DestroyDB(dbname_, Options());
+    delete env_;
+  }
+
+  DBImpl* dbfull() {
+    return reinterpret_cast<DBImpl*>(db_);
+  }
+
+  void Reopen(Options* options = NULL) {
+    ASSERT_OK(TryReopen(options));
+  }
+
+  void Close() {
+    delete db_;
+    db_ = NULL;
+  }
+
+  void DestroyAndReopen(Options* options = NULL) {
+    delete db_;
+    db_ = NULL;
+    DestroyDB(dbname_, Options());
+    ASSERT_OK(TryReopen(options));
+  }
+
+  Status TryReopen(Options* options) {
+    delete db_;
+    db_ = NULL;
+    Options opts;
+    if (options != NULL) {
+      opts = *options;
+    }
+    opts.create_if_missing = true;
+    opts.env = env_;
+    last_options_ = opts;
+    return DB::Open(opts, dbname_, &db_);
+  }
+
+  Status Put(const std::string& k, const std::string& v) {
+    return db_->Put(WriteOptions(), k, v);
+  }
+
+  Status Delete(const std::string& k) {
+    return db_->Delete(WriteOptions(), k);
+  }
+
+  std::string Get(const std::string& k, const Snapshot* snapshot = NULL) {
+    ReadOptions options;
+    options.snapshot = snapshot;
+    std::string result;
+    Status s = db_->Get(options, k, &result);
+    if (s.IsNotFound()) {
+      result = "NOT_FOUND";
+    } else if (!s.ok()) {
+      result = s.ToString();
+    }
+    return result;
+  }
+
+  int NumTableFilesAtLevel(int level) {
+    std::string property;
+    ASSERT_TRUE(
+        db_->GetProperty("leveldb.num-files-at-level" + NumberToString(level),
+                         &property));
+    return atoi(property.c_str());
+  }
+
+  int TotalTableFiles() {
+    int result = 0;
+    for (int level = 0; level < config::kNumLevels; level++) {
+      result += NumTableFilesAtLevel(level);
+    }
+    return result;
+  }
+
+  // Check that the database, read at "snapshot", holds exactly the
+  // entries of "model": through Get() of every key below Key(num_keys),
+  // and through iteration in both directions.
+  void CheckModel(const KVMap& model, int num_keys,
+                  const Snapshot* snapshot = NULL) {
+    for (int i = 0; i < num_keys; i++) {
+      KVMap::const_iterator it = model.find(Key(i));
+      ASSERT_EQ(it == model.end() ? "NOT_FOUND" : it->second,
+                Get(Key(i), snapshot));
+    }
+
+    ReadOptions options;
+    options.snapshot = snapshot;
+    Iterator* iter = db_->NewIterator(options);
+    KVMap::const_iterator it = model.begin();
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next(), ++it) {
+      ASSERT_TRUE(it != model.end());
+      ASSERT_EQ(it->first, iter->key().ToString());
+      ASSERT_EQ(it->second, iter->value().ToString());
+    }
+    ASSERT_TRUE(it == model.end());
+    KVMap::const_reverse_iterator rit = model.rbegin();
+    for (iter->SeekToLast(); iter->Valid(); iter->Prev(), ++rit) {
+      ASSERT_TRUE(rit != model.rend());
+      ASSERT_EQ(rit->first, iter->key().ToString());
+      ASSERT_EQ(rit->second, iter->value().ToString());
+    }
+    ASSERT_TRUE(rit == model.rend());
+    ASSERT_OK(iter->status());
+    delete iter;
+  }
+
+  // Check that MultiGet() of "keys", read at "snapshot", returns what a
+  // Get() of each key returns, and what "model" holds.
+  void CheckMultiGet(const std::vector<std::string>& keys,
+                     const KVMap& model, const Snapshot* snapshot = NULL) {
+    ReadOptions options;
+    options.snapshot = snapshot;
+    std::vector<Slice> slices(keys.begin(), keys.end());
+    std::vector<std::string> values;
+    std::vector<Status> statuses;
+    db_->MultiGet(options, slices, &values, &statuses);
+    ASSERT_EQ(keys.size(), values.size());
+    ASSERT_EQ(keys.size(), statuses.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+      std::string value;
+      Status s = db_->Get(options, keys[i], &value);
+      ASSERT_EQ(s.ToString(), statuses[i].ToString());
+      KVMap::const_iterator it = model.find(keys[i]);
+      if (it == model.end()) {
+        ASSERT_TRUE(statuses[i].IsNotFound());
+      } else {
+        ASSERT_OK(statuses[i]);
+        ASSERT_EQ(it->second, values[i]);
+        ASSERT_EQ(value, values[i]);
+      }
+    }
+  }
+
+  // Check Get(), MultiGet() and iterators at "snapshot" against "model"
+  void CheckVisible(const KVMap& model, int num_keys,
+                    const Snapshot* snapshot = NULL) {
+    CheckModel(model, num_keys, snapshot);
+    std::vector<std::string> keys;
+    for (int i = 0; i < num_keys; i++) {
+      keys.push_back(Key(i));
+    }
+    CheckMultiGet(keys, model, snapshot);
+  }
+
+  // Check an iterator that reads with the bounds in "options" against
+  // the entries of "model" within those bounds, with full scans in both
+  // directions and random seeks followed by a mix of moves.
+  void CheckBounded(const KVMap& model, const ReadOptions& options,
+                    int num_keys, Random* rnd) {
+    KVMap expected;
+    for (KVMap::const_iterator it = model.begin(); it != model.end(); ++it) {
+      if ((options.iterate_lower_bound == NULL ||
+           Slice(it->first).compare(*options.iterate_lower_bound) >= 0) &&
+          (options.iterate_upper_bound == NULL ||
+           Slice(it->first).compare(*options.iterate_upper_bound) < 0)) {
+        expected.insert(*it);
+      }
+    }
+    Iterator* iter = db_->NewIterator(options);
+    KVMap::const_iterator it = expected.begin();
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next(), ++it) {
+      ASSERT_TRUE(it != expected.end());
+      ASSERT_EQ(it->first, iter->key().ToString());
+      ASSERT_EQ(it->second, iter->value().ToString());
+    }
+    ASSERT_TRUE(it == expected.end());
+    KVMap::const_reverse_iterator rit = expected.rbegin();
+    for (iter->SeekToLast(); iter->Valid(); iter->Prev(), ++rit) {
+      ASSERT_TRUE(rit != expected.rend());
+      ASSERT_EQ(rit->first, iter->key().ToString());
+      ASSERT_EQ(rit->second, iter->value().ToString());
+    }
+    ASSERT_TRUE(rit == expected.rend());
+    for (int i = 0; i < 50; i++) {
+      const std::string target = Key(rnd->Uniform(num_keys));
+      iter->Seek(target);
+      it = expected.lower_bound(target);
+      for (int step = 0; step < 20; step++) {
+        if (it == expected.end()) {
+          ASSERT_TRUE(!iter->Valid());
+          break;
+        }
+        ASSERT_TRUE(iter->Valid());
+        ASSERT_EQ(it->first, iter->key().ToString());
+        if (rnd->OneIn(2)) {
+          iter->Next();
+          ++it;
+        } else if (it == expected.begin()) {
+          iter->Prev();
+          ASSERT_TRUE(!iter->Valid());
+          break;
+        } else {
+          iter->Prev();
+          --it;
+        }
+      }
+    }
+    ASSERT_OK(iter->status());
+    delete iter;
+  }
+
+  // Check bounded iterators with "options" over random puts and deletes
+  // spread over small tables and the memtable
+  void CheckBoundsWorkload(Options* options) {
+    options->write_buffer_size = 32 << 10;
+    options->max_file_size = 32 << 10;
+    options->block_size = 512;
+    DestroyAndReopen(options);
+
+    const int kNumKeys = 2000;
+    Random rnd(99);
+    KVMap model;
+    for (int round = 0; round < 6; round++) {
+      for (int i = 0; i < 4000; i++) {
+        const std::string key = Key(rnd.Uniform(kNumKeys));
+        if (rnd.OneIn(4)) {
+          ASSERT_OK(Delete(key));
+          model.erase(key);
+        } else {
+          const std::string value(rnd.Uniform(60) + 1, 'a' + (i % 26));
+          ASSERT_OK(Put(key, value));
+          model[key] = value;
+        }
+      }
+      if (round == 2) {
+        db_->CompactRange(NULL, NULL);
+      }
+      for (int b = 0; b < 12; b++) {
+        std::string lower = Key(rnd.Uniform(kNumKeys + 100));
+        std::string upper = Key(rnd.Uniform(kNumKeys + 100));
+        if (b % 3 == 1) {
+          lower.resize(lower.size() - 1);  // A bound that is not a key
+        }
+        Slice lower_slice(lower);
+        Slice upper_slice(upper);
+        ReadOptions read_options;
+        if (b % 4 != 1) read_options.iterate_lower_bound = &lower_slice;
+        if (b % 4 != 2) read_options.iterate_upper_bound = &upper_slice;
+        CheckBounded(model, read_options, kNumKeys + 100, &rnd);
+      }
+    }
+  }
+
+  // Apply random puts, deletes and range deletions with "options", and
+  // check the contents against a model, also at snapshots, through
+  // compactions and after reopening the database.  Once everything is
+  // deleted, compactions must drop all of the data.
+  void CheckDeleteRangeWorkload(Options* options) {
+    options->write_buffer_size = 64 << 10;
+    options->max_file_size = 32 << 10;
+    DestroyAndReopen(options);
+
+    const int kNumKeys = 10000;
+    Random rnd(303);
+    KVMap model;
+    std::vector<const Snapshot*> snapshots;
+    std::vector<KVMap> models;
+    for (int round = 0; round < 6; round++) {
+      for (int i = 0; i < 20000; i++) {
+        const int k = rnd.Uniform(kNumKeys);
+        if (rnd.OneIn(200)) {
+          const int e = k + 1 + rnd.Uniform(rnd.OneIn(10) ? 2000 : 100);
+          ASSERT_OK(db_->DeleteRange(WriteOptions(), Key(k), Key(e)));
+          model.erase(model.lower_bound(Key(k)), model.lower_bound(Key(e)));
+        } else if (rnd.OneIn(10)) {
+          ASSERT_OK(Delete(Key(k)));
+          model.erase(Key(k));
+        } else if (rnd.OneIn(50)) {
+          // Within a batch, the range deletion hides the earlier put only
+          const int e = k + 1 + rnd.Uniform(50);
+          WriteBatch batch;
+          batch.Put(Key(k), "x");
+          batch.DeleteRange(Key(k), Key(e));
+          batch.Put(Key(e - 1), "y");
+          ASSERT_OK(db_->Write(WriteOptions(), &batch));
+          model.erase(model.lower_bound(Key(k)), model.lower_bound(Key(e)));
+          model[Key(e - 1)] = "y";
+        } else {
+          const std::string value(rnd.Uniform(100) + 1, 'a' + (i % 26));
+          ASSERT_OK(Put(Key(k), value));
+          model[Key(k)] = value;
+        }
+        if (i % 10000 == 0) {
+          snapshots.push_back(db_->GetSnapshot());
+          models.push_back(model);
+        }
+      }
+      CheckVisible(model, kNumKeys);
+      for (size_t s = 0; s < snapshots.size(); s++) {
+        CheckModel(models[s], kNumKeys, snapshots[s]);
+      }
+      if (round == 2) {
+        db_->CompactRange(NULL, NULL);
+        CheckVisible(model, kNumKeys);
+        for (size_t s = 0; s < snapshots.size(); s++) {
+          CheckModel(models[s], kNumKeys, snapshots[s]);
+        }
+      } else if (round == 3) {
+        for (size_t s = 0; s < snapshots.size(); s++) {
+          db_->ReleaseSnapshot(snapshots[s]);
+        }
+        snapshots.clear();
+        models.clear();
+        Reopen(options);
+        CheckVisible(model, kNumKeys);
+        db_->CompactRange(NULL, NULL);
+        CheckVisible(model, kNumKeys);
+      }
+    }
+    for (size_t s = 0; s < snapshots.size(); s++) {
+      db_->ReleaseSnapshot(snapshots[s]);
+    }
+
+    ASSERT_OK(db_->DeleteRange(WriteOptions(), Key(0), Key(kNumKeys)));
+    model.clear();
+    CheckVisible(model, kNumKeys);
+    db_->CompactRange(NULL, NULL);
+    CheckVisible(model, kNumKeys);
+    ASSERT_EQ(0, TotalTableFiles());
+    Reopen(options);
+    CheckVisible(model, kNumKeys);
+  }
+
+  // Write the entries of "kv" to the external table file "fname", for
+  // a database opened with "options"
+  Status WriteExternalFile(const Options& options, const std::string& fname,
+                           const KVMap& kv) {
+    SstFileWriter writer(options);
+    Status s = writer.Open(fname);
+    for (KVMap::const_iterator it = kv.begin(); s.ok() && it != kv.end();
+         ++it) {
+      s = writer.Put(it->first, it->second);
+    }
+    if (s.ok()) {
+      ASSERT_EQ(kv.size(), writer.NumEntries());
+      s = writer.Finish();
+    }
+    return s;
+  }
+
+  // Alternate batches of puts and deletes with the ingestion of files
+  // over random key ranges under "options", and check the database
+  // against a model, also at snapshots and after reopening it.
+  void CheckIngestWorkload(Options* options) {
+    options->write_buffer_size = 64 << 10;
+    DestroyAndReopen(options);
+
+    const int kNumKeys = 5000;
+    const std::string fname = dbname_ + "_external.ldb";
+    Random rnd(99);
+    KVMap model;
+    std::vector<const Snapshot*> snapshots;
+    std::vector<KVMap> models;
+    for (int round = 0; round < 40; round++) {
+      for (int i = 0; i < 300; i++) {
+        const int k = rnd.Uniform(kNumKeys);
+        if (rnd.OneIn(5)) {
+          ASSERT_OK(Delete(Key(k)));
+          model.erase(Key(k));
+        } else {
+          const std::string value =
+              "w" + std::string(rnd.Uniform(100), 'a' + round % 26);
+          ASSERT_OK(Put(Key(k), value));
+          model[Key(k)] = value;
+        }
+      }
+      const int start = rnd.Uniform(kNumKeys);
+      const int limit = start + rnd.Uniform(rnd.OneIn(4) ? 50 : 800);
+      KVMap kv;
+      for (int k = start; k < limit && k < kNumKeys; k++) {
+        if (!rnd.OneIn(3)) {
+          kv[Key(k)] = "i" + std::string(rnd.Uniform(100), 'A' + round % 26);
+        }
+      }
+      ASSERT_OK(WriteExternalFile(*options, fname, kv));
+      ASSERT_OK(db_->IngestExternalFile(std::vector<std::string>(1, fname)));
+      for (KVMap::const_iterator it = kv.begin(); it != kv.end(); ++it) {
+        model[it->first] = it->second;
+      }
+      if (round % 10 == 3) {
+        snapshots.push_back(db_->GetSnapshot());
+        models.push_back(model);
+      }
+      if (round % 13 == 12) {
+        db_->CompactRange(NULL, NULL);
+      }
+    }
+    CheckVisible(model, kNumKeys);
+    for (size_t s = 0; s < snapshots.size(); s++) {
+      CheckVisible(models[s], kNumKeys, snapshots[s]);
+      db_->ReleaseSnapshot(snapshots[s]);
+    }
+    Reopen(options);
+    CheckVisible(model, kNumKeys);
+    env_->DeleteFile(fname);
+  }
+
+  // Mix merges of short operands with puts, deletes and range deletions
+  // under "options", whose merge operator must be an AppendOperator, and
+  // check the merged values against a model, also at snapshots, after
+  // full compactions and after reopening the database.
+  void CheckMergeWorkload(Options* options) {
+    options->write_buffer_size = 64 << 10;
+    options->max_file_size = 32 << 10;
+    DestroyAndReopen(options);
+
+    const int kNumKeys = 3000;
+    Random rnd(404);
+    KVMap model;
+    std::vector<const Snapshot*> snapshots;
+    std::vector<KVMap> models;
+    for (int round = 0; round < 6; round++) {
+      for (int i = 0; i < 20000; i++) {
+        const int k = rnd.Uniform(kNumKeys);
+        const std::string operand(1, 'a' + rnd.Uniform(26));
+        if (rnd.OneIn(400)) {
+          const int e = k + 1 + rnd.Uniform(100);
+          ASSERT_OK(db_->DeleteRange(WriteOptions(), Key(k), Key(e)));
+          model.erase(model.lower_bound(Key(k)), model.lower_bound(Key(e)));
+        } else if (rnd.OneIn(30)) {
+          ASSERT_OK(Delete(Key(k)));
+          model.erase(Key(k));
+        } else if (rnd.OneIn(20)) {
+          const std::string value(rnd.Uniform(10) + 1, 'A' + (i % 26));
+          ASSERT_OK(Put(Key(k), value));
+          model[Key(k)] = value;
+        } else if (rnd.OneIn(10)) {
+          WriteBatch batch;
+          batch.Merge(Key(k), operand);
+          batch.Merge(Key(k), operand);
+          ASSERT_OK(db_->Write(WriteOptions(), &batch));
+          ModelMerge(&model, Key(k), operand);
+          ModelMerge(&model, Key(k), operand);
+        } else {
+          ASSERT_OK(db_->Merge(WriteOptions(), Key(k), operand));
+          ModelMerge(&model, Key(k), operand);
+        }
+        if (i % 7000 == 0) {
+          snapshots.push_back(db_->GetSnapshot());
+          models.push_back(model);
+        }
+      }
+      CheckVisible(model, kNumKeys);
+      for (size_t s = 0; s < snapshots.size(); s++) {
+        CheckModel(models[s], kNumKeys, snapshots[s]);
+      }
+      if (round == 2) {
+        db_->CompactRange(NULL, NULL);
+        CheckVisible(model, kNumKeys);
+        for (size_t s = 0; s < snapshots.size(); s++) {
+          CheckVisible(models[s], kNumKeys, snapshots[s]);
+        }
+      } else if (round == 3) {
+        for (size_t s = 0; s < snapshots.size(); s++) {
+          db_->ReleaseSnapshot(snapshots[s]);
+        }
+        snapshots.clear();
+        models.clear();
+        Reopen(options);
+        CheckVisible(model, kNumKeys);
+        db_->CompactRange(NULL, NULL);
+        CheckVisible(model, kNumKeys);
+      }
+    }
+    for (size_t s = 0; s < snapshots.size(); s++) {
+      db_->ReleaseSnapshot(snapshots[s]);
+    }
+    db_->CompactRange(NULL, NULL);
+    CheckVisible(model, kNumKeys);
+    Reopen(options);
+    CheckVisible(model, kNumKeys);
+  }
+
+  // Write from several threads at once with "options", and check that
+  // every write is there, also after reopening the database.
+  void CheckConcurrentWrites(Options* options) {
+    options->write_buffer_size = 128 << 10;
+    DestroyAndReopen(options);
+    for (int round = 0; round < 2; round++) {
+      WriterThread threads[kWriterThreads];
+      for (int id = 0; id < kWriterThreads; id++) {
+        threads[id].db = db_;
+        threads[id].id = id;
+        threads[id].done.Release_Store(NULL);
+        env_->StartThread(WriterBody, &threads[id]);
+      }
+      for (int id = 0; id < kWriterThreads; id++) {
+        while (threads[id].done.Acquire_Load() == NULL) {
+          env_->SleepForMicroseconds(1000);
+        }
+      }
+
+      if (round == 1) {
+        Reopen(options);
+      }
+      Iterator* iter = db_->NewIterator(ReadOptions());
+      iter->SeekToFirst();
+      for (int id = 0; id < kWriterThreads; id++) {
+        for (int i = 0; i < kKeysPerWriter; i++) {
+          ASSERT_TRUE(iter->Valid());
+          ASSERT_EQ(WriterKey(id, i), iter->key().ToString());
+          ASSERT_EQ(WriterKey(i, id), iter->value().ToString());
+          iter->Next();
+        }
+      }
+      ASSERT_TRUE(!iter->Valid());
+      delete iter;
+    }
+  }
+
+  // Apply random puts and deletes with "options", enough to fill several
+  // levels, and check the contents against a model along the way and
+  // after reopening the database.
+  void CheckRandomWorkload(Options* options) {
+    options->write_buffer_size = 256 << 10;
+    options->max_file_size = 1 << 20;
+    DestroyAndReopen(options);
+
+    const int kNumKeys = 20000;
+    KVMap model;
+    Random rnd(301);
+    for (int round = 0; round < 3; round++) {
+      for (int i = 0; i < 20000; i++) {
+        const std::string k = Key(rnd.Uniform(kNumKeys));
+        if (rnd.OneIn(8)) {
+          ASSERT_OK(Delete(k));
+          model.erase(k);
+        } else {
+          std::string v;
+          test::RandomString(&rnd, 100 + rnd.Uniform(1000), &v);
+          ASSERT_OK(Put(k, v));
+          model[k] = v;
+        }
+      }
+      CheckModel(model, kNumKeys);
+      if (round == 1) {
+        db_->CompactRange(NULL, NULL);
+        CheckModel(model, kNumKeys);
+      }
+    }
+    Reopen(options);
+    CheckModel(model, kNumKeys);
+  }
+};
+
+TEST(DBTest, Empty) {
+  ASSERT_TRUE(db_ != NULL);
+  ASSERT_EQ("NOT_FOUND", Get("foo"));
+}
+
+TEST(DBTest, WaitForLogSyncCoversSwitchedLogs) {
+  Options options;
+  options.write_buffer_size = 64 << 10;
+  options.max_write_buffer_number = 4;
+  DestroyAndReopen(&options);
+
+  // Fill more than one memtable without syncing, keeping the sealed
+  // memtable and its log around.
+  env_->HoldFlushes();
+  const std::string value(1000, 'v');
+  for (int i = 0; i < 100; i++) {
+    ASSERT_OK(Put(Key(i), value));
+  }
+  ASSERT_GT(env_->LogFiles(), 1);
+
+  ASSERT_OK(db_->WaitForLogSync());
+  ASSERT_EQ(0, env_->UnsyncedLogs());
+
+  env_->ReleaseFlushes();
+  for (int i = 0; i < 100; i++) {
+    ASSERT_EQ(value, Get(Key(i)));
+  }
+}
+
+TEST(DBTest, PeriodicLogSync) {
+  Options options;
+  options.log_sync_interval_micros = 10000;
+  DestroyAndReopen(&options);
+  for (int i = 0; i < 100; i++) {
+    ASSERT_OK(Put(Key(i), "v"));
+  }
+  // The sync thread catches up within an interval or so
+  for (int i = 0; i < 100 && env_->UnsyncedLogs() > 0; i++) {
+    env_->SleepForMicroseconds(10000);
+  }
+  ASSERT_EQ(0, env_->UnsyncedLogs());
+
+  options.log_sync_interval_micros = 0;
+  options.log_sync_bytes = 10000;
+  DestroyAndReopen(&options);
+  for (int i = 0; i < 100; i++) {
+    ASSERT_OK(Put(Key(i), std::string(1000, 'v')));
+  }
+  // Less than log_sync_bytes, plus the write that crossed it, is left
+  for (int i = 0; i < 100 && env_->MaxUnsyncedBytes() >= 12000; i++) {
+    env_->SleepForMicroseconds(10000);
+  }
+  ASSERT_LT(env_->MaxUnsyncedBytes(), 12000);
+
+  // WaitForLogSync() waits for the sync thread
+  ASSERT_OK(Put("foo", "v"));
+  ASSERT_OK(db_->WaitForLogSync());
+  ASSERT_EQ(0, env_->UnsyncedLogs());
+}
+
+TEST(DBTest, MultipleImmutableMemTables) {
+  Options options;
+  options.write_buffer_size = 64 << 10;
+  options.max_write_buffer_number = 4;
+  DestroyAndReopen(&options);
+
+  // Seal a few memtables while their flushes are held back; reads must
+  // see every one of them, newest first.
+  env_->HoldFlushes();
+  const int kNumKeys = 200;
+  KVMap model;
+  for (int i = 0; i < 150; i++) {
+    const std::string k = Key(i % kNumKeys);
+    model[k] = NumberToString(i) + std::string(1000, 'v');
+    ASSERT_OK(Put(k, model[k]));
+    if (i == 50) {
+      ASSERT_OK(Delete(Key(3)));
+      model.erase(Key(3));
+    }
+  }
+  ASSERT_GE(env_->LogFiles(), 3);
+  const Snapshot* snapshot = db_->GetSnapshot();
+  KVMap at_snapshot = model;
+  ASSERT_OK(Put(Key(7), "after"));
+  model[Key(7)] = "after";
+  CheckModel(model, kNumKeys);
+  CheckModel(at_snapshot, kNumKeys, snapshot);
+  ASSERT_EQ(0, TotalTableFiles());
+
+  env_->ReleaseFlushes();
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  CheckModel(model, kNumKeys);
+  CheckModel(at_snapshot, kNumKeys, snapshot);
+  db_->ReleaseSnapshot(snapshot);
+  Reopen(&options);
+  CheckModel(model, kNumKeys);
+}
+
+static uint64_t WriteStallMicros(DB* db) {
+  std::string value;
+  ASSERT_TRUE(db->GetProperty("leveldb.write-stall-micros", &value));
+  return strtoull(value.c_str(), NULL, 10);
+}
+
+TEST(DBTest, WritesSlowDownBehindCompactions) {
+  Options options;
+  options.delayed_write_rate = 1 << 20;
+  DestroyAndReopen(&options);
+  ASSERT_EQ(0, WriteStallMicros(db_));
+
+  // Pile up level-0 files that no compaction gets to merge.  Each one
+  // spans the same keys so that none of them is pushed below level-0.
+  env_->HoldCompactions();
+  KVMap model;
+  int round = 0;
+  while (NumTableFilesAtLevel(0) < config::kL0_SlowdownWritesTrigger) {
+    ASSERT_OK(Put(Key(0), NumberToString(round)));
+    ASSERT_OK(Put(Key(99), NumberToString(round)));
+    model[Key(0)] = model[Key(99)] = NumberToString(round);
+    ASSERT_OK(dbfull()->TEST_CompactMemTable());
+    round++;
+  }
+
+  // Writes are now admitted at about delayed_write_rate
+  const std::string value(1000, 'x');
+  const uint64_t start = env_->NowMicros();
+  for (int i = 1; i <= 100; i++) {
+    ASSERT_OK(Put(Key(i), value));
+    model[Key(i)] = value;
+  }
+  const uint64_t stalled = WriteStallMicros(db_);
+  ASSERT_GE(stalled, 50000);
+  ASSERT_GE(env_->NowMicros() - start, stalled);
+
+  // Past the old stop trigger writes get slower, but never stop
+  while (NumTableFilesAtLevel(0) <= config::kL0_StopWritesTrigger) {
+    ASSERT_OK(Put(Key(0), NumberToString(round)));
+    model[Key(0)] = NumberToString(round);
+    ASSERT_OK(dbfull()->TEST_CompactMemTable());
+    round++;
+  }
+  for (int i = 0; i < 4; i++) {
+    ASSERT_OK(Put(Key(200 + i), value));
+    model[Key(200 + i)] = value;
+  }
+  ASSERT_GT(WriteStallMicros(db_), stalled);
+  CheckModel(model, 300);
+
+  // Once compactions catch up, writes are no longer delayed
+  env_->ReleaseCompactions();
+  dbfull()->TEST_CompactRange(0, NULL, NULL);
+  ASSERT_LT(NumTableFilesAtLevel(0), config::kL0_SlowdownWritesTrigger);
+  const uint64_t before = WriteStallMicros(db_);
+  for (int i = 0; i < 100; i++) {
+    ASSERT_OK(Put(Key(i), value));
+    model[Key(i)] = value;
+  }
+  ASSERT_EQ(before, WriteStallMicros(db_));
+  CheckModel(model, 300);
+}
+
+TEST(DBTest, MultiGetMatchesGet) {
+  const int kNumKeys = 1000;
+  for (int use_filter = 0; use_filter < 2; use_filter++) {
+    Options options;
+    if (use_filter) {
+      options.filter_policy = NewBloomFilterPolicy(10);
+    }
+    DestroyAndReopen(&options);
+
+    // Layer the keys over a deeper level, level-1, level-0 and the
+    // memtable, each layer overwriting or deleting some of the keys
+    // below it.  A snapshot is taken after each layer.
+    KVMap model;
+    std::vector<KVMap> models;
+    std::vector<const Snapshot*> snapshots;
+    for (int layer = 0; layer < 4; layer++) {
+      for (int i = 0; i < kNumKeys; i++) {
+        if (layer == 0 || i % (layer + 2) == 0) {
+          const std::string v = "v" + NumberToString(layer) + "_" + Key(i);
+          ASSERT_OK(Put(Key(i), v));
+          model[Key(i)] = v;
+        } else if (i % (layer + 6) == 0) {
+          ASSERT_OK(Delete(Key(i)));
+          model.erase(Key(i));
+        }
+      }
+      if (layer == 0) {
+        db_->CompactRange(NULL, NULL);
+      } else if (layer < 3) {
+        ASSERT_OK(dbfull()->TEST_CompactMemTable());
+      }
+      models.push_back(model);
+      snapshots.push_back(db_->GetSnapshot());
+    }
+    ASSERT_EQ(1, NumTableFilesAtLevel(0));
+    ASSERT_EQ(3, TotalTableFiles());
+
+    // Look up present, deleted and missing keys, out of order and with
+    // duplicates, in batches of different sizes
+    Random rnd(301 + use_filter);
+    std::vector<std::string> all;
+    for (int i = 0; i < kNumKeys + 100; i++) {
+      all.push_back(Key(rnd.Uniform(kNumKeys + 100)));
+    }
+    all.push_back("");
+    all.push_back(Key(5));
+    all.push_back(Key(5));
+    CheckMultiGet(std::vector<std::string>(), model);
+    for (size_t s = 0; s <= snapshots.size(); s++) {
+      const Snapshot* snapshot = (s < snapshots.size()) ? snapshots[s] : NULL;
+      const KVMap& expected = (s < models.size()) ? models[s] : model;
+      CheckMultiGet(all, expected, snapshot);
+      for (size_t start = 0; start < all.size(); ) {
+        const size_t n = 1 + rnd.Uniform(64);
+        const size_t end = std::min(start + n, all.size());
+        CheckMultiGet(std::vector<std::string>(all.begin() + start,
+                                               all.begin() + end),
+                      expected, snapshot);
+        start = end;
+      }
+    }
+    for (size_t s = 0; s < snapshots.size(); s++) {
+      db_->ReleaseSnapshot(snapshots[s]);
+    }
+
+    // And again once everything has been compacted into one level
+    db_->CompactRange(NULL, NULL);
+    CheckMultiGet(all, model);
+    Close();
+    delete options.filter_policy;
+  }
+}
+
+TEST(DBTest, ReadsDuringFlushesAndCompactions) {
+  Options options;
+  options.write_buffer_size = 64 << 10;
+  options.max_file_size = 1 << 20;
+  DestroyAndReopen(&options);
+  for (int i = 0; i < kReaderKeys; i++) {
+    ASSERT_OK(Put(Key(i), Counter(0)));
+  }
+
+  ReaderState state;
+  state.db = db_;
+  state.stop.Release_Store(NULL);
+  state.started = 0;
+  state.running = kReaderThreads;
+  state.reads = 0;
+  state.failures = 0;
+  for (int i = 0; i < kReaderThreads; i++) {
+    env_->StartThread(ReaderBody, &state);
+  }
+
+  // Overwrite enough to switch memtables and compact many times over
+  Random rnd(301);
+  for (uint64_t n = 1; n <= 100000; n++) {
+    ASSERT_OK(Put(Key(rnd.Uniform(kReaderKeys)), Counter(n)));
+  }
+  state.stop.Release_Store(&state);
+  while (true) {
+    {
+      MutexLock l(&state.mu);
+      if (state.running == 0) {
+        break;
+      }
+    }
+    env_->SleepForMicroseconds(1000);
+  }
+  ASSERT_GT(state.reads, 0);
+  ASSERT_EQ(0, state.failures);
+  ASSERT_GT(TotalTableFiles(), 0);
+}
+
+static std::string PrefixKey(int p, int k) {
+  char buf[100];
+  snprintf(buf, sizeof(buf), "p%03d/k%03d", p, k);
+  return std::string(buf);
+}
+
+static std::string Prefix(int p) {
+  return PrefixKey(p, 0).substr(0, 5);
+}
+
+TEST(DBTest, PrefixSameAsStart) {
+  const int kPrefixes = 400;
+  Options options;
+  options.filter_policy = NewBloomFilterPolicy(10);
+  options.prefix_extractor = NewFixedPrefixTransform(5);
+  options.write_buffer_size = 64 << 10;
+  DestroyAndReopen(&options);
+
+  // Even prefixes are in tables; some of them also have newer keys in
+  // the memtable.  Odd prefixes are missing.
+  KVMap model;
+  for (int p = 0; p < kPrefixes; p += 2) {
+    for (int k = 0; k < 20; k++) {
+      model[PrefixKey(p, k)] = std::string(100, 'a' + k);
+    }
+  }
+  for (KVMap::iterator it = model.begin(); it != model.end(); ++it) {
+    ASSERT_OK(Put(it->first, it->second));
+  }
+  db_->CompactRange(NULL, NULL);
+  ASSERT_GT(TotalTableFiles(), 1);
+  for (int p = 0; p < kPrefixes; p += 10) {
+    ASSERT_OK(Put(PrefixKey(p, 25), "mem"));
+    model[PrefixKey(p, 25)] = "mem";
+  }
+
+  // Filters never hide a key from Get()
+  for (KVMap::iterator it = model.begin(); it != model.end(); ++it) {
+    ASSERT_EQ(it->second, Get(it->first));
+  }
+
+  // Iteration yields exactly the keys with the prefix sought
+  ReadOptions prefix_options;
+  prefix_options.prefix_same_as_start = true;
+  for (int p = 0; p < kPrefixes; p++) {
+    for (int from = 0; from < 2; from++) {
+      const std::string start = from ? PrefixKey(p, 10) : Prefix(p);
+      Iterator* iter = db_->NewIterator(prefix_options);
+      KVMap::iterator it = model.lower_bound(start);
+      for (iter->Seek(start); iter->Valid(); iter->Next(), ++it) {
+        ASSERT_TRUE(it != model.end());
+        ASSERT_EQ(it->first, iter->key().ToString());
+        ASSERT_EQ(it->second, iter->value().ToString());
+      }
+      ASSERT_OK(iter->status());
+      ASSERT_TRUE(it == model.end() || !Slice(it->first).starts_with(Prefix(p)));
+      delete iter;
+    }
+  }
+
+  // Seeking a missing prefix reads (almost) no table blocks
+  int reads = env_->TableReads();
+  for (int p = 1; p < kPrefixes; p += 2) {
+    Iterator* iter = db_->NewIterator(prefix_options);
+    iter->Seek(Prefix(p));
+    ASSERT_TRUE(!iter->Valid());
+    delete iter;
+  }
+  const int filtered_reads = env_->TableReads() - reads;
+  reads = env_->TableReads();
+  for (int p = 1; p < kPrefixes; p += 2) {
+    Iterator* iter = db_->NewIterator(ReadOptions());
+    iter->Seek(Prefix(p));
+    delete iter;
+  }
+  const int plain_reads = env_->TableReads() - reads;
+  ASSERT_GE(plain_reads, kPrefixes / 4);
+  ASSERT_LT(filtered_reads, plain_reads / 10);
+
+  Close();
+  delete options.prefix_extractor;
+  delete options.filter_policy;
+}
+
+TEST(DBTest, FullFilter) {
+  const int kNumKeys = 4000;
+  Options options;
+  options.filter_policy = NewBloomFilterPolicy(10);
+  DestroyAndReopen(&options);
+
+  // The lower half of the even keys is in a table with per-block filters,
+  // the upper half in one with a full filter
+  KVMap model;
+  for (int i = 0; i < kNumKeys; i += 2) {
+    if (i == kNumKeys / 2) {
+      db_->CompactRange(NULL, NULL);
+      options.full_filter = true;
+      Reopen(&options);
+    }
+    ASSERT_OK(Put(Key(i), Key(i) + std::string(100, 'v')));
+    model[Key(i)] = Key(i) + std::string(100, 'v');
+  }
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  ASSERT_EQ(2, TotalTableFiles());
+
+  std::vector<std::string> keys;
+  for (int i = 0; i < kNumKeys; i++) {
+    keys.push_back(Key(i));
+  }
+  for (int full = 1; full >= 0; full--) {
+    options.full_filter = full;
+    Reopen(&options);
+
+    // No key is ever filtered out, and most missing keys are filtered
+    // out before any block of their table is read
+    for (int half = 0; half < 2; half++) {
+      const int reads = env_->TableReads();
+      int missing = 0;
+      for (int i = half * kNumKeys / 2; i < (half + 1) * kNumKeys / 2; i++) {
+        if (i % 2 == 0) {
+          ASSERT_EQ(model[Key(i)], Get(Key(i)));
+        } else {
+          ASSERT_EQ("NOT_FOUND", Get(Key(i)));
+          missing++;
+        }
+      }
+      const int missing_reads =
+          env_->TableReads() - reads - (kNumKeys / 2 - missing);
+      ASSERT_LE(missing_reads, missing / 20);
+    }
+    CheckMultiGet(keys, model);
+    CheckModel(model, kNumKeys);
+  }
+
+  // Tables rewritten with per-block filters
+  db_->CompactRange(NULL, NULL);
+  CheckMultiGet(keys, model);
+  CheckModel(model, kNumKeys);
+  Close();
+  delete options.filter_policy;
+}
+
+TEST(DBTest, BlockedBloomFilter) {
+  for (int full = 0; full < 2; full++) {
+    Options options;
+    options.filter_policy = NewBlockedBloomFilterPolicy(10);
+    options.full_filter = full;
+    CheckRandomWorkload(&options);
+    Close();
+    delete options.filter_policy;
+  }
+}
+
+TEST(DBTest, RibbonFilter) {
+  for (int full = 0; full < 2; full++) {
+    Options options;
+    options.filter_policy = NewRibbonFilterPolicy(10);
+    options.full_filter = full;
+    CheckRandomWorkload(&options);
+    Close();
+    delete options.filter_policy;
+  }
+}
+
+TEST(DBTest, PartitionedIndexAndFilters) {
+  const int kPrefixes = 400;
+  for (int full = 0; full < 2; full++) {
+    Options options;
+    options.filter_policy = NewBloomFilterPolicy(10);
+    options.prefix_extractor = NewFixedPrefixTransform(5);
+    options.block_size = 512;
+    DestroyAndReopen(&options);
+
+    // Unpartitioned tables hold the lower half of the even prefixes,
+    // partitioned ones the upper half
+    KVMap model;
+    for (int p = 0; p < kPrefixes; p += 2) {
+      if (p == kPrefixes / 2) {
+        db_->CompactRange(NULL, NULL);
+        options.full_filter = full;
+        options.index_partition_size = 256;
+        Reopen(&options);
+      }
+      for (int k = 0; k < 20; k++) {
+        ASSERT_OK(Put(PrefixKey(p, k), std::string(100, 'a' + k)));
+        model[PrefixKey(p, k)] = std::string(100, 'a' + k);
+      }
+    }
+    db_->CompactRange(NULL, NULL);
+
+    std::vector<std::string> keys;
+    for (int p = 0; p < kPrefixes; p++) {
+      keys.push_back(PrefixKey(p, 7));
+    }
+    for (int round = 0; round < 2; round++) {
+      Reopen(&options);
+      CheckModel(model, 0);
+      for (KVMap::iterator it = model.begin(); it != model.end(); ++it) {
+        ASSERT_EQ(it->second, Get(it->first));
+      }
+      CheckMultiGet(keys, model);
+
+      // Missing keys and prefixes in the partitioned tables
+      ReadOptions prefix_options;
+      prefix_options.prefix_same_as_start = true;
+      for (int p = kPrefixes / 2 + 1; p < kPrefixes; p += 2) {
+        ASSERT_EQ("NOT_FOUND", Get(PrefixKey(p, 7)));
+        Iterator* iter = db_->NewIterator(prefix_options);
+        iter->Seek(Prefix(p));
+        ASSERT_TRUE(!iter->Valid());
+        delete iter;
+      }
+
+      uint64_t size;
+      const std::string start = Prefix(kPrefixes / 2);
+      const std::string limit = Prefix(kPrefixes);
+      Range r(start, limit);
+      db_->GetApproximateSizes(&r, 1, &size);
+      ASSERT_GE(size, (kPrefixes / 4) * 20 * 100);
+
+      // Partitioned tables are read whatever the options
+      options.full_filter = false;
+      options.index_partition_size = 0;
+    }
+    Close();
+    delete options.prefix_extractor;
+    delete options.filter_policy;
+  }
+}
+
+TEST(DBTest, PartitionedIndexWorkload) {
+  for (int full = 0; full < 2; full++) {
+    Options options;
+    options.filter_policy = NewBloomFilterPolicy(10);
+    options.full_filter = full;
+    options.index_partition_size = 128;
+    options.block_size = 256;
+    CheckRandomWorkload(&options);
+    Close();
+    delete options.filter_policy;
+  }
+}
+
+TEST(DBTest, CachedIndexAndFilterBlocks) {
+  env_->CopyTableReads(true);
+  for (int mode = 0; mode < 3; mode++) {
+    Options options;
+    options.filter_policy = NewBloomFilterPolicy(10);
+    options.block_cache = NewLRUCache(64 << 20, 0.5);
+    options.cache_index_and_filter_blocks = (mode > 0);
+    options.pin_l0_filter_and_index_blocks_in_cache = (mode == 2);
+    DestroyAndReopen(&options);
+
+    KVMap model;
+    for (int i = 0; i < 20000; i++) {
+      ASSERT_OK(Put(Key(i), std::string(100, 'v')));
+      model[Key(i)] = std::string(100, 'v');
+    }
+    db_->CompactRange(NULL, NULL);
+    for (int round = 0; round < 2; round++) {
+      // The second of these flushes stays in level-0
+      for (int i = 0; i < 2000; i++) {
+        ASSERT_OK(Put(Key(i), std::string(100, 'w')));
+        model[Key(i)] = std::string(100, 'w');
+      }
+      ASSERT_OK(dbfull()->TEST_CompactMemTable());
+    }
+    ASSERT_EQ(1, NumTableFilesAtLevel(0));
+
+    // Reads that do not cache data blocks leave only indexes and filters
+    // in the cache, if they are kept there at all
+    ReadOptions read_options;
+    read_options.fill_cache = false;
+    for (int i = 0; i < 21000; i += 7) {
+      std::string value;
+      Status s = db_->Get(read_options, Key(i), &value);
+      if (i < 20000) {
+        ASSERT_OK(s);
+        ASSERT_EQ(model[Key(i)], value);
+      } else {
+        ASSERT_TRUE(s.IsNotFound());
+      }
+    }
+    const size_t charge = options.block_cache->TotalCharge();
+    options.block_cache->Prune();
+    const size_t pinned = options.block_cache->TotalCharge();
+    if (mode == 0) {
+      ASSERT_EQ(0, charge);
+    } else if (mode == 1) {
+      ASSERT_GT(charge, 0);
+      ASSERT_EQ(0, pinned);
+    } else {
+      ASSERT_GT(pinned, 0);
+      ASSERT_LT(pinned, charge);
+    }
+    CheckModel(model, 21000);
+
+    // Pins are released with the tables
+    Close();
+    options.block_cache->Prune();
+    ASSERT_EQ(0, options.block_cache->TotalCharge());
+    delete options.block_cache;
+    delete options.filter_policy;
+  }
+}
+
+TEST(DBTest, CachedIndexAndFilterBlocksTinyCache) {
+  env_->CopyTableReads(true);
+  for (int full = 0; full < 2; full++) {
+    Options options;
+    options.filter_policy = NewBloomFilterPolicy(10);
+    options.full_filter = full;
+    options.block_cache = NewLRUCache(16 << 10, 0.5);
+    options.cache_index_and_filter_blocks = true;
+    options.pin_l0_filter_and_index_blocks_in_cache = true;
+    CheckRandomWorkload(&options);
+    Close();
+    delete options.block_cache;
+    delete options.filter_policy;
+  }
+}
+
+TEST(DBTest, RowCache) {
+  const int kNumKeys = 500;
+  Options options;
+  options.row_cache = NewLRUCache(4 << 20);
+  options.filter_policy = NewBloomFilterPolicy(10);
+  DestroyAndReopen(&options);
+
+  // Overwrite and delete keys in every table, and read them at every
+  // snapshot so that rows are cached for different sequence numbers
+  Random rnd(17);
+  KVMap model;
+  std::vector<KVMap> models;
+  std::vector<const Snapshot*> snapshots;
+  std::vector<std::string> keys;
+  for (int i = 0; i < kNumKeys + 10; i++) {
+    keys.push_back(Key(i));
+  }
+  for (int round = 0; round < 8; round++) {
+    for (int i = 0; i < 3000; i++) {
+      const std::string key = Key(rnd.Uniform(kNumKeys));
+      if (rnd.OneIn(5)) {
+        ASSERT_OK(Delete(key));
+        model.erase(key);
+      } else {
+        const std::string value(rnd.Uniform(50) + 1, 'a' + (i % 26));
+        ASSERT_OK(Put(key, value));
+        model[key] = value;
+      }
+    }
+    ASSERT_OK(dbfull()->TEST_CompactMemTable());
+    models.push_back(model);
+    snapshots.push_back(db_->GetSnapshot());
+    if (round == 5) {
+      db_->CompactRange(NULL, NULL);
+    }
+    for (size_t s = 0; s < snapshots.size(); s++) {
+      CheckModel(models[s], kNumKeys + 10, snapshots[s]);
+      CheckMultiGet(keys, models[s], snapshots[s]);
+    }
+    CheckModel(model, kNumKeys + 10);
+  }
+  for (size_t s = 0; s < snapshots.size(); s++) {
+    db_->ReleaseSnapshot(snapshots[s]);
+  }
+  db_->CompactRange(NULL, NULL);
+  CheckModel(model, kNumKeys + 10);
+
+  // Hot keys are served from the row cache without reading any table
+  for (int i = 0; i < kNumKeys; i++) {
+    Get(Key(i));
+  }
+  const int reads = env_->TableReads();
+  for (int rep = 0; rep < 10; rep++) {
+    for (int i = 0; i < kNumKeys; i++) {
+      KVMap::const_iterator it = model.find(Key(i));
+      ASSERT_EQ(it == model.end() ? "NOT_FOUND" : it->second, Get(Key(i)));
+    }
+  }
+  ASSERT_EQ(reads, env_->TableReads());
+
+  Close();
+  delete options.filter_policy;
+  delete options.row_cache;
+}
+
+TEST(DBTest, RowCacheWorkload) {
+  Options options;
+  options.row_cache = NewLRUCache(1 << 20);
+  CheckRandomWorkload(&options);
+  Close();
+  delete options.row_cache;
+}
+
+TEST(DBTest, IterateBounds) {
+  Options options;
+  CheckBoundsWorkload(&options);
+}
+
+TEST(DBTest, IterateBoundsPartitioned) {
+  Options options;
+  options.filter_policy = NewBloomFilterPolicy(10);
+  options.full_filter = true;
+  options.index_partition_size = 128;
+  CheckBoundsWorkload(&options);
+  Close();
+  delete options.filter_policy;
+}
+
+TEST(DBTest, IterateBoundsSkipBlocks) {
+  Options options;
+  options.write_buffer_size = 64 << 10;
+  options.max_file_size = 64 << 10;
+  DestroyAndReopen(&options);
+  for (int i = 0; i < 20000; i++) {
+    ASSERT_OK(Put(Key(i), std::string(100, 'v')));
+  }
+  db_->CompactRange(NULL, NULL);
+  ASSERT_GT(TotalTableFiles(), 10);
+
+  const std::string lower = Key(10000);
+  const std::string upper = Key(10010);
+  Slice lower_slice(lower);
+  Slice upper_slice(upper);
+  for (int bounded = 0; bounded < 2; bounded++) {
+    ReadOptions read_options;
+    if (bounded) {
+      read_options.iterate_lower_bound = &lower_slice;
+      read_options.iterate_upper_bound = &upper_slice;
+    }
+    const int reads = env_->TableReads();
+    Iterator* iter = db_->NewIterator(read_options);
+    int n = 0;
+    for (iter->Seek(lower);
+         iter->Valid() && iter->key().compare(upper_slice) < 0;
+         iter->Next()) {
+      n++;
+    }
+    ASSERT_EQ(10, n);
+    n = 0;
+    for (iter->SeekToLast();
+         iter->Valid() && iter->key().compare(lower_slice) >= 0;
+         iter->Prev()) {
+      n++;
+    }
+    ASSERT_EQ(bounded ? 10 : 10000, n);
+    delete iter;
+
+    // Only the blocks holding the keys within the bounds are read
+    if (bounded) {
+      ASSERT_LE(env_->TableReads() - reads, 4);
+    }
+  }
+}
+
+TEST(DBTest, DeleteRangeAcrossLevels) {
+  const int kNumKeys = 100;
+  Options options;
+  options.filter_policy = NewBloomFilterPolicy(10);
+  DestroyAndReopen(&options);
+
+  // Keys at a deeper level, overwritten in part by two newer tables
+  KVMap model;
+  for (int i = 0; i < kNumKeys; i++) {
+    ASSERT_OK(Put(Key(i), "old"));
+    model[Key(i)] = "old";
+  }
+  db_->CompactRange(NULL, NULL);
+  for (int i = 0; i < kNumKeys; i += 3) {
+    ASSERT_OK(Put(Key(i), "mid"));
+    model[Key(i)] = "mid";
+  }
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  for (int i = 20; i < 30; i++) {
+    ASSERT_OK(Put(Key(i), "new"));
+    model[Key(i)] = "new";
+  }
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  ASSERT_EQ(1, NumTableFilesAtLevel(0));
+  ASSERT_EQ(3, TotalTableFiles());
+  const Snapshot* snapshot = db_->GetSnapshot();
+  const KVMap before = model;
+
+  // The range deletion hides older keys in every level, but not newer
+  // ones or those at the end of the range
+  ASSERT_OK(Put(Key(45), "memtable"));
+  ASSERT_OK(db_->DeleteRange(WriteOptions(), Key(10), Key(50)));
+  ASSERT_OK(Put(Key(40), "newer"));
+  model.erase(model.lower_bound(Key(10)), model.lower_bound(Key(50)));
+  model[Key(40)] = "newer";
+  ASSERT_EQ("old", model[Key(50)]);
+  CheckVisible(model, kNumKeys);
+  CheckVisible(before, kNumKeys, snapshot);
+
+  // Flushed to level-0, and compacted further down
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  ASSERT_EQ(2, NumTableFilesAtLevel(0));
+  CheckVisible(model, kNumKeys);
+  CheckVisible(before, kNumKeys, snapshot);
+  dbfull()->TEST_CompactRange(0, NULL, NULL);
+  ASSERT_EQ(0, NumTableFilesAtLevel(0));
+  CheckVisible(model, kNumKeys);
+  CheckVisible(before, kNumKeys, snapshot);
+
+  // Keys written after the range deletion are visible
+  ASSERT_OK(Put(Key(15), "again"));
+  model[Key(15)] = "again";
+  CheckVisible(model, kNumKeys);
+
+  // Without the snapshot, compaction drops the deleted keys for good
+  db_->ReleaseSnapshot(snapshot);
+  db_->CompactRange(NULL, NULL);
+  CheckVisible(model, kNumKeys);
+  Reopen(&options);
+  CheckVisible(model, kNumKeys);
+  Close();
+  delete options.filter_policy;
+}
+
+TEST(DBTest, DeleteRangeWorkload) {
+  Options options;
+  CheckDeleteRangeWorkload(&options);
+}
+
+TEST(DBTest, DeleteRangeSubcompactions) {
+  Options options;
+  options.max_subcompactions = 4;
+  options.pipelined_compaction = true;
+  CheckDeleteRangeWorkload(&options);
+}
+
+TEST(DBTest, DeleteRangeRowCache) {
+  Options options;
+  options.row_cache = NewLRUCache(1 << 20);
+  options.filter_policy = NewBloomFilterPolicy(10);
+  CheckDeleteRangeWorkload(&options);
+  Close();
+  delete options.filter_policy;
+  delete options.row_cache;
+}
+
+TEST(DBTest, DeleteFilesInRange) {
+  const int kNumKeys = 20000;
+  Options options;
+  options.write_buffer_size = 64 << 10;
+  options.max_file_size = 32 << 10;
+  DestroyAndReopen(&options);
+  KVMap model;
+  for (int i = 0; i < kNumKeys; i++) {
+    const std::string value(50, 'a' + i % 26);
+    ASSERT_OK(Put(Key(i), value));
+    model[Key(i)] = value;
+  }
+  db_->CompactRange(NULL, NULL);
+  ASSERT_OK(Put(Key(6000), "memtable"));
+  model[Key(6000)] = "memtable";
+  const Snapshot* snapshot = db_->GetSnapshot();
+
+  // Without a range deletion first, only whole files in the range vanish,
+  // also from snapshots; keys in the memtable stay
+  const std::string begin = Key(5000);
+  const std::string end = Key(12000);
+  Slice begin_slice(begin);
+  Slice end_slice(end);
+  const int files = TotalTableFiles();
+  ASSERT_OK(db_->DeleteFilesInRange(&begin_slice, &end_slice));
+  ASSERT_LE(TotalTableFiles(), files - 5);
+  for (int s = 0; s < 2; s++) {
+    ReadOptions read_options;
+    read_options.snapshot = s ? snapshot : NULL;
+    Iterator* iter = db_->NewIterator(read_options);
+    KVMap::iterator it = model.begin();
+    int missing = 0;
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next(), ++it) {
+      for (; it != model.end() && it->first < iter->key().ToString(); ++it) {
+        ASSERT_TRUE(it->first >= begin && it->first <= end);
+        missing++;
+      }
+      ASSERT_TRUE(it != model.end());
+      ASSERT_EQ(it->first, iter->key().ToString());
+      ASSERT_EQ(it->second, iter->value().ToString());
+    }
+    for (; it != model.end(); ++it) {
+      ASSERT_TRUE(it->first >= begin && it->first <= end);
+      missing++;
+    }
+    ASSERT_GT(missing, 6000);
+    ASSERT_LE(missing, 7000);
+    delete iter;
+  }
+  ASSERT_EQ("memtable", Get(Key(6000)));
+  db_->ReleaseSnapshot(snapshot);
+
+  // With a range deletion first, the range is empty afterwards
+  ASSERT_OK(db_->DeleteRange(WriteOptions(), begin, end));
+  model.erase(model.lower_bound(begin), model.lower_bound(end));
+  ASSERT_OK(db_->DeleteFilesInRange(&begin_slice, &end_slice));
+  CheckVisible(model, kNumKeys);
+
+  // Interleaved with writes and the compactions they cause
+  Random rnd(11);
+  for (int round = 0; round < 20; round++) {
+    for (int i = 0; i < 3000; i++) {
+      const std::string key = Key(rnd.Uniform(kNumKeys));
+      const std::string value(rnd.Uniform(80) + 1, 'x');
+      ASSERT_OK(Put(key, value));
+      model[key] = value;
+    }
+    const int k = 1 + rnd.Uniform(kNumKeys - 2000);
+    const std::string lower = Key(k);
+    const std::string upper = Key(k + 2000);
+    ASSERT_OK(db_->DeleteRange(WriteOptions(), lower, upper));
+    model.erase(model.lower_bound(lower), model.lower_bound(upper));
+    Slice lower_slice(lower);
+    Slice upper_slice(upper);
+    ASSERT_OK(db_->DeleteFilesInRange(&lower_slice, &upper_slice));
+    if (round % 5 == 0) {
+      // Open-ended at the start
+      ASSERT_OK(db_->DeleteRange(WriteOptions(), Key(0), lower));
+      model.erase(model.begin(), model.lower_bound(lower));
+      const std::string last = Key(k - 1);
+      Slice last_slice(last);
+      ASSERT_OK(db_->DeleteFilesInRange(NULL, &last_slice));
+    }
+  }
+  CheckVisible(model, kNumKeys);
+  Reopen(&options);
+  CheckVisible(model, kNumKeys);
+
+  ASSERT_OK(db_->DeleteRange(WriteOptions(), Key(0), Key(kNumKeys)));
+  ASSERT_OK(db_->DeleteFilesInRange(NULL, NULL));
+  model.clear();
+  CheckVisible(model, kNumKeys);
+}
+
+TEST(DBTest, DeleteFilesInRangeKeepsRangeDeletions) {
+  const int kNumKeys = 5000;
+  Options options;
+  options.max_file_size = 32 << 10;
+  DestroyAndReopen(&options);
+  for (int i = 0; i < kNumKeys; i++) {
+    ASSERT_OK(Put(Key(i), std::string(50, 'v')));
+  }
+  db_->CompactRange(NULL, NULL);
+
+  // The range deletion lands alone in a level-1 file inside the range,
+  // above deeper files that extend beyond the range
+  const std::string begin = Key(1003);
+  const std::string end = Key(3007);
+  ASSERT_OK(db_->DeleteRange(WriteOptions(), begin, end));
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  ASSERT_EQ(1, NumTableFilesAtLevel(1));
+  Slice begin_slice(begin);
+  Slice end_slice(end);
+  ASSERT_OK(db_->DeleteFilesInRange(&begin_slice, &end_slice));
+  ASSERT_EQ(1, NumTableFilesAtLevel(1));
+  for (int i = 0; i < kNumKeys; i++) {
+    if (Key(i) >= begin && Key(i) < end) {
+      ASSERT_EQ("NOT_FOUND", Get(Key(i)));
+    } else {
+      ASSERT_EQ(std::string(50, 'v'), Get(Key(i)));
+    }
+  }
+}
+
+TEST(DBTest, MergeAcrossLevels) {
+  AppendOperator merge_operator(true);
+  Options options;
+  options.merge_operator = &merge_operator;
+  DestroyAndReopen(&options);
+
+  // Base value at level 2
+  ASSERT_OK(Put(Key(0), "base"));
+  ASSERT_OK(Put(Key(2), "zz"));
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  dbfull()->TEST_CompactRange(0, NULL, NULL);
+  dbfull()->TEST_CompactRange(1, NULL, NULL);
+  ASSERT_EQ(1, NumTableFilesAtLevel(2));
+
+  // Operands at level 1 and in the memtable
+  KVMap model;
+  model[Key(0)] = "base";
+  model[Key(2)] = "zz";
+  for (int i = 0; i < 5; i++) {
+    const std::string operand(1, '0' + i);
+    ASSERT_OK(db_->Merge(WriteOptions(), Key(0), operand));
+    ModelMerge(&model, Key(0), operand);
+  }
+  ASSERT_OK(db_->Merge(WriteOptions(), Key(1), "a"));
+  ModelMerge(&model, Key(1), "a");
+  CheckVisible(model, 3);
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  ASSERT_EQ(1, NumTableFilesAtLevel(1));
+  CheckVisible(model, 3);
+
+  // More operands at level 0, above those at level 1
+  for (int i = 5; i < 10; i++) {
+    const std::string operand(1, '0' + i);
+    ASSERT_OK(db_->Merge(WriteOptions(), Key(0), operand));
+    ModelMerge(&model, Key(0), operand);
+  }
+  ASSERT_OK(db_->Merge(WriteOptions(), Key(1), "b"));
+  ModelMerge(&model, Key(1), "b");
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  ASSERT_EQ(1, NumTableFilesAtLevel(0));
+  ASSERT_EQ("base,0,1,2,3,4,5,6,7,8,9", model[Key(0)]);
+  CheckVisible(model, 3);
+
+  // Compacting the operands above the base can only merge them partially
+  dbfull()->TEST_CompactRange(0, NULL, NULL);
+  ASSERT_EQ(0, NumTableFilesAtLevel(0));
+  ASSERT_GE(merge_operator.partial_merges(), 9);
+  CheckVisible(model, 3);
+
+  // Once compacted into the base, reads no longer merge
+  dbfull()->TEST_CompactRange(1, NULL, NULL);
+  ASSERT_EQ(0, NumTableFilesAtLevel(1));
+  const int full_merges = merge_operator.full_merges();
+  ASSERT_EQ(model[Key(0)], Get(Key(0)));
+  ASSERT_EQ(model[Key(1)], Get(Key(1)));
+  ASSERT_EQ(full_merges, merge_operator.full_merges());
+
+  // A snapshot keeps the operands written after it apart
+  ASSERT_OK(db_->Merge(WriteOptions(), Key(0), "p"));
+  ModelMerge(&model, Key(0), "p");
+  const Snapshot* snapshot = db_->GetSnapshot();
+  const KVMap before = model;
+  ASSERT_OK(db_->Merge(WriteOptions(), Key(0), "q"));
+  ModelMerge(&model, Key(0), "q");
+  db_->CompactRange(NULL, NULL);
+  ASSERT_EQ("base,0,1,2,3,4,5,6,7,8,9,p", Get(Key(0), snapshot));
+  CheckVisible(before, 3, snapshot);
+  CheckVisible(model, 3);
+  db_->ReleaseSnapshot(snapshot);
+
+  // A deletion at any level ends the operands below it
+  ASSERT_OK(Delete(Key(0)));
+  ASSERT_OK(db_->Merge(WriteOptions(), Key(0), "r"));
+  model[Key(0)] = "r";
+  CheckVisible(model, 3);
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  CheckVisible(model, 3);
+  Reopen(&options);
+  CheckVisible(model, 3);
+  db_->CompactRange(NULL, NULL);
+  CheckVisible(model, 3);
+  Close();
+}
+
+TEST(DBTest, MergeErrors) {
+  ASSERT_TRUE(db_->Merge(WriteOptions(), "k", "v").IsNotSupportedError());
+
+  AppendOperator merge_operator(false);
+  Options options;
+  options.merge_operator = &merge_operator;
+  Reopen(&options);
+  ASSERT_OK(Put("a", "1"));
+  ASSERT_OK(db_->Merge(WriteOptions(), "a", "2"));
+  ASSERT_OK(db_->Merge(WriteOptions(), "b", "FAIL"));
+  ASSERT_OK(db_->Merge(WriteOptions(), "c", "3"));
+  ASSERT_EQ("1,2", Get("a"));
+  std::string value;
+  ASSERT_TRUE(db_->Get(ReadOptions(), "b", &value).IsCorruption());
+
+  // Iteration stops at the operands that cannot be merged
+  Iterator* iter = db_->NewIterator(ReadOptions());
+  iter->SeekToFirst();
+  ASSERT_TRUE(iter->Valid());
+  ASSERT_EQ("1,2", iter->value().ToString());
+  iter->Next();
+  ASSERT_TRUE(!iter->Valid());
+  ASSERT_TRUE(iter->status().IsCorruption());
+  delete iter;
+
+  // Without the operator, merge operands cannot be read
+  options.merge_operator = NULL;
+  Reopen(&options);
+  ASSERT_TRUE(db_->Get(ReadOptions(), "c", &value).IsNotSupportedError());
+  Close();
+}
+
+TEST(DBTest, MergeCompactionWithoutOperator) {
+  AppendOperator merge_operator(true);
+  Options options;
+  options.merge_operator = &merge_operator;
+  DestroyAndReopen(&options);
+  ASSERT_OK(Put("x", "base"));
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  ASSERT_OK(db_->Merge(WriteOptions(), "x", "1"));
+  ASSERT_OK(db_->Merge(WriteOptions(), "x", "2"));
+
+  // Compacting without the operator keeps the base under the operands
+  options.merge_operator = NULL;
+  Reopen(&options);
+  db_->CompactRange(NULL, NULL);
+  options.merge_operator = &merge_operator;
+  Reopen(&options);
+  ASSERT_EQ("base,1,2", Get("x"));
+  db_->CompactRange(NULL, NULL);
+  ASSERT_EQ("base,1,2", Get("x"));
+  Close();
+}
+
+TEST(DBTest, MergeWorkload) {
+  AppendOperator merge_operator(false);
+  Options options;
+  options.merge_operator = &merge_operator;
+  CheckMergeWorkload(&options);
+  Close();
+}
+
+TEST(DBTest, MergeWorkloadPartial) {
+  AppendOperator merge_operator(true);
+  Options options;
+  options.merge_operator = &merge_operator;
+  CheckMergeWorkload(&options);
+  Close();
+}
+
+TEST(DBTest, MergeWorkloadPipelined) {
+  AppendOperator merge_operator(true);
+  Options options;
+  options.merge_operator = &merge_operator;
+  options.max_subcompactions = 4;
+  options.pipelined_compaction = true;
+  options.row_cache = NewLRUCache(1 << 20);
+  options.filter_policy = NewBloomFilterPolicy(10);
+  CheckMergeWorkload(&options);
+  Close();
+  delete options.filter_policy;
+  delete options.row_cache;
+}
+
+TEST(DBTest, IngestExternalFile) {
+  const int kNumKeys = 3000;
+  Options options;
+  options.filter_policy = NewBloomFilterPolicy(10);
+  DestroyAndReopen(&options);
+  const std::string fname1 = dbname_ + "_external1.ldb";
+  const std::string fname2 = dbname_ + "_external2.ldb";
+
+  // Keys out of order are rejected, and an unfinished file is removed
+  {
+    SstFileWriter writer(options);
+    ASSERT_OK(writer.Open(fname1));
+    ASSERT_OK(writer.Put("b", "1"));
+    ASSERT_TRUE(writer.Put("a", "1").IsInvalidArgument());
+    ASSERT_TRUE(writer.Put("b", "1").IsInvalidArgument());
+  }
+  ASSERT_TRUE(!env_->FileExists(fname1));
+
+  // Into an empty database, the files go to the deepest level
+  KVMap kv1, kv2, model;
+  for (int i = 0; i < 1000; i++) {
+    kv1[Key(i)] = "v1-" + Key(i);
+    kv2[Key(i + 1000)] = "v1-" + Key(i + 1000);
+  }
+  ASSERT_OK(WriteExternalFile(options, fname1, kv1));
+  ASSERT_OK(WriteExternalFile(options, fname2, kv2));
+  std::vector<std::string> paths;
+  paths.push_back(fname2);
+  paths.push_back(fname1);
+  ASSERT_OK(db_->IngestExternalFile(paths));
+  model.insert(kv1.begin(), kv1.end());
+  model.insert(kv2.begin(), kv2.end());
+  ASSERT_EQ(2, NumTableFilesAtLevel(config::kNumLevels - 1));
+  ASSERT_TRUE(env_->FileExists(fname1));
+  CheckVisible(model, kNumKeys);
+
+  // Files whose ranges overlap are rejected
+  paths.clear();
+  paths.push_back(fname1);
+  paths.push_back(fname1);
+  ASSERT_TRUE(db_->IngestExternalFile(paths).IsInvalidArgument());
+  CheckVisible(model, kNumKeys);
+
+  // Over older data in the tables and the memtable, and under a snapshot
+  // that does not see the ingested keys
+  ASSERT_OK(Put(Key(5), "mem"));
+  ASSERT_OK(Put(Key(2500), "mem2500"));
+  model[Key(5)] = "mem";
+  model[Key(2500)] = "mem2500";
+  const Snapshot* snapshot = db_->GetSnapshot();
+  const KVMap before = model;
+  KVMap kv3;
+  for (int i = 0; i < 2000; i += 3) {
+    kv3[Key(i)] = "v2-" + Key(i);
+  }
+  ASSERT_OK(WriteExternalFile(options, fname1, kv3));
+  ASSERT_OK(db_->IngestExternalFile(std::vector<std::string>(1, fname1)));
+  for (KVMap::const_iterator it = kv3.begin(); it != kv3.end(); ++it) {
+    model[it->first] = it->second;
+  }
+  CheckVisible(model, kNumKeys);
+  CheckVisible(before, kNumKeys, snapshot);
+
+  // Later writes win over the ingested keys
+  ASSERT_OK(Put(Key(3), "after"));
+  model[Key(3)] = "after";
+  CheckVisible(model, kNumKeys);
+  db_->ReleaseSnapshot(snapshot);
+  db_->CompactRange(NULL, NULL);
+  CheckVisible(model, kNumKeys);
+
+  // Empty files are ignored; missing ones fail the ingestion
+  {
+    SstFileWriter writer(options);
+    ASSERT_OK(writer.Open(fname2));
+    ASSERT_OK(writer.Finish());
+  }
+  paths.clear();
+  paths.push_back(fname2);
+  ASSERT_OK(db_->IngestExternalFile(paths));
+  paths.push_back(fname2 + ".missing");
+  ASSERT_TRUE(!db_->IngestExternalFile(paths).ok());
+  CheckVisible(model, kNumKeys);
+
+  // Reopening keeps the ingested keys and the sequence number
+  Reopen(&options);
+  CheckVisible(model, kNumKeys);
+  ASSERT_OK(Put(Key(6), "reopened"));
+  model[Key(6)] = "reopened";
+  CheckVisible(model, kNumKeys);
+  Close();
+  env_->DeleteFile(fname1);
+  env_->DeleteFile(fname2);
+  delete options.filter_policy;
+}
+
+// Snapshots taken while a file is ingested see all of it or none of it,
+// and keep seeing what they saw at first
+TEST(DBTest, IngestSnapshotsStayStable) {
+  Options options;
+  DestroyAndReopen(&options);
+  const std::string fname = dbname_ + "_external.ldb";
+  for (int round = 0; round < 20; round++) {
+    KVMap kv;
+    kv[Key(round)] = "v";
+    ASSERT_OK(WriteExternalFile(options, fname, kv));
+    SnapshotProbe probe;
+    probe.db = db_;
+    probe.key = Key(round);
+    probe.stop.Release_Store(NULL);
+    env_->StartThread(SnapshotProbeBody, &probe);
+    env_->SleepForMicroseconds(1000);
+    ASSERT_OK(db_->IngestExternalFile(std::vector<std::string>(1, fname)));
+    env_->SleepForMicroseconds(1000);
+    probe.stop.Release_Store(&probe);
+    while (probe.stop.Acquire_Load() != NULL) {
+      env_->SleepForMicroseconds(100);
+    }
+    ASSERT_EQ("v", Get(Key(round)));
+    for (size_t i = 0; i < probe.snapshots.size(); i++) {
+      ASSERT_EQ(probe.found[i] ? "v" : "NOT_FOUND",
+                Get(Key(round), probe.snapshots[i]));
+      db_->ReleaseSnapshot(probe.snapshots[i]);
+    }
+  }
+  env_->DeleteFile(fname);
+}
+
+TEST(DBTest, IngestWorkload) {
+  Options options;
+  CheckIngestWorkload(&options);
+}
+
+TEST(DBTest, IngestWorkloadPipelined) {
+  Options options;
+  options.enable_pipelined_write = true;
+  options.row_cache = NewLRUCache(1 << 20);
+  options.filter_policy = NewBloomFilterPolicy(10);
+  CheckIngestWorkload(&options);
+  Close();
+  delete options.filter_policy;
+  delete options.row_cache;
+}
+
+TEST(DBTest, ParallelCompactions) {
+  Options options;
+  options.max_background_compactions = 4;
+  CheckRandomWorkload(&options);
+}
+
+TEST(DBTest, Subcompactions) {
+  Options options;
+  options.max_subcompactions = 4;
+  CheckRandomWorkload(&options);
+}
+
+TEST(DBTest, SubcompactionsKeepSnapshots) {
+  Options options;
+  options.write_buffer_size = 1 << 20;
+  options.max_subcompactions = 4;
+  MessageCounter counter("Compacting in %d subcompactions");
+  options.info_log = &counter;
+  DestroyAndReopen(&options);
+
+  // Memtable outputs that overlap nothing are placed below level-0, so
+  // first cover the key range at levels 2, 1 and 0.
+  const int kNumKeys = 4000;
+  KVMap before;
+  for (int pass = 0; pass < 3; pass++) {
+    for (int i = 0; i < kNumKeys; i++) {
+      before[Key(i)] = "v" + NumberToString(pass) + Key(i);
+      ASSERT_OK(Put(Key(i), before[Key(i)]));
+    }
+    ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  }
+  ASSERT_EQ(1, NumTableFilesAtLevel(0));
+
+  // Then overwrite each half of the range in a level-0 file of its own,
+  // whose boundaries split the level-0 compaction.  (A fourth level-0
+  // file would start a compaction by itself.)
+  const Snapshot* snapshot = db_->GetSnapshot();
+  KVMap after = before;
+  for (int half = 0; half < 2; half++) {
+    for (int i = half * kNumKeys / 2; i < (half + 1) * kNumKeys / 2; i += 3) {
+      if (i % 2 == 0) {
+        ASSERT_OK(Delete(Key(i)));
+        after.erase(Key(i));
+      } else {
+        after[Key(i)] = "new" + Key(i);
+        ASSERT_OK(Put(Key(i), after[Key(i)]));
+      }
+    }
+    ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  }
+  ASSERT_EQ(3, NumTableFilesAtLevel(0));
+  dbfull()->TEST_CompactRange(0, NULL, NULL);
+  ASSERT_EQ(0, NumTableFilesAtLevel(0));
+  ASSERT_GT(counter.Count(), 0);
+
+  CheckModel(before, kNumKeys, snapshot);
+  CheckModel(after, kNumKeys);
+  db_->ReleaseSnapshot(snapshot);
+  dbfull()->TEST_CompactRange(1, NULL, NULL);
+  CheckModel(after, kNumKeys);
+  Close();
+}
+
+TEST(DBTest, PipelinedCompaction) {
+  Options options;
+  options.pipelined_compaction = true;
+  CheckRandomWorkload(&options);
+}
+
+TEST(DBTest, PipelinedSubcompactions) {
+  // Stages and slices compete for the threads of the LOW pool
+  Options options;
+  options.pipelined_compaction = true;
+  options.max_subcompactions = 4;
+  options.max_background_compactions = 3;
+  CheckRandomWorkload(&options);
+}
+
+TEST(DBTest, ConcurrentMemTableWrites) {
+  Options options;
+  options.allow_concurrent_memtable_write = true;
+  CheckConcurrentWrites(&options);
+}
+
+TEST(DBTest, PipelinedWrites) {
+  Options options;
+  options.enable_pipelined_write = true;
+  CheckConcurrentWrites(&options);
+  CheckRandomWorkload(&options);
+}
+
+TEST(DBTest, PipelinedConcurrentMemTableWrites) {
+  Options options;
+  options.enable_pipelined_write = true;
+  options.allow_concurrent_memtable_write = true;
+  CheckConcurrentWrites(&options);
+}
+
+TEST(DBTest, WriteAsync) {
+  Options options;
+  options.write_buffer_size = 64 << 10;
+  DestroyAndReopen(&options);
+
+  // Asynchronous writes, some of them synced, interleaved with
+  // synchronous ones; later writes of a key win.
+  const int kNumKeys = 2000;
+  AsyncWrites writes;
+  KVMap model;
+  Random rnd(301);
+  for (int i = 0; i < 10000; i++) {
+    const std::string k = Key(rnd.Uniform(kNumKeys));
+    const std::string v = "v" + NumberToString(i);
+    if (i % 10 == 0) {
+      ASSERT_OK(Put(k, v));
+    } else {
+      WriteOptions write_options;
+      write_options.sync = (i % 1000 == 1);
+      writes.Write(db_, write_options, k, v);
+    }
+    model[k] = v;
+  }
+  writes.WaitFor(9000);
+  ASSERT_EQ(9000, writes.done);
+  ASSERT_EQ(0, writes.failed);
+  CheckModel(model, kNumKeys);
+
+  // Writes still queued when the database is deleted are completed first
+  for (int i = 0; i < 1000; i++) {
+    writes.Write(db_, WriteOptions(), Key(i), "last");
+    model[Key(i)] = "last";
+  }
+  Close();
+  ASSERT_EQ(10000, writes.done);
+  ASSERT_EQ(0, writes.failed);
+  Reopen(&options);
+  CheckModel(model, kNumKeys);
+}
+
+TEST(DBTest, WriteAsyncShutdownWithFullMemTables) {
+  Options options;
+  options.write_buffer_size = 64 << 10;
+  options.max_write_buffer_number = 2;
+  DestroyAndReopen(&options);
+
+  // Queue several memtables' worth of writes and delete the database at
+  // once.  Writes that would wait for a flush fail, instead of keeping
+  // the database from shutting down.
+  const int kNumWrites = 300;
+  AsyncWrites writes;
+  for (int i = 0; i < kNumWrites; i++) {
+    writes.Write(db_, WriteOptions(), Key(i), std::string(1000, 'v'));
+  }
+  Close();
+  ASSERT_EQ(kNumWrites, writes.done);
+}
+
+TEST(DBTest, OpenSizesCompactionPool) {
+  Options options;
+  options.max_background_compactions = 3;
+  DestroyAndReopen(&options);
+  MutexLock l(&env_->mu_);
+  ASSERT_GE(env_->low_threads_, 3);
+}
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  return leveldb::test::RunAllTests();
+}
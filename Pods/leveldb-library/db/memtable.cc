@@ -4,10 +4,13 @@
 
 #include "db/memtable.h"
 #include "db/dbformat.h"
+#include "db/merge_helper.h"
+#include "db/range_del.h"
 #include "leveldb/comparator.h"
 #include "leveldb/env.h"
 #include "leveldb/iterator.h"
 #include "util/coding.h"
+#include "util/mutexlock.h"
 
 namespace leveldb {
 
@@ -18,14 +21,29 @@ static Slice GetLengthPrefixedSlice(const char* data) {
   return Slice(p, len);
 }
 
+struct MemTable::FragmentedRangeDeletions {
+  RangeTombstoneList list;
+  size_t num_range_dels;  // Value of num_range_dels_ when "list" was built
+  int refs;               // Protected by range_del_mu_
+
+  explicit FragmentedRangeDeletions(const Comparator* ucmp)
+      : list(ucmp), num_range_dels(0), refs(1) { }
+};
+
 MemTable::MemTable(const InternalKeyComparator& cmp)
     : comparator_(cmp),
       refs_(0),
-      table_(comparator_, &arena_) {
+      table_(comparator_, &arena_),
+      range_del_table_(comparator_, &arena_),
+      num_range_dels_(0),
+      range_dels_(NULL) {
 }
 
 MemTable::~MemTable() {
   assert(refs_ == 0);
+  if (range_dels_ != NULL) {
+    ReleaseRangeDeletions(range_dels_);
+  }
 }
 
 size_t MemTable::ApproximateMemoryUsage() { return arena_.MemoryUsage(); }
@@ -79,9 +97,18 @@ Iterator* MemTable::NewIterator() {
   return new MemTableIterator(&table_);
 }
 
-void MemTable::Add(SequenceNumber s, ValueType type,
-                   const Slice& key,
-                   const Slice& value) {
+Iterator* MemTable::NewRangeDeletionIterator() {
+  return new MemTableIterator(&range_del_table_);
+}
+
+size_t MemTable::EncodedLength(const Slice& key, const Slice& value) {
+  size_t internal_key_size = key.size() + 8;
+  return VarintLength(internal_key_size) + internal_key_size +
+         VarintLength(value.size()) + value.size();
+}
+
+void MemTable::EncodeEntry(char* buf, SequenceNumber s, ValueType type,
+                           const Slice& key, const Slice& value) {
   // Format of an entry is concatenation of:
   //  key_size     : varint32 of internal_key.size()
   //  key bytes    : char[internal_key.size()]
@@ -90,10 +117,6 @@ void MemTable::Add(SequenceNumber s, ValueType type,
   size_t key_size = key.size();
   size_t val_size = value.size();
   size_t internal_key_size = key_size + 8;
-  const size_t encoded_len =
-      VarintLength(internal_key_size) + internal_key_size +
-      VarintLength(val_size) + val_size;
-  char* buf = arena_.Allocate(encoded_len);
   char* p = EncodeVarint32(buf, internal_key_size);
   memcpy(p, key.data(), key_size);
   p += key_size;
@@ -101,15 +124,99 @@ void MemTable::Add(SequenceNumber s, ValueType type,
   p += 8;
   p = EncodeVarint32(p, val_size);
   memcpy(p, value.data(), val_size);
-  assert((p + val_size) - buf == encoded_len);
-  table_.Insert(buf);
+  assert((p + val_size) - buf == EncodedLength(key, value));
+}
+
+void MemTable::Add(SequenceNumber s, ValueType type,
+                   const Slice& key,
+                   const Slice& value) {
+  char* buf = arena_.Allocate(EncodedLength(key, value));
+  EncodeEntry(buf, s, type, key, value);
+  if (type == kTypeRangeDeletion) {
+    range_del_table_.Insert(buf);
+    RecordRangeDeletionAdded();
+  } else {
+    table_.Insert(buf);
+  }
+}
+
+void MemTable::AddConcurrently(SequenceNumber s, ValueType type,
+                               const Slice& key, const Slice& value,
+                               Random* rnd) {
+  char* buf = arena_.AllocateConcurrently(EncodedLength(key, value));
+  EncodeEntry(buf, s, type, key, value);
+  if (type == kTypeRangeDeletion) {
+    range_del_table_.InsertConcurrently(buf, rnd);
+    RecordRangeDeletionAdded();
+  } else {
+    table_.InsertConcurrently(buf, rnd);
+  }
+}
+
+void MemTable::RecordRangeDeletionAdded() {
+  // Readers that see the sequence number of the new range deletion
+  // acquire range_del_mu_ after this, and so rebuild the fragments.
+  MutexLock l(&range_del_mu_);
+  num_range_dels_++;
+}
+
+MemTable::FragmentedRangeDeletions* MemTable::RefRangeDeletions() {
+  MutexLock l(&range_del_mu_);
+  if (range_dels_ == NULL || range_dels_->num_range_dels != num_range_dels_) {
+    // Range deletions added while the list is built are included too,
+    // which is harmless: they only count for readers that see them.
+    FragmentedRangeDeletions* f = new FragmentedRangeDeletions(
+        comparator_.comparator.user_comparator());
+    f->num_range_dels = num_range_dels_;
+    Iterator* iter = NewRangeDeletionIterator();
+    Status s = f->list.AddEntries(iter, kMaxSequenceNumber);
+    assert(s.ok());  // Entries of range_del_table_ are well-formed
+    delete iter;
+    f->list.Finish();
+    if (range_dels_ != NULL && --range_dels_->refs == 0) {
+      delete range_dels_;
+    }
+    range_dels_ = f;
+  }
+  range_dels_->refs++;
+  return range_dels_;
+}
+
+void MemTable::ReleaseRangeDeletions(FragmentedRangeDeletions* f) {
+  MutexLock l(&range_del_mu_);
+  if (--f->refs == 0) {
+    delete f;
+  }
 }
 
-bool MemTable::Get(const LookupKey& key, std::string* value, Status* s) {
+SequenceNumber MemTable::MaxCoveringRangeDeletion(
+    const LookupKey& key) {
+  const Slice ikey = key.internal_key();
+  const SequenceNumber snapshot =
+      DecodeFixed64(ikey.data() + ikey.size() - 8) >> 8;
+
+  Table::Iterator iter(&range_del_table_);
+  iter.SeekToFirst();
+  if (!iter.Valid()) {
+    return 0;  // The common case: no range deletions at all
+  }
+  FragmentedRangeDeletions* f = RefRangeDeletions();
+  const SequenceNumber result =
+      f->list.MaxCoveringSequence(key.user_key(), snapshot);
+  ReleaseRangeDeletions(f);
+  return result;
+}
+
+bool MemTable::Get(const LookupKey& key, std::string* value, Status* s,
+                   MergeContext* merge_context) {
+  // The newest range deletion covering the key hides older entries
+  const SequenceNumber range_del_seq = MaxCoveringRangeDeletion(key);
+
   Slice memkey = key.memtable_key();
   Table::Iterator iter(&table_);
   iter.Seek(memkey.data());
-  if (iter.Valid()) {
+  // Merge operands are followed by older entries of the same key
+  for (; iter.Valid(); iter.Next()) {
     // entry format is:
     //    klength  varint32
     //    userkey  char[klength]
@@ -124,19 +231,67 @@ bool MemTable::Get(const LookupKey& key, std::string* value, Status* s) {
     const char* key_ptr = GetVarint32Ptr(entry, entry+5, &key_length);
     if (comparator_.comparator.user_comparator()->Compare(
             Slice(key_ptr, key_length - 8),
-            key.user_key()) == 0) {
-      // Correct user key
-      const uint64_t tag = DecodeFixed64(key_ptr + key_length - 8);
-      switch (static_cast<ValueType>(tag & 0xff)) {
-        case kTypeValue: {
-          Slice v = GetLengthPrefixedSlice(key_ptr + key_length);
-          value->assign(v.data(), v.size());
-          return true;
-        }
-        case kTypeDeletion:
-          *s = Status::NotFound(Slice());
-          return true;
+            key.user_key()) != 0) {
+      break;
+    }
+    // Correct user key
+    const uint64_t tag = DecodeFixed64(key_ptr + key_length - 8);
+    if ((tag >> 8) < range_del_seq) {
+      *s = Status::NotFound(Slice());
+      return true;
+    }
+    switch (static_cast<ValueType>(tag & 0xff)) {
+      case kTypeValue: {
+        Slice v = GetLengthPrefixedSlice(key_ptr + key_length);
+        value->assign(v.data(), v.size());
+        return true;
       }
+      case kTypeDeletion:
+        *s = Status::NotFound(Slice());
+        return true;
+      case kTypeMerge:
+        merge_context->AddOlder(GetLengthPrefixedSlice(key_ptr + key_length));
+        break;
+      case kTypeRangeDeletion:
+        break;  // Not stored in table_
+    }
+  }
+  if (range_del_seq > 0) {
+    // Older entries in other memtables and tables are deleted too
+    *s = Status::NotFound(Slice());
+    return true;
+  }
+  return false;
+}
+
+bool MemTable::OverlapsRange(const Slice& smallest_user_key,
+                             const Slice& largest_user_key) {
+  const Comparator* ucmp = comparator_.comparator.user_comparator();
+  LookupKey start(smallest_user_key, kMaxSequenceNumber);
+  Table::Iterator iter(&table_);
+  iter.Seek(start.memtable_key().data());
+  if (iter.Valid()) {
+    const char* entry = iter.key();
+    uint32_t key_length;
+    const char* key_ptr = GetVarint32Ptr(entry, entry+5, &key_length);
+    if (ucmp->Compare(Slice(key_ptr, key_length - 8),
+                      largest_user_key) <= 0) {
+      return true;
+    }
+  }
+
+  Table::Iterator range_iter(&range_del_table_);
+  for (range_iter.SeekToFirst(); range_iter.Valid(); range_iter.Next()) {
+    const char* entry = range_iter.key();
+    uint32_t key_length;
+    const char* key_ptr = GetVarint32Ptr(entry, entry+5, &key_length);
+    if (ucmp->Compare(Slice(key_ptr, key_length - 8),
+                      largest_user_key) > 0) {
+      break;  // Begins after the range, and so do the rest
+    }
+    if (ucmp->Compare(smallest_user_key,
+                      GetLengthPrefixedSlice(key_ptr + key_length)) < 0) {
+      return true;
     }
   }
   return false;
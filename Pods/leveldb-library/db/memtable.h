@@ -9,6 +9,7 @@
 #include "leveldb/db.h"
 #include "db/dbformat.h"
 #include "db/skiplist.h"
+#include "port/port.h"
 #include "util/arena.h"
 
 namespace leveldb {
@@ -16,6 +17,7 @@ namespace leveldb {
 class InternalKeyComparator;
 class Mutex;
 class MemTableIterator;
+class MergeContext;
 
 class MemTable {
  public:
@@ -47,22 +49,69 @@ class MemTable {
   // db/format.{h,cc} module.
   Iterator* NewIterator();
 
+  // Return an iterator over the range deletions in the memtable, which
+  // are kept apart from the entries yielded by NewIterator().  Its keys
+  // are the internal keys of the beginnings of the ranges, and its values
+  // the (exclusive) ends.  The same liveness rule applies.
+  Iterator* NewRangeDeletionIterator();
+
   // Add an entry into memtable that maps key to value at the
   // specified sequence number and with the specified type.
-  // Typically value will be empty if type==kTypeDeletion.
+  // Typically value will be empty if type==kTypeDeletion.  If
+  // type==kTypeRangeDeletion, key and value are the beginning and the
+  // (exclusive) end of the deleted range.
   void Add(SequenceNumber seq, ValueType type,
            const Slice& key,
            const Slice& value);
 
+  // Like Add(), but may be called by several threads at the same time,
+  // as long as no call to Add() overlaps with them.  "*rnd" must not be
+  // shared with other threads.
+  void AddConcurrently(SequenceNumber seq, ValueType type,
+                       const Slice& key, const Slice& value, Random* rnd);
+
   // If memtable contains a value for key, store it in *value and return true.
-  // If memtable contains a deletion for key, store a NotFound() error
-  // in *status and return true.
+  // If memtable contains a deletion for key, or a range deletion covering
+  // key that is newer than any value, store a NotFound() error in
+  // *status and return true.
   // Else, return false.
-  bool Get(const LookupKey& key, std::string* value, Status* s);
+  // Merge operands newer than the value or deletion are added to
+  // *merge_context, which then has to be applied to the result.
+  bool Get(const LookupKey& key, std::string* value, Status* s,
+           MergeContext* merge_context);
+
+  // Returns true if the memtable holds an entry whose user key lies in
+  // [smallest_user_key, largest_user_key], or a range deletion that
+  // overlaps that range.
+  bool OverlapsRange(const Slice& smallest_user_key,
+                     const Slice& largest_user_key);
 
  private:
   ~MemTable();  // Private since only Unref() should be used to delete it
 
+  // Returns the sequence number of the newest range deletion in the
+  // memtable that covers the user key of "key" and is visible at its
+  // sequence number, or 0 if there is none.
+  SequenceNumber MaxCoveringRangeDeletion(const LookupKey& key);
+
+  // The range deletions of range_del_table_, split into fragments.
+  struct FragmentedRangeDeletions;
+
+  // Returns a reference to fragments that hold at least every range
+  // deletion added so far, rebuilding them if one was added since they
+  // were last built.  The caller must pass the result to
+  // ReleaseRangeDeletions().
+  FragmentedRangeDeletions* RefRangeDeletions();
+  void ReleaseRangeDeletions(FragmentedRangeDeletions* f);
+
+  // Called after a range deletion is added to range_del_table_.
+  void RecordRangeDeletionAdded();
+
+  // Encode an entry into "buf", which must hold EncodedLength() bytes.
+  static size_t EncodedLength(const Slice& key, const Slice& value);
+  static void EncodeEntry(char* buf, SequenceNumber seq, ValueType type,
+                          const Slice& key, const Slice& value);
+
   struct KeyComparator {
     const InternalKeyComparator comparator;
     explicit KeyComparator(const InternalKeyComparator& c) : comparator(c) { }
@@ -77,6 +126,11 @@ class MemTable {
   int refs_;
   Arena arena_;
   Table table_;
+  Table range_del_table_;  // Range deletions, encoded like table_ entries
+
+  port::Mutex range_del_mu_;
+  size_t num_range_dels_;  // Added to range_del_table_ so far
+  FragmentedRangeDeletions* range_dels_;  // NULL until first needed
 
   // No copying allowed
   MemTable(const MemTable&);
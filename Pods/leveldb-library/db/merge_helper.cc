@@ -0,0 +1,127 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "db/merge_helper.h"
+
+#include "db/range_del.h"
+#include "leveldb/comparator.h"
+#include "leveldb/iterator.h"
+#include "leveldb/merge_operator.h"
+
+namespace leveldb {
+
+Status MergeContext::Merge(const MergeOperator* merge_operator,
+                           Logger* logger,
+                           const Slice& user_key,
+                           const Slice* existing_value,
+                           std::string* result) const {
+  if (merge_operator == NULL) {
+    return Status::NotSupported("merge operand found without a merge operator",
+                                user_key);
+  }
+  std::vector<Slice> operands;
+  operands.reserve(operands_.size());
+  for (size_t i = 0; i < operands_.size(); i++) {
+    operands.push_back(operands_[i]);
+  }
+  std::string merged;
+  if (!merge_operator->FullMerge(user_key, existing_value, operands, &merged,
+                                 logger)) {
+    return Status::Corruption("merge failed for ", user_key);
+  }
+  result->swap(merged);
+  return Status::OK();
+}
+
+Status MergeHelper::MergeUntil(Iterator* iter,
+                               SequenceNumber smallest_snapshot,
+                               const RangeTombstoneList* range_dels,
+                               bool bottommost) {
+  keys_.clear();
+  values_.clear();
+  ParsedInternalKey ikey;
+  if (!ParseInternalKey(iter->key(), &ikey)) {
+    return Status::Corruption("corrupted merge operand");
+  }
+  assert(ikey.type == kTypeMerge);
+  assert(ikey.sequence <= smallest_snapshot);
+  const std::string user_key = ikey.user_key.ToString();
+  const SequenceNumber sequence = ikey.sequence;
+
+  // Gather the operands down to the first older value or deletion.  Older
+  // entries are hidden by the result, so the caller drops them.
+  bool found_base = false;
+  bool corrupted = false;
+  bool has_value = false;
+  std::string existing_value;
+  do {
+    keys_.push_back(iter->key().ToString());
+    values_.push_back(iter->value().ToString());
+    iter->Next();
+    if (!iter->Valid()) {
+      break;
+    }
+    if (!ParseInternalKey(iter->key(), &ikey)) {
+      corrupted = true;
+      break;
+    }
+    if (user_comparator_->Compare(ikey.user_key, user_key) != 0) {
+      break;
+    }
+    if (range_dels != NULL &&
+        range_dels->MaxCoveringSequence(ikey.user_key, smallest_snapshot) >
+        ikey.sequence) {
+      found_base = true;  // Deleted by a range deletion
+    } else if (ikey.type != kTypeMerge) {
+      found_base = true;
+      if (ikey.type == kTypeValue) {
+        existing_value.assign(iter->value().data(), iter->value().size());
+        has_value = true;
+      }
+    }
+  } while (!found_base);
+  if (found_base) {
+    iter->Next();
+  } else if (bottommost && !corrupted) {
+    found_base = true;  // No older entries anywhere
+  }
+
+  if (found_base) {
+    MergeContext context;
+    for (size_t i = 0; i < values_.size(); i++) {
+      context.AddOlder(values_[i]);
+    }
+    const Slice existing(existing_value);
+    std::string merged;
+    Status s = context.Merge(merge_operator_, logger_, user_key,
+                             has_value ? &existing : NULL, &merged);
+    if (!s.ok()) {
+      return s;
+    }
+    keys_.resize(1);
+    keys_[0].clear();
+    AppendInternalKey(&keys_[0],
+                      ParsedInternalKey(user_key, sequence, kTypeValue));
+    values_.resize(1);
+    values_[0].swap(merged);
+  } else if (values_.size() > 1) {
+    // The value the operands apply to is not known: try to fold them
+    // into one operand, from the oldest to the newest
+    std::string combined = values_.back();
+    for (size_t i = values_.size() - 1; i > 0; i--) {
+      std::string next;
+      if (!merge_operator_->PartialMerge(user_key, combined, values_[i - 1],
+                                         &next, logger_)) {
+        return Status::OK();  // Keep the operands as they are
+      }
+      combined.swap(next);
+    }
+    keys_.resize(1);
+    values_.resize(1);
+    values_[0].swap(combined);
+  }
+  return Status::OK();
+}
+
+}  // namespace leveldb
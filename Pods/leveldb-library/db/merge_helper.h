@@ -0,0 +1,104 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// A merge operand is stored as an entry of type kTypeMerge.  Reads
+// gather the operands of a key, newest first, down to the value (or
+// deletion) they apply to, and combine them with the MergeOperator of
+// the database.  Compactions combine the operands that every snapshot
+// sees, fully when the value they apply to is known and pairwise
+// otherwise.
+
+#ifndef STORAGE_LEVELDB_DB_MERGE_HELPER_H_
+#define STORAGE_LEVELDB_DB_MERGE_HELPER_H_
+
+#include <deque>
+#include <string>
+#include <vector>
+#include "db/dbformat.h"
+#include "leveldb/slice.h"
+#include "leveldb/status.h"
+
+namespace leveldb {
+
+class Comparator;
+class Iterator;
+class Logger;
+class MergeOperator;
+class RangeTombstoneList;
+
+// The merge operands found for one user key.
+class MergeContext {
+ public:
+  MergeContext() { }
+
+  bool empty() const { return operands_.empty(); }
+  void Clear() { operands_.clear(); }
+
+  // Add an operand that is older than all the operands added so far
+  void AddOlder(const Slice& operand) {
+    operands_.push_front(operand.ToString());
+  }
+
+  // Add an operand that is newer than all the operands added so far
+  void AddNewer(const Slice& operand) {
+    operands_.push_back(operand.ToString());
+  }
+
+  // Store in "*result" the value of "user_key" obtained by applying the
+  // operands to "existing_value", or to no value if it is NULL.
+  // "existing_value" may point into "*result".
+  Status Merge(const MergeOperator* merge_operator, Logger* logger,
+               const Slice& user_key, const Slice* existing_value,
+               std::string* result) const;
+
+ private:
+  std::deque<std::string> operands_;  // Oldest first
+
+  // No copying allowed
+  MergeContext(const MergeContext&);
+  void operator=(const MergeContext&);
+};
+
+// Combines merge operands during a compaction.
+class MergeHelper {
+ public:
+  MergeHelper(const Comparator* user_comparator,
+              const MergeOperator* merge_operator,
+              Logger* logger)
+      : user_comparator_(user_comparator),
+        merge_operator_(merge_operator),
+        logger_(logger) {
+  }
+
+  // "iter" is positioned at a merge operand that every snapshot sees,
+  // that is, whose sequence number is at most "smallest_snapshot".
+  // Advance "iter" past the operand and the older entries of the same
+  // user key that it can be combined with, and store the entries that
+  // replace them, newest first, in keys() and values().  The operands
+  // are applied to the first value or deletion found, or to no value if
+  // "bottommost" is true and no older entry is found.  "range_dels",
+  // if non-NULL, holds the range deletions of the compaction.
+  //
+  // Returns a non-ok status if the merge operator fails.
+  Status MergeUntil(Iterator* iter, SequenceNumber smallest_snapshot,
+                    const RangeTombstoneList* range_dels, bool bottommost);
+
+  const std::vector<std::string>& keys() const { return keys_; }
+  const std::vector<std::string>& values() const { return values_; }
+
+ private:
+  const Comparator* const user_comparator_;
+  const MergeOperator* const merge_operator_;
+  Logger* const logger_;
+  std::vector<std::string> keys_;    // Newest first
+  std::vector<std::string> values_;
+
+  // No copying allowed
+  MergeHelper(const MergeHelper&);
+  void operator=(const MergeHelper&);
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_DB_MERGE_HELPER_H_
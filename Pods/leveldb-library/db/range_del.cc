@@ -0,0 +1,152 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "db/range_del.h"
+
+#include <algorithm>
+#include <functional>
+#include "leveldb/comparator.h"
+#include "leveldb/iterator.h"
+
+namespace leveldb {
+
+namespace {
+struct BoundLess {
+  const Comparator* ucmp;
+  explicit BoundLess(const Comparator* c) : ucmp(c) { }
+  bool operator()(const std::string& a, const std::string& b) const {
+    return ucmp->Compare(a, b) < 0;
+  }
+};
+
+struct BoundEqual {
+  const Comparator* ucmp;
+  explicit BoundEqual(const Comparator* c) : ucmp(c) { }
+  bool operator()(const std::string& a, const std::string& b) const {
+    return ucmp->Compare(a, b) == 0;
+  }
+};
+}  // namespace
+
+RangeTombstoneList::RangeTombstoneList(const Comparator* user_comparator)
+    : ucmp_(user_comparator),
+      finished_(false) {
+}
+
+void RangeTombstoneList::Add(const Slice& begin, const Slice& end,
+                             SequenceNumber seq) {
+  assert(!finished_);
+  if (ucmp_->Compare(begin, end) >= 0) {
+    return;
+  }
+  tombstones_.resize(tombstones_.size() + 1);
+  Tombstone* t = &tombstones_.back();
+  t->begin.assign(begin.data(), begin.size());
+  t->end.assign(end.data(), end.size());
+  t->sequence = seq;
+}
+
+Status RangeTombstoneList::AddEntries(Iterator* iter,
+                                      SequenceNumber snapshot) {
+  ParsedInternalKey ikey;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    if (!ParseInternalKey(iter->key(), &ikey) ||
+        ikey.type != kTypeRangeDeletion) {
+      return Status::Corruption("corrupted range deletion");
+    }
+    if (ikey.sequence <= snapshot) {
+      Add(ikey.user_key, iter->value(), ikey.sequence);
+    }
+  }
+  return iter->status();
+}
+
+void RangeTombstoneList::AddList(const RangeTombstoneList& list,
+                                 SequenceNumber snapshot) {
+  assert(!finished_);
+  for (size_t i = 0; i < list.tombstones_.size(); i++) {
+    if (list.tombstones_[i].sequence <= snapshot) {
+      tombstones_.push_back(list.tombstones_[i]);
+    }
+  }
+}
+
+void RangeTombstoneList::Finish() {
+  assert(!finished_);
+  finished_ = true;
+  if (tombstones_.empty()) {
+    return;
+  }
+
+  // Every beginning and end of a range deletion is a fragment boundary
+  for (size_t i = 0; i < tombstones_.size(); i++) {
+    bounds_.push_back(tombstones_[i].begin);
+    bounds_.push_back(tombstones_[i].end);
+  }
+  std::sort(bounds_.begin(), bounds_.end(), BoundLess(ucmp_));
+  bounds_.erase(std::unique(bounds_.begin(), bounds_.end(),
+                            BoundEqual(ucmp_)),
+                bounds_.end());
+
+  // bounds_ no longer changes, so the fragments may point into it
+  std::vector<Fragment> all(bounds_.size() - 1);
+  for (size_t i = 0; i + 1 < bounds_.size(); i++) {
+    all[i].begin = bounds_[i];
+    all[i].end = bounds_[i + 1];
+  }
+  for (size_t i = 0; i < tombstones_.size(); i++) {
+    const Tombstone& t = tombstones_[i];
+    size_t f = std::lower_bound(bounds_.begin(), bounds_.end(), t.begin,
+                                BoundLess(ucmp_)) - bounds_.begin();
+    for (; ucmp_->Compare(bounds_[f], t.end) < 0; f++) {
+      all[f].sequences.push_back(t.sequence);
+    }
+  }
+  for (size_t i = 0; i < all.size(); i++) {
+    std::vector<SequenceNumber>* seqs = &all[i].sequences;
+    if (seqs->empty()) {
+      continue;  // A gap between range deletions
+    }
+    std::sort(seqs->begin(), seqs->end(), std::greater<SequenceNumber>());
+    seqs->erase(std::unique(seqs->begin(), seqs->end()), seqs->end());
+    fragments_.push_back(Fragment());
+    fragments_.back().begin = all[i].begin;
+    fragments_.back().end = all[i].end;
+    fragments_.back().sequences.swap(*seqs);
+  }
+}
+
+size_t RangeTombstoneList::FindFragment(const Slice& user_key) const {
+  assert(finished_);
+  // Binary search for the first fragment whose end is after user_key
+  size_t left = 0;
+  size_t right = fragments_.size();
+  while (left < right) {
+    const size_t mid = (left + right) / 2;
+    if (ucmp_->Compare(fragments_[mid].end, user_key) <= 0) {
+      left = mid + 1;
+    } else {
+      right = mid;
+    }
+  }
+  return right;
+}
+
+SequenceNumber RangeTombstoneList::MaxCoveringSequence(
+    const Slice& user_key, SequenceNumber snapshot) const {
+  const size_t index = FindFragment(user_key);
+  if (index == fragments_.size() ||
+      ucmp_->Compare(fragments_[index].begin, user_key) > 0) {
+    return 0;
+  }
+  const std::vector<SequenceNumber>& seqs = fragments_[index].sequences;
+  for (size_t i = 0; i < seqs.size(); i++) {
+    if (seqs[i] <= snapshot) {
+      return seqs[i];
+    }
+  }
+  return 0;
+}
+
+}  // namespace leveldb
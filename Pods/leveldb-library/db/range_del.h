@@ -0,0 +1,100 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// A range deletion (or range tombstone) erases every entry whose user key
+// lies in [begin, end) and whose sequence number is smaller than its own.
+// It is stored as an entry with internal key (begin, sequence,
+// kTypeRangeDeletion) and value "end", apart from the other entries: in
+// a second skiplist of each memtable, and in a meta block of each table.
+
+#ifndef STORAGE_LEVELDB_DB_RANGE_DEL_H_
+#define STORAGE_LEVELDB_DB_RANGE_DEL_H_
+
+#include <string>
+#include <vector>
+#include "db/dbformat.h"
+#include "leveldb/slice.h"
+#include "leveldb/status.h"
+
+namespace leveldb {
+
+class Comparator;
+class Iterator;
+
+// A set of range deletions, split into non-overlapping fragments so that
+// the deletions covering a user key are found with a binary search.
+//
+// Add*() and Finish() require external synchronization; once Finish()
+// has been called, the const methods may be called by several threads.
+class RangeTombstoneList {
+ public:
+  // A fragment covers the user keys in [begin, end).  "sequences" holds
+  // the sequence numbers of the range deletions that cover the fragment,
+  // in decreasing order.
+  struct Fragment {
+    Slice begin;
+    Slice end;
+    std::vector<SequenceNumber> sequences;
+  };
+
+  explicit RangeTombstoneList(const Comparator* user_comparator);
+
+  // Add the range deletion of [begin, end) at sequence number "seq".
+  // Empty ranges are ignored.
+  // REQUIRES: Finish() has not been called
+  void Add(const Slice& begin, const Slice& end, SequenceNumber seq);
+
+  // Add the range deletion entries yielded by "iter" (see above) whose
+  // sequence numbers are at most "snapshot".  Returns a non-ok status if
+  // an entry cannot be parsed or the iterator fails.
+  // REQUIRES: Finish() has not been called
+  Status AddEntries(Iterator* iter, SequenceNumber snapshot);
+
+  // Like AddEntries() for the range deletions in "*list".
+  // REQUIRES: Finish() has not been called
+  void AddList(const RangeTombstoneList& list, SequenceNumber snapshot);
+
+  // Split the range deletions into fragments.
+  void Finish();
+
+  bool empty() const { return tombstones_.empty(); }
+
+  // Returns the sequence number of the newest range deletion with a
+  // sequence number of at most "snapshot" that covers "user_key", or 0
+  // if there is none.
+  // REQUIRES: Finish() has been called
+  SequenceNumber MaxCoveringSequence(const Slice& user_key,
+                                     SequenceNumber snapshot) const;
+
+  // The fragments in increasing key order.  Only fragments covered by
+  // some range deletion are kept.
+  // REQUIRES: Finish() has been called
+  const std::vector<Fragment>& fragments() const { return fragments_; }
+
+  // Returns the index of the first fragment that ends after "user_key",
+  // or fragments().size() if there is none.
+  // REQUIRES: Finish() has been called
+  size_t FindFragment(const Slice& user_key) const;
+
+ private:
+  struct Tombstone {
+    std::string begin;
+    std::string end;
+    SequenceNumber sequence;
+  };
+
+  const Comparator* const ucmp_;
+  std::vector<Tombstone> tombstones_;
+  std::vector<std::string> bounds_;  // Fragment boundaries, sorted
+  std::vector<Fragment> fragments_;  // Point into bounds_
+  bool finished_;
+
+  // No copying allowed
+  RangeTombstoneList(const RangeTombstoneList&);
+  void operator=(const RangeTombstoneList&);
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_DB_RANGE_DEL_H_
@@ -49,7 +49,9 @@ class Repairer {
         env_(options.env),
         icmp_(options.comparator),
         ipolicy_(options.filter_policy),
-        options_(SanitizeOptions(dbname, &icmp_, &ipolicy_, options)),
+        iprefix_(options.prefix_extractor),
+        options_(SanitizeOptions(dbname, &icmp_, &ipolicy_, &iprefix_,
+                                 options)),
         owns_info_log_(options_.info_log != options.info_log),
         owns_cache_(options_.block_cache != options.block_cache),
         next_file_number_(1) {
@@ -101,6 +103,7 @@ class Repairer {
   Env* const env_;
   InternalKeyComparator const icmp_;
   InternalFilterPolicy const ipolicy_;
+  InternalKeySliceTransform const iprefix_;
   Options const options_;
   bool owns_info_log_;
   bool owns_cache_;
@@ -224,8 +227,11 @@ class Repairer {
     FileMetaData meta;
     meta.number = next_file_number_++;
     Iterator* iter = mem->NewIterator();
-    status = BuildTable(dbname_, env_, options_, table_cache_, iter, &meta);
+    Iterator* range_del_iter = mem->NewRangeDeletionIterator();
+    status = BuildTable(dbname_, env_, options_, table_cache_, iter,
+                        range_del_iter, &meta);
     delete iter;
+    delete range_del_iter;
     mem->Unref();
     mem = NULL;
     if (status.ok()) {
@@ -252,7 +258,7 @@ class Repairer {
     // on checksum verification.
     ReadOptions r;
     r.verify_checksums = options_.paranoid_checks;
-    return table_cache_->NewIterator(r, meta.number, meta.file_size);
+    return table_cache_->NewIterator(r, meta.number, meta.file_size, -1);
   }
 
   void ScanTable(uint64_t number) {
@@ -306,6 +312,49 @@ class Repairer {
       status = iter->status();
     }
     delete iter;
+
+    // The range deletions widen the key range of the table
+    iter = table_cache_->NewRangeDeletionIterator(t.meta.number,
+                                                  t.meta.file_size, -1);
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+      Slice key = iter->key();
+      if (!ParseInternalKey(key, &parsed) ||
+          parsed.type != kTypeRangeDeletion) {
+        Log(options_.info_log, "Table #%llu: unparsable range deletion %s",
+            (unsigned long long) t.meta.number,
+            EscapeString(key).c_str());
+        continue;
+      }
+      if (icmp_.user_comparator()->Compare(parsed.user_key,
+                                           iter->value()) >= 0) {
+        continue;  // Empty range
+      }
+
+      counter++;
+      InternalKey begin, end(iter->value(), kMaxSequenceNumber,
+                             kValueTypeForSeek);
+      begin.DecodeFrom(key);
+      if (empty) {
+        empty = false;
+        t.meta.smallest = begin;
+        t.meta.largest = end;
+      } else {
+        if (icmp_.Compare(begin, t.meta.smallest) < 0) {
+          t.meta.smallest = begin;
+        }
+        if (icmp_.Compare(end, t.meta.largest) > 0) {
+          t.meta.largest = end;
+        }
+      }
+      t.meta.has_range_deletions = true;
+      if (parsed.sequence > t.max_sequence) {
+        t.max_sequence = parsed.sequence;
+      }
+    }
+    if (!iter->status().ok()) {
+      status = iter->status();
+    }
+    delete iter;
     Log(options_.info_log, "Table #%llu: %d entries %s",
         (unsigned long long) t.meta.number,
         counter,
@@ -339,6 +388,15 @@ class Repairer {
       counter++;
     }
     delete iter;
+    if (t.meta.has_range_deletions) {
+      iter = table_cache_->NewRangeDeletionIterator(t.meta.number,
+                                                    t.meta.file_size, -1);
+      for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+        builder->AddRangeDeletion(iter->key(), iter->value());
+        counter++;
+      }
+      delete iter;
+    }
 
     ArchiveFile(src);
     if (counter == 0) {
@@ -396,7 +454,8 @@ class Repairer {
       // TODO(opt): separate out into multiple levels
       const TableInfo& t = tables_[i];
       edit_.AddFile(0, t.meta.number, t.meta.file_size,
-                    t.meta.smallest, t.meta.largest);
+                    t.meta.smallest, t.meta.largest,
+                    t.meta.has_range_deletions);
     }
 
     //fprintf(stderr, "NewDescriptor:\n%s\n", edit_.DebugString().c_str());
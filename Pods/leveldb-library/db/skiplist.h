@@ -9,6 +9,9 @@
 // -------------
 //
 // Writes require external synchronization, most likely a mutex.
+// The exception is InsertConcurrently(), which may be called by several
+// threads at once; it links new nodes with compare-and-swap and must
+// not overlap with Insert().
 // Reads require a guarantee that the SkipList will not be destroyed
 // while the read is in progress.  Apart from that, reads progress
 // without any internal locking or synchronization.
@@ -52,6 +55,12 @@ class SkipList {
   // REQUIRES: nothing that compares equal to key is currently in the list.
   void Insert(const Key& key);
 
+  // Like Insert(), but may run concurrently with other calls to
+  // InsertConcurrently().  "*rnd" picks the height of the new node and
+  // must not be shared with other threads.
+  // REQUIRES: nothing that compares equal to key is currently in the list.
+  void InsertConcurrently(const Key& key, Random* rnd);
+
   // Returns true iff an entry that compares equal to key is in the list.
   bool Contains(const Key& key) const;
 
@@ -115,13 +124,19 @@ class SkipList {
   // Read/written only by Insert().
   Random rnd_;
 
-  Node* NewNode(const Key& key, int height);
-  int RandomHeight();
+  Node* NewNode(const Key& key, int height, bool concurrent = false);
+  int RandomHeight(Random* rnd);
   bool Equal(const Key& a, const Key& b) const { return (compare_(a, b) == 0); }
 
   // Return true if key is greater than the data stored in "n"
   bool KeyIsAfterNode(const Key& key, Node* n) const;
 
+  // Starting at "before", which comes before key, find the adjacent
+  // nodes *prev < key <= *next at "level".  The search stops early at
+  // "after" if it is reached.
+  void FindSpliceForLevel(const Key& key, Node* before, Node* after,
+                          int level, Node** prev, Node** next) const;
+
   // Return the earliest node that comes at or after key.
   // Return NULL if there is no such node.
   //
@@ -174,6 +189,13 @@ struct SkipList<Key,Comparator>::Node {
     next_[n].NoBarrier_Store(x);
   }
 
+  // Link "x" after this node at level "n" if the link still points to
+  // "expected".  The full barrier publishes the contents of "x".
+  bool CASNext(int n, Node* expected, Node* x) {
+    assert(n >= 0);
+    return next_[n].CompareAndSwap(expected, x);
+  }
+
  private:
   // Array of length equal to the node height.  next_[0] is lowest level link.
   port::AtomicPointer next_[1];
@@ -181,9 +203,11 @@ struct SkipList<Key,Comparator>::Node {
 
 template<typename Key, class Comparator>
 typename SkipList<Key,Comparator>::Node*
-SkipList<Key,Comparator>::NewNode(const Key& key, int height) {
-  char* mem = arena_->AllocateAligned(
-      sizeof(Node) + sizeof(port::AtomicPointer) * (height - 1));
+SkipList<Key,Comparator>::NewNode(const Key& key, int height,
+                                  bool concurrent) {
+  const size_t size = sizeof(Node) + sizeof(port::AtomicPointer) * (height - 1);
+  char* mem = concurrent ? arena_->AllocateAlignedConcurrently(size)
+                         : arena_->AllocateAligned(size);
   return new (mem) Node(key);
 }
 
@@ -240,11 +264,11 @@ inline void SkipList<Key,Comparator>::Iterator::SeekToLast() {
 }
 
 template<typename Key, class Comparator>
-int SkipList<Key,Comparator>::RandomHeight() {
+int SkipList<Key,Comparator>::RandomHeight(Random* rnd) {
   // Increase height with probability 1 in kBranching
   static const unsigned int kBranching = 4;
   int height = 1;
-  while (height < kMaxHeight && ((rnd_.Next() % kBranching) == 0)) {
+  while (height < kMaxHeight && ((rnd->Next() % kBranching) == 0)) {
     height++;
   }
   assert(height > 0);
@@ -280,6 +304,22 @@ typename SkipList<Key,Comparator>::Node* SkipList<Key,Comparator>::FindGreaterOr
   }
 }
 
+template<typename Key, class Comparator>
+void SkipList<Key,Comparator>::FindSpliceForLevel(const Key& key,
+                                                  Node* before, Node* after,
+                                                  int level, Node** prev,
+                                                  Node** next) const {
+  while (true) {
+    Node* x = before->Next(level);
+    if (x == after || !KeyIsAfterNode(key, x)) {
+      *prev = before;
+      *next = x;
+      return;
+    }
+    before = x;
+  }
+}
+
 template<typename Key, class Comparator>
 typename SkipList<Key,Comparator>::Node*
 SkipList<Key,Comparator>::FindLessThan(const Key& key) const {
@@ -343,7 +383,7 @@ void SkipList<Key,Comparator>::Insert(const Key& key) {
   // Our data structure does not allow duplicate insertion
   assert(x == NULL || !Equal(key, x->key));
 
-  int height = RandomHeight();
+  int height = RandomHeight(&rnd_);
   if (height > GetMaxHeight()) {
     for (int i = GetMaxHeight(); i < height; i++) {
       prev[i] = head_;
@@ -369,6 +409,53 @@ void SkipList<Key,Comparator>::Insert(const Key& key) {
   }
 }
 
+template<typename Key, class Comparator>
+void SkipList<Key,Comparator>::InsertConcurrently(const Key& key,
+                                                  Random* rnd) {
+  const int height = RandomHeight(rnd);
+
+  // Raise max_height_ first, so that the search below starts from a
+  // level that includes the new node.  Concurrent readers cope with a
+  // raised height as explained in Insert().
+  int max_height = GetMaxHeight();
+  while (height > max_height) {
+    if (max_height_.CompareAndSwap(reinterpret_cast<void*>(max_height),
+                                   reinterpret_cast<void*>(height))) {
+      max_height = height;
+      break;
+    }
+    max_height = GetMaxHeight();
+  }
+
+  // prev[i] < key <= next[i] at every level i.  The search for each
+  // level starts from the splice found one level up.
+  Node* prev[kMaxHeight + 1];
+  Node* next[kMaxHeight + 1];
+  prev[max_height] = head_;
+  next[max_height] = NULL;
+  for (int i = max_height - 1; i >= 0; i--) {
+    FindSpliceForLevel(key, prev[i + 1], next[i + 1], i, &prev[i], &next[i]);
+  }
+
+  // Our data structure does not allow duplicate insertion
+  assert(next[0] == NULL || !Equal(key, next[0]->key));
+
+  // Link the node bottom-up, so that it is reachable at level 0 before
+  // any higher level.  If another thread linked a node into the same
+  // gap first, the CAS fails and we search again from prev[i], which
+  // still comes before key since nodes are never removed.
+  Node* x = NewNode(key, height, true);
+  for (int i = 0; i < height; i++) {
+    while (true) {
+      x->NoBarrier_SetNext(i, next[i]);
+      if (prev[i]->CASNext(i, next[i], x)) {
+        break;
+      }
+      FindSpliceForLevel(key, prev[i], NULL, i, &prev[i], &next[i]);
+    }
+  }
+}
+
 template<typename Key, class Comparator>
 bool SkipList<Key,Comparator>::Contains(const Key& key) const {
   Node* x = FindGreaterOrEqual(key, NULL);
@@ -0,0 +1,172 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "db/skiplist.h"
+#include <set>
+#include <vector>
+#include "leveldb/env.h"
+#include "port/port.h"
+#include "util/arena.h"
+#include "util/mutexlock.h"
+#include "util/random.h"
+#include "util/testharness.h"
+
+namespace leveldb {
+
+typedef uint64_t Key;
+
+struct Comparator {
+  int operator()(const Key& a, const Key& b) const {
+    if (a < b) {
+      return -1;
+    } else if (a > b) {
+      return +1;
+    } else {
+      return 0;
+    }
+  }
+};
+
+class SkipTest { };
+
+TEST(SkipTest, Empty) {
+  Arena arena;
+  Comparator cmp;
+  SkipList<Key, Comparator> list(cmp, &arena);
+  ASSERT_TRUE(!list.Contains(10));
+
+  SkipList<Key, Comparator>::Iterator iter(&list);
+  ASSERT_TRUE(!iter.Valid());
+  iter.SeekToFirst();
+  ASSERT_TRUE(!iter.Valid());
+  iter.Seek(100);
+  ASSERT_TRUE(!iter.Valid());
+  iter.SeekToLast();
+  ASSERT_TRUE(!iter.Valid());
+}
+
+TEST(SkipTest, InsertAndLookup) {
+  const int N = 2000;
+  const int R = 5000;
+  Random rnd(1000);
+  std::set<Key> keys;
+  Arena arena;
+  Comparator cmp;
+  SkipList<Key, Comparator> list(cmp, &arena);
+  for (int i = 0; i < N; i++) {
+    Key key = rnd.Next() % R;
+    if (keys.insert(key).second) {
+      list.Insert(key);
+    }
+  }
+
+  for (int i = 0; i < R; i++) {
+    if (list.Contains(i)) {
+      ASSERT_EQ(keys.count(i), 1);
+    } else {
+      ASSERT_EQ(keys.count(i), 0);
+    }
+  }
+
+  // Forward iteration
+  SkipList<Key, Comparator>::Iterator iter(&list);
+  iter.SeekToFirst();
+  for (std::set<Key>::iterator model_iter = keys.begin();
+       model_iter != keys.end(); ++model_iter) {
+    ASSERT_TRUE(iter.Valid());
+    ASSERT_EQ(*model_iter, iter.key());
+    iter.Next();
+  }
+  ASSERT_TRUE(!iter.Valid());
+
+  // Backward iteration
+  iter.SeekToLast();
+  for (std::set<Key>::reverse_iterator model_iter = keys.rbegin();
+       model_iter != keys.rend(); ++model_iter) {
+    ASSERT_TRUE(iter.Valid());
+    ASSERT_EQ(*model_iter, iter.key());
+    iter.Prev();
+  }
+  ASSERT_TRUE(!iter.Valid());
+}
+
+// Several threads insert disjoint sets of keys with InsertConcurrently()
+// into the same list; afterwards every key must be present, in order.
+namespace {
+
+const int kConcurrentThreads = 8;
+const int kKeysPerThread = 20000;
+
+struct InsertState {
+  SkipList<Key, Comparator>* list;
+  port::Mutex mu;
+  port::CondVar cv;
+  int running;
+  InsertState() : cv(&mu), running(0) { }
+};
+
+struct InsertThread {
+  InsertState* state;
+  int id;
+};
+
+static void ConcurrentInsert(void* arg) {
+  InsertThread* t = reinterpret_cast<InsertThread*>(arg);
+  Random rnd(2000 + t->id);
+  // Interleave the threads' keys so that they splice into the same gaps
+  for (int i = 0; i < kKeysPerThread; i++) {
+    const Key key = static_cast<Key>(i) * kConcurrentThreads + t->id;
+    t->state->list->InsertConcurrently(key, &rnd);
+  }
+  MutexLock l(&t->state->mu);
+  t->state->running--;
+  t->state->cv.Signal();
+}
+
+}  // namespace
+
+TEST(SkipTest, ConcurrentInsert) {
+  for (int run = 0; run < 5; run++) {
+    Arena arena;
+    Comparator cmp;
+    SkipList<Key, Comparator> list(cmp, &arena);
+    InsertState state;
+    state.list = &list;
+    state.running = kConcurrentThreads;
+    InsertThread threads[kConcurrentThreads];
+    for (int i = 0; i < kConcurrentThreads; i++) {
+      threads[i].state = &state;
+      threads[i].id = i;
+      Env::Default()->StartThread(ConcurrentInsert, &threads[i]);
+    }
+    {
+      MutexLock l(&state.mu);
+      while (state.running > 0) {
+        state.cv.Wait();
+      }
+    }
+
+    const Key total = static_cast<Key>(kConcurrentThreads) * kKeysPerThread;
+    SkipList<Key, Comparator>::Iterator iter(&list);
+    iter.SeekToFirst();
+    for (Key k = 0; k < total; k++) {
+      ASSERT_TRUE(iter.Valid());
+      ASSERT_EQ(k, iter.key());
+      iter.Next();
+    }
+    ASSERT_TRUE(!iter.Valid());
+    for (Key k = 0; k < total; k += 97) {
+      ASSERT_TRUE(list.Contains(k));
+      iter.Seek(k);
+      ASSERT_TRUE(iter.Valid());
+      ASSERT_EQ(k, iter.key());
+    }
+  }
+}
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  return leveldb::test::RunAllTests();
+}
@@ -0,0 +1,129 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "leveldb/sst_file_writer.h"
+
+#include "db/dbformat.h"
+#include "leveldb/comparator.h"
+#include "leveldb/env.h"
+#include "leveldb/table_builder.h"
+
+namespace leveldb {
+
+// The file is a table in the format of the database's own tables.  Its
+// entries are values at sequence number 0; IngestExternalFile() gives
+// them the sequence number of the ingestion.
+struct SstFileWriter::Rep {
+  InternalKeyComparator internal_comparator;
+  InternalFilterPolicy internal_filter_policy;
+  InternalKeySliceTransform internal_prefix_extractor;
+  Options options;
+  std::string fname;
+  WritableFile* file;
+  TableBuilder* builder;
+  bool finished;
+  std::string last_key;      // User key of the last entry added
+  std::string internal_key;  // Scratch space for Put()
+
+  explicit Rep(const Options& opt)
+      : internal_comparator(opt.comparator),
+        internal_filter_policy(opt.filter_policy),
+        internal_prefix_extractor(opt.prefix_extractor),
+        options(opt),
+        file(NULL),
+        builder(NULL),
+        finished(false) {
+    options.comparator = &internal_comparator;
+    if (opt.filter_policy != NULL) {
+      options.filter_policy = &internal_filter_policy;
+    }
+    if (opt.prefix_extractor != NULL) {
+      options.prefix_extractor = &internal_prefix_extractor;
+    }
+  }
+};
+
+SstFileWriter::SstFileWriter(const Options& options)
+    : rep_(new Rep(options)) {
+}
+
+SstFileWriter::~SstFileWriter() {
+  Abandon();
+  delete rep_;
+}
+
+void SstFileWriter::Abandon() {
+  Rep* r = rep_;
+  if (r->builder != NULL) {
+    if (!r->finished) {
+      r->builder->Abandon();
+    }
+    delete r->builder;
+    r->builder = NULL;
+  }
+  if (r->file != NULL) {
+    r->file->Close();
+    delete r->file;
+    r->file = NULL;
+    r->options.env->DeleteFile(r->fname);
+  }
+}
+
+Status SstFileWriter::Open(const std::string& fname) {
+  Rep* r = rep_;
+  Abandon();
+  r->finished = false;
+  r->last_key.clear();
+  r->fname = fname;
+  Status s = r->options.env->NewWritableFile(fname, &r->file);
+  if (s.ok()) {
+    r->builder = new TableBuilder(r->options, r->file);
+  }
+  return s;
+}
+
+Status SstFileWriter::Put(const Slice& key, const Slice& value) {
+  Rep* r = rep_;
+  assert(r->builder != NULL && !r->finished);
+  if (r->builder->NumEntries() > 0 &&
+      r->internal_comparator.user_comparator()->Compare(key,
+                                                        r->last_key) <= 0) {
+    return Status::InvalidArgument("keys must be added in increasing order",
+                                   key);
+  }
+  r->internal_key.clear();
+  AppendInternalKey(&r->internal_key, ParsedInternalKey(key, 0, kTypeValue));
+  r->builder->Add(r->internal_key, value);
+  r->last_key.assign(key.data(), key.size());
+  return r->builder->status();
+}
+
+Status SstFileWriter::Finish() {
+  Rep* r = rep_;
+  assert(r->builder != NULL && !r->finished);
+  r->finished = true;
+  Status s = r->builder->Finish();
+  if (s.ok()) {
+    s = r->file->Sync();
+  }
+  if (s.ok()) {
+    s = r->file->Close();
+  }
+  delete r->file;
+  r->file = NULL;
+  if (!s.ok()) {
+    r->options.env->DeleteFile(r->fname);
+  }
+  return s;
+}
+
+uint64_t SstFileWriter::NumEntries() const {
+  return rep_->builder == NULL ? 0 : rep_->builder->NumEntries();
+}
+
+uint64_t SstFileWriter::FileSize() const {
+  return rep_->builder == NULL ? 0 : rep_->builder->FileSize();
+}
+
+}  // namespace leveldb
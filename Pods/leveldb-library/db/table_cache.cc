@@ -5,6 +5,7 @@
 #include "db/table_cache.h"
 
 #include "db/filename.h"
+#include "db/range_del.h"
 #include "leveldb/env.h"
 #include "leveldb/table.h"
 #include "util/coding.h"
@@ -14,10 +15,12 @@ namespace leveldb {
 struct TableAndFile {
   RandomAccessFile* file;
   Table* table;
+  RangeTombstoneList* range_dels;  // NULL if the table has none
 };
 
 static void DeleteEntry(const Slice& key, void* value) {
   TableAndFile* tf = reinterpret_cast<TableAndFile*>(value);
+  delete tf->range_dels;
   delete tf->table;
   delete tf->file;
   delete tf;
@@ -35,7 +38,8 @@ TableCache::TableCache(const std::string& dbname,
     : env_(options->env),
       dbname_(dbname),
       options_(options),
-      cache_(NewLRUCache(entries)) {
+      cache_(NewLRUCache(entries)),
+      row_cache_id_(options->row_cache ? options->row_cache->NewId() : 0) {
 }
 
 TableCache::~TableCache() {
@@ -43,7 +47,7 @@ TableCache::~TableCache() {
 }
 
 Status TableCache::FindTable(uint64_t file_number, uint64_t file_size,
-                             Cache::Handle** handle) {
+                             int level, Cache::Handle** handle) {
   Status s;
   char buf[sizeof(file_number)];
   EncodeFixed64(buf, file_number);
@@ -61,7 +65,31 @@ Status TableCache::FindTable(uint64_t file_number, uint64_t file_size,
       }
     }
     if (s.ok()) {
-      s = Table::Open(*options_, file, file_size, &table);
+      // Level-0 tables are consulted by every read, so their index and
+      // filter may be pinned in the block cache.
+      const bool pin_metadata =
+          options_->pin_l0_filter_and_index_blocks_in_cache && level == 0;
+      s = Table::Open(*options_, file, file_size, pin_metadata, &table);
+    }
+    RangeTombstoneList* range_dels = NULL;
+    if (s.ok()) {
+      // Split the range deletions of the table into fragments once, so
+      // that reads can look them up quickly
+      Iterator* iter = table->NewRangeDeletionIterator();
+      if (iter != NULL) {
+        // Tables of the DB are ordered by its InternalKeyComparator
+        const InternalKeyComparator* icmp =
+            static_cast<const InternalKeyComparator*>(options_->comparator);
+        range_dels = new RangeTombstoneList(icmp->user_comparator());
+        s = range_dels->AddEntries(iter, kMaxSequenceNumber);
+        range_dels->Finish();
+        delete iter;
+      }
+      if (!s.ok()) {
+        delete range_dels;
+        delete table;
+        table = NULL;
+      }
     }
 
     if (!s.ok()) {
@@ -73,6 +101,7 @@ Status TableCache::FindTable(uint64_t file_number, uint64_t file_size,
       TableAndFile* tf = new TableAndFile;
       tf->file = file;
       tf->table = table;
+      tf->range_dels = range_dels;
       *handle = cache_->Insert(key, tf, 1, &DeleteEntry);
     }
   }
@@ -82,13 +111,14 @@ Status TableCache::FindTable(uint64_t file_number, uint64_t file_size,
 Iterator* TableCache::NewIterator(const ReadOptions& options,
                                   uint64_t file_number,
                                   uint64_t file_size,
+                                  int level,
                                   Table** tableptr) {
   if (tableptr != NULL) {
     *tableptr = NULL;
   }
 
   Cache::Handle* handle = NULL;
-  Status s = FindTable(file_number, file_size, &handle);
+  Status s = FindTable(file_number, file_size, level, &handle);
   if (!s.ok()) {
     return NewErrorIterator(s);
   }
@@ -102,14 +132,90 @@ Iterator* TableCache::NewIterator(const ReadOptions& options,
   return result;
 }
 
+// A row cache entry holds what a lookup of the newest possible internal
+// key for a user key finds in a table file: the length prefixed internal
+// key of the first entry at or after it followed by its value, or nothing
+// if there is no such entry.  A lookup at sequence number "s" finds the
+// same entry unless the file has entries for the user key that are newer
+// than "s", in which case the cached entry is one of them.
+
+static void DeleteRow(const Slice& key, void* value) {
+  delete reinterpret_cast<std::string*>(value);
+}
+
+static void SaveRow(void* arg, const Slice& k, const Slice& v) {
+  std::string* row = reinterpret_cast<std::string*>(arg);
+  PutLengthPrefixedSlice(row, k);
+  row->append(v.data(), v.size());
+}
+
 Status TableCache::Get(const ReadOptions& options,
                        uint64_t file_number,
                        uint64_t file_size,
+                       int level,
                        const Slice& k,
                        void* arg,
                        void (*saver)(void*, const Slice&, const Slice&)) {
+  Cache* row_cache = options_->row_cache;
+  if (row_cache == NULL) {
+    return GetFromTable(options, file_number, file_size, level, k, arg,
+                        saver);
+  }
+
+  const Slice user_key = ExtractUserKey(k);
+  const SequenceNumber sequence = DecodeFixed64(k.data() + k.size() - 8) >> 8;
+  std::string row_key;
+  PutFixed64(&row_key, row_cache_id_);
+  PutFixed64(&row_key, file_number);
+  row_key.append(user_key.data(), user_key.size());
+
+  Cache::Handle* row_handle = row_cache->Lookup(row_key);
+  if (row_handle == NULL) {
+    if (!options.fill_cache) {
+      return GetFromTable(options, file_number, file_size, level, k, arg,
+                          saver);
+    }
+    std::string* row = new std::string;
+    InternalKey newest(user_key, kMaxSequenceNumber, kValueTypeForSeek);
+    Status s = GetFromTable(options, file_number, file_size, level,
+                            newest.Encode(), row, SaveRow);
+    if (!s.ok()) {
+      delete row;
+      return s;
+    }
+    row_handle = row_cache->Insert(row_key, row,
+                                   row_key.size() + row->size(), &DeleteRow);
+  }
+
+  Slice row = *reinterpret_cast<std::string*>(row_cache->Value(row_handle));
+  Slice found_key;
+  bool hit = true;
+  if (!row.empty()) {
+    if (GetLengthPrefixedSlice(&row, &found_key) && found_key.size() >= 8 &&
+        (DecodeFixed64(found_key.data() + found_key.size() - 8) >> 8) <=
+            sequence) {
+      (*saver)(arg, found_key, row);
+    } else {
+      hit = false;  // The entry may be too new for "k"
+    }
+  }
+  row_cache->Release(row_handle);
+  if (hit) {
+    return Status::OK();
+  }
+  return GetFromTable(options, file_number, file_size, level, k, arg, saver);
+}
+
+Status TableCache::GetFromTable(const ReadOptions& options,
+                                uint64_t file_number,
+                                uint64_t file_size,
+                                int level,
+                                const Slice& k,
+                                void* arg,
+                                void (*saver)(void*, const Slice&,
+                                              const Slice&)) {
   Cache::Handle* handle = NULL;
-  Status s = FindTable(file_number, file_size, &handle);
+  Status s = FindTable(file_number, file_size, level, &handle);
   if (s.ok()) {
     Table* t = reinterpret_cast<TableAndFile*>(cache_->Value(handle))->table;
     s = t->InternalGet(options, k, arg, saver);
@@ -118,6 +224,90 @@ Status TableCache::Get(const ReadOptions& options,
   return s;
 }
 
+Status TableCache::MultiGet(const ReadOptions& options,
+                            uint64_t file_number,
+                            uint64_t file_size,
+                            int level,
+                            int n, const Slice* ks, void* const* args,
+                            void (*saver)(void*, const Slice&, const Slice&)) {
+  Cache::Handle* handle = NULL;
+  Status s = FindTable(file_number, file_size, level, &handle);
+  if (s.ok()) {
+    Table* t = reinterpret_cast<TableAndFile*>(cache_->Value(handle))->table;
+    s = t->InternalMultiGet(options, n, ks, args, saver);
+    cache_->Release(handle);
+  }
+  return s;
+}
+
+Iterator* TableCache::NewRangeDeletionIterator(uint64_t file_number,
+                                               uint64_t file_size,
+                                               int level) {
+  Cache::Handle* handle = NULL;
+  Status s = FindTable(file_number, file_size, level, &handle);
+  if (!s.ok()) {
+    return NewErrorIterator(s);
+  }
+  Table* t = reinterpret_cast<TableAndFile*>(cache_->Value(handle))->table;
+  Iterator* result = t->NewRangeDeletionIterator();
+  if (result == NULL) {
+    result = NewEmptyIterator();
+  }
+  result->RegisterCleanup(&UnrefEntry, cache_, handle);
+  return result;
+}
+
+Status TableCache::MaxCoveringRangeDeletion(uint64_t file_number,
+                                            uint64_t file_size,
+                                            int level,
+                                            const Slice& k,
+                                            SequenceNumber* seq) {
+  *seq = 0;
+  Cache::Handle* handle = NULL;
+  Status s = FindTable(file_number, file_size, level, &handle);
+  if (s.ok()) {
+    const RangeTombstoneList* range_dels =
+        reinterpret_cast<TableAndFile*>(cache_->Value(handle))->range_dels;
+    if (range_dels != NULL) {
+      *seq = range_dels->MaxCoveringSequence(
+          ExtractUserKey(k), DecodeFixed64(k.data() + k.size() - 8) >> 8);
+    }
+    cache_->Release(handle);
+  }
+  return s;
+}
+
+Status TableCache::AddRangeDeletions(uint64_t file_number,
+                                     uint64_t file_size,
+                                     int level,
+                                     SequenceNumber snapshot,
+                                     RangeTombstoneList* list) {
+  Cache::Handle* handle = NULL;
+  Status s = FindTable(file_number, file_size, level, &handle);
+  if (s.ok()) {
+    const RangeTombstoneList* range_dels =
+        reinterpret_cast<TableAndFile*>(cache_->Value(handle))->range_dels;
+    if (range_dels != NULL) {
+      list->AddList(*range_dels, snapshot);
+    }
+    cache_->Release(handle);
+  }
+  return s;
+}
+
+bool TableCache::PrefixMayMatch(uint64_t file_number,
+                                uint64_t file_size,
+                                const Slice& k) {
+  Cache::Handle* handle = NULL;
+  bool may_match = true;
+  if (FindTable(file_number, file_size, -1, &handle).ok()) {
+    Table* t = reinterpret_cast<TableAndFile*>(cache_->Value(handle))->table;
+    may_match = Table::PrefixMayMatch(t, k);
+    cache_->Release(handle);
+  }
+  return may_match;
+}
+
 void TableCache::Evict(uint64_t file_number) {
   char buf[sizeof(file_number)];
   EncodeFixed64(buf, file_number);
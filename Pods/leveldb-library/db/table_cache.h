@@ -17,6 +17,7 @@
 namespace leveldb {
 
 class Env;
+class RangeTombstoneList;
 
 class TableCache {
  public:
@@ -24,7 +25,10 @@ class TableCache {
   ~TableCache();
 
   // Return an iterator for the specified file number (the corresponding
-  // file length must be exactly "file_size" bytes).  If "tableptr" is
+  // file length must be exactly "file_size" bytes).  "level" is the level
+  // of the file in the current version, or -1 if unknown; it decides
+  // whether options.pin_l0_filter_and_index_blocks_in_cache applies if
+  // the file has to be opened.  If "tableptr" is
   // non-NULL, also sets "*tableptr" to point to the Table object
   // underlying the returned iterator, or NULL if no Table object underlies
   // the returned iterator.  The returned "*tableptr" object is owned by
@@ -33,17 +37,59 @@ class TableCache {
   Iterator* NewIterator(const ReadOptions& options,
                         uint64_t file_number,
                         uint64_t file_size,
+                        int level,
                         Table** tableptr = NULL);
 
   // If a seek to internal key "k" in specified file finds an entry,
-  // call (*handle_result)(arg, found_key, found_value).
+  // call (*handle_result)(arg, found_key, found_value).  Answered from
+  // options->row_cache when possible.
   Status Get(const ReadOptions& options,
              uint64_t file_number,
              uint64_t file_size,
+             int level,
              const Slice& k,
              void* arg,
              void (*handle_result)(void*, const Slice&, const Slice&));
 
+  // Like Get() for each of the sorted internal keys ks[0,n-1], calling
+  // (*handle_result)(args[i], found_key, found_value) for ks[i].
+  Status MultiGet(const ReadOptions& options,
+                  uint64_t file_number,
+                  uint64_t file_size,
+                  int level,
+                  int n, const Slice* ks, void* const* args,
+                  void (*handle_result)(void*, const Slice&, const Slice&));
+
+  // Return an iterator over the range deletion entries of the specified
+  // file (see db/range_del.h).
+  Iterator* NewRangeDeletionIterator(uint64_t file_number,
+                                     uint64_t file_size,
+                                     int level);
+
+  // Sets "*seq" to the sequence number of the newest range deletion in
+  // the specified file that covers the user key of internal key "k" and
+  // is visible at its sequence number, or to 0 if there is none.
+  Status MaxCoveringRangeDeletion(uint64_t file_number,
+                                  uint64_t file_size,
+                                  int level,
+                                  const Slice& k,
+                                  SequenceNumber* seq);
+
+  // Adds to "*list" the range deletions of the specified file whose
+  // sequence numbers are at most "snapshot".
+  Status AddRangeDeletions(uint64_t file_number,
+                           uint64_t file_size,
+                           int level,
+                           SequenceNumber snapshot,
+                           RangeTombstoneList* list);
+
+  // Returns false if the filters of the specified file show that no
+  // entry at or after internal key "k" shares the prefix of "k" under
+  // options_->prefix_extractor.  Errors are treated as potential matches.
+  bool PrefixMayMatch(uint64_t file_number,
+                      uint64_t file_size,
+                      const Slice& k);
+
   // Evict any entry for the specified file number
   void Evict(uint64_t file_number);
 
@@ -52,8 +98,18 @@ class TableCache {
   const std::string dbname_;
   const Options* options_;
   Cache* cache_;
+  const uint64_t row_cache_id_;
 
-  Status FindTable(uint64_t file_number, uint64_t file_size, Cache::Handle**);
+  Status GetFromTable(const ReadOptions& options,
+                      uint64_t file_number,
+                      uint64_t file_size,
+                      int level,
+                      const Slice& k,
+                      void* arg,
+                      void (*handle_result)(void*, const Slice&,
+                                            const Slice&));
+  Status FindTable(uint64_t file_number, uint64_t file_size, int level,
+                   Cache::Handle**);
 };
 
 }  // namespace leveldb
@@ -10,10 +10,12 @@
 #include "db/log_reader.h"
 #include "db/log_writer.h"
 #include "db/memtable.h"
+#include "db/merge_helper.h"
 #include "db/table_cache.h"
 #include "leveldb/env.h"
 #include "leveldb/table_builder.h"
 #include "table/merger.h"
+#include "table/prefix_filtered_iterator.h"
 #include "table/two_level_iterator.h"
 #include "util/coding.h"
 #include "util/logging.h"
@@ -63,6 +65,15 @@ static int64_t TotalFileSize(const std::vector<FileMetaData*>& files) {
   return sum;
 }
 
+static bool AnyBeingCompacted(const std::vector<FileMetaData*>& files) {
+  for (size_t i = 0; i < files.size(); i++) {
+    if (files[i]->being_compacted) {
+      return true;
+    }
+  }
+  return false;
+}
+
 Version::~Version() {
   assert(refs_ == 0);
 
@@ -159,24 +170,39 @@ bool SomeFileOverlapsRange(
 // information about the files in the level.  For a given entry, key()
 // is the largest key that occurs in the file, and value() is an
 // 16-byte value containing the file number and file size, both
-// encoded using EncodeFixed64.
+// encoded using EncodeFixed64.  Only the files in [begin,end) of the
+// list are visited.
 class Version::LevelFileNumIterator : public Iterator {
  public:
   LevelFileNumIterator(const InternalKeyComparator& icmp,
                        const std::vector<FileMetaData*>* flist)
       : icmp_(icmp),
         flist_(flist),
-        index_(flist->size()) {        // Marks as invalid
+        begin_(0),
+        end_(flist->size()),
+        index_(end_) {                 // Marks as invalid
+  }
+  LevelFileNumIterator(const InternalKeyComparator& icmp,
+                       const std::vector<FileMetaData*>* flist,
+                       uint32_t begin, uint32_t end)
+      : icmp_(icmp),
+        flist_(flist),
+        begin_(begin),
+        end_(end),
+        index_(end) {                  // Marks as invalid
+    assert(begin_ <= end_ && end_ <= flist_->size());
   }
   virtual bool Valid() const {
-    return index_ < flist_->size();
+    return index_ < end_;
   }
   virtual void Seek(const Slice& target) {
-    index_ = FindFile(icmp_, *flist_, target);
+    index_ = std::min(std::max<uint32_t>(FindFile(icmp_, *flist_, target),
+                                         begin_),
+                      end_);
   }
-  virtual void SeekToFirst() { index_ = 0; }
+  virtual void SeekToFirst() { index_ = begin_; }
   virtual void SeekToLast() {
-    index_ = flist_->empty() ? 0 : flist_->size() - 1;
+    index_ = (begin_ == end_) ? end_ : end_ - 1;
   }
   virtual void Next() {
     assert(Valid());
@@ -184,8 +210,8 @@ class Version::LevelFileNumIterator : public Iterator {
   }
   virtual void Prev() {
     assert(Valid());
-    if (index_ == 0) {
-      index_ = flist_->size();  // Marks as invalid
+    if (index_ == begin_) {
+      index_ = end_;  // Marks as invalid
     } else {
       index_--;
     }
@@ -204,6 +230,8 @@ class Version::LevelFileNumIterator : public Iterator {
  private:
   const InternalKeyComparator icmp_;
   const std::vector<FileMetaData*>* const flist_;
+  const uint32_t begin_;
+  const uint32_t end_;
   uint32_t index_;
 
   // Backing store for value().  Holds the file number and size.
@@ -218,26 +246,112 @@ static Iterator* GetFileIterator(void* arg,
     return NewErrorIterator(
         Status::Corruption("FileReader invoked with unexpected value"));
   } else {
+    // Only used for levels > 0, whose level does not matter here
     return cache->NewIterator(options,
                               DecodeFixed64(file_value.data()),
-                              DecodeFixed64(file_value.data() + 8));
+                              DecodeFixed64(file_value.data() + 8),
+                              -1);
+  }
+}
+
+namespace {
+struct LevelPrefixState {
+  const InternalKeyComparator* icmp;
+  const std::vector<FileMetaData*>* files;
+  TableCache* table_cache;
+};
+}
+
+static bool LevelPrefixMayMatch(void* arg, const Slice& key) {
+  LevelPrefixState* state = reinterpret_cast<LevelPrefixState*>(arg);
+  const std::vector<FileMetaData*>& files = *state->files;
+  // Files in a level are disjoint, so the first entry at or after "key"
+  // is in the file that a seek to "key" lands in.
+  uint32_t index = FindFile(*state->icmp, files, key);
+  if (index >= files.size()) {
+    return false;
+  }
+  return state->table_cache->PrefixMayMatch(files[index]->number,
+                                            files[index]->file_size, key);
+}
+
+static void DeleteLevelPrefixState(void* arg1, void* arg2) {
+  delete reinterpret_cast<LevelPrefixState*>(arg1);
+}
+
+// Returns true if "f" may hold keys within the read bounds of "options".
+static bool FileInReadBounds(const InternalKeyComparator& icmp,
+                             const ReadOptions& options,
+                             const FileMetaData* f) {
+  if (options.iterate_lower_bound != NULL &&
+      icmp.Compare(f->largest.Encode(), *options.iterate_lower_bound) < 0) {
+    return false;
+  }
+  if (options.iterate_upper_bound != NULL &&
+      icmp.Compare(f->smallest.Encode(), *options.iterate_upper_bound) >= 0) {
+    return false;
   }
+  return true;
 }
 
 Iterator* Version::NewConcatenatingIterator(const ReadOptions& options,
                                             int level) const {
-  return NewTwoLevelIterator(
-      new LevelFileNumIterator(vset_->icmp_, &files_[level]),
-      &GetFileIterator, vset_->table_cache_, options);
+  // Only visit the files that may hold keys within the read bounds, so
+  // that a seek near a bound does not open a file on the other side.
+  const std::vector<FileMetaData*>& files = files_[level];
+  uint32_t begin = 0;
+  uint32_t end = files.size();
+  if (options.iterate_lower_bound != NULL) {
+    begin = FindFile(vset_->icmp_, files, *options.iterate_lower_bound);
+  }
+  if (options.iterate_upper_bound != NULL) {
+    end = FindFile(vset_->icmp_, files, *options.iterate_upper_bound);
+    if (end < files.size() &&
+        FileInReadBounds(vset_->icmp_, options, files[end])) {
+      end++;
+    }
+  }
+  if (begin > end) {
+    begin = end;
+  }
+
+  if (!options.prefix_same_as_start ||
+      vset_->options_->prefix_extractor == NULL) {
+    return NewTwoLevelIterator(
+        new LevelFileNumIterator(vset_->icmp_, &files, begin, end),
+        &GetFileIterator, vset_->table_cache_, options, &vset_->icmp_);
+  }
+
+  // Check the filter of the file a seek lands in once for the whole
+  // level: otherwise a seek that a file's filter rejects would move on
+  // to read the first block of the next file.  The file iterators need
+  // not repeat the check.
+  ReadOptions file_options = options;
+  file_options.prefix_same_as_start = false;
+  LevelPrefixState* state = new LevelPrefixState;
+  state->icmp = &vset_->icmp_;
+  state->files = &files_[level];
+  state->table_cache = vset_->table_cache_;
+  Iterator* iter = NewPrefixFilteredIterator(
+      NewTwoLevelIterator(
+          new LevelFileNumIterator(vset_->icmp_, &files, begin, end),
+          &GetFileIterator, vset_->table_cache_, file_options,
+          &vset_->icmp_),
+      &LevelPrefixMayMatch, state);
+  iter->RegisterCleanup(&DeleteLevelPrefixState, state, NULL);
+  return iter;
 }
 
 void Version::AddIterators(const ReadOptions& options,
                            std::vector<Iterator*>* iters) {
   // Merge all level zero files together since they may overlap
   for (size_t i = 0; i < files_[0].size(); i++) {
+    if (!FileInReadBounds(vset_->icmp_, options, files_[0][i])) {
+      continue;
+    }
     iters->push_back(
         vset_->table_cache_->NewIterator(
-            options, files_[0][i]->number, files_[0][i]->file_size));
+            options, files_[0][i]->number, files_[0][i]->file_size, 0));
   }
 
   // For levels > 0, we can use a concatenating iterator that sequentially
@@ -250,6 +364,23 @@ void Version::AddIterators(const ReadOptions& options,
   }
 }
 
+Status Version::AddRangeDeletions(const ReadOptions& options,
+                                  SequenceNumber snapshot,
+                                  RangeTombstoneList* list) {
+  Status s;
+  for (int level = 0; level < config::kNumLevels && s.ok(); level++) {
+    for (size_t i = 0; i < files_[level].size() && s.ok(); i++) {
+      FileMetaData* f = files_[level][i];
+      if (f->has_range_deletions &&
+          FileInReadBounds(vset_->icmp_, options, f)) {
+        s = vset_->table_cache_->AddRangeDeletions(f->number, f->file_size,
+                                                   level, snapshot, list);
+      }
+    }
+  }
+  return s;
+}
+
 // Callback from TableCache::Get()
 namespace {
 enum SaverState {
@@ -257,12 +388,16 @@ enum SaverState {
   kFound,
   kDeleted,
   kCorrupt,
+  kMerge,
 };
 struct Saver {
   SaverState state;
   const Comparator* ucmp;
   Slice user_key;
   std::string* value;
+  SequenceNumber range_del_seq;  // Newest range deletion of user_key in file
+  MergeContext* merge_context;
+  SequenceNumber merge_seq;      // Sequence number of the last operand
 };
 }
 static void SaveValue(void* arg, const Slice& ikey, const Slice& v) {
@@ -272,14 +407,55 @@ static void SaveValue(void* arg, const Slice& ikey, const Slice& v) {
     s->state = kCorrupt;
   } else {
     if (s->ucmp->Compare(parsed_key.user_key, s->user_key) == 0) {
-      s->state = (parsed_key.type == kTypeValue) ? kFound : kDeleted;
-      if (s->state == kFound) {
+      if (parsed_key.sequence <= s->range_del_seq) {
+        s->state = kDeleted;
+      } else if (parsed_key.type == kTypeValue) {
+        s->state = kFound;
         s->value->assign(v.data(), v.size());
+      } else if (parsed_key.type == kTypeMerge) {
+        s->state = kMerge;
+        s->merge_context->AddOlder(v);
+        s->merge_seq = parsed_key.sequence;
+      } else {
+        s->state = kDeleted;
       }
     }
   }
 }
 
+// The lookup of "saver" in file "f" stopped at a merge operand.  Reads
+// the older entries of the same user key in "f" until one of them is
+// not a merge operand, and leaves saver->state as for that entry, or
+// kNotFound if there is none.
+static Status ContinueMerge(TableCache* table_cache,
+                            const ReadOptions& options,
+                            int level, FileMetaData* f, Saver* saver) {
+  assert(saver->state == kMerge);
+  saver->state = kNotFound;
+  if (saver->merge_seq == 0) {
+    return Status::OK();  // Nothing older
+  }
+  std::string older;
+  AppendInternalKey(&older, ParsedInternalKey(saver->user_key,
+                                              saver->merge_seq - 1,
+                                              kValueTypeForSeek));
+  Iterator* iter = table_cache->NewIterator(options, f->number, f->file_size,
+                                            level);
+  for (iter->Seek(older); iter->Valid(); iter->Next()) {
+    saver->state = kNotFound;
+    SaveValue(saver, iter->key(), iter->value());
+    if (saver->state != kMerge) {
+      break;
+    }
+  }
+  if (saver->state == kMerge) {
+    saver->state = kNotFound;  // The last operand was the last entry
+  }
+  Status s = iter->status();
+  delete iter;
+  return s;
+}
+
 static bool NewestFirst(FileMetaData* a, FileMetaData* b) {
   return a->number > b->number;
 }
@@ -332,7 +508,8 @@ void Version::ForEachOverlapping(Slice user_key, Slice internal_key,
 Status Version::Get(const ReadOptions& options,
                     const LookupKey& k,
                     std::string* value,
-                    GetStats* stats) {
+                    GetStats* stats,
+                    MergeContext* merge_context) {
   Slice ikey = k.internal_key();
   Slice user_key = k.user_key();
   const Comparator* ucmp = vset_->icmp_.user_comparator();
@@ -405,13 +582,29 @@ Status Version::Get(const ReadOptions& options,
       saver.ucmp = ucmp;
       saver.user_key = user_key;
       saver.value = value;
-      s = vset_->table_cache_->Get(options, f->number, f->file_size,
+      saver.range_del_seq = 0;
+      saver.merge_context = merge_context;
+      if (f->has_range_deletions) {
+        s = vset_->table_cache_->MaxCoveringRangeDeletion(
+            f->number, f->file_size, level, ikey, &saver.range_del_seq);
+        if (!s.ok()) {
+          return s;
+        }
+      }
+      s = vset_->table_cache_->Get(options, f->number, f->file_size, level,
                                    ikey, &saver, SaveValue);
+      if (s.ok() && saver.state == kMerge) {
+        s = ContinueMerge(vset_->table_cache_, options, level, f, &saver);
+      }
       if (!s.ok()) {
         return s;
       }
       switch (saver.state) {
         case kNotFound:
+          if (saver.range_del_seq > 0) {
+            // Older entries in other files are deleted too
+            return Status::NotFound(Slice());
+          }
           break;      // Keep searching in other files
         case kFound:
           return s;
@@ -421,6 +614,9 @@ Status Version::Get(const ReadOptions& options,
         case kCorrupt:
           s = Status::Corruption("corrupted key for ", user_key);
           return s;
+        case kMerge:
+          assert(false);  // Resolved by ContinueMerge()
+          break;
       }
     }
   }
@@ -428,6 +624,170 @@ Status Version::Get(const ReadOptions& options,
   return Status::NotFound(Slice());  // Use an empty error message for speed
 }
 
+void Version::MultiGet(const ReadOptions& options, int n,
+                       const LookupKey* const* keys,
+                       std::string* const* vals,
+                       Status* statuses,
+                       GetStats* stats,
+                       MergeContext* const* merge_contexts) {
+  const Comparator* ucmp = vset_->icmp_.user_comparator();
+  std::vector<Saver> savers(n);
+  std::vector<FileMetaData*> last_file_read(n);
+  std::vector<int> last_file_read_level(n);
+  std::vector<int> pending;  // Keys not resolved yet, in sorted order
+  for (int i = 0; i < n; i++) {
+    savers[i].state = kNotFound;
+    savers[i].ucmp = ucmp;
+    savers[i].user_key = keys[i]->user_key();
+    savers[i].value = vals[i];
+    savers[i].range_del_seq = 0;
+    savers[i].merge_context = merge_contexts[i];
+    statuses[i] = Status::NotFound(Slice());
+    stats[i].seek_file = NULL;
+    stats[i].seek_file_level = -1;
+    last_file_read[i] = NULL;
+    pending.push_back(i);
+  }
+
+  // Files to search in the current level, and for each of them the
+  // pending keys that have to be looked up in it.
+  std::vector<FileMetaData*> files;
+  std::vector<std::vector<int> > groups;
+  std::vector<Slice> ikeys;
+  std::vector<void*> args;
+  std::vector<bool> resolved(n, false);
+  for (int level = 0; level < config::kNumLevels && !pending.empty();
+       level++) {
+    const size_t num_files = files_[level].size();
+    if (num_files == 0) continue;
+    files.clear();
+    groups.clear();
+
+    if (level == 0) {
+      // Level-0 files may overlap each other.  Search every file that
+      // overlaps some pending key, from newest to oldest.
+      files = files_[0];
+      std::sort(files.begin(), files.end(), NewestFirst);
+      groups.resize(files.size());
+      for (size_t f = 0; f < files.size(); f++) {
+        for (size_t p = 0; p < pending.size(); p++) {
+          const Slice user_key = keys[pending[p]]->user_key();
+          if (ucmp->Compare(user_key, files[f]->smallest.user_key()) >= 0 &&
+              ucmp->Compare(user_key, files[f]->largest.user_key()) <= 0) {
+            groups[f].push_back(pending[p]);
+          }
+        }
+      }
+    } else {
+      // Walk the sorted keys and the sorted files of the level together
+      size_t index = FindFile(vset_->icmp_, files_[level],
+                              keys[pending[0]]->internal_key());
+      for (size_t p = 0; p < pending.size() && index < num_files; p++) {
+        const LookupKey* k = keys[pending[p]];
+        while (index < num_files &&
+               vset_->icmp_.Compare(files_[level][index]->largest.Encode(),
+                                    k->internal_key()) < 0) {
+          index++;
+        }
+        if (index == num_files) break;
+        FileMetaData* f = files_[level][index];
+        if (ucmp->Compare(k->user_key(), f->smallest.user_key()) < 0) {
+          // All of "f" is past any data for this key
+          continue;
+        }
+        if (files.empty() || files.back() != f) {
+          files.push_back(f);
+          groups.push_back(std::vector<int>());
+        }
+        groups.back().push_back(pending[p]);
+      }
+    }
+
+    for (size_t f = 0; f < files.size(); f++) {
+      ikeys.clear();
+      args.clear();
+      const std::vector<int>& group = groups[f];
+      for (size_t g = 0; g < group.size(); g++) {
+        const int i = group[g];
+        if (resolved[i]) continue;  // Found in a newer level-0 file
+        if (last_file_read[i] != NULL && stats[i].seek_file == NULL) {
+          // We have had more than one seek for this read.  Charge the
+          // 1st file.
+          stats[i].seek_file = last_file_read[i];
+          stats[i].seek_file_level = last_file_read_level[i];
+        }
+        last_file_read[i] = files[f];
+        last_file_read_level[i] = level;
+        ikeys.push_back(keys[i]->internal_key());
+        args.push_back(&savers[i]);
+      }
+      if (ikeys.empty()) continue;
+
+      Status s;
+      for (size_t g = 0; g < group.size() && s.ok(); g++) {
+        const int i = group[g];
+        if (resolved[i]) continue;
+        savers[i].range_del_seq = 0;
+        if (files[f]->has_range_deletions) {
+          s = vset_->table_cache_->MaxCoveringRangeDeletion(
+              files[f]->number, files[f]->file_size, level,
+              keys[i]->internal_key(), &savers[i].range_del_seq);
+        }
+      }
+      if (s.ok()) {
+        s = vset_->table_cache_->MultiGet(
+            options, files[f]->number, files[f]->file_size, level,
+            static_cast<int>(ikeys.size()), &ikeys[0], &args[0], SaveValue);
+      }
+      for (size_t g = 0; g < group.size(); g++) {
+        const int i = group[g];
+        if (resolved[i]) continue;
+        Status key_status = s;
+        if (key_status.ok() && savers[i].state == kMerge) {
+          key_status = ContinueMerge(vset_->table_cache_, options, level,
+                                     files[f], &savers[i]);
+        }
+        if (!key_status.ok()) {
+          statuses[i] = key_status;
+          resolved[i] = true;
+          continue;
+        }
+        switch (savers[i].state) {
+          case kNotFound:
+            // Keep searching in other files, unless a range deletion
+            // in this one deletes the older entries
+            resolved[i] = (savers[i].range_del_seq > 0);
+            break;
+          case kFound:
+            statuses[i] = Status::OK();
+            resolved[i] = true;
+            break;
+          case kDeleted:
+            resolved[i] = true;
+            break;
+          case kCorrupt:
+            statuses[i] = Status::Corruption("corrupted key for ",
+                                             savers[i].user_key);
+            resolved[i] = true;
+            break;
+          case kMerge:
+            assert(false);  // Resolved by ContinueMerge()
+            break;
+        }
+      }
+    }
+
+    // Drop the keys resolved in this level
+    size_t kept = 0;
+    for (size_t p = 0; p < pending.size(); p++) {
+      if (!resolved[pending[p]]) {
+        pending[kept++] = pending[p];
+      }
+    }
+    pending.resize(kept);
+  }
+}
+
 bool Version::UpdateStats(const GetStats& stats) {
   FileMetaData* f = stats.seek_file;
   if (f != NULL) {
@@ -527,6 +887,21 @@ int Version::PickLevelForMemTableOutput(
   return level;
 }
 
+int Version::PickLevelForIngestedFile(const Slice& smallest_user_key,
+                                      const Slice& largest_user_key) {
+  int level = 0;
+  if (!OverlapInLevel(0, &smallest_user_key, &largest_user_key)) {
+    // Level-0 files are ordered by file number, so a file that overlaps
+    // others there is still read first.  Below level-0, the file has to
+    // stay above every file it overlaps.
+    while (level + 1 < config::kNumLevels &&
+           !OverlapInLevel(level + 1, &smallest_user_key, &largest_user_key)) {
+      level++;
+    }
+  }
+  return level;
+}
+
 // Store in "*inputs" all files in "level" that overlap [begin,end]
 void Version::GetOverlappingInputs(
     int level,
@@ -571,6 +946,54 @@ void Version::GetOverlappingInputs(
   }
 }
 
+void Version::GetFilesInRange(int level, const Slice* begin, const Slice* end,
+                              std::vector<FileMetaData*>* inputs) {
+  assert(level > 0);
+  assert(level < config::kNumLevels);
+  inputs->clear();
+  const Comparator* user_cmp = vset_->icmp_.user_comparator();
+  const std::vector<FileMetaData*>& files = files_[level];
+  std::vector<bool> in_range(files.size());
+  for (size_t i = 0; i < files.size(); i++) {
+    const FileMetaData* f = files[i];
+    // Files with range deletions are kept: they may hide older entries
+    // in files that are not dropped.
+    in_range[i] =
+        !f->being_compacted && !f->has_range_deletions &&
+        (begin == NULL || user_cmp->Compare(f->smallest.user_key(),
+                                            *begin) >= 0) &&
+        (end == NULL || user_cmp->Compare(f->largest.user_key(),
+                                          *end) <= 0);
+  }
+
+  // Entries of one user key may be split between adjacent files.  Keep
+  // such files together, or dropping one of them would expose the older
+  // entries in the other.
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (size_t i = 0; i < files.size(); i++) {
+      if (!in_range[i]) {
+        continue;
+      }
+      if ((i > 0 && !in_range[i - 1] &&
+           user_cmp->Compare(files[i - 1]->largest.user_key(),
+                             files[i]->smallest.user_key()) == 0) ||
+          (i + 1 < files.size() && !in_range[i + 1] &&
+           user_cmp->Compare(files[i]->largest.user_key(),
+                             files[i + 1]->smallest.user_key()) == 0)) {
+        in_range[i] = false;
+        changed = true;
+      }
+    }
+  }
+  for (size_t i = 0; i < files.size(); i++) {
+    if (in_range[i]) {
+      inputs->push_back(files[i]);
+    }
+  }
+}
+
 std::string Version::DebugString() const {
   std::string r;
   for (int level = 0; level < config::kNumLevels; level++) {
@@ -591,7 +1014,11 @@ std::string Version::DebugString() const {
       r.append(files[i]->smallest.DebugString());
       r.append(" .. ");
       r.append(files[i]->largest.DebugString());
-      r.append("]\n");
+      r.append("]");
+      if (files[i]->has_range_deletions) {
+        r.append(" (range deletions)");
+      }
+      r.push_back('\n');
     }
   }
   return r;
@@ -817,7 +1244,23 @@ void VersionSet::AppendVersion(Version* v) {
   v->next_->prev_ = v;
 }
 
+// Information kept for every thread waiting in LogAndApply()
+struct VersionSet::ManifestWriter {
+  port::CondVar cv;
+
+  explicit ManifestWriter(port::Mutex* mu) : cv(mu) { }
+};
+
 Status VersionSet::LogAndApply(VersionEdit* edit, port::Mutex* mu) {
+  // Wait until all earlier edits have been installed.  The MANIFEST
+  // write below releases *mu, so without this a second caller could
+  // build its version from a stale current_.
+  ManifestWriter w(mu);
+  manifest_writers_.push_back(&w);
+  while (&w != manifest_writers_.front()) {
+    w.cv.Wait();
+  }
+
   if (edit->has_log_number_) {
     assert(edit->log_number_ >= log_number_);
     assert(edit->log_number_ < next_file_number_);
@@ -830,7 +1273,11 @@ Status VersionSet::LogAndApply(VersionEdit* edit, port::Mutex* mu) {
   }
 
   edit->SetNextFile(next_file_number_);
-  edit->SetLastSequence(last_sequence_);
+  if (edit->has_last_sequence_) {
+    assert(edit->last_sequence_ >= last_sequence_);
+  } else {
+    edit->SetLastSequence(last_sequence_);
+  }
 
   Version* v = new Version(this);
   {
@@ -899,6 +1346,10 @@ Status VersionSet::LogAndApply(VersionEdit* edit, port::Mutex* mu) {
     }
   }
 
+  manifest_writers_.pop_front();
+  if (!manifest_writers_.empty()) {
+    manifest_writers_.front()->cv.Signal();
+  }
   return s;
 }
 
@@ -1065,9 +1516,11 @@ void VersionSet::Finalize(Version* v) {
   // Precomputed best level for next compaction
   int best_level = -1;
   double best_score = -1;
+  uint64_t pending_bytes = 0;
 
   for (int level = 0; level < config::kNumLevels-1; level++) {
     double score;
+    const uint64_t level_bytes = TotalFileSize(v->files_[level]);
     if (level == 0) {
       // We treat level-0 specially by bounding the number of files
       // instead of number of bytes for two reasons:
@@ -1082,12 +1535,18 @@ void VersionSet::Finalize(Version* v) {
       // overwrites/deletions).
       score = v->files_[level].size() /
           static_cast<double>(config::kL0_CompactionTrigger);
+      if (score >= 1) {
+        pending_bytes += level_bytes;
+      }
     } else {
       // Compute the ratio of current size to size limit.
-      const uint64_t level_bytes = TotalFileSize(v->files_[level]);
-      score =
-          static_cast<double>(level_bytes) / MaxBytesForLevel(options_, level);
+      const double max_bytes = MaxBytesForLevel(options_, level);
+      score = static_cast<double>(level_bytes) / max_bytes;
+      if (level_bytes > max_bytes) {
+        pending_bytes += level_bytes - static_cast<uint64_t>(max_bytes);
+      }
     }
+    v->level_scores_[level] = score;
 
     if (score > best_score) {
       best_level = level;
@@ -1097,6 +1556,7 @@ void VersionSet::Finalize(Version* v) {
 
   v->compaction_level_ = best_level;
   v->compaction_score_ = best_score;
+  v->pending_compaction_bytes_ = pending_bytes;
 }
 
 Status VersionSet::WriteSnapshot(log::Writer* log) {
@@ -1120,7 +1580,8 @@ Status VersionSet::WriteSnapshot(log::Writer* log) {
     const std::vector<FileMetaData*>& files = current_->files_[level];
     for (size_t i = 0; i < files.size(); i++) {
       const FileMetaData* f = files[i];
-      edit.AddFile(level, f->number, f->file_size, f->smallest, f->largest);
+      edit.AddFile(level, f->number, f->file_size, f->smallest, f->largest,
+                   f->has_range_deletions);
     }
   }
 
@@ -1171,7 +1632,8 @@ uint64_t VersionSet::ApproximateOffsetOf(Version* v, const InternalKey& ikey) {
         // approximate offset of "ikey" within the table.
         Table* tableptr;
         Iterator* iter = table_cache_->NewIterator(
-            ReadOptions(), files[i]->number, files[i]->file_size, &tableptr);
+            ReadOptions(), files[i]->number, files[i]->file_size, level,
+            &tableptr);
         if (tableptr != NULL) {
           result += tableptr->ApproximateOffsetOf(ikey.Encode());
         }
@@ -1272,13 +1734,13 @@ Iterator* VersionSet::MakeInputIterator(Compaction* c) {
         const std::vector<FileMetaData*>& files = c->inputs_[which];
         for (size_t i = 0; i < files.size(); i++) {
           list[num++] = table_cache_->NewIterator(
-              options, files[i]->number, files[i]->file_size);
+              options, files[i]->number, files[i]->file_size, 0);
         }
       } else {
         // Create concatenating iterator for the files from this level
         list[num++] = NewTwoLevelIterator(
             new Version::LevelFileNumIterator(icmp_, &c->inputs_[which]),
-            &GetFileIterator, table_cache_, options);
+            &GetFileIterator, table_cache_, options, &icmp_);
       }
     }
   }
@@ -1289,65 +1751,107 @@ Iterator* VersionSet::MakeInputIterator(Compaction* c) {
 }
 
 Compaction* VersionSet::PickCompaction() {
-  Compaction* c;
-  int level;
+  Compaction* c = NULL;
 
   // We prefer compactions triggered by too much data in a level over
-  // the compactions triggered by seeks.
-  const bool size_compaction = (current_->compaction_score_ >= 1);
-  const bool seek_compaction = (current_->file_to_compact_ != NULL);
-  if (size_compaction) {
-    level = current_->compaction_level_;
-    assert(level >= 0);
-    assert(level+1 < config::kNumLevels);
-    c = new Compaction(options_, level);
-
-    // Pick the first file that comes after compact_pointer_[level]
-    for (size_t i = 0; i < current_->files_[level].size(); i++) {
-      FileMetaData* f = current_->files_[level][i];
-      if (compact_pointer_[level].empty() ||
-          icmp_.Compare(f->largest.Encode(), compact_pointer_[level]) > 0) {
-        c->inputs_[0].push_back(f);
-        break;
-      }
-    }
-    if (c->inputs_[0].empty()) {
-      // Wrap-around to the beginning of the key space
-      c->inputs_[0].push_back(current_->files_[level][0]);
+  // the compactions triggered by seeks.  If the files of the most
+  // urgent level are busy with other compactions, try the next one.
+  std::vector<std::pair<double, int> > by_score;
+  for (int level = 0; level < config::kNumLevels - 1; level++) {
+    if (current_->level_scores_[level] >= 1) {
+      by_score.push_back(std::make_pair(-current_->level_scores_[level],
+                                        level));
     }
-  } else if (seek_compaction) {
-    level = current_->file_to_compact_level_;
+  }
+  std::sort(by_score.begin(), by_score.end());
+  for (size_t i = 0; i < by_score.size() && c == NULL; i++) {
+    c = PickSizeCompaction(by_score[i].second);
+  }
+
+  if (c == NULL && current_->file_to_compact_ != NULL &&
+      !current_->file_to_compact_->being_compacted) {
+    const int level = current_->file_to_compact_level_;
     c = new Compaction(options_, level);
     c->inputs_[0].push_back(current_->file_to_compact_);
-  } else {
-    return NULL;
+    c->input_version_ = current_;
+    c->input_version_->Ref();
+    if (level == 0) {
+      InternalKey smallest, largest;
+      GetRange(c->inputs_[0], &smallest, &largest);
+      current_->GetOverlappingInputs(0, &smallest, &largest, &c->inputs_[0]);
+    }
+    if (AnyBeingCompacted(c->inputs_[0]) || !SetupOtherInputs(c)) {
+      delete c;
+      c = NULL;
+    }
   }
 
-  c->input_version_ = current_;
-  c->input_version_->Ref();
+  if (c != NULL) {
+    c->MarkInputsBeingCompacted(true);
+  }
+  return c;
+}
 
-  // Files in level 0 may overlap each other, so pick up all overlapping ones
-  if (level == 0) {
-    InternalKey smallest, largest;
-    GetRange(c->inputs_[0], &smallest, &largest);
-    // Note that the next call will discard the file we placed in
-    // c->inputs_[0] earlier and replace it with an overlapping set
-    // which will include the picked file.
-    current_->GetOverlappingInputs(0, &smallest, &largest, &c->inputs_[0]);
-    assert(!c->inputs_[0].empty());
+Compaction* VersionSet::PickSizeCompaction(int level) {
+  assert(level >= 0);
+  assert(level+1 < config::kNumLevels);
+  const std::vector<FileMetaData*>& files = current_->files_[level];
+
+  // Level-0 files may overlap each other, so only one level-0
+  // compaction may run at a time.
+  if (level == 0 && AnyBeingCompacted(files)) {
+    return NULL;
+  }
+
+  // Pick the first file that comes after compact_pointer_[level],
+  // wrapping around to the beginning of the key space.
+  size_t start = 0;
+  if (!compact_pointer_[level].empty()) {
+    while (start < files.size() &&
+           icmp_.Compare(files[start]->largest.Encode(),
+                         compact_pointer_[level]) <= 0) {
+      start++;
+    }
   }
+  for (size_t i = 0; i < files.size(); i++) {
+    FileMetaData* f = files[(start + i) % files.size()];
+    if (f->being_compacted) {
+      continue;
+    }
 
-  SetupOtherInputs(c);
+    Compaction* c = new Compaction(options_, level);
+    c->inputs_[0].push_back(f);
+    c->input_version_ = current_;
+    c->input_version_->Ref();
 
-  return c;
+    // Files in level 0 may overlap each other, so pick up all overlapping ones
+    if (level == 0) {
+      InternalKey smallest, largest;
+      GetRange(c->inputs_[0], &smallest, &largest);
+      // Note that the next call will discard the file we placed in
+      // c->inputs_[0] earlier and replace it with an overlapping set
+      // which will include the picked file.
+      current_->GetOverlappingInputs(0, &smallest, &largest, &c->inputs_[0]);
+      assert(!c->inputs_[0].empty());
+    }
+
+    if (SetupOtherInputs(c)) {
+      return c;
+    }
+    delete c;
+  }
+  return NULL;
 }
 
-void VersionSet::SetupOtherInputs(Compaction* c) {
+bool VersionSet::SetupOtherInputs(Compaction* c) {
   const int level = c->level();
   InternalKey smallest, largest;
   GetRange(c->inputs_[0], &smallest, &largest);
 
   current_->GetOverlappingInputs(level+1, &smallest, &largest, &c->inputs_[1]);
+  if (AnyBeingCompacted(c->inputs_[1])) {
+    return false;
+  }
 
   // Get entire range covered by compaction
   InternalKey all_start, all_limit;
@@ -1363,7 +1867,8 @@ void VersionSet::SetupOtherInputs(Compaction* c) {
     const int64_t expanded0_size = TotalFileSize(expanded0);
     if (expanded0.size() > c->inputs_[0].size() &&
         inputs1_size + expanded0_size <
-            ExpandedCompactionByteSizeLimit(options_)) {
+            ExpandedCompactionByteSizeLimit(options_) &&
+        !AnyBeingCompacted(expanded0)) {
       InternalKey new_start, new_limit;
       GetRange(expanded0, &new_start, &new_limit);
       std::vector<FileMetaData*> expanded1;
@@ -1408,6 +1913,7 @@ void VersionSet::SetupOtherInputs(Compaction* c) {
   // key range next time.
   compact_pointer_[level] = largest.Encode().ToString();
   c->edit_.SetCompactPointer(level, largest);
+  return true;
 }
 
 Compaction* VersionSet::CompactRange(
@@ -1441,7 +1947,11 @@ Compaction* VersionSet::CompactRange(
   c->input_version_ = current_;
   c->input_version_->Ref();
   c->inputs_[0] = inputs;
-  SetupOtherInputs(c);
+  assert(!AnyBeingCompacted(c->inputs_[0]));
+  const bool ok = SetupOtherInputs(c);
+  assert(ok);
+  (void)ok;
+  c->MarkInputsBeingCompacted(true);
   return c;
 }
 
@@ -1449,18 +1959,20 @@ Compaction::Compaction(const Options* options, int level)
     : level_(level),
       max_output_file_size_(MaxFileSizeForLevel(options, level)),
       input_version_(NULL),
-      grandparent_index_(0),
-      seen_key_(false),
-      overlapped_bytes_(0) {
+      inputs_marked_(false) {
+}
+
+Compaction::Cursor::Cursor()
+    : grandparent_index(0),
+      seen_key(false),
+      overlapped_bytes(0) {
   for (int i = 0; i < config::kNumLevels; i++) {
-    level_ptrs_[i] = 0;
+    level_ptrs[i] = 0;
   }
 }
 
 Compaction::~Compaction() {
-  if (input_version_ != NULL) {
-    input_version_->Unref();
-  }
+  ReleaseInputs();
 }
 
 bool Compaction::IsTrivialMove() const {
@@ -1481,13 +1993,13 @@ void Compaction::AddInputDeletions(VersionEdit* edit) {
   }
 }
 
-bool Compaction::IsBaseLevelForKey(const Slice& user_key) {
+bool Compaction::IsBaseLevelForKey(const Slice& user_key, Cursor* cursor) {
   // Maybe use binary search to find right entry instead of linear search?
   const Comparator* user_cmp = input_version_->vset_->icmp_.user_comparator();
   for (int lvl = level_ + 2; lvl < config::kNumLevels; lvl++) {
     const std::vector<FileMetaData*>& files = input_version_->files_[lvl];
-    for (; level_ptrs_[lvl] < files.size(); ) {
-      FileMetaData* f = files[level_ptrs_[lvl]];
+    for (; cursor->level_ptrs[lvl] < files.size(); ) {
+      FileMetaData* f = files[cursor->level_ptrs[lvl]];
       if (user_cmp->Compare(user_key, f->largest.user_key()) <= 0) {
         // We've advanced far enough
         if (user_cmp->Compare(user_key, f->smallest.user_key()) >= 0) {
@@ -1496,37 +2008,119 @@ bool Compaction::IsBaseLevelForKey(const Slice& user_key) {
         }
         break;
       }
-      level_ptrs_[lvl]++;
+      cursor->level_ptrs[lvl]++;
     }
   }
   return true;
 }
 
-bool Compaction::ShouldStopBefore(const Slice& internal_key) {
+bool Compaction::IsBaseLevelForRange(const Slice& begin, const Slice& end) {
+  for (int lvl = level_ + 2; lvl < config::kNumLevels; lvl++) {
+    if (input_version_->OverlapInLevel(lvl, &begin, &end)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Compaction::HasRangeDeletions() const {
+  for (int which = 0; which < 2; which++) {
+    for (size_t i = 0; i < inputs_[which].size(); i++) {
+      if (inputs_[which][i]->has_range_deletions) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+bool Compaction::ShouldStopBefore(const Slice& internal_key,
+                                  Cursor* cursor) {
   const VersionSet* vset = input_version_->vset_;
   // Scan to find earliest grandparent file that contains key.
   const InternalKeyComparator* icmp = &vset->icmp_;
-  while (grandparent_index_ < grandparents_.size() &&
+  while (cursor->grandparent_index < grandparents_.size() &&
       icmp->Compare(internal_key,
-                    grandparents_[grandparent_index_]->largest.Encode()) > 0) {
-    if (seen_key_) {
-      overlapped_bytes_ += grandparents_[grandparent_index_]->file_size;
+                    grandparents_[cursor->grandparent_index]->largest.Encode())
+      > 0) {
+    if (cursor->seen_key) {
+      cursor->overlapped_bytes +=
+          grandparents_[cursor->grandparent_index]->file_size;
     }
-    grandparent_index_++;
+    cursor->grandparent_index++;
   }
-  seen_key_ = true;
+  cursor->seen_key = true;
 
-  if (overlapped_bytes_ > MaxGrandParentOverlapBytes(vset->options_)) {
+  if (cursor->overlapped_bytes > MaxGrandParentOverlapBytes(vset->options_)) {
     // Too much overlap for current output; start new output
-    overlapped_bytes_ = 0;
+    cursor->overlapped_bytes = 0;
     return true;
   } else {
     return false;
   }
 }
 
+namespace {
+struct UserKeyLess {
+  const Comparator* ucmp;
+  explicit UserKeyLess(const Comparator* c) : ucmp(c) { }
+  bool operator()(const Slice& a, const Slice& b) const {
+    return ucmp->Compare(a, b) < 0;
+  }
+};
+}  // namespace
+
+void Compaction::GetSubcompactionBoundaries(
+    int max_ranges, std::vector<Slice>* boundaries) const {
+  boundaries->clear();
+  if (max_ranges <= 1) {
+    return;
+  }
+  const Comparator* user_cmp = input_version_->vset_->icmp_.user_comparator();
+
+  // Candidate cut points are the ends of all files involved.
+  std::vector<Slice> keys;
+  for (int which = 0; which < 2; which++) {
+    for (size_t i = 0; i < inputs_[which].size(); i++) {
+      keys.push_back(inputs_[which][i]->smallest.user_key());
+      keys.push_back(inputs_[which][i]->largest.user_key());
+    }
+  }
+  for (size_t i = 0; i < grandparents_.size(); i++) {
+    keys.push_back(grandparents_[i]->smallest.user_key());
+    keys.push_back(grandparents_[i]->largest.user_key());
+  }
+  std::sort(keys.begin(), keys.end(), UserKeyLess(user_cmp));
+
+  // Pick evenly spaced candidates.  A cut at the smallest key would
+  // produce an empty first range, so it is never chosen.
+  for (int r = 1; r < max_ranges; r++) {
+    const Slice& key = keys[keys.size() * r / max_ranges];
+    if (user_cmp->Compare(key, keys[0]) > 0 &&
+        (boundaries->empty() ||
+         user_cmp->Compare(key, boundaries->back()) > 0)) {
+      boundaries->push_back(key);
+    }
+  }
+}
+
+void Compaction::MarkInputsBeingCompacted(bool mark) {
+  if (inputs_marked_ == mark) {
+    return;
+  }
+  inputs_marked_ = mark;
+  for (int which = 0; which < 2; which++) {
+    for (size_t i = 0; i < inputs_[which].size(); i++) {
+      assert(inputs_[which][i]->being_compacted != mark);
+      inputs_[which][i]->being_compacted = mark;
+    }
+  }
+}
+
 void Compaction::ReleaseInputs() {
   if (input_version_ != NULL) {
+    // The inputs are kept alive by input_version_, so unmark them first.
+    MarkInputsBeingCompacted(false);
     input_version_->Unref();
     input_version_ = NULL;
   }
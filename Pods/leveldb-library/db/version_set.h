@@ -15,6 +15,7 @@
 #ifndef STORAGE_LEVELDB_DB_VERSION_SET_H_
 #define STORAGE_LEVELDB_DB_VERSION_SET_H_
 
+#include <deque>
 #include <map>
 #include <set>
 #include <vector>
@@ -30,6 +31,8 @@ namespace log { class Writer; }
 class Compaction;
 class Iterator;
 class MemTable;
+class MergeContext;
+class RangeTombstoneList;
 class TableBuilder;
 class TableCache;
 class Version;
@@ -60,18 +63,38 @@ class Version {
  public:
   // Append to *iters a sequence of iterators that will
   // yield the contents of this Version when merged together.
+  // The read bounds of the options, if any, must be internal keys;
+  // files that only hold keys outside them are left out.
   // REQUIRES: This version has been saved (see VersionSet::SaveTo)
   void AddIterators(const ReadOptions&, std::vector<Iterator*>* iters);
 
+  // Add to *list the range deletions of this Version whose sequence
+  // numbers are at most "snapshot".  As with AddIterators(), files that
+  // only hold keys outside the read bounds of the options are left out.
+  Status AddRangeDeletions(const ReadOptions&, SequenceNumber snapshot,
+                           RangeTombstoneList* list);
+
   // Lookup the value for key.  If found, store it in *val and
-  // return OK.  Else return a non-OK status.  Fills *stats.
+  // return OK.  Else return a non-OK status.  Fills *stats.  Merge
+  // operands found before the value or deletion are added to
+  // *merge_context, which then has to be applied to the result.
   // REQUIRES: lock is not held
   struct GetStats {
     FileMetaData* seek_file;
     int seek_file_level;
   };
   Status Get(const ReadOptions&, const LookupKey& key, std::string* val,
-             GetStats* stats);
+             GetStats* stats, MergeContext* merge_context);
+
+  // Like Get() for each of keys[0,n-1], storing the outcome for keys[i]
+  // in vals[i], statuses[i] and stats[i].  Keys that land in the same
+  // table are looked up together, so that the table is found in the
+  // cache once and each of its data blocks is read at most once.
+  // REQUIRES: keys are sorted by user key
+  // REQUIRES: lock is not held
+  void MultiGet(const ReadOptions&, int n, const LookupKey* const* keys,
+                std::string* const* vals, Status* statuses, GetStats* stats,
+                MergeContext* const* merge_contexts);
 
   // Adds "stats" into the current state.  Returns true if a new
   // compaction may need to be triggered, false otherwise.
@@ -95,6 +118,17 @@ class Version {
       const InternalKey* end,           // NULL means after all keys
       std::vector<FileMetaData*>* inputs);
 
+  // Store in "*inputs" the files of "level" (which must be >= 1) whose
+  // user keys all lie in [*begin,*end].  Files that are inputs of a
+  // running compaction, files with range deletions, and files that share
+  // a boundary user key with a neighbour that is left out, are left out
+  // too.
+  void GetFilesInRange(
+      int level,
+      const Slice* begin,               // NULL means before all keys
+      const Slice* end,                 // NULL means after all keys
+      std::vector<FileMetaData*>* inputs);
+
   // Returns true iff some file in the specified level overlaps
   // some part of [*smallest_user_key,*largest_user_key].
   // smallest_user_key==NULL represents a key smaller than all keys in the DB.
@@ -108,6 +142,12 @@ class Version {
   int PickLevelForMemTableOutput(const Slice& smallest_user_key,
                                  const Slice& largest_user_key);
 
+  // Return the deepest level at which a new file holding data newer than
+  // any data of the version in the specified key range can be placed,
+  // that is, the level just above the first level overlapping the range.
+  int PickLevelForIngestedFile(const Slice& smallest_user_key,
+                               const Slice& largest_user_key);
+
   int NumFiles(int level) const { return files_[level].size(); }
 
   // Return a human readable string that describes this version's contents.
@@ -147,12 +187,25 @@ class Version {
   double compaction_score_;
   int compaction_level_;
 
+  // Compaction score of every level, also initialized by Finalize().
+  // Used to fall back to another level when the files of the best one
+  // are already being compacted.
+  double level_scores_[config::kNumLevels];
+
+  // Bytes that compactions have to rewrite to bring every level back
+  // within its limits, also initialized by Finalize().
+  uint64_t pending_compaction_bytes_;
+
   explicit Version(VersionSet* vset)
       : vset_(vset), next_(this), prev_(this), refs_(0),
         file_to_compact_(NULL),
         file_to_compact_level_(-1),
         compaction_score_(-1),
-        compaction_level_(-1) {
+        compaction_level_(-1),
+        pending_compaction_bytes_(0) {
+    for (int level = 0; level < config::kNumLevels; level++) {
+      level_scores_[level] = -1;
+    }
   }
 
   ~Version();
@@ -173,8 +226,10 @@ class VersionSet {
   // Apply *edit to the current version to form a new descriptor that
   // is both saved to persistent state and installed as the new
   // current version.  Will release *mu while actually writing to the file.
+  // Concurrent calls are queued and applied one at a time, in order.
+  // A last sequence already set in *edit is logged as is, and the caller
+  // must SetLastSequence() to it before next releasing *mu.
   // REQUIRES: *mu is held on entry.
-  // REQUIRES: no other thread concurrently calls LogAndApply()
   Status LogAndApply(VersionEdit* edit, port::Mutex* mu)
       EXCLUSIVE_LOCKS_REQUIRED(mu);
 
@@ -205,6 +260,12 @@ class VersionSet {
   // Return the combined file size of all files at the specified level.
   int64_t NumLevelBytes(int level) const;
 
+  // Return an estimate of the bytes compactions have to rewrite before
+  // no level of the current version needs compacting.
+  uint64_t PendingCompactionBytes() const {
+    return current_->pending_compaction_bytes_;
+  }
+
   // Return the last sequence number.
   uint64_t LastSequence() const { return last_sequence_; }
 
@@ -224,7 +285,10 @@ class VersionSet {
   // being compacted, or zero if there is no such log file.
   uint64_t PrevLogNumber() const { return prev_log_number_; }
 
-  // Pick level and inputs for a new compaction.
+  // Pick level and inputs for a new compaction.  Files that are already
+  // inputs of a running compaction are never picked, nor is any file
+  // whose compaction would need them, so the result may run concurrently
+  // with all other outstanding compactions.
   // Returns NULL if there is no compaction to be done.
   // Otherwise returns a pointer to a heap-allocated object that
   // describes the compaction.  Caller should delete the result.
@@ -234,6 +298,7 @@ class VersionSet {
   // the specified level.  Returns NULL if there is nothing in that
   // level that overlaps the specified range.  Caller should delete
   // the result.
+  // REQUIRES: no other compaction is running
   Compaction* CompactRange(
       int level,
       const InternalKey* begin,
@@ -270,6 +335,7 @@ class VersionSet {
 
  private:
   class Builder;
+  struct ManifestWriter;
 
   friend class Compaction;
   friend class Version;
@@ -287,7 +353,12 @@ class VersionSet {
                  InternalKey* smallest,
                  InternalKey* largest);
 
-  void SetupOtherInputs(Compaction* c);
+  Compaction* PickSizeCompaction(int level);
+
+  // Fill in the level+1 inputs and grandparents of "c".  Returns false,
+  // leaving the compaction pointer untouched, if some needed input is
+  // already being compacted.
+  bool SetupOtherInputs(Compaction* c);
 
   // Save current contents to *log
   Status WriteSnapshot(log::Writer* log);
@@ -311,6 +382,10 @@ class VersionSet {
   Version dummy_versions_;  // Head of circular doubly-linked list of versions.
   Version* current_;        // == dummy_versions_.prev_
 
+  // Queue of LogAndApply() callers.  Only the front one may build a new
+  // version and write it to the MANIFEST.
+  std::deque<ManifestWriter*> manifest_writers_;
+
   // Per-level key at which the next compaction at that level should start.
   // Either an empty string, or a valid InternalKey.
   std::string compact_pointer_[config::kNumLevels];
@@ -349,17 +424,49 @@ class Compaction {
   // Add all inputs to this compaction as delete operations to *edit.
   void AddInputDeletions(VersionEdit* edit);
 
+  // Position of one pass over (a range of) the compaction's keys in
+  // increasing order.  IsBaseLevelForKey() and ShouldStopBefore() advance
+  // it, so subcompactions that walk disjoint ranges each keep their own.
+  struct Cursor {
+    size_t grandparent_index;  // Index in grandparents_
+    bool seen_key;             // Some output key has been seen
+    int64_t overlapped_bytes;  // Bytes of overlap between current output
+                               // and grandparent files
+
+    // level_ptrs holds indices into input_version_->levels_: our state
+    // is that we are positioned at one of the file ranges for each
+    // higher level than the ones involved in this compaction (i.e. for
+    // all L >= level_ + 2).
+    size_t level_ptrs[config::kNumLevels];
+
+    Cursor();
+  };
+
   // Returns true if the information we have available guarantees that
   // the compaction is producing data in "level+1" for which no data exists
   // in levels greater than "level+1".
-  bool IsBaseLevelForKey(const Slice& user_key);
+  bool IsBaseLevelForKey(const Slice& user_key, Cursor* cursor);
+
+  // Returns true if no data exists in levels greater than "level+1" for
+  // the user keys in [begin, end].
+  bool IsBaseLevelForRange(const Slice& begin, const Slice& end);
+
+  // Returns true if some input file holds range deletions.
+  bool HasRangeDeletions() const;
 
   // Returns true iff we should stop building the current output
   // before processing "internal_key".
-  bool ShouldStopBefore(const Slice& internal_key);
+  bool ShouldStopBefore(const Slice& internal_key, Cursor* cursor);
+
+  // Store in *boundaries up to "max_ranges - 1" sorted user keys that
+  // cut the key space of the compaction into ranges of roughly equal
+  // numbers of input and grandparent file boundaries.  The slices refer
+  // to file metadata and stay valid until ReleaseInputs() is called.
+  void GetSubcompactionBoundaries(int max_ranges,
+                                  std::vector<Slice>* boundaries) const;
 
   // Release the input version for the compaction, once the compaction
-  // is successful.
+  // is successful.  Also clears the being_compacted marks of the inputs.
   void ReleaseInputs();
 
  private:
@@ -368,9 +475,13 @@ class Compaction {
 
   Compaction(const Options* options, int level);
 
+  // Set the being_compacted flag of all inputs to "mark".
+  void MarkInputsBeingCompacted(bool mark);
+
   int level_;
   uint64_t max_output_file_size_;
   Version* input_version_;
+  bool inputs_marked_;        // inputs_ are flagged as being_compacted
   VersionEdit edit_;
 
   // Each compaction reads inputs from "level_" and "level_+1"
@@ -379,18 +490,6 @@ class Compaction {
   // State used to check for number of of overlapping grandparent files
   // (parent == level_ + 1, grandparent == level_ + 2)
   std::vector<FileMetaData*> grandparents_;
-  size_t grandparent_index_;  // Index in grandparent_starts_
-  bool seen_key_;             // Some output key has been seen
-  int64_t overlapped_bytes_;  // Bytes of overlap between current output
-                              // and grandparent files
-
-  // State for implementing IsBaseLevelForKey
-
-  // level_ptrs_ holds indices into input_version_->levels_: our state
-  // is that we are positioned at one of the file ranges for each
-  // higher level than the ones involved in this compaction (i.e. for
-  // all L >= level_ + 2).
-  size_t level_ptrs_[config::kNumLevels];
 };
 
 }  // namespace leveldb
@@ -0,0 +1,112 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "db/write_controller.h"
+
+#include "db/dbformat.h"
+
+namespace leveldb {
+
+// Writes are never paced below this rate, so that they keep making
+// progress however far behind compactions are.
+static const uint64_t kMinWriteRate = 16 << 10;
+
+// Once fully behind, writes are admitted at this fraction of the
+// compaction throughput.
+static const double kMinRateFraction = 1.0 / 16;
+
+WriteController::WriteController(uint64_t default_rate,
+                                 uint64_t soft_pending_bytes)
+    : default_rate_(default_rate),
+      soft_pending_bytes_(soft_pending_bytes),
+      compaction_rate_(0),
+      rate_(0),
+      credit_(0),
+      last_refill_(0) {
+}
+
+void WriteController::RecordCompaction(uint64_t bytes, uint64_t micros) {
+  if (micros == 0 || bytes == 0) {
+    return;
+  }
+  const uint64_t sample = static_cast<uint64_t>(bytes * 1e6 / micros);
+  if (compaction_rate_ == 0) {
+    compaction_rate_ = sample;
+  } else {
+    compaction_rate_ = (3 * compaction_rate_ + sample) / 4;
+  }
+}
+
+void WriteController::Update(uint64_t now, int level0_files,
+                             uint64_t pending_bytes) {
+  // How far behind compactions are, from 0 (just started falling
+  // behind) to 1 (writes get the minimum rate).
+  double pressure = -1;
+  if (level0_files >= config::kL0_SlowdownWritesTrigger) {
+    pressure = static_cast<double>(
+        level0_files - config::kL0_SlowdownWritesTrigger) /
+        (config::kL0_StopWritesTrigger - config::kL0_SlowdownWritesTrigger);
+  }
+  if (soft_pending_bytes_ > 0 && pending_bytes >= soft_pending_bytes_) {
+    const double p = static_cast<double>(pending_bytes - soft_pending_bytes_) /
+                     soft_pending_bytes_;
+    if (p > pressure) pressure = p;
+  }
+
+  if (pressure < 0) {
+    rate_ = 0;
+    return;
+  }
+  if (pressure > 1) pressure = 1;
+  const uint64_t base = (compaction_rate_ > 0) ? compaction_rate_
+                                               : default_rate_;
+  uint64_t rate = static_cast<uint64_t>(
+      base * (1 - pressure * (1 - kMinRateFraction)));
+  // Past the level-0 stop trigger, halve the rate for every extra file so
+  // that reads do not have to merge an unbounded number of files.
+  const int extra_files = level0_files - config::kL0_StopWritesTrigger;
+  if (extra_files > 0) {
+    rate >>= (extra_files < 20 ? extra_files : 20);
+  }
+  if (rate < kMinWriteRate) rate = kMinWriteRate;
+  if (rate_ == 0) {
+    // Start pacing with an empty bucket
+    credit_ = 0;
+    last_refill_ = now;
+  } else {
+    Refill(now);
+  }
+  rate_ = rate;
+}
+
+void WriteController::Refill(uint64_t now) {
+  if (now > last_refill_) {
+    credit_ += static_cast<int64_t>(rate_ * ((now - last_refill_) / 1e6));
+    last_refill_ = now;
+  }
+  // Allow bursts of up to 10ms worth of writes
+  const int64_t max_credit = static_cast<int64_t>(rate_ / 100);
+  if (credit_ > max_credit) {
+    credit_ = max_credit;
+  }
+}
+
+uint64_t WriteController::DelayMicros(uint64_t now) {
+  if (rate_ == 0) {
+    return 0;
+  }
+  Refill(now);
+  if (credit_ >= 0) {
+    return 0;
+  }
+  return static_cast<uint64_t>(-credit_ * 1e6 / rate_) + 1;
+}
+
+void WriteController::Charge(uint64_t bytes) {
+  if (rate_ > 0) {
+    credit_ -= static_cast<int64_t>(bytes);
+  }
+}
+
+}  // namespace leveldb
@@ -0,0 +1,64 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// WriteController paces writes once compactions fall behind.  Instead of
+// sleeping a fixed amount per write and then stopping writes outright,
+// writes are admitted through a token bucket whose rate follows the
+// measured compaction throughput, scaled down as the compaction debt
+// (level-0 files and bytes above the level size limits) grows.
+
+#ifndef STORAGE_LEVELDB_DB_WRITE_CONTROLLER_H_
+#define STORAGE_LEVELDB_DB_WRITE_CONTROLLER_H_
+
+#include <stdint.h>
+
+namespace leveldb {
+
+// Not thread-safe: the DB mutex protects every call.
+class WriteController {
+ public:
+  // "default_rate" (bytes per second) is used as the compaction
+  // throughput until a compaction has been measured.  Writes are delayed
+  // once the number of level-0 files reaches kL0_SlowdownWritesTrigger or
+  // the pending compaction bytes reach "soft_pending_bytes" (0 disables
+  // this trigger).
+  WriteController(uint64_t default_rate, uint64_t soft_pending_bytes);
+
+  // Record that a compaction wrote "bytes" in "micros".
+  void RecordCompaction(uint64_t bytes, uint64_t micros);
+
+  // Recompute the admitted write rate from the current compaction debt.
+  void Update(uint64_t now, int level0_files, uint64_t pending_bytes);
+
+  // Are writes currently being paced?
+  bool delayed() const { return rate_ > 0; }
+
+  // Admitted write rate in bytes per second; 0 if writes are not paced.
+  uint64_t rate() const { return rate_; }
+
+  // Return the number of microseconds a write arriving at "now" has to
+  // wait before it may proceed.
+  uint64_t DelayMicros(uint64_t now);
+
+  // Charge "bytes" that have just been written against the rate.
+  void Charge(uint64_t bytes);
+
+ private:
+  const uint64_t default_rate_;
+  const uint64_t soft_pending_bytes_;
+  uint64_t compaction_rate_;    // Moving average; 0 until measured
+  uint64_t rate_;
+  int64_t credit_;              // Bytes that may be written without waiting
+  uint64_t last_refill_;
+
+  void Refill(uint64_t now);
+
+  // No copying allowed
+  WriteController(const WriteController&);
+  void operator=(const WriteController&);
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_DB_WRITE_CONTROLLER_H_
@@ -0,0 +1,104 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "db/write_controller.h"
+
+#include "db/dbformat.h"
+#include "util/testharness.h"
+
+namespace leveldb {
+
+static const uint64_t kDefaultRate = 1 << 20;
+static const uint64_t kMinRate = 16 << 10;
+
+class WriteControllerTest { };
+
+TEST(WriteControllerTest, NotDelayedWhileCompactionsKeepUp) {
+  WriteController controller(kDefaultRate, 0);
+  controller.Update(0, config::kL0_SlowdownWritesTrigger - 1, 1 << 30);
+  ASSERT_TRUE(!controller.delayed());
+  controller.Charge(1 << 20);
+  ASSERT_EQ(0, controller.DelayMicros(0));
+}
+
+TEST(WriteControllerTest, RateDropsAsLevel0Grows) {
+  WriteController controller(kDefaultRate, 0);
+  uint64_t last = kDefaultRate + 1;
+  for (int files = config::kL0_SlowdownWritesTrigger;
+       files <= config::kL0_StopWritesTrigger + 4; files++) {
+    controller.Update(0, files, 0);
+    ASSERT_TRUE(controller.delayed());
+    ASSERT_LE(controller.rate(), kDefaultRate);
+    ASSERT_GE(controller.rate(), kMinRate);
+    if (controller.rate() > kMinRate) {
+      ASSERT_LT(controller.rate(), last);
+    }
+    last = controller.rate();
+  }
+
+  // Writes are never stopped outright
+  controller.Update(0, 1000, 0);
+  ASSERT_EQ(kMinRate, controller.rate());
+}
+
+TEST(WriteControllerTest, FollowsMeasuredCompactionRate) {
+  WriteController controller(kDefaultRate, 0);
+  controller.Update(0, config::kL0_SlowdownWritesTrigger, 0);
+  ASSERT_EQ(kDefaultRate, controller.rate());
+
+  // 8MB in one second
+  controller.RecordCompaction(8 << 20, 1000000);
+  controller.Update(0, config::kL0_SlowdownWritesTrigger, 0);
+  ASSERT_EQ(8 << 20, controller.rate());
+
+  // Later samples are averaged in
+  controller.RecordCompaction(4 << 20, 1000000);
+  controller.Update(0, config::kL0_SlowdownWritesTrigger, 0);
+  ASSERT_EQ(7 << 20, controller.rate());
+}
+
+TEST(WriteControllerTest, PendingBytesTrigger) {
+  const uint64_t kSoftLimit = 64 << 20;
+  WriteController controller(kDefaultRate, kSoftLimit);
+  controller.Update(0, 0, kSoftLimit - 1);
+  ASSERT_TRUE(!controller.delayed());
+  controller.Update(0, 0, kSoftLimit);
+  ASSERT_EQ(kDefaultRate, controller.rate());
+  controller.Update(0, 0, kSoftLimit + kSoftLimit / 2);
+  ASSERT_LT(controller.rate(), kDefaultRate);
+  ASSERT_GT(controller.rate(), kDefaultRate / 16);
+  controller.Update(0, 0, 10 * kSoftLimit);
+  ASSERT_EQ(kDefaultRate / 16, controller.rate());
+  controller.Update(0, 0, 0);
+  ASSERT_TRUE(!controller.delayed());
+}
+
+TEST(WriteControllerTest, DelayMatchesRate) {
+  WriteController controller(kDefaultRate, 0);
+  uint64_t now = 1000000;
+  controller.Update(now, config::kL0_SlowdownWritesTrigger, 0);
+  ASSERT_EQ(0, controller.DelayMicros(now));
+
+  // A quarter second's worth of writes has to wait a quarter second
+  controller.Charge(kDefaultRate / 4);
+  const uint64_t delay = controller.DelayMicros(now);
+  ASSERT_GE(delay, 250000 - 1);
+  ASSERT_LE(delay, 250000 + 1);
+  now += delay / 2;
+  ASSERT_GT(controller.DelayMicros(now), 0);
+  now += delay / 2 + 1;
+  ASSERT_EQ(0, controller.DelayMicros(now));
+
+  // Idle time only builds up a small burst allowance
+  now += 10000000;
+  ASSERT_EQ(0, controller.DelayMicros(now));
+  controller.Charge(kDefaultRate / 10);
+  ASSERT_GE(controller.DelayMicros(now), 80000);
+}
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  return leveldb::test::RunAllTests();
+}
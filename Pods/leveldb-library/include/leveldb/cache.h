@@ -29,6 +29,13 @@ class Cache;
 // of Cache uses a least-recently-used eviction policy.
 extern Cache* NewLRUCache(size_t capacity);
 
+// Like NewLRUCache(capacity), but up to capacity*high_pri_pool_ratio of
+// the cache is reserved for entries inserted with Cache::kHighPriority:
+// they are evicted only after every unused low-priority entry, unless
+// they overflow the reserved pool.
+// REQUIRES: 0 <= high_pri_pool_ratio <= 1
+extern Cache* NewLRUCache(size_t capacity, double high_pri_pool_ratio);
+
 class Cache {
  public:
   Cache() { }
@@ -40,6 +47,12 @@ class Cache {
   // Opaque handle to an entry stored in the cache.
   struct Handle { };
 
+  // How long an entry should be kept relative to other entries.
+  enum Priority {
+    kLowPriority,
+    kHighPriority
+  };
+
   // Insert a mapping from key->value into the cache and assign it
   // the specified charge against the total cache capacity.
   //
@@ -52,6 +65,15 @@ class Cache {
   virtual Handle* Insert(const Slice& key, void* value, size_t charge,
                          void (*deleter)(const Slice& key, void* value)) = 0;
 
+  // Like Insert(key, value, charge, deleter), but the entry is kept with
+  // the specified priority.  Caches that do not support priorities may
+  // ignore it, which is what the default implementation does.
+  virtual Handle* Insert(const Slice& key, void* value, size_t charge,
+                         void (*deleter)(const Slice& key, void* value),
+                         Priority priority) {
+    return Insert(key, value, charge, deleter);
+  }
+
   // If the cache has no mapping for "key", returns NULL.
   //
   // Else return a handle that corresponds to the mapping.  The caller
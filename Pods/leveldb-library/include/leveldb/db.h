@@ -7,6 +7,7 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <vector>
 #include "leveldb/iterator.h"
 #include "leveldb/options.h"
 
@@ -68,11 +69,47 @@ class DB {
   // Note: consider setting options.sync = true.
   virtual Status Delete(const WriteOptions& options, const Slice& key) = 0;
 
+  // Remove the database entries (if any) for every key in ["begin", "end"),
+  // as ordered by options.comparator, with a single range deletion rather
+  // than one deletion per key.  Returns OK on success, and a non-OK status
+  // on error.  It is not an error if the range is empty.
+  // Note: consider setting options.sync = true.
+  virtual Status DeleteRange(const WriteOptions& options,
+                             const Slice& begin, const Slice& end);
+
+  // Store "value" as a merge operand for "key", to be combined with the
+  // current value of "key" by options.merge_operator when "key" is read.
+  // Returns OK on success, and a non-OK status on error.  Fails if the
+  // database was opened without a merge operator.
+  // Note: consider setting options.sync = true.
+  virtual Status Merge(const WriteOptions& options,
+                       const Slice& key, const Slice& value);
+
   // Apply the specified updates to the database.
   // Returns OK on success, non-OK on failure.
   // Note: consider setting options.sync = true.
   virtual Status Write(const WriteOptions& options, WriteBatch* updates) = 0;
 
+  // Apply the specified updates to the database without waiting for
+  // them to be applied.  (*callback)(arg, s) is called once they have
+  // been applied, or have failed with status s; when options.sync is
+  // set, only after the log has been synced.  The callback may run on a
+  // thread owned by the database or inside another write call, and must
+  // not block for long.  It must not call Write() on this database:
+  // that would wait on the write queue that is running the callback.
+  // "*updates" must not be changed or destroyed until the callback has
+  // been called.  Writes still queued when the database is deleted fail
+  // if they would have to wait for a memtable flush.
+  virtual void WriteAsync(const WriteOptions& options, WriteBatch* updates,
+                          void (*callback)(void* arg, const Status& s),
+                          void* arg);
+
+  // Wait until every write that returned before this call is on stable
+  // storage.  With options.log_sync_interval_micros or
+  // options.log_sync_bytes set this waits for the next periodic sync of
+  // the log; otherwise it syncs the log right away.
+  virtual Status WaitForLogSync();
+
   // If the database contains an entry for "key" store the
   // corresponding value in *value and return OK.
   //
@@ -83,6 +120,17 @@ class DB {
   virtual Status Get(const ReadOptions& options,
                      const Slice& key, std::string* value) = 0;
 
+  // Look up every key in "keys" as if by Get(), storing the outcome for
+  // keys[i] in (*values)[i] and (*statuses)[i].  All lookups read the
+  // same state of the database, and keys that live in the same table are
+  // looked up together, which is much cheaper than separate Get() calls.
+  // As with Get(), (*statuses)[i].IsNotFound() is true if keys[i] is not
+  // in the database.
+  virtual void MultiGet(const ReadOptions& options,
+                        const std::vector<Slice>& keys,
+                        std::vector<std::string>* values,
+                        std::vector<Status>* statuses);
+
   // Return a heap-allocated iterator over the contents of the database.
   // The result of NewIterator() is initially invalid (caller must
   // call one of the Seek methods on the iterator before using it).
@@ -117,6 +165,8 @@ class DB {
   //     of the sstables that make up the db contents.
   //  "leveldb.approximate-memory-usage" - returns the approximate number of
   //     bytes of memory in use by the DB.
+  //  "leveldb.write-stall-micros" - returns the total number of microseconds
+  //     writes have been delayed or stopped waiting for compactions.
   virtual bool GetProperty(const Slice& property, std::string* value) = 0;
 
   // For each i in [0,n-1], store in "sizes[i]", the approximate
@@ -142,6 +192,37 @@ class DB {
   //    db->CompactRange(NULL, NULL);
   virtual void CompactRange(const Slice* begin, const Slice* end) = 0;
 
+  // Drop every table file at levels >= 1 whose keys all lie in the range
+  // [*begin,*end], without reading or rewriting any data, with a single
+  // update of the database description.  NULL bounds are treated as in
+  // CompactRange().  This is much cheaper than deleting the keys, but:
+  //
+  //  - Only whole files are dropped.  Keys of the range that live in the
+  //    memtable, in level-0 files, or in files that extend beyond the
+  //    range are kept, and older versions of dropped keys in such files
+  //    may become visible again.  Call DeleteRange() first to hide every
+  //    key of the range.
+  //  - Files that hold range deletions are kept, so that the keys those
+  //    deletions hide in other files stay hidden.
+  //  - The dropped entries also vanish from existing snapshots.
+  //  - Files that a running compaction reads are skipped.
+  virtual Status DeleteFilesInRange(const Slice* begin, const Slice* end);
+
+  // Add the contents of the table files at "paths", written by an
+  // SstFileWriter, to the database as if they had been written by a
+  // single Write() that no earlier snapshot sees.  The entries bypass
+  // the log and the memtable: each file is copied once into a table of
+  // the database with the sequence number of the ingestion, and that
+  // table is placed at the deepest level where no older data overlaps
+  // its key range.  The files at "paths" are left in place.
+  //
+  // The key ranges of the files must not overlap each other.  The
+  // memtable is flushed first if it holds keys in the range of a file.
+  // Every write to the database, whatever its keys, waits until the
+  // files have been copied and installed, so ingesting large files
+  // stalls writers for the duration of the copy.
+  virtual Status IngestExternalFile(const std::vector<std::string>& paths);
+
  private:
   // No copying allowed
   DB(const DB&);
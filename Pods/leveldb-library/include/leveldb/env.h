@@ -140,6 +140,35 @@ class Env {
       void (*function)(void* arg),
       void* arg) = 0;
 
+  // Background work is divided into pools by priority.  HIGH is meant for
+  // short jobs that foreground operations may be waiting on (e.g. memtable
+  // compactions), LOW for long-running jobs (e.g. table compactions).
+  enum Priority { LOW, HIGH, TOTAL };
+
+  // Like Schedule(function, arg), but run "(*function)(arg)" in the pool
+  // associated with "pri" so that work in one pool is never queued behind
+  // work in another.  It has its own name so that an Env that overrides
+  // only one of the two does not hide the other.
+  //
+  // The default implementation ignores "pri" and calls
+  // Schedule(function, arg).
+  virtual void ScheduleWithPriority(
+      void (*function)(void* arg),
+      void* arg,
+      Priority pri);
+
+  // Set the maximum number of threads used to run work scheduled with
+  // priority "pri".  Threads are started lazily as work arrives.
+  //
+  // The default implementation does nothing.
+  virtual void SetBackgroundThreads(int number, Priority pri);
+
+  // Like SetBackgroundThreads(number, pri), but never lowers the number
+  // of threads of the pool.
+  //
+  // The default implementation does nothing.
+  virtual void IncBackgroundThreadsIfNeeded(int number, Priority pri);
+
   // Start a new thread, invoking "function(arg)" within the new thread.
   // When "function(arg)" returns, the thread will be destroyed.
   virtual void StartThread(void (*function)(void* arg), void* arg) = 0;
@@ -327,6 +356,15 @@ class EnvWrapper : public Env {
   void Schedule(void (*f)(void*), void* a) {
     return target_->Schedule(f, a);
   }
+  void ScheduleWithPriority(void (*f)(void*), void* a, Priority pri) {
+    return target_->ScheduleWithPriority(f, a, pri);
+  }
+  void SetBackgroundThreads(int number, Priority pri) {
+    return target_->SetBackgroundThreads(number, pri);
+  }
+  void IncBackgroundThreadsIfNeeded(int number, Priority pri) {
+    return target_->IncBackgroundThreadsIfNeeded(number, pri);
+  }
   void StartThread(void (*f)(void*), void* a) {
     return target_->StartThread(f, a);
   }
@@ -0,0 +1,59 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// A database can be configured with a MergeOperator to support
+// DB::Merge().  A merge stores an operand for a key without reading the
+// key's current value; reads and compactions later combine the operands
+// with the value they apply to.  This turns read-modify-write updates,
+// such as incrementing a counter, into blind writes.
+
+#ifndef STORAGE_LEVELDB_INCLUDE_MERGE_OPERATOR_H_
+#define STORAGE_LEVELDB_INCLUDE_MERGE_OPERATOR_H_
+
+#include <string>
+#include <vector>
+#include "leveldb/slice.h"
+
+namespace leveldb {
+
+class Logger;
+
+class MergeOperator {
+ public:
+  virtual ~MergeOperator();
+
+  // Return the name of this operator.  It is only used in log messages.
+  virtual const char* Name() const = 0;
+
+  // Store in "*new_value" the value of "key" obtained by applying
+  // "operands", oldest first, to "existing_value", or to no value if
+  // "existing_value" is NULL (the key was never set or was deleted).
+  // Return false if the operands cannot be applied, in which case the
+  // read or compaction that needed the value fails with a Corruption
+  // status.  "logger" may be used to report the problem.
+  //
+  // The operator is called concurrently by several threads.
+  virtual bool FullMerge(const Slice& key,
+                         const Slice* existing_value,
+                         const std::vector<Slice>& operands,
+                         std::string* new_value,
+                         Logger* logger) const = 0;
+
+  // If the two operands "left_operand" and "right_operand" (the newer
+  // one) of "key" can be replaced by a single operand that has the same
+  // effect on any value, store it in "*new_value" and return true.
+  // Compactions use this to shrink runs of operands whose value is not
+  // known yet.
+  //
+  // The default implementation returns false.
+  virtual bool PartialMerge(const Slice& key,
+                            const Slice& left_operand,
+                            const Slice& right_operand,
+                            std::string* new_value,
+                            Logger* logger) const;
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_INCLUDE_MERGE_OPERATOR_H_
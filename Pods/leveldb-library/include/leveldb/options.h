@@ -6,6 +6,7 @@
 #define STORAGE_LEVELDB_INCLUDE_OPTIONS_H_
 
 #include <stddef.h>
+#include <stdint.h>
 
 namespace leveldb {
 
@@ -14,6 +15,9 @@ class Comparator;
 class Env;
 class FilterPolicy;
 class Logger;
+class MergeOperator;
+class Slice;
+class SliceTransform;
 class Snapshot;
 
 // DB contents are stored in a set of blocks, each of which holds a
@@ -82,6 +86,42 @@ struct Options {
   // Default: 4MB
   size_t write_buffer_size;
 
+  // Maximum number of write buffers (the memtable being written plus
+  // full memtables waiting to be compacted) held in memory.  Writes stall
+  // only once this many are full, so a value above 2 lets bursts of
+  // writes ride through a slow memtable compaction.  All full memtables
+  // waiting at that point are compacted into a single level-0 table.
+  //
+  // Default: 2
+  int max_write_buffer_number;
+
+  // If true, the writers of a write group insert their own batches into
+  // the memtable in parallel once the group's log record is written,
+  // instead of the group leader inserting all of them.  This lets
+  // concurrent write throughput scale with the number of cores.
+  //
+  // Default: false
+  bool allow_concurrent_memtable_write;
+
+  // If true, a write group hands the log to the next group as soon as
+  // its log record is written and inserts into the memtable while the
+  // next group is logging.  Reads and snapshots only see a group once it
+  // and every earlier group have been inserted.
+  //
+  // Default: false
+  bool enable_pipelined_write;
+
+  // If either of these is non-zero, a background thread syncs the log
+  // once writes that did not ask for WriteOptions::sync have been
+  // unsynced for log_sync_interval_micros, or once they add up to
+  // log_sync_bytes, whichever comes first.  This bounds how much a
+  // machine crash can lose while such writes still return without
+  // waiting for the disk.  See also DB::WaitForLogSync().
+  //
+  // Default: 0 (only WriteOptions::sync writes sync the log)
+  uint64_t log_sync_interval_micros;
+  uint64_t log_sync_bytes;
+
   // Number of open files that can be used by the DB.  You may need to
   // increase this if your database has a large working set (budget
   // one open file per 2MB of working set).
@@ -89,6 +129,57 @@ struct Options {
   // Default: 1000
   int max_open_files;
 
+  // Maximum number of table compactions that may run concurrently.
+  // Compactions running at the same time never share input files, and
+  // at most one of them compacts level-0.  Each compaction occupies a
+  // thread of the Env's LOW priority pool, which is grown to at least
+  // this many threads when the database is opened (see
+  // Env::IncBackgroundThreadsIfNeeded()).
+  //
+  // Default: 1
+  int max_background_compactions;
+
+  // Once compactions fall behind (too many level-0 files, or too many
+  // bytes above the level size limits), writes are admitted at a rate
+  // derived from the measured compaction throughput, which drops as the
+  // compaction debt grows.  delayed_write_rate (bytes per second) is
+  // used until a compaction has been measured.
+  //
+  // Default: 16MB/s
+  uint64_t delayed_write_rate;
+
+  // Writes start being paced once the compactions needed to bring every
+  // level within its size limit would rewrite this many bytes, and reach
+  // the lowest rate at twice that.  0 disables this trigger; 64MB suits
+  // a database whose levels are a few GB.
+  //
+  // Default: 0
+  uint64_t soft_pending_compaction_bytes_limit;
+
+  // Maximum number of threads a level-0 compaction is split across.  If
+  // greater than one, the key range of a level-0 compaction is cut into
+  // up to this many slices at input and grandparent file boundaries.
+  // Each slice is merged into its own output files by a task in the
+  // Env's LOW priority pool and all outputs are installed together when
+  // every slice is done.  Slices that no thread of the pool has started
+  // by the time the compaction is done with its own are merged by the
+  // compaction itself, so the pool must have spare threads for slices to
+  // run in parallel.
+  //
+  // Default: 1
+  int max_subcompactions;
+
+  // If true, each compaction reads and merges its input tables on one
+  // thread, decides which entries to keep on another and builds,
+  // compresses and writes its output tables on a third, handing entries
+  // between them in bounded batches.  This lets a single compaction use
+  // the CPU and the disk at the same time.  The reading and writing
+  // stages are tasks in the Env's LOW priority pool; while the pool has
+  // no thread for them, the compaction does their work itself.
+  //
+  // Default: false
+  bool pipelined_compaction;
+
   // Control over blocks (user data is stored in a set of blocks, and
   // a block is the unit of reading from disk).
 
@@ -97,6 +188,37 @@ struct Options {
   // Default: NULL
   Cache* block_cache;
 
+  // If true, the index and filter of each table are kept in block_cache
+  // with Cache::kHighPriority and charged against its capacity, instead
+  // of being held by the open table outside of any budget, so that
+  // block_cache bounds the memory used for reads.  Use a cache created
+  // with NewLRUCache(capacity, high_pri_pool_ratio) to keep them from
+  // being evicted by data blocks.  The internal 8MB cache reserves half
+  // of its capacity for them.  Blocks read from memory-mapped files
+  // without a copy take no heap memory and are still held by the table.
+  //
+  // Default: false
+  bool cache_index_and_filter_blocks;
+
+  // If true (and cache_index_and_filter_blocks is true), the index and
+  // filter of tables opened while they are in level 0, which every read
+  // consults, are held in block_cache for as long as the table is open
+  // and are never evicted.
+  //
+  // Default: false
+  bool pin_l0_filter_and_index_blocks_in_cache;
+
+  // If non-NULL, use the specified cache for the results of point lookups
+  // in tables: the newest entry for a user key in a table file, or the
+  // entry that follows where it would be.  A Get() that finds its key
+  // there skips opening the table and searching its index and blocks.
+  // Entries never go stale, since table files are immutable and their
+  // numbers are never reused; the entries of deleted files age out of
+  // the cache.  May be shared by several databases.
+  //
+  // Default: NULL
+  Cache* row_cache;
+
   // Approximate size of user data packed per block.  Note that the
   // block size specified here corresponds to uncompressed data.  The
   // actual size of the unit read from disk may be smaller if
@@ -112,6 +234,19 @@ struct Options {
   // Default: 16
   int block_restart_interval;
 
+  // If non-zero, the index of each new table is split into partitions
+  // of approximately this many bytes, found through a small top-level
+  // index, and, if full_filter is set, the table's filter is split into
+  // one filter per index partition.  An open table then keeps only the
+  // top-level index in memory and reads partitions on demand through
+  // block_cache, which bounds the memory of tables with large indexes
+  // (see max_file_size) at the cost of an extra block read on a cache
+  // miss.  Tables with partitioned indexes cannot be read by releases
+  // that predate this option.
+  //
+  // Default: 0
+  size_t index_partition_size;
+
   // Leveldb will write up to this amount of bytes to a file before
   // switching to a new one.
   // Most clients should leave this parameter alone.  However if your
@@ -153,6 +288,35 @@ struct Options {
   // Default: NULL
   const FilterPolicy* filter_policy;
 
+  // If true, tables get a single filter built by filter_policy over all
+  // of their keys rather than one filter per 2KB of data blocks.  A
+  // lookup then consults the filter before searching the index, and the
+  // per-filter overhead is paid once per table.  Tables written either
+  // way can be read regardless of this setting; tables written with it
+  // are read without filters by releases that predate it.
+  //
+  // Default: false
+  bool full_filter;
+
+  // If non-NULL, the filters built by filter_policy also summarize the
+  // prefixes of keys under this transformation, which lets iterators
+  // that read with ReadOptions::prefix_same_as_start skip tables and
+  // blocks that hold no key with the prefix they are scanning.  Tables
+  // are only skipped if filter_policy is also set.
+  //
+  // Default: NULL
+  const SliceTransform* prefix_extractor;
+
+  // If non-NULL, use the specified operator to combine the operands
+  // stored by DB::Merge() and WriteBatch::Merge() with the values they
+  // apply to.  Without one, DB::Merge() fails and so do reads of keys
+  // that have merge operands.  The same operator (or one with the same
+  // behavior) must be used whenever a database that holds merge
+  // operands is opened.
+  //
+  // Default: NULL
+  const MergeOperator* merge_operator;
+
   // Create an Options object with default values for all fields.
   Options();
 };
@@ -176,10 +340,42 @@ struct ReadOptions {
   // Default: NULL
   const Snapshot* snapshot;
 
+  // If true, an iterator positioned by Seek(target) only yields keys
+  // that have the same prefix as "target" under Options::prefix_extractor
+  // and becomes invalid once it moves past them.  Tables and blocks
+  // whose filter shows that they hold no key with that prefix are not
+  // read at all.  Only forward iteration after Seek() is supported in
+  // this mode: Prev() may stop before reaching the first key of the
+  // prefix.  Has no effect if Options::prefix_extractor is NULL, or if
+  // "target" is not in the domain of the extractor.
+  // Default: false
+  bool prefix_same_as_start;
+
+  // If non-NULL, an iterator only yields keys at or after
+  // "*iterate_lower_bound": Seek() to an earlier key and SeekToFirst()
+  // position it at the first key at or after the bound, and Prev()
+  // makes it invalid once it moves past the bound.  Files and blocks
+  // that only hold keys before the bound are not read.  The pointed-to
+  // key must remain live while the iterator is in use.
+  // Default: NULL
+  const Slice* iterate_lower_bound;
+
+  // If non-NULL, an iterator only yields keys before
+  // "*iterate_upper_bound" (the bound itself is excluded): SeekToLast()
+  // positions it at the last key before the bound, and Next() makes it
+  // invalid once it reaches the bound.  Files and blocks that only hold
+  // keys at or after the bound are not read.  The pointed-to key must
+  // remain live while the iterator is in use.
+  // Default: NULL
+  const Slice* iterate_upper_bound;
+
   ReadOptions()
       : verify_checksums(false),
         fill_cache(true),
-        snapshot(NULL) {
+        snapshot(NULL),
+        prefix_same_as_start(false),
+        iterate_lower_bound(NULL),
+        iterate_upper_bound(NULL) {
   }
 };
 
@@ -0,0 +1,58 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// A database can be configured with a SliceTransform that maps each key
+// to a prefix.  When one is supplied, the filters stored in tables also
+// summarize the prefixes of their keys, so that iterators reading with
+// ReadOptions::prefix_same_as_start can skip data that cannot contain
+// any key with the prefix they were positioned at.
+
+#ifndef STORAGE_LEVELDB_INCLUDE_SLICE_TRANSFORM_H_
+#define STORAGE_LEVELDB_INCLUDE_SLICE_TRANSFORM_H_
+
+#include <stddef.h>
+#include "leveldb/slice.h"
+
+namespace leveldb {
+
+class SliceTransform {
+ public:
+  virtual ~SliceTransform();
+
+  // Return the name of this transformation.  The name is recorded in
+  // every table built with the transformation, and prefix filtering is
+  // only used for tables whose recorded name matches.  If the mapping
+  // from keys to prefixes changes, the name must be changed too.
+  virtual const char* Name() const = 0;
+
+  // Return the prefix of "key".  The result must be a prefix of "key"
+  // (so that it refers to the same storage), and all keys that share a
+  // prefix must be adjacent in the order of the comparator in use.
+  // REQUIRES: InDomain(key)
+  virtual Slice Transform(const Slice& key) const = 0;
+
+  // Return true if Transform() may be applied to "key".  Keys outside
+  // the domain are not summarized by prefix and are never filtered out
+  // by prefix.
+  virtual bool InDomain(const Slice& key) const = 0;
+};
+
+// Return a new transformation that maps each key of at least
+// "prefix_len" bytes to its first "prefix_len" bytes.  Shorter keys
+// are outside its domain.
+//
+// Callers must delete the result after any database that is using the
+// result has been closed.
+extern const SliceTransform* NewFixedPrefixTransform(size_t prefix_len);
+
+// Return a new transformation that maps each key to its first
+// "cap_len" bytes, or to the whole key if the key is shorter.
+//
+// Callers must delete the result after any database that is using the
+// result has been closed.
+extern const SliceTransform* NewCappedPrefixTransform(size_t cap_len);
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_INCLUDE_SLICE_TRANSFORM_H_
@@ -0,0 +1,70 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// SstFileWriter writes a table file that DB::IngestExternalFile() can
+// add to a database, which bypasses the log, the memtable and most of
+// the compactions that writing the same keys one by one goes through.
+//
+// Typical use:
+//    leveldb::SstFileWriter writer(options);
+//    leveldb::Status s = writer.Open("/tmp/bulk.ldb");
+//    ... for each key in increasing order: s = writer.Put(key, value);
+//    if (s.ok()) s = writer.Finish();
+//    if (s.ok()) s = db->IngestExternalFile(paths);
+
+#ifndef STORAGE_LEVELDB_INCLUDE_SST_FILE_WRITER_H_
+#define STORAGE_LEVELDB_INCLUDE_SST_FILE_WRITER_H_
+
+#include <stdint.h>
+#include <string>
+#include "leveldb/options.h"
+#include "leveldb/status.h"
+
+namespace leveldb {
+
+class SstFileWriter {
+ public:
+  // Create a writer of files for databases that use the comparator,
+  // filter policy and prefix extractor of "options".  The other table
+  // options of "options" (block size, compression, ...) apply to the
+  // files written.
+  explicit SstFileWriter(const Options& options);
+
+  // Abandons and deletes the current file if Finish() was not called.
+  ~SstFileWriter();
+
+  // Create the file "fname", replacing any existing file of that name.
+  // REQUIRES: No file is open, or Finish() was called for it
+  Status Open(const std::string& fname);
+
+  // Add a key and its value to the file.  Keys must be added in strictly
+  // increasing order according to options.comparator; a key that is not
+  // after the previous one is rejected with an InvalidArgument status.
+  // REQUIRES: Open() succeeded and Finish() has not been called
+  Status Put(const Slice& key, const Slice& value);
+
+  // Finish the file, sync it and close it.
+  // REQUIRES: Open() succeeded and Finish() has not been called
+  Status Finish();
+
+  // Number of calls to Put() that succeeded for the current file.
+  uint64_t NumEntries() const;
+
+  // Size of the current file so far, or its final size after Finish().
+  uint64_t FileSize() const;
+
+ private:
+  void Abandon();
+
+  struct Rep;
+  Rep* rep_;
+
+  // No copying allowed
+  SstFileWriter(const SstFileWriter&);
+  void operator=(const SstFileWriter&);
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_INCLUDE_SST_FILE_WRITER_H_
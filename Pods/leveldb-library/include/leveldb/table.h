@@ -6,12 +6,14 @@
 #define STORAGE_LEVELDB_INCLUDE_TABLE_H_
 
 #include <stdint.h>
+#include "leveldb/cache.h"
 #include "leveldb/iterator.h"
 
 namespace leveldb {
 
 class Block;
 class BlockHandle;
+struct FilterEntry;
 class Footer;
 struct Options;
 class RandomAccessFile;
@@ -45,6 +47,9 @@ class Table {
   // Returns a new iterator over the table contents.
   // The result of NewIterator() is initially invalid (caller must
   // call one of the Seek methods on the iterator before using it).
+  // The read bounds in ReadOptions are ordered by options.comparator;
+  // blocks that only hold keys outside them are not read, but keys
+  // outside them may still be yielded.
   Iterator* NewIterator(const ReadOptions&) const;
 
   // Given a key, return an approximate byte offset in the file where
@@ -60,7 +65,59 @@ class Table {
   Rep* rep_;
 
   explicit Table(Rep* rep) { rep_ = rep; }
+
+  // Like the public Open(), but if "pin_metadata" is true and the index
+  // and filter are kept in options.block_cache, they stay there for the
+  // lifetime of the table.
+  static Status Open(const Options& options,
+                     RandomAccessFile* file,
+                     uint64_t file_size,
+                     bool pin_metadata,
+                     Table** table);
+
   static Iterator* BlockReader(void*, const ReadOptions&, const Slice&);
+  static Iterator* IndexPartitionReader(void*, const ReadOptions&,
+                                        const Slice&);
+  Iterator* NewBlockIterator(const ReadOptions&, const Slice& index_value,
+                             Cache::Priority) const;
+
+  // Sets "*block" to the block at "handle", looked up in options.block_cache
+  // or read (and if possible inserted into the cache with "priority").
+  // Sets "*cache_handle" to the cache entry to release after use, or to
+  // NULL if the caller owns "*block".
+  Status ReadCachedBlock(const ReadOptions&, const BlockHandle& handle,
+                         Cache::Priority priority,
+                         Block** block, Cache::Handle** cache_handle) const;
+
+  // Like ReadCachedBlock(), for the filter at "handle".  "full" says
+  // whether it is a full filter or a set of per-block filters.
+  Status ReadCachedFilter(const ReadOptions&, const BlockHandle& handle,
+                          bool full, Cache::Priority priority,
+                          FilterEntry** filter,
+                          Cache::Handle** cache_handle) const;
+
+  // Sets "*filter" to the filter of the table, or to NULL if it has none,
+  // and returns the cache entry to pass to ReleaseFilter() after use.
+  Cache::Handle* GetFilter(const ReadOptions&, FilterEntry** filter) const;
+  void ReleaseFilter(FilterEntry* filter, Cache::Handle* cache_handle) const;
+
+  // Returns false if the filters show that no key at or after "key"
+  // shares its prefix under options.prefix_extractor.
+  static bool PrefixMayMatch(void*, const Slice& key);
+
+  // Returns an iterator over the index block, which is the top-level
+  // index of a partitioned index.
+  Iterator* NewIndexBlockIterator(const ReadOptions&) const;
+
+  // Returns an iterator over the block handles of the index.  Looks
+  // through the top-level index of a partitioned index.
+  Iterator* NewIndexIterator(const ReadOptions&) const;
+
+  // Returns false if the filter partition that covers "key" shows that
+  // "key" (or "*prefix", if non-NULL) is not present.
+  // REQUIRES: rep_->partitioned_filter
+  bool PartitionedFilterMayMatch(const ReadOptions&, const Slice& key,
+                                 const Slice* prefix) const;
 
   // Calls (*handle_result)(arg, ...) with the entry found after a call
   // to Seek(key).  May not make such a call if filter policy says
@@ -71,9 +128,22 @@ class Table {
       void* arg,
       void (*handle_result)(void* arg, const Slice& k, const Slice& v));
 
+  // Like InternalGet() for each of keys[0,n-1], which must be sorted,
+  // calling (*handle_result)(args[i], ...) for keys[i].  Each data block
+  // is read at most once, and blocks are read in file order.
+  Status InternalMultiGet(
+      const ReadOptions&, int n, const Slice* keys, void* const* args,
+      void (*handle_result)(void* arg, const Slice& k, const Slice& v));
+
+  // Returns an iterator over the range deletion entries of the table, or
+  // NULL if it has none.
+  Iterator* NewRangeDeletionIterator() const;
 
-  void ReadMeta(const Footer& footer);
-  void ReadFilter(const Slice& filter_handle_value);
+  // Reads the filters and the range deletions named by the metaindex.
+  // Failures to read the filters are ignored.
+  Status ReadMeta(const Footer& footer, bool pin_metadata);
+  void ReadFilter(const Slice& filter_handle_value, bool full,
+                  bool pin_metadata);
 
   // No copying allowed
   Table(const Table&);
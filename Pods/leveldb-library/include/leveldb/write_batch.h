@@ -39,6 +39,16 @@ class WriteBatch {
   // If the database contains a mapping for "key", erase it.  Else do nothing.
   void Delete(const Slice& key);
 
+  // Erase every database entry whose key is in ["begin", "end"), as
+  // ordered by the database's comparator.  Keys written after this
+  // deletion are not affected.  Nothing is erased if "begin" is not
+  // before "end".
+  void DeleteRange(const Slice& begin, const Slice& end);
+
+  // Store "value" as a merge operand for "key".  Reads combine it with
+  // the value of "key" before it using Options::merge_operator.
+  void Merge(const Slice& key, const Slice& value);
+
   // Clear all updates buffered in this batch.
   void Clear();
 
@@ -48,6 +58,9 @@ class WriteBatch {
     virtual ~Handler();
     virtual void Put(const Slice& key, const Slice& value) = 0;
     virtual void Delete(const Slice& key) = 0;
+    // The default implementations ignore range deletions and merges.
+    virtual void DeleteRange(const Slice& begin, const Slice& end);
+    virtual void Merge(const Slice& key, const Slice& value);
   };
   Status Iterate(Handler* handler) const;
 
@@ -5,8 +5,10 @@
 #include "port/port_posix.h"
 
 #include <cstdlib>
+#include <errno.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/time.h>
 
 namespace leveldb {
 namespace port {
@@ -37,6 +39,22 @@ void CondVar::Wait() {
   PthreadCall("wait", pthread_cond_wait(&cv_, &mu_->mu_));
 }
 
+bool CondVar::TimedWait(uint64_t micros) {
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  uint64_t deadline = static_cast<uint64_t>(now.tv_sec) * 1000000 +
+                      now.tv_usec + micros;
+  struct timespec ts;
+  ts.tv_sec = static_cast<time_t>(deadline / 1000000);
+  ts.tv_nsec = static_cast<long>(deadline % 1000000) * 1000;
+  int result = pthread_cond_timedwait(&cv_, &mu_->mu_, &ts);
+  if (result == ETIMEDOUT) {
+    return true;
+  }
+  PthreadCall("timedwait", result);
+  return false;
+}
+
 void CondVar::Signal() {
   PthreadCall("signal", pthread_cond_signal(&cv_));
 }
@@ -5,6 +5,7 @@
 #include "table/filter_block.h"
 
 #include "leveldb/filter_policy.h"
+#include "leveldb/slice_transform.h"
 #include "util/coding.h"
 
 namespace leveldb {
@@ -15,8 +16,22 @@ namespace leveldb {
 static const size_t kFilterBaseLg = 11;
 static const size_t kFilterBase = 1 << kFilterBaseLg;
 
-FilterBlockBuilder::FilterBlockBuilder(const FilterPolicy* policy)
-    : policy_(policy) {
+// Prefixes are added to the filters followed by this many bytes, which
+// gives them the shape of the keys stored in a table by the db layer:
+// a filter policy that strips the trailer of internal keys is handed
+// the bare prefix.
+static const size_t kPrefixPaddingSize = 8;
+
+void AppendPrefixFilterKey(std::string* dst, const Slice& prefix) {
+  dst->append(prefix.data(), prefix.size());
+  dst->append(kPrefixPaddingSize, '\0');
+}
+
+FilterBlockBuilder::FilterBlockBuilder(const FilterPolicy* policy,
+                                       const SliceTransform* prefix_extractor)
+    : policy_(policy),
+      prefix_extractor_(prefix_extractor),
+      has_last_prefix_(false) {
 }
 
 void FilterBlockBuilder::StartBlock(uint64_t block_offset) {
@@ -31,6 +46,18 @@ void FilterBlockBuilder::AddKey(const Slice& key) {
   Slice k = key;
   start_.push_back(keys_.size());
   keys_.append(k.data(), k.size());
+
+  if (prefix_extractor_ != NULL && prefix_extractor_->InDomain(k)) {
+    // Keys arrive in sorted order, so all keys with the same prefix are
+    // adjacent and each prefix only needs to be added once per filter.
+    Slice prefix = prefix_extractor_->Transform(k);
+    if (!has_last_prefix_ || prefix != Slice(last_prefix_)) {
+      last_prefix_.assign(prefix.data(), prefix.size());
+      has_last_prefix_ = true;
+      start_.push_back(keys_.size());
+      AppendPrefixFilterKey(&keys_, prefix);
+    }
+  }
 }
 
 Slice FilterBlockBuilder::Finish() {
@@ -73,6 +100,7 @@ void FilterBlockBuilder::GenerateFilter() {
   tmp_keys_.clear();
   keys_.clear();
   start_.clear();
+  has_last_prefix_ = false;
 }
 
 FilterBlockReader::FilterBlockReader(const FilterPolicy* policy,
@@ -108,4 +136,11 @@ bool FilterBlockReader::KeyMayMatch(uint64_t block_offset, const Slice& key) {
   return true;  // Errors are treated as potential matches
 }
 
+bool FilterBlockReader::PrefixMayMatch(uint64_t block_offset,
+                                       const Slice& prefix) {
+  std::string key;
+  AppendPrefixFilterKey(&key, prefix);
+  return KeyMayMatch(block_offset, key);
+}
+
 }
@@ -19,16 +19,23 @@
 namespace leveldb {
 
 class FilterPolicy;
+class SliceTransform;
+
+// Append to *dst the entry that filters hold for key prefix "prefix".
+extern void AppendPrefixFilterKey(std::string* dst, const Slice& prefix);
 
 // A FilterBlockBuilder is used to construct all of the filters for a
 // particular Table.  It generates a single string which is stored as
 // a special block in the Table.
 //
+// If a prefix extractor is supplied, the filters also summarize the
+// prefix of every key in the extractor's domain.
+//
 // The sequence of calls to FilterBlockBuilder must match the regexp:
 //      (StartBlock AddKey*)* Finish
 class FilterBlockBuilder {
  public:
-  explicit FilterBlockBuilder(const FilterPolicy*);
+  FilterBlockBuilder(const FilterPolicy*, const SliceTransform*);
 
   void StartBlock(uint64_t block_offset);
   void AddKey(const Slice& key);
@@ -38,7 +45,10 @@ class FilterBlockBuilder {
   void GenerateFilter();
 
   const FilterPolicy* policy_;
+  const SliceTransform* prefix_extractor_;
   std::string keys_;              // Flattened key contents
+  std::string last_prefix_;       // Last prefix added to the current filter
+  bool has_last_prefix_;
   std::vector<size_t> start_;     // Starting index in keys_ of each key
   std::string result_;            // Filter data computed so far
   std::vector<Slice> tmp_keys_;   // policy_->CreateFilter() argument
@@ -55,6 +65,10 @@ class FilterBlockReader {
   FilterBlockReader(const FilterPolicy* policy, const Slice& contents);
   bool KeyMayMatch(uint64_t block_offset, const Slice& key);
 
+  // Like KeyMayMatch(), but for a prefix produced by the prefix
+  // extractor the filters were built with.
+  bool PrefixMayMatch(uint64_t block_offset, const Slice& prefix);
+
  private:
   const FilterPolicy* policy_;
   const char* data_;    // Pointer to filter data (at block-start)
@@ -46,7 +46,7 @@ class BlockHandle {
 // end of every table file.
 class Footer {
  public:
-  Footer() { }
+  Footer() : partitioned_index_(false) { }
 
   // The block handle for the metaindex block of the table
   const BlockHandle& metaindex_handle() const { return metaindex_handle_; }
@@ -60,6 +60,12 @@ class Footer {
     index_handle_ = h;
   }
 
+  // Is the index block a top-level index over index partitions?  Such
+  // tables carry a different magic number so that readers which do
+  // not know about partitions reject them instead of misreading them.
+  bool partitioned_index() const { return partitioned_index_; }
+  void set_partitioned_index(bool b) { partitioned_index_ = b; }
+
   void EncodeTo(std::string* dst) const;
   Status DecodeFrom(Slice* input);
 
@@ -73,6 +79,7 @@ class Footer {
  private:
   BlockHandle metaindex_handle_;
   BlockHandle index_handle_;
+  bool partitioned_index_;
 };
 
 // kTableMagicNumber was picked by running
@@ -80,6 +87,11 @@ class Footer {
 // and taking the leading 64 bits.
 static const uint64_t kTableMagicNumber = 0xdb4775248b80fb57ull;
 
+// kPartitionedTableMagicNumber marks tables with a partitioned index.
+// It was picked like kTableMagicNumber, from
+//    echo -n http://code.google.com/p/leveldb/partitioned | sha1sum
+static const uint64_t kPartitionedTableMagicNumber = 0xef8b5644ba1d6a1bull;
+
 // 1-byte type + 32-bit crc
 static const size_t kBlockTrailerSize = 5;
 
@@ -0,0 +1,73 @@
+// Copyright (c) 2012 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "table/full_filter_block.h"
+
+#include "leveldb/filter_policy.h"
+#include "leveldb/slice_transform.h"
+#include "table/filter_block.h"
+
+namespace leveldb {
+
+FullFilterBlockBuilder::FullFilterBlockBuilder(
+    const FilterPolicy* policy, const SliceTransform* prefix_extractor)
+    : policy_(policy),
+      prefix_extractor_(prefix_extractor),
+      has_last_prefix_(false) {
+}
+
+void FullFilterBlockBuilder::AddKey(const Slice& key) {
+  start_.push_back(keys_.size());
+  keys_.append(key.data(), key.size());
+
+  if (prefix_extractor_ != NULL && prefix_extractor_->InDomain(key)) {
+    // Keys arrive in sorted order, so each prefix is added once.
+    Slice prefix = prefix_extractor_->Transform(key);
+    if (!has_last_prefix_ || prefix != Slice(last_prefix_)) {
+      last_prefix_.assign(prefix.data(), prefix.size());
+      has_last_prefix_ = true;
+      start_.push_back(keys_.size());
+      AppendPrefixFilterKey(&keys_, prefix);
+    }
+  }
+}
+
+Slice FullFilterBlockBuilder::Finish() {
+  const size_t num_keys = start_.size();
+  if (num_keys > 0) {
+    std::vector<Slice> tmp_keys(num_keys);
+    start_.push_back(keys_.size());  // Simplify length computation
+    for (size_t i = 0; i < num_keys; i++) {
+      const char* base = keys_.data() + start_[i];
+      size_t length = start_[i+1] - start_[i];
+      tmp_keys[i] = Slice(base, length);
+    }
+    policy_->CreateFilter(&tmp_keys[0], static_cast<int>(num_keys), &result_);
+  }
+  keys_.clear();
+  start_.clear();
+  return Slice(result_);
+}
+
+FullFilterBlockReader::FullFilterBlockReader(const FilterPolicy* policy,
+                                             const Slice& contents)
+    : policy_(policy),
+      contents_(contents) {
+}
+
+bool FullFilterBlockReader::KeyMayMatch(const Slice& key) const {
+  if (contents_.empty()) {
+    // The table holds no keys
+    return false;
+  }
+  return policy_->KeyMayMatch(key, contents_);
+}
+
+bool FullFilterBlockReader::PrefixMayMatch(const Slice& prefix) const {
+  std::string key;
+  AppendPrefixFilterKey(&key, prefix);
+  return KeyMayMatch(key);
+}
+
+}  // namespace leveldb
@@ -0,0 +1,64 @@
+// Copyright (c) 2012 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// A full filter block holds a single filter (e.g., a bloom filter) for
+// all of the keys in a Table, as an alternative to the per-2KB filters
+// of a filter block.  It can be consulted before locating a key's data
+// block through the index, and pays the per-filter overhead only once.
+
+#ifndef STORAGE_LEVELDB_TABLE_FULL_FILTER_BLOCK_H_
+#define STORAGE_LEVELDB_TABLE_FULL_FILTER_BLOCK_H_
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include "leveldb/slice.h"
+
+namespace leveldb {
+
+class FilterPolicy;
+class SliceTransform;
+
+// A FullFilterBlockBuilder collects the keys of a Table (and, if a
+// prefix extractor is supplied, the prefixes of the keys in its domain)
+// and generates one filter for all of them.
+//
+// The sequence of calls to FullFilterBlockBuilder must match the regexp:
+//      AddKey* Finish
+class FullFilterBlockBuilder {
+ public:
+  FullFilterBlockBuilder(const FilterPolicy*, const SliceTransform*);
+
+  void AddKey(const Slice& key);
+  Slice Finish();
+
+ private:
+  const FilterPolicy* policy_;
+  const SliceTransform* prefix_extractor_;
+  std::string keys_;              // Flattened key contents
+  std::vector<size_t> start_;     // Starting index in keys_ of each key
+  std::string last_prefix_;       // Last prefix added
+  bool has_last_prefix_;
+  std::string result_;            // Filter data
+
+  // No copying allowed
+  FullFilterBlockBuilder(const FullFilterBlockBuilder&);
+  void operator=(const FullFilterBlockBuilder&);
+};
+
+class FullFilterBlockReader {
+ public:
+  // REQUIRES: "contents" and *policy must stay live while *this is live.
+  FullFilterBlockReader(const FilterPolicy* policy, const Slice& contents);
+  bool KeyMayMatch(const Slice& key) const;
+  bool PrefixMayMatch(const Slice& prefix) const;
+
+ private:
+  const FilterPolicy* policy_;
+  Slice contents_;
+};
+
+}
+
+#endif  // STORAGE_LEVELDB_TABLE_FULL_FILTER_BLOCK_H_
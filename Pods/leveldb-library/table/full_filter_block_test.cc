@@ -0,0 +1,105 @@
+// Copyright (c) 2012 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "table/full_filter_block.h"
+
+#include "leveldb/filter_policy.h"
+#include "leveldb/slice_transform.h"
+#include "util/coding.h"
+#include "util/hash.h"
+#include "util/logging.h"
+#include "util/testharness.h"
+#include "util/testutil.h"
+
+namespace leveldb {
+
+// For testing: emit an array with one hash value per key
+class TestHashFilter : public FilterPolicy {
+ public:
+  virtual const char* Name() const {
+    return "TestHashFilter";
+  }
+
+  virtual void CreateFilter(const Slice* keys, int n, std::string* dst) const {
+    for (int i = 0; i < n; i++) {
+      uint32_t h = Hash(keys[i].data(), keys[i].size(), 1);
+      PutFixed32(dst, h);
+    }
+  }
+
+  virtual bool KeyMayMatch(const Slice& key, const Slice& filter) const {
+    uint32_t h = Hash(key.data(), key.size(), 1);
+    for (size_t i = 0; i + 4 <= filter.size(); i += 4) {
+      if (h == DecodeFixed32(filter.data() + i)) {
+        return true;
+      }
+    }
+    return false;
+  }
+};
+
+class FullFilterBlockTest {
+ public:
+  TestHashFilter policy_;
+};
+
+TEST(FullFilterBlockTest, EmptyBuilder) {
+  FullFilterBlockBuilder builder(&policy_, NULL);
+  Slice block = builder.Finish();
+  ASSERT_EQ("", EscapeString(block));
+  FullFilterBlockReader reader(&policy_, block);
+  ASSERT_TRUE(! reader.KeyMayMatch("foo"));
+  ASSERT_TRUE(! reader.PrefixMayMatch("foo"));
+}
+
+TEST(FullFilterBlockTest, SingleFilter) {
+  FullFilterBlockBuilder builder(&policy_, NULL);
+  builder.AddKey("bar");
+  builder.AddKey("box");
+  builder.AddKey("foo");
+  builder.AddKey("hello");
+  Slice block = builder.Finish();
+
+  // One hash per key: a single filter covers the whole table
+  ASSERT_EQ(16, block.size());
+  FullFilterBlockReader reader(&policy_, block);
+  ASSERT_TRUE(reader.KeyMayMatch("foo"));
+  ASSERT_TRUE(reader.KeyMayMatch("bar"));
+  ASSERT_TRUE(reader.KeyMayMatch("box"));
+  ASSERT_TRUE(reader.KeyMayMatch("hello"));
+  ASSERT_TRUE(! reader.KeyMayMatch("missing"));
+  ASSERT_TRUE(! reader.KeyMayMatch("other"));
+}
+
+TEST(FullFilterBlockTest, Prefixes) {
+  const SliceTransform* prefix_extractor = NewFixedPrefixTransform(3);
+  FullFilterBlockBuilder builder(&policy_, prefix_extractor);
+  builder.AddKey("ab");        // Outside the extractor's domain
+  builder.AddKey("bar1");
+  builder.AddKey("bar2");
+  builder.AddKey("foo1");
+  builder.AddKey("zap");
+  Slice block = builder.Finish();
+
+  // Each prefix is added once
+  ASSERT_EQ(4 * (5 + 3), block.size());
+  FullFilterBlockReader reader(&policy_, block);
+  ASSERT_TRUE(reader.KeyMayMatch("ab"));
+  ASSERT_TRUE(reader.KeyMayMatch("bar1"));
+  ASSERT_TRUE(reader.KeyMayMatch("zap"));
+  ASSERT_TRUE(reader.PrefixMayMatch("bar"));
+  ASSERT_TRUE(reader.PrefixMayMatch("foo"));
+  ASSERT_TRUE(reader.PrefixMayMatch("zap"));
+  ASSERT_TRUE(! reader.PrefixMayMatch("baz"));
+  ASSERT_TRUE(! reader.PrefixMayMatch("ab"));
+  ASSERT_TRUE(! reader.KeyMayMatch("bar"));
+
+  delete prefix_extractor;
+}
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  return leveldb::test::RunAllTests();
+}
@@ -4,6 +4,7 @@
 
 #include "table/merger.h"
 
+#include <vector>
 #include "leveldb/comparator.h"
 #include "leveldb/iterator.h"
 #include "table/iterator_wrapper.h"
@@ -11,6 +12,12 @@
 namespace leveldb {
 
 namespace {
+
+// Yields the union of the children by keeping the valid ones in a binary
+// heap ordered by their current keys: smallest key first when moving
+// forward, largest key first when moving in reverse.  Stepping costs
+// O(log n) comparisons instead of the O(n) of a linear scan, and only
+// one or two while the same child keeps yielding the next key.
 class MergingIterator : public Iterator {
  public:
   MergingIterator(const Comparator* comparator, Iterator** children, int n)
@@ -22,6 +29,7 @@ class MergingIterator : public Iterator {
     for (int i = 0; i < n; i++) {
       children_[i].Set(children[i]);
     }
+    heap_.reserve(n);
   }
 
   virtual ~MergingIterator() {
@@ -36,24 +44,24 @@ class MergingIterator : public Iterator {
     for (int i = 0; i < n_; i++) {
       children_[i].SeekToFirst();
     }
-    FindSmallest();
     direction_ = kForward;
+    BuildHeap();
   }
 
   virtual void SeekToLast() {
     for (int i = 0; i < n_; i++) {
       children_[i].SeekToLast();
     }
-    FindLargest();
     direction_ = kReverse;
+    BuildHeap();
   }
 
   virtual void Seek(const Slice& target) {
     for (int i = 0; i < n_; i++) {
       children_[i].Seek(target);
     }
-    FindSmallest();
     direction_ = kForward;
+    BuildHeap();
   }
 
   virtual void Next() {
@@ -76,10 +84,13 @@ class MergingIterator : public Iterator {
         }
       }
       direction_ = kForward;
+      current_->Next();
+      BuildHeap();
+      return;
     }
 
     current_->Next();
-    FindSmallest();
+    ReplaceTop();
   }
 
   virtual void Prev() {
@@ -105,10 +116,13 @@ class MergingIterator : public Iterator {
         }
       }
       direction_ = kReverse;
+      current_->Prev();
+      BuildHeap();
+      return;
     }
 
     current_->Prev();
-    FindLargest();
+    ReplaceTop();
   }
 
   virtual Slice key() const {
@@ -133,16 +147,33 @@ class MergingIterator : public Iterator {
   }
 
  private:
-  void FindSmallest();
-  void FindLargest();
+  // Returns true if "a" should be yielded before "b" in the current
+  // direction.  Ties go to the earlier child when moving forward and to
+  // the later child when moving in reverse.
+  bool Before(const IteratorWrapper* a, const IteratorWrapper* b) const {
+    const int r = comparator_->Compare(a->key(), b->key());
+    if (r != 0) {
+      return (direction_ == kForward) == (r < 0);
+    }
+    return (direction_ == kForward) == (a < b);
+  }
+
+  // Rebuild the heap from the valid children.
+  void BuildHeap();
+
+  // Restore the heap after the child at its top has moved.
+  void ReplaceTop();
+
+  void SiftDown(size_t pos);
 
-  // We might want to use a heap in case there are lots of children.
-  // For now we use a simple array since we expect a very small number
-  // of children in leveldb.
   const Comparator* comparator_;
   IteratorWrapper* children_;
   int n_;
-  IteratorWrapper* current_;
+  IteratorWrapper* current_;  // == heap_[0], or NULL if heap_ is empty
+
+  // The valid children, ordered so that no child is yielded before its
+  // parent: heap_[i] is the parent of heap_[2i+1] and heap_[2i+2].
+  std::vector<IteratorWrapper*> heap_;
 
   // Which direction is the iterator moving?
   enum Direction {
@@ -152,34 +183,51 @@ class MergingIterator : public Iterator {
   Direction direction_;
 };
 
-void MergingIterator::FindSmallest() {
-  IteratorWrapper* smallest = NULL;
+void MergingIterator::BuildHeap() {
+  heap_.clear();
   for (int i = 0; i < n_; i++) {
-    IteratorWrapper* child = &children_[i];
-    if (child->Valid()) {
-      if (smallest == NULL) {
-        smallest = child;
-      } else if (comparator_->Compare(child->key(), smallest->key()) < 0) {
-        smallest = child;
-      }
+    if (children_[i].Valid()) {
+      heap_.push_back(&children_[i]);
     }
   }
-  current_ = smallest;
+  for (size_t i = heap_.size() / 2; i > 0; i--) {
+    SiftDown(i - 1);
+  }
+  current_ = heap_.empty() ? NULL : heap_[0];
 }
 
-void MergingIterator::FindLargest() {
-  IteratorWrapper* largest = NULL;
-  for (int i = n_-1; i >= 0; i--) {
-    IteratorWrapper* child = &children_[i];
-    if (child->Valid()) {
-      if (largest == NULL) {
-        largest = child;
-      } else if (comparator_->Compare(child->key(), largest->key()) > 0) {
-        largest = child;
-      }
+void MergingIterator::ReplaceTop() {
+  assert(!heap_.empty() && current_ == heap_[0]);
+  if (!current_->Valid()) {
+    heap_[0] = heap_.back();
+    heap_.pop_back();
+    if (heap_.empty()) {
+      current_ = NULL;
+      return;
+    }
+  }
+  SiftDown(0);
+  current_ = heap_[0];
+}
+
+void MergingIterator::SiftDown(size_t pos) {
+  const size_t size = heap_.size();
+  IteratorWrapper* child = heap_[pos];
+  while (true) {
+    size_t next = 2 * pos + 1;
+    if (next >= size) {
+      break;
+    }
+    if (next + 1 < size && Before(heap_[next + 1], heap_[next])) {
+      next++;
+    }
+    if (!Before(heap_[next], child)) {
+      break;
     }
+    heap_[pos] = heap_[next];
+    pos = next;
   }
-  current_ = largest;
+  heap_[pos] = child;
 }
 }  // namespace
 
@@ -0,0 +1,167 @@
+// Copyright (c) 2012 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// Measures the throughput of a merging iterator over 2 to 64 children,
+// scanning forward and in reverse, and the number of key comparisons it
+// makes per entry.
+//
+// Usage: merger_bench [--num=N] [--run=R]
+//
+//   --num  total number of keys, spread over the children
+//   --run  number of consecutive keys given to the same child: 1 spreads
+//          the keys at random like overlapping level-0 files, larger
+//          values give long runs from one child like disjoint levels
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include "leveldb/comparator.h"
+#include "leveldb/env.h"
+#include "leveldb/iterator.h"
+#include "leveldb/options.h"
+#include "leveldb/slice.h"
+#include "table/block.h"
+#include "table/block_builder.h"
+#include "table/format.h"
+#include "table/merger.h"
+#include "util/random.h"
+
+namespace leveldb {
+
+namespace {
+
+int FLAGS_num = 1000000;
+int FLAGS_run = 1;
+
+// Counts the comparisons made through it
+class CountingComparator : public Comparator {
+ public:
+  CountingComparator() : count_(0) { }
+  virtual int Compare(const Slice& a, const Slice& b) const {
+    count_++;
+    return BytewiseComparator()->Compare(a, b);
+  }
+  virtual const char* Name() const { return "leveldb.CountingComparator"; }
+  virtual void FindShortestSeparator(std::string*, const Slice&) const { }
+  virtual void FindShortSuccessor(std::string*) const { }
+
+  uint64_t count() const { return count_; }
+  void Reset() { count_ = 0; }
+
+ private:
+  mutable uint64_t count_;
+};
+
+static void MakeKey(int i, std::string* key) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%016d", i);
+  key->assign(buf);
+}
+
+static void Run(int n) {
+  // Give the keys to the children in runs of FLAGS_run, and build one
+  // in-memory block per child.
+  Random rnd(301 + n);
+  std::vector<BlockBuilder*> builders;
+  Options options;
+  options.block_restart_interval = 16;
+  for (int i = 0; i < n; i++) {
+    builders.push_back(new BlockBuilder(&options));
+  }
+  std::string key;
+  for (int i = 0; i < FLAGS_num; ) {
+    BlockBuilder* builder = builders[rnd.Uniform(n)];
+    for (int j = 0; j < FLAGS_run && i < FLAGS_num; j++, i++) {
+      MakeKey(i, &key);
+      builder->Add(key, Slice("value", 5));
+    }
+  }
+  // The blocks point into the buffers of their builders
+  std::vector<Block*> blocks;
+  for (int i = 0; i < n; i++) {
+    BlockContents contents;
+    contents.data = builders[i]->Finish();
+    contents.cachable = false;
+    contents.heap_allocated = false;
+    blocks.push_back(new Block(contents));
+  }
+
+  CountingComparator cmp;
+  std::vector<Iterator*> children;
+  for (int i = 0; i < n; i++) {
+    children.push_back(blocks[i]->NewIterator(&cmp));
+  }
+  Iterator* iter = NewMergingIterator(&cmp, &children[0], n);
+
+  Env* env = Env::Default();
+  cmp.Reset();
+  uint64_t start = env->NowMicros();
+  int count = 0;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    count++;
+  }
+  const uint64_t forward_micros = env->NowMicros() - start;
+  const uint64_t forward_compares = cmp.count();
+
+  cmp.Reset();
+  start = env->NowMicros();
+  for (iter->SeekToLast(); iter->Valid(); iter->Prev()) {
+    count--;
+  }
+  const uint64_t reverse_micros = env->NowMicros() - start;
+  const uint64_t reverse_compares = cmp.count();
+  if (count != 0 || !iter->status().ok()) {
+    fprintf(stderr, "%d children: scans disagree\n", n);
+    exit(1);
+  }
+  delete iter;
+
+  fprintf(stdout,
+          "%3d children : %7.1f ns/key %6.2f cmp/key forward"
+          "  %7.1f ns/key %6.2f cmp/key reverse\n",
+          n,
+          forward_micros * 1000.0 / FLAGS_num,
+          forward_compares * 1.0 / FLAGS_num,
+          reverse_micros * 1000.0 / FLAGS_num,
+          reverse_compares * 1.0 / FLAGS_num);
+
+  for (int i = 0; i < n; i++) {
+    delete blocks[i];
+    delete builders[i];
+  }
+}
+
+}  // namespace
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  for (int i = 1; i < argc; i++) {
+    int n;
+    char junk;
+    if (sscanf(argv[i], "--num=%d%c", &n, &junk) == 1) {
+      leveldb::FLAGS_num = n;
+    } else if (sscanf(argv[i], "--run=%d%c", &n, &junk) == 1) {
+      leveldb::FLAGS_run = n;
+    } else {
+      fprintf(stderr, "Invalid flag '%s'\n", argv[i]);
+      exit(1);
+    }
+  }
+  if (leveldb::FLAGS_num < 1 || leveldb::FLAGS_run < 1) {
+    fprintf(stderr, "--num and --run must be positive\n");
+    exit(1);
+  }
+
+  fprintf(stdout, "Keys:       %d\n", leveldb::FLAGS_num);
+  fprintf(stdout, "Run:        %d\n", leveldb::FLAGS_run);
+  fprintf(stdout, "------------------------------------------------\n");
+
+  static const int kChildren[] = { 2, 4, 8, 16, 32, 64 };
+  for (size_t i = 0; i < sizeof(kChildren) / sizeof(kChildren[0]); i++) {
+    leveldb::Run(kChildren[i]);
+  }
+  return 0;
+}
@@ -0,0 +1,220 @@
+// Copyright (c) 2012 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "table/merger.h"
+
+#include <stdio.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "leveldb/comparator.h"
+#include "leveldb/iterator.h"
+#include "leveldb/options.h"
+#include "table/block.h"
+#include "table/block_builder.h"
+#include "table/format.h"
+#include "util/random.h"
+#include "util/testharness.h"
+
+namespace leveldb {
+
+// Counts the comparisons made through it
+class CountingComparator : public Comparator {
+ public:
+  CountingComparator() : count_(0) { }
+  virtual int Compare(const Slice& a, const Slice& b) const {
+    count_++;
+    return BytewiseComparator()->Compare(a, b);
+  }
+  virtual const char* Name() const { return "leveldb.CountingComparator"; }
+  virtual void FindShortestSeparator(std::string*, const Slice&) const { }
+  virtual void FindShortSuccessor(std::string*) const { }
+
+  uint64_t count() const { return count_; }
+  void Reset() { count_ = 0; }
+
+ private:
+  mutable uint64_t count_;
+};
+
+static std::string MakeKey(int i) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%08d", i);
+  return std::string(buf);
+}
+
+class MergerTest {
+ public:
+  CountingComparator cmp_;
+  std::map<std::string, std::string> model_;
+  std::vector<BlockBuilder*> builders_;
+  std::vector<Block*> blocks_;
+  Iterator* iter_;
+
+  MergerTest() : iter_(NULL) { }
+
+  ~MergerTest() {
+    Reset();
+  }
+
+  void Reset() {
+    delete iter_;
+    iter_ = NULL;
+    for (size_t i = 0; i < blocks_.size(); i++) {
+      delete blocks_[i];
+    }
+    blocks_.clear();
+    for (size_t i = 0; i < builders_.size(); i++) {
+      delete builders_[i];
+    }
+    builders_.clear();
+    model_.clear();
+  }
+
+  // Merge "n" children, one in-memory block each, that between them hold
+  // "num" keys handed out in runs of "run" consecutive keys.  Every other
+  // key is left out, so that seeks also land between keys.
+  void Build(int n, int num, int run, Random* rnd) {
+    Reset();
+    Options options;
+    options.block_restart_interval = 4;
+    for (int i = 0; i < n; i++) {
+      builders_.push_back(new BlockBuilder(&options));
+    }
+    for (int i = 0; i < num && n > 0; ) {
+      BlockBuilder* builder = builders_[rnd->Uniform(n)];
+      for (int j = 0; j < run && i < num; j++, i++) {
+        const std::string key = MakeKey(2 * i);
+        const std::string value = "v" + MakeKey(i);
+        builder->Add(key, value);
+        model_[key] = value;
+      }
+    }
+    std::vector<Iterator*> children;
+    for (int i = 0; i < n; i++) {
+      // The blocks point into the buffers of their builders
+      BlockContents contents;
+      contents.data = builders_[i]->Finish();
+      contents.cachable = false;
+      contents.heap_allocated = false;
+      blocks_.push_back(new Block(contents));
+      children.push_back(blocks_[i]->NewIterator(&cmp_));
+    }
+    iter_ = NewMergingIterator(&cmp_, n > 0 ? &children[0] : NULL, n);
+  }
+
+  void CheckScans() {
+    std::map<std::string, std::string>::const_iterator it = model_.begin();
+    for (iter_->SeekToFirst(); iter_->Valid(); iter_->Next(), ++it) {
+      ASSERT_TRUE(it != model_.end());
+      ASSERT_EQ(it->first, iter_->key().ToString());
+      ASSERT_EQ(it->second, iter_->value().ToString());
+    }
+    ASSERT_TRUE(it == model_.end());
+    std::map<std::string, std::string>::const_reverse_iterator rit =
+        model_.rbegin();
+    for (iter_->SeekToLast(); iter_->Valid(); iter_->Prev(), ++rit) {
+      ASSERT_TRUE(rit != model_.rend());
+      ASSERT_EQ(rit->first, iter_->key().ToString());
+      ASSERT_EQ(rit->second, iter_->value().ToString());
+    }
+    ASSERT_TRUE(rit == model_.rend());
+  }
+
+  // Seek to random targets and move in random directions, switching
+  // direction often
+  void CheckRandomMoves(int num, Random* rnd) {
+    for (int i = 0; i < 200; i++) {
+      const std::string target = MakeKey(rnd->Uniform(2 * num + 2));
+      iter_->Seek(target);
+      std::map<std::string, std::string>::const_iterator it =
+          model_.lower_bound(target);
+      for (int step = 0; step < 30; step++) {
+        if (it == model_.end()) {
+          ASSERT_TRUE(!iter_->Valid());
+          break;
+        }
+        ASSERT_TRUE(iter_->Valid());
+        ASSERT_EQ(it->first, iter_->key().ToString());
+        ASSERT_EQ(it->second, iter_->value().ToString());
+        if (rnd->OneIn(2)) {
+          iter_->Next();
+          ++it;
+        } else if (it == model_.begin()) {
+          iter_->Prev();
+          ASSERT_TRUE(!iter_->Valid());
+          break;
+        } else {
+          iter_->Prev();
+          --it;
+        }
+      }
+    }
+    ASSERT_OK(iter_->status());
+  }
+
+  // Return the number of comparisons per entry of a forward scan
+  double ComparesPerEntry() {
+    cmp_.Reset();
+    int count = 0;
+    for (iter_->SeekToFirst(); iter_->Valid(); iter_->Next()) {
+      count++;
+    }
+    return static_cast<double>(cmp_.count()) / count;
+  }
+};
+
+TEST(MergerTest, Empty) {
+  Random rnd(301);
+  for (int n = 0; n < 3; n++) {
+    Build(n, 0, 1, &rnd);
+    iter_->SeekToFirst();
+    ASSERT_TRUE(!iter_->Valid());
+    iter_->SeekToLast();
+    ASSERT_TRUE(!iter_->Valid());
+    iter_->Seek("foo");
+    ASSERT_TRUE(!iter_->Valid());
+  }
+}
+
+TEST(MergerTest, ManyChildren) {
+  static const int kChildren[] = { 1, 2, 3, 5, 8, 13, 32, 64 };
+  static const int kRuns[] = { 1, 7, 100 };
+  Random rnd(301);
+  for (size_t c = 0; c < sizeof(kChildren) / sizeof(kChildren[0]); c++) {
+    for (size_t r = 0; r < sizeof(kRuns) / sizeof(kRuns[0]); r++) {
+      const int num = 20 * kChildren[c] + rnd.Uniform(100);
+      Build(kChildren[c], num, kRuns[r], &rnd);
+      CheckScans();
+      CheckRandomMoves(num, &rnd);
+    }
+  }
+}
+
+TEST(MergerTest, SomeChildrenEmpty) {
+  // With 64 children and 30 keys, most children hold nothing
+  Random rnd(301);
+  Build(64, 30, 1, &rnd);
+  CheckScans();
+  CheckRandomMoves(30, &rnd);
+}
+
+TEST(MergerTest, ComparisonsPerEntry) {
+  Random rnd(301);
+
+  // Keys spread at random over the children cost about log2(n)
+  // comparisons per step, not n
+  Build(64, 64 * 200, 1, &rnd);
+  ASSERT_LT(ComparesPerEntry(), 2 * 6 + 2);
+
+  // Long runs from one child take the fast path
+  Build(64, 64 * 200, 1000, &rnd);
+  ASSERT_LT(ComparesPerEntry(), 3);
+}
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  return leveldb::test::RunAllTests();
+}
@@ -0,0 +1,64 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "table/prefix_filtered_iterator.h"
+
+#include "leveldb/iterator.h"
+
+namespace leveldb {
+
+namespace {
+
+class PrefixFilteredIterator : public Iterator {
+ public:
+  PrefixFilteredIterator(Iterator* iter,
+                         bool (*may_match)(void*, const Slice&),
+                         void* arg)
+      : iter_(iter),
+        may_match_(may_match),
+        arg_(arg),
+        filtered_(false) {
+  }
+  virtual ~PrefixFilteredIterator() {
+    delete iter_;
+  }
+
+  virtual bool Valid() const { return !filtered_ && iter_->Valid(); }
+  virtual void Seek(const Slice& target) {
+    filtered_ = !(*may_match_)(arg_, target);
+    if (!filtered_) {
+      iter_->Seek(target);
+    }
+  }
+  virtual void SeekToFirst() { filtered_ = false; iter_->SeekToFirst(); }
+  virtual void SeekToLast() { filtered_ = false; iter_->SeekToLast(); }
+  virtual void Next() { assert(Valid()); iter_->Next(); }
+  virtual void Prev() { assert(Valid()); iter_->Prev(); }
+  virtual Slice key() const { assert(Valid()); return iter_->key(); }
+  virtual Slice value() const { assert(Valid()); return iter_->value(); }
+  virtual Status status() const {
+    return filtered_ ? Status::OK() : iter_->status();
+  }
+
+ private:
+  Iterator* const iter_;
+  bool (*const may_match_)(void*, const Slice&);
+  void* const arg_;
+  bool filtered_;   // Did the last Seek() skip iter_?
+
+  // No copying allowed
+  PrefixFilteredIterator(const PrefixFilteredIterator&);
+  void operator=(const PrefixFilteredIterator&);
+};
+
+}  // namespace
+
+Iterator* NewPrefixFilteredIterator(
+    Iterator* iter,
+    bool (*may_match)(void* arg, const Slice& target),
+    void* arg) {
+  return new PrefixFilteredIterator(iter, may_match, arg);
+}
+
+}  // namespace leveldb
@@ -0,0 +1,27 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef STORAGE_LEVELDB_TABLE_PREFIX_FILTERED_ITERATOR_H_
+#define STORAGE_LEVELDB_TABLE_PREFIX_FILTERED_ITERATOR_H_
+
+namespace leveldb {
+
+class Iterator;
+class Slice;
+
+// Return an iterator that behaves like "iter", except that each Seek()
+// first calls (*may_match)(arg, target).  If that returns false, the
+// result becomes invalid without seeking "iter", as there is no entry
+// at or after "target" that the caller is interested in (typically
+// because a filter shows that none of them share the prefix of
+// "target").  Takes ownership of "iter" and will delete it when the
+// result is deleted.
+extern Iterator* NewPrefixFilteredIterator(
+    Iterator* iter,
+    bool (*may_match)(void* arg, const Slice& target),
+    void* arg);
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_TABLE_PREFIX_FILTERED_ITERATOR_H_
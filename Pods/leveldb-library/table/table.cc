@@ -9,36 +9,85 @@
 #include "leveldb/env.h"
 #include "leveldb/filter_policy.h"
 #include "leveldb/options.h"
+#include "leveldb/slice_transform.h"
 #include "table/block.h"
 #include "table/filter_block.h"
 #include "table/format.h"
+#include "table/full_filter_block.h"
+#include "table/prefix_filtered_iterator.h"
 #include "table/two_level_iterator.h"
 #include "util/coding.h"
 
 namespace leveldb {
 
+// The filter of a table, or a filter partition.
+struct FilterEntry {
+  FilterBlockReader* filter;           // Per-block filters, or
+  FullFilterBlockReader* full_filter;  // a single filter for the keys
+  const char* heap_data;  // Data to delete[] along with the reader, if any
+};
+
+static void DeleteFilterEntry(FilterEntry* entry) {
+  if (entry != NULL) {
+    delete entry->filter;
+    delete entry->full_filter;
+    delete[] entry->heap_data;
+    delete entry;
+  }
+}
+
 struct Table::Rep {
   ~Rep() {
-    delete filter;
-    delete [] filter_data;
-    delete index_block;
+    if (filter_cache_handle != NULL) {
+      options.block_cache->Release(filter_cache_handle);
+    } else {
+      DeleteFilterEntry(filter);
+    }
+    if (index_cache_handle != NULL) {
+      options.block_cache->Release(index_cache_handle);
+    } else {
+      delete index_block;
+    }
+    delete range_del_block;
   }
 
   Options options;
   Status status;
   RandomAccessFile* file;
   uint64_t cache_id;
-  FilterBlockReader* filter;
-  const char* filter_data;
+  bool metadata_in_cache;  // Index and filter live in options.block_cache?
+
+  // The filter, if has_filter.  Unless "filter" is non-NULL, it is read
+  // through the block cache when needed.
+  bool has_filter;
+  bool full_filter;  // A single filter for the table?
+  BlockHandle filter_handle;
+  FilterEntry* filter;                 // Owned, or pinned in the cache by
+  Cache::Handle* filter_cache_handle;  // this handle if non-NULL
+  bool prefix_filtered;  // filter summarizes options.prefix_extractor?
+  bool partitioned_index;   // index_block is a top-level index?
+  bool partitioned_filter;  // Top-level index entries name filter partitions?
 
   BlockHandle metaindex_handle;  // Handle to metaindex_block: saved from footer
-  Block* index_block;
+  BlockHandle index_handle;
+  Block* index_block;                 // Like filter and filter_cache_handle;
+  Cache::Handle* index_cache_handle;  // index_block may be NULL too
+
+  Block* range_del_block;  // Range deletion entries, or NULL if none
 };
 
 Status Table::Open(const Options& options,
                    RandomAccessFile* file,
                    uint64_t size,
                    Table** table) {
+  return Open(options, file, size, false, table);
+}
+
+Status Table::Open(const Options& options,
+                   RandomAccessFile* file,
+                   uint64_t size,
+                   bool pin_metadata,
+                   Table** table) {
   *table = NULL;
   if (size < Footer::kEncodedLength) {
     return Status::Corruption("file is too short to be an sstable");
@@ -54,15 +103,45 @@ Status Table::Open(const Options& options,
   s = footer.DecodeFrom(&footer_input);
   if (!s.ok()) return s;
 
+  Rep* rep = new Table::Rep;
+  rep->options = options;
+  rep->file = file;
+  rep->cache_id = (options.block_cache ? options.block_cache->NewId() : 0);
+  rep->metadata_in_cache = (options.cache_index_and_filter_blocks &&
+                            options.block_cache != NULL);
+  rep->has_filter = false;
+  rep->full_filter = false;
+  rep->filter = NULL;
+  rep->filter_cache_handle = NULL;
+  rep->prefix_filtered = false;
+  rep->partitioned_index = footer.partitioned_index();
+  rep->partitioned_filter = false;
+  rep->metaindex_handle = footer.metaindex_handle();
+  rep->index_handle = footer.index_handle();
+  rep->index_block = NULL;
+  rep->index_cache_handle = NULL;
+  rep->range_del_block = NULL;
+  Table* t = new Table(rep);
+
   // Read the index block
-  BlockContents contents;
+  ReadOptions opt;
+  if (options.paranoid_checks) {
+    opt.verify_checksums = true;
+  }
   Block* index_block = NULL;
-  if (s.ok()) {
-    ReadOptions opt;
-    if (options.paranoid_checks) {
-      opt.verify_checksums = true;
+  Cache::Handle* cache_handle = NULL;
+  if (rep->metadata_in_cache) {
+    s = t->ReadCachedBlock(opt, rep->index_handle, Cache::kHighPriority,
+                           &index_block, &cache_handle);
+    if (s.ok() && cache_handle != NULL && !pin_metadata) {
+      // Leave the block to the cache
+      options.block_cache->Release(cache_handle);
+      index_block = NULL;
+      cache_handle = NULL;
     }
-    s = ReadBlock(file, opt, footer.index_handle(), &contents);
+  } else {
+    BlockContents contents;
+    s = ReadBlock(file, opt, rep->index_handle, &contents);
     if (s.ok()) {
       index_block = new Block(contents);
     }
@@ -71,73 +150,129 @@ Status Table::Open(const Options& options,
   if (s.ok()) {
     // We've successfully read the footer and the index block: we're
     // ready to serve requests.
-    Rep* rep = new Table::Rep;
-    rep->options = options;
-    rep->file = file;
-    rep->metaindex_handle = footer.metaindex_handle();
     rep->index_block = index_block;
-    rep->cache_id = (options.block_cache ? options.block_cache->NewId() : 0);
-    rep->filter_data = NULL;
-    rep->filter = NULL;
-    *table = new Table(rep);
-    (*table)->ReadMeta(footer);
+    rep->index_cache_handle = cache_handle;
+    s = t->ReadMeta(footer, pin_metadata);
+  }
+  if (s.ok()) {
+    *table = t;
   } else {
-    delete index_block;
+    delete t;
   }
 
   return s;
 }
 
-void Table::ReadMeta(const Footer& footer) {
-  if (rep_->options.filter_policy == NULL) {
-    return;  // Do not need any metadata
+Status Table::ReadMeta(const Footer& footer, bool pin_metadata) {
+  // An empty metaindex block holds nothing but its restart array
+  if (footer.metaindex_handle().size() <= 2 * sizeof(uint32_t)) {
+    return Status::OK();
   }
 
-  // TODO(sanjay): Skip this if footer.metaindex_handle() size indicates
-  // it is an empty block.
   ReadOptions opt;
   if (rep_->options.paranoid_checks) {
     opt.verify_checksums = true;
   }
   BlockContents contents;
-  if (!ReadBlock(rep_->file, opt, footer.metaindex_handle(), &contents).ok()) {
-    // Do not propagate errors since meta info is not needed for operation
-    return;
+  Status s = ReadBlock(rep_->file, opt, footer.metaindex_handle(), &contents);
+  if (!s.ok()) {
+    // Without the metaindex the range deletions could be missed
+    return s;
   }
   Block* meta = new Block(contents);
 
   Iterator* iter = meta->NewIterator(BytewiseComparator());
-  std::string key = "filter.";
-  key.append(rep_->options.filter_policy->Name());
+  std::string key;
+  if (rep_->options.filter_policy != NULL) {
+    // Errors reading the filters are not propagated since filters are
+    // not needed for operation
+    key = "fullfilter.";
+    key.append(rep_->options.filter_policy->Name());
+    iter->Seek(key);
+    if (iter->Valid() && iter->key() == Slice(key)) {
+      ReadFilter(iter->value(), true, pin_metadata);
+    } else if (rep_->partitioned_index) {
+      key = "partitionedfilter.";
+      key.append(rep_->options.filter_policy->Name());
+      iter->Seek(key);
+      rep_->partitioned_filter = (iter->Valid() && iter->key() == Slice(key));
+    }
+    if (!rep_->has_filter && !rep_->partitioned_filter) {
+      key = "filter.";
+      key.append(rep_->options.filter_policy->Name());
+      iter->Seek(key);
+      if (iter->Valid() && iter->key() == Slice(key)) {
+        ReadFilter(iter->value(), false, pin_metadata);
+      }
+    }
+    const bool has_filter = (rep_->has_filter || rep_->partitioned_filter);
+    if (has_filter && rep_->options.prefix_extractor != NULL) {
+      key = "prefix.";
+      key.append(rep_->options.prefix_extractor->Name());
+      iter->Seek(key);
+      rep_->prefix_filtered = (iter->Valid() && iter->key() == Slice(key));
+    }
+  }
+
+  key = "rangedeletions";
   iter->Seek(key);
   if (iter->Valid() && iter->key() == Slice(key)) {
-    ReadFilter(iter->value());
+    // The range deletions are few and needed by every read of the
+    // table, so they are kept out of the block cache
+    Slice v = iter->value();
+    BlockHandle handle;
+    s = handle.DecodeFrom(&v);
+    if (s.ok()) {
+      s = ReadBlock(rep_->file, opt, handle, &contents);
+    }
+    if (s.ok()) {
+      rep_->range_del_block = new Block(contents);
+    }
   }
   delete iter;
   delete meta;
+  return s;
 }
 
-void Table::ReadFilter(const Slice& filter_handle_value) {
+void Table::ReadFilter(const Slice& filter_handle_value, bool full,
+                       bool pin_metadata) {
   Slice v = filter_handle_value;
   BlockHandle filter_handle;
   if (!filter_handle.DecodeFrom(&v).ok()) {
     return;
   }
 
-  // We might want to unify with ReadBlock() if we start
-  // requiring checksum verification in Table::Open.
   ReadOptions opt;
   if (rep_->options.paranoid_checks) {
     opt.verify_checksums = true;
   }
-  BlockContents block;
-  if (!ReadBlock(rep_->file, opt, filter_handle, &block).ok()) {
+  FilterEntry* filter = NULL;
+  Cache::Handle* cache_handle = NULL;
+  if (!rep_->metadata_in_cache) {
+    opt.fill_cache = false;  // Owned by the table
+  }
+  if (!ReadCachedFilter(opt, filter_handle, full, Cache::kHighPriority,
+                        &filter, &cache_handle).ok()) {
     return;
   }
-  if (block.heap_allocated) {
-    rep_->filter_data = block.data.data();     // Will need to delete later
+  if (cache_handle != NULL && !pin_metadata) {
+    // Leave the filter to the cache
+    rep_->options.block_cache->Release(cache_handle);
+    filter = NULL;
+    cache_handle = NULL;
+  }
+  rep_->has_filter = true;
+  rep_->full_filter = full;
+  rep_->filter_handle = filter_handle;
+  rep_->filter = filter;
+  rep_->filter_cache_handle = cache_handle;
+}
+
+Iterator* Table::NewRangeDeletionIterator() const {
+  if (rep_->range_del_block == NULL) {
+    return NULL;
   }
-  rep_->filter = new FilterBlockReader(rep_->options.filter_policy, block.data);
+  return rep_->range_del_block->NewIterator(rep_->options.comparator);
 }
 
 Table::~Table() {
@@ -153,19 +288,157 @@ static void DeleteCachedBlock(const Slice& key, void* value) {
   delete block;
 }
 
+static void DeleteCachedFilterEntry(const Slice& key, void* value) {
+  DeleteFilterEntry(reinterpret_cast<FilterEntry*>(value));
+}
+
 static void ReleaseBlock(void* arg, void* h) {
   Cache* cache = reinterpret_cast<Cache*>(arg);
   Cache::Handle* handle = reinterpret_cast<Cache::Handle*>(h);
   cache->Release(handle);
 }
 
+Status Table::ReadCachedBlock(const ReadOptions& options,
+                              const BlockHandle& handle,
+                              Cache::Priority priority,
+                              Block** block,
+                              Cache::Handle** cache_handle) const {
+  Cache* block_cache = rep_->options.block_cache;
+  *block = NULL;
+  *cache_handle = NULL;
+
+  Status s;
+  BlockContents contents;
+  if (block_cache != NULL) {
+    char cache_key_buffer[16];
+    EncodeFixed64(cache_key_buffer, rep_->cache_id);
+    EncodeFixed64(cache_key_buffer+8, handle.offset());
+    Slice key(cache_key_buffer, sizeof(cache_key_buffer));
+    *cache_handle = block_cache->Lookup(key);
+    if (*cache_handle != NULL) {
+      *block = reinterpret_cast<Block*>(block_cache->Value(*cache_handle));
+    } else {
+      s = ReadBlock(rep_->file, options, handle, &contents);
+      if (s.ok()) {
+        *block = new Block(contents);
+        if (contents.cachable && options.fill_cache) {
+          *cache_handle = block_cache->Insert(
+              key, *block, (*block)->size(), &DeleteCachedBlock, priority);
+        }
+      }
+    }
+  } else {
+    s = ReadBlock(rep_->file, options, handle, &contents);
+    if (s.ok()) {
+      *block = new Block(contents);
+    }
+  }
+  return s;
+}
+
+Status Table::ReadCachedFilter(const ReadOptions& options,
+                               const BlockHandle& handle,
+                               bool full,
+                               Cache::Priority priority,
+                               FilterEntry** filter,
+                               Cache::Handle** cache_handle) const {
+  Cache* block_cache = rep_->options.block_cache;
+  *filter = NULL;
+  *cache_handle = NULL;
+
+  char cache_key_buffer[16];
+  Slice key(cache_key_buffer, sizeof(cache_key_buffer));
+  if (block_cache != NULL) {
+    EncodeFixed64(cache_key_buffer, rep_->cache_id);
+    EncodeFixed64(cache_key_buffer+8, handle.offset());
+    *cache_handle = block_cache->Lookup(key);
+    if (*cache_handle != NULL) {
+      *filter = reinterpret_cast<FilterEntry*>(
+          block_cache->Value(*cache_handle));
+      return Status::OK();
+    }
+  }
+
+  BlockContents contents;
+  Status s = ReadBlock(rep_->file, options, handle, &contents);
+  if (s.ok()) {
+    FilterEntry* entry = new FilterEntry;
+    entry->filter = NULL;
+    entry->full_filter = NULL;
+    if (full) {
+      entry->full_filter = new FullFilterBlockReader(
+          rep_->options.filter_policy, contents.data);
+    } else {
+      entry->filter = new FilterBlockReader(rep_->options.filter_policy,
+                                            contents.data);
+    }
+    entry->heap_data = contents.heap_allocated ? contents.data.data() : NULL;
+    *filter = entry;
+    if (block_cache != NULL && contents.cachable && options.fill_cache) {
+      *cache_handle = block_cache->Insert(key, entry, contents.data.size(),
+                                          &DeleteCachedFilterEntry, priority);
+    }
+  }
+  return s;
+}
+
+// Index and filter blocks kept in the block cache are inserted even by
+// reads that do not fill the cache, since every read of the table needs
+// them.
+static ReadOptions MetadataReadOptions(const ReadOptions& options) {
+  ReadOptions result = options;
+  result.fill_cache = true;
+  return result;
+}
+
+Cache::Handle* Table::GetFilter(const ReadOptions& options,
+                                FilterEntry** filter) const {
+  *filter = rep_->filter;
+  Cache::Handle* cache_handle = NULL;
+  if (*filter == NULL && rep_->has_filter) {
+    if (!ReadCachedFilter(MetadataReadOptions(options),
+                          rep_->filter_handle, rep_->full_filter,
+                          Cache::kHighPriority, filter,
+                          &cache_handle).ok()) {
+      *filter = NULL;  // Proceed without the filter
+    }
+  }
+  return cache_handle;
+}
+
+void Table::ReleaseFilter(FilterEntry* filter,
+                          Cache::Handle* cache_handle) const {
+  if (cache_handle != NULL) {
+    rep_->options.block_cache->Release(cache_handle);
+  } else if (filter != rep_->filter) {
+    DeleteFilterEntry(filter);
+  }
+}
+
 // Convert an index iterator value (i.e., an encoded BlockHandle)
 // into an iterator over the contents of the corresponding block.
 Iterator* Table::BlockReader(void* arg,
                              const ReadOptions& options,
                              const Slice& index_value) {
+  return reinterpret_cast<Table*>(arg)->NewBlockIterator(
+      options, index_value, Cache::kLowPriority);
+}
+
+// Like BlockReader(), for the values of a top-level index.
+Iterator* Table::IndexPartitionReader(void* arg,
+                                      const ReadOptions& options,
+                                      const Slice& index_value) {
   Table* table = reinterpret_cast<Table*>(arg);
-  Cache* block_cache = table->rep_->options.block_cache;
+  if (table->rep_->metadata_in_cache) {
+    return table->NewBlockIterator(MetadataReadOptions(options), index_value,
+                                   Cache::kHighPriority);
+  }
+  return table->NewBlockIterator(options, index_value, Cache::kLowPriority);
+}
+
+Iterator* Table::NewBlockIterator(const ReadOptions& options,
+                                  const Slice& index_value,
+                                  Cache::Priority priority) const {
   Block* block = NULL;
   Cache::Handle* cache_handle = NULL;
 
@@ -176,40 +449,17 @@ Iterator* Table::BlockReader(void* arg,
   // can add more features in the future.
 
   if (s.ok()) {
-    BlockContents contents;
-    if (block_cache != NULL) {
-      char cache_key_buffer[16];
-      EncodeFixed64(cache_key_buffer, table->rep_->cache_id);
-      EncodeFixed64(cache_key_buffer+8, handle.offset());
-      Slice key(cache_key_buffer, sizeof(cache_key_buffer));
-      cache_handle = block_cache->Lookup(key);
-      if (cache_handle != NULL) {
-        block = reinterpret_cast<Block*>(block_cache->Value(cache_handle));
-      } else {
-        s = ReadBlock(table->rep_->file, options, handle, &contents);
-        if (s.ok()) {
-          block = new Block(contents);
-          if (contents.cachable && options.fill_cache) {
-            cache_handle = block_cache->Insert(
-                key, block, block->size(), &DeleteCachedBlock);
-          }
-        }
-      }
-    } else {
-      s = ReadBlock(table->rep_->file, options, handle, &contents);
-      if (s.ok()) {
-        block = new Block(contents);
-      }
-    }
+    s = ReadCachedBlock(options, handle, priority, &block, &cache_handle);
   }
 
   Iterator* iter;
   if (block != NULL) {
-    iter = block->NewIterator(table->rep_->options.comparator);
+    iter = block->NewIterator(rep_->options.comparator);
     if (cache_handle == NULL) {
       iter->RegisterCleanup(&DeleteBlock, block, NULL);
     } else {
-      iter->RegisterCleanup(&ReleaseBlock, block_cache, cache_handle);
+      iter->RegisterCleanup(&ReleaseBlock, rep_->options.block_cache,
+                            cache_handle);
     }
   } else {
     iter = NewErrorIterator(s);
@@ -217,25 +467,145 @@ Iterator* Table::BlockReader(void* arg,
   return iter;
 }
 
+Iterator* Table::NewIndexBlockIterator(const ReadOptions& options) const {
+  if (rep_->index_block != NULL) {
+    return rep_->index_block->NewIterator(rep_->options.comparator);
+  }
+  std::string handle_encoding;
+  rep_->index_handle.EncodeTo(&handle_encoding);
+  return NewBlockIterator(MetadataReadOptions(options), handle_encoding,
+                          Cache::kHighPriority);
+}
+
+Iterator* Table::NewIndexIterator(const ReadOptions& options) const {
+  Iterator* iter = NewIndexBlockIterator(options);
+  if (rep_->partitioned_index) {
+    // The partitions have the same format as data blocks
+    iter = NewTwoLevelIterator(iter, &Table::IndexPartitionReader,
+                               const_cast<Table*>(this), options,
+                               rep_->options.comparator);
+  }
+  return iter;
+}
+
+bool Table::PartitionedFilterMayMatch(const ReadOptions& options,
+                                      const Slice& key,
+                                      const Slice* prefix) const {
+  bool may_match = true;
+  Iterator* iiter = NewIndexBlockIterator(options);
+  iiter->Seek(key);
+  if (!iiter->Valid()) {
+    // "key" is past the last key of the table, unless there was an error
+    may_match = !iiter->status().ok();
+    delete iiter;
+    return may_match;
+  }
+
+  Slice input = iiter->value();
+  BlockHandle partition_handle, filter_handle;
+  Status s = partition_handle.DecodeFrom(&input);
+  if (s.ok()) {
+    s = filter_handle.DecodeFrom(&input);
+  }
+  delete iiter;
+  if (!s.ok()) {
+    return true;  // Errors are treated as potential matches
+  }
+
+  FilterEntry* partition = NULL;
+  Cache::Handle* cache_handle = NULL;
+  if (rep_->metadata_in_cache) {
+    s = ReadCachedFilter(MetadataReadOptions(options), filter_handle, true,
+                         Cache::kHighPriority, &partition, &cache_handle);
+  } else {
+    s = ReadCachedFilter(options, filter_handle, true, Cache::kLowPriority,
+                         &partition, &cache_handle);
+  }
+  if (!s.ok()) {
+    return true;
+  }
+  may_match = (prefix == NULL)
+      ? partition->full_filter->KeyMayMatch(key)
+      : partition->full_filter->PrefixMayMatch(*prefix);
+  ReleaseFilter(partition, cache_handle);
+  return may_match;
+}
+
+bool Table::PrefixMayMatch(void* arg, const Slice& key) {
+  Table* table = reinterpret_cast<Table*>(arg);
+  const Rep* r = table->rep_;
+  if (!r->prefix_filtered || !r->options.prefix_extractor->InDomain(key)) {
+    return true;
+  }
+  const Slice prefix = r->options.prefix_extractor->Transform(key);
+
+  // Keys that share a prefix are adjacent, so if the first key at or
+  // after "key" has the prefix of "key", it is in the block (and index
+  // partition) that the index points at for "key".
+  if (r->partitioned_filter) {
+    return table->PartitionedFilterMayMatch(ReadOptions(), key, &prefix);
+  }
+  FilterEntry* filter;
+  Cache::Handle* filter_cache_handle = table->GetFilter(ReadOptions(),
+                                                        &filter);
+  bool may_match = true;
+  if (filter == NULL) {
+    // Could not read the filter
+  } else if (filter->full_filter != NULL) {
+    may_match = filter->full_filter->PrefixMayMatch(prefix);
+  } else {
+    Iterator* iiter = table->NewIndexIterator(ReadOptions());
+    iiter->Seek(key);
+    if (iiter->Valid()) {
+      Slice handle_value = iiter->value();
+      BlockHandle handle;
+      if (handle.DecodeFrom(&handle_value).ok()) {
+        may_match = filter->filter->PrefixMayMatch(handle.offset(), prefix);
+      }
+    } else if (iiter->status().ok()) {
+      may_match = false;  // "key" is past the last key of the table
+    }
+    delete iiter;
+  }
+  table->ReleaseFilter(filter, filter_cache_handle);
+  return may_match;
+}
+
 Iterator* Table::NewIterator(const ReadOptions& options) const {
-  return NewTwoLevelIterator(
-      rep_->index_block->NewIterator(rep_->options.comparator),
-      &Table::BlockReader, const_cast<Table*>(this), options);
+  Iterator* iter = NewTwoLevelIterator(
+      NewIndexIterator(options),
+      &Table::BlockReader, const_cast<Table*>(this), options,
+      rep_->options.comparator);
+  if (options.prefix_same_as_start && rep_->prefix_filtered) {
+    iter = NewPrefixFilteredIterator(iter, &Table::PrefixMayMatch,
+                                     const_cast<Table*>(this));
+  }
+  return iter;
 }
 
 Status Table::InternalGet(const ReadOptions& options, const Slice& k,
                           void* arg,
                           void (*saver)(void*, const Slice&, const Slice&)) {
+  FilterEntry* filter;
+  Cache::Handle* filter_cache_handle = GetFilter(options, &filter);
+  if ((filter != NULL && filter->full_filter != NULL &&
+       !filter->full_filter->KeyMayMatch(k)) ||
+      (rep_->partitioned_filter &&
+       !PartitionedFilterMayMatch(options, k, NULL))) {
+    ReleaseFilter(filter, filter_cache_handle);
+    return Status::OK();  // Not found
+  }
+
   Status s;
-  Iterator* iiter = rep_->index_block->NewIterator(rep_->options.comparator);
+  Iterator* iiter = NewIndexIterator(options);
   iiter->Seek(k);
   if (iiter->Valid()) {
     Slice handle_value = iiter->value();
-    FilterBlockReader* filter = rep_->filter;
+    FilterBlockReader* block_filter = (filter != NULL) ? filter->filter : NULL;
     BlockHandle handle;
-    if (filter != NULL &&
+    if (block_filter != NULL &&
         handle.DecodeFrom(&handle_value).ok() &&
-        !filter->KeyMayMatch(handle.offset(), k)) {
+        !block_filter->KeyMayMatch(handle.offset(), k)) {
       // Not found
     } else {
       Iterator* block_iter = BlockReader(this, options, iiter->value());
@@ -251,13 +621,97 @@ Status Table::InternalGet(const ReadOptions& options, const Slice& k,
     s = iiter->status();
   }
   delete iiter;
+  ReleaseFilter(filter, filter_cache_handle);
   return s;
 }
 
+Status Table::InternalMultiGet(const ReadOptions& options, int n,
+                               const Slice* keys, void* const* args,
+                               void (*saver)(void*, const Slice&,
+                                             const Slice&)) {
+  // Drop the keys that the table-wide (or partition-wide) filters rule
+  // out before looking at the index.
+  FilterEntry* filter;
+  Cache::Handle* filter_cache_handle = GetFilter(options, &filter);
+  FullFilterBlockReader* full_filter =
+      (filter != NULL) ? filter->full_filter : NULL;
+  std::vector<Slice> filtered_keys;
+  std::vector<void*> filtered_args;
+  if (full_filter != NULL || rep_->partitioned_filter) {
+    for (int j = 0; j < n; j++) {
+      if (full_filter != NULL
+          ? full_filter->KeyMayMatch(keys[j])
+          : PartitionedFilterMayMatch(options, keys[j], NULL)) {
+        filtered_keys.push_back(keys[j]);
+        filtered_args.push_back(args[j]);
+      }
+    }
+    if (filtered_keys.empty()) {
+      ReleaseFilter(filter, filter_cache_handle);
+      return Status::OK();
+    }
+    n = static_cast<int>(filtered_keys.size());
+    keys = &filtered_keys[0];
+    args = &filtered_args[0];
+  }
+
+  Status s;
+  const Comparator* cmp = rep_->options.comparator;
+  Iterator* iiter = NewIndexIterator(options);
+  std::vector<int> candidates;
+  int i = 0;
+  while (s.ok() && i < n) {
+    iiter->Seek(keys[i]);
+    if (!iiter->Valid()) {
+      break;  // Remaining keys are past the last block
+    }
+
+    // keys[i,end-1] all fall into the block that iiter points at
+    int end = i + 1;
+    while (end < n && cmp->Compare(keys[end], iiter->key()) <= 0) {
+      end++;
+    }
+
+    Slice handle_value = iiter->value();
+    FilterBlockReader* block_filter = (filter != NULL) ? filter->filter : NULL;
+    BlockHandle handle;
+    candidates.clear();
+    if (block_filter != NULL && handle.DecodeFrom(&handle_value).ok()) {
+      for (int j = i; j < end; j++) {
+        if (block_filter->KeyMayMatch(handle.offset(), keys[j])) {
+          candidates.push_back(j);
+        }
+      }
+    } else {
+      for (int j = i; j < end; j++) {
+        candidates.push_back(j);
+      }
+    }
+
+    if (!candidates.empty()) {
+      Iterator* block_iter = BlockReader(this, options, iiter->value());
+      for (size_t c = 0; c < candidates.size(); c++) {
+        const int j = candidates[c];
+        block_iter->Seek(keys[j]);
+        if (block_iter->Valid()) {
+          (*saver)(args[j], block_iter->key(), block_iter->value());
+        }
+      }
+      s = block_iter->status();
+      delete block_iter;
+    }
+    i = end;
+  }
+  if (s.ok()) {
+    s = iiter->status();
+  }
+  delete iiter;
+  ReleaseFilter(filter, filter_cache_handle);
+  return s;
+}
 
 uint64_t Table::ApproximateOffsetOf(const Slice& key) const {
-  Iterator* index_iter =
-      rep_->index_block->NewIterator(rep_->options.comparator);
+  Iterator* index_iter = NewIndexIterator(ReadOptions());
   index_iter->Seek(key);
   uint64_t result;
   if (index_iter->Valid()) {
@@ -9,9 +9,11 @@
 #include "leveldb/env.h"
 #include "leveldb/filter_policy.h"
 #include "leveldb/options.h"
+#include "leveldb/slice_transform.h"
 #include "table/block_builder.h"
 #include "table/filter_block.h"
 #include "table/format.h"
+#include "table/full_filter_block.h"
 #include "util/coding.h"
 #include "util/crc32c.h"
 
@@ -24,11 +26,17 @@ struct TableBuilder::Rep {
   uint64_t offset;
   Status status;
   BlockBuilder data_block;
-  BlockBuilder index_block;
+  BlockBuilder index_block;   // Whole index, or current index partition
+  BlockBuilder top_level_index_block;
+  BlockBuilder range_del_block;
   std::string last_key;
   int64_t num_entries;
+  int64_t num_range_deletions;
   bool closed;          // Either Finish() or Abandon() has been called.
   FilterBlockBuilder* filter_block;
+  FullFilterBlockBuilder* full_filter_block;
+  bool partitioned_index;   // options.index_partition_size > 0
+  bool partitioned_filter;  // One full filter per index partition?
 
   // We do not emit the index entry for a block until we have seen the
   // first key for the next data block.  This allows us to use shorter
@@ -51,10 +59,20 @@ struct TableBuilder::Rep {
         offset(0),
         data_block(&options),
         index_block(&index_block_options),
+        top_level_index_block(&index_block_options),
+        range_del_block(&options),
         num_entries(0),
+        num_range_deletions(0),
         closed(false),
-        filter_block(opt.filter_policy == NULL ? NULL
-                     : new FilterBlockBuilder(opt.filter_policy)),
+        filter_block((opt.filter_policy == NULL || opt.full_filter) ? NULL
+                     : new FilterBlockBuilder(opt.filter_policy,
+                                              opt.prefix_extractor)),
+        full_filter_block((opt.filter_policy == NULL || !opt.full_filter)
+                          ? NULL
+                          : new FullFilterBlockBuilder(opt.filter_policy,
+                                                       opt.prefix_extractor)),
+        partitioned_index(opt.index_partition_size > 0),
+        partitioned_filter(partitioned_index && full_filter_block != NULL),
         pending_index_entry(false) {
     index_block_options.block_restart_interval = 1;
   }
@@ -70,6 +88,7 @@ TableBuilder::TableBuilder(const Options& options, WritableFile* file)
 TableBuilder::~TableBuilder() {
   assert(rep_->closed);  // Catch errors where caller forgot to call Finish()
   delete rep_->filter_block;
+  delete rep_->full_filter_block;
   delete rep_;
 }
 
@@ -80,6 +99,19 @@ Status TableBuilder::ChangeOptions(const Options& options) {
   if (options.comparator != rep_->options.comparator) {
     return Status::InvalidArgument("changing comparator while building table");
   }
+  if (options.prefix_extractor != rep_->options.prefix_extractor) {
+    return Status::InvalidArgument(
+        "changing prefix extractor while building table");
+  }
+  if (options.filter_policy != rep_->options.filter_policy ||
+      options.full_filter != rep_->options.full_filter) {
+    return Status::InvalidArgument(
+        "changing filter options while building table");
+  }
+  if ((options.index_partition_size > 0) != rep_->partitioned_index) {
+    return Status::InvalidArgument(
+        "changing index partitioning while building table");
+  }
 
   // Note that any live BlockBuilders point to rep_->options and therefore
   // will automatically pick up the updated options.
@@ -104,10 +136,21 @@ void TableBuilder::Add(const Slice& key, const Slice& value) {
     r->pending_handle.EncodeTo(&handle_encoding);
     r->index_block.Add(r->last_key, Slice(handle_encoding));
     r->pending_index_entry = false;
+    if (r->partitioned_index &&
+        r->index_block.CurrentSizeEstimate() >=
+            r->options.index_partition_size) {
+      FinishIndexPartition();
+      if (r->filter_block != NULL) {
+        // The next data block starts after the partition
+        r->filter_block->StartBlock(r->offset);
+      }
+    }
   }
 
   if (r->filter_block != NULL) {
     r->filter_block->AddKey(key);
+  } else if (r->full_filter_block != NULL) {
+    r->full_filter_block->AddKey(key);
   }
 
   r->last_key.assign(key.data(), key.size());
@@ -120,6 +163,14 @@ void TableBuilder::Add(const Slice& key, const Slice& value) {
   }
 }
 
+void TableBuilder::AddRangeDeletion(const Slice& key, const Slice& value) {
+  Rep* r = rep_;
+  assert(!r->closed);
+  if (!ok()) return;
+  r->range_del_block.Add(key, value);
+  r->num_range_deletions++;
+}
+
 void TableBuilder::Flush() {
   Rep* r = rep_;
   assert(!r->closed);
@@ -136,6 +187,32 @@ void TableBuilder::Flush() {
   }
 }
 
+void TableBuilder::FinishIndexPartition() {
+  Rep* r = rep_;
+  if (!ok()) return;
+  assert(!r->index_block.empty());
+
+  // The top-level index maps the last key of the partition (which is
+  // >= every key in the partition's blocks and < every key after them)
+  // to the partition, followed by the partition's filter if any.
+  BlockHandle partition_handle;
+  WriteBlock(&r->index_block, &partition_handle);
+  std::string value;
+  partition_handle.EncodeTo(&value);
+  if (ok() && r->partitioned_filter) {
+    BlockHandle filter_handle;
+    WriteRawBlock(r->full_filter_block->Finish(), kNoCompression,
+                  &filter_handle);
+    filter_handle.EncodeTo(&value);
+    delete r->full_filter_block;
+    r->full_filter_block = new FullFilterBlockBuilder(
+        r->options.filter_policy, r->options.prefix_extractor);
+  }
+  if (ok()) {
+    r->top_level_index_block.Add(r->last_key, value);
+  }
+}
+
 void TableBuilder::WriteBlock(BlockBuilder* block, BlockHandle* handle) {
   // File format contains a sequence of blocks where each block has:
   //    block_data: uint8[n]
@@ -205,25 +282,61 @@ Status TableBuilder::Finish() {
   BlockHandle filter_block_handle, metaindex_block_handle, index_block_handle;
 
   // Write filter block
+  const bool has_filter =
+      (r->filter_block != NULL || r->full_filter_block != NULL);
   if (ok() && r->filter_block != NULL) {
     WriteRawBlock(r->filter_block->Finish(), kNoCompression,
                   &filter_block_handle);
+  } else if (ok() && r->full_filter_block != NULL && !r->partitioned_filter) {
+    WriteRawBlock(r->full_filter_block->Finish(), kNoCompression,
+                  &filter_block_handle);
   }
 
   // Write metaindex block
   if (ok()) {
     BlockBuilder meta_index_block(&r->options);
-    if (r->filter_block != NULL) {
-      // Add mapping from "filter.Name" to location of filter data
-      std::string key = "filter.";
+    if (has_filter) {
+      // Add mapping from "filter.Name" (or "fullfilter.Name") to location
+      // of filter data.  Partitioned filters are found through the
+      // top-level index; "partitionedfilter.Name" records their policy.
+      std::string key;
+      if (r->partitioned_filter) {
+        key = "partitionedfilter.";
+      } else if (r->full_filter_block != NULL) {
+        key = "fullfilter.";
+      } else {
+        key = "filter.";
+      }
       key.append(r->options.filter_policy->Name());
       std::string handle_encoding;
-      filter_block_handle.EncodeTo(&handle_encoding);
+      if (!r->partitioned_filter) {
+        filter_block_handle.EncodeTo(&handle_encoding);
+      }
       meta_index_block.Add(key, handle_encoding);
+
+      if (r->options.prefix_extractor != NULL) {
+        // Record which prefixes the filters summarize.  "prefix." sorts
+        // after the filter entry, as the block builder requires.
+        key = "prefix.";
+        key.append(r->options.prefix_extractor->Name());
+        meta_index_block.Add(key, handle_encoding);
+      }
+    }
+
+    if (r->num_range_deletions > 0) {
+      // Add mapping from "rangedeletions" to the block of range deletion
+      // entries.  It sorts after the filter entries.
+      BlockHandle range_del_handle;
+      WriteBlock(&r->range_del_block, &range_del_handle);
+      std::string handle_encoding;
+      range_del_handle.EncodeTo(&handle_encoding);
+      meta_index_block.Add("rangedeletions", handle_encoding);
     }
 
     // TODO(postrelease): Add stats and other meta blocks
-    WriteBlock(&meta_index_block, &metaindex_block_handle);
+    if (ok()) {
+      WriteBlock(&meta_index_block, &metaindex_block_handle);
+    }
   }
 
   // Write index block
@@ -235,7 +348,16 @@ Status TableBuilder::Finish() {
       r->index_block.Add(r->last_key, Slice(handle_encoding));
       r->pending_index_entry = false;
     }
-    WriteBlock(&r->index_block, &index_block_handle);
+    if (!r->partitioned_index) {
+      WriteBlock(&r->index_block, &index_block_handle);
+    } else {
+      if (!r->index_block.empty()) {
+        FinishIndexPartition();
+      }
+      if (ok()) {
+        WriteBlock(&r->top_level_index_block, &index_block_handle);
+      }
+    }
   }
 
   // Write footer
@@ -243,6 +365,7 @@ Status TableBuilder::Finish() {
     Footer footer;
     footer.set_metaindex_handle(metaindex_block_handle);
     footer.set_index_handle(index_block_handle);
+    footer.set_partitioned_index(r->partitioned_index);
     std::string footer_encoding;
     footer.EncodeTo(&footer_encoding);
     r->status = r->file->Append(footer_encoding);
@@ -263,6 +386,10 @@ uint64_t TableBuilder::NumEntries() const {
   return rep_->num_entries;
 }
 
+uint64_t TableBuilder::NumRangeDeletions() const {
+  return rep_->num_range_deletions;
+}
+
 uint64_t TableBuilder::FileSize() const {
   return rep_->offset;
 }
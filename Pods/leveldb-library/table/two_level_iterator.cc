@@ -4,6 +4,7 @@
 
 #include "table/two_level_iterator.h"
 
+#include "leveldb/comparator.h"
 #include "leveldb/table.h"
 #include "table/block.h"
 #include "table/format.h"
@@ -21,7 +22,8 @@ class TwoLevelIterator: public Iterator {
     Iterator* index_iter,
     BlockFunction block_function,
     void* arg,
-    const ReadOptions& options);
+    const ReadOptions& options,
+    const Comparator* comparator);
 
   virtual ~TwoLevelIterator();
 
@@ -62,9 +64,26 @@ class TwoLevelIterator: public Iterator {
   void SetDataIterator(Iterator* data_iter);
   void InitDataBlock();
 
+  // True if the blocks after the current one only hold keys at or
+  // after options_.iterate_upper_bound.
+  bool IndexAtOrPastUpperBound() const {
+    return (comparator_ != NULL && options_.iterate_upper_bound != NULL &&
+            comparator_->Compare(index_iter_.key(),
+                                 *options_.iterate_upper_bound) >= 0);
+  }
+
+  // True if the current block only holds keys before
+  // options_.iterate_lower_bound.
+  bool IndexBeforeLowerBound() const {
+    return (comparator_ != NULL && options_.iterate_lower_bound != NULL &&
+            comparator_->Compare(index_iter_.key(),
+                                 *options_.iterate_lower_bound) < 0);
+  }
+
   BlockFunction block_function_;
   void* arg_;
   const ReadOptions options_;
+  const Comparator* const comparator_;
   Status status_;
   IteratorWrapper index_iter_;
   IteratorWrapper data_iter_; // May be NULL
@@ -77,10 +96,12 @@ TwoLevelIterator::TwoLevelIterator(
     Iterator* index_iter,
     BlockFunction block_function,
     void* arg,
-    const ReadOptions& options)
+    const ReadOptions& options,
+    const Comparator* comparator)
     : block_function_(block_function),
       arg_(arg),
       options_(options),
+      comparator_(comparator),
       index_iter_(index_iter),
       data_iter_(NULL) {
 }
@@ -96,6 +117,11 @@ void TwoLevelIterator::Seek(const Slice& target) {
 }
 
 void TwoLevelIterator::SeekToFirst() {
+  if (comparator_ != NULL && options_.iterate_lower_bound != NULL) {
+    // Skip the blocks before the lower bound
+    Seek(*options_.iterate_lower_bound);
+    return;
+  }
   index_iter_.SeekToFirst();
   InitDataBlock();
   if (data_iter_.iter() != NULL) data_iter_.SeekToFirst();
@@ -103,7 +129,21 @@ void TwoLevelIterator::SeekToFirst() {
 }
 
 void TwoLevelIterator::SeekToLast() {
-  index_iter_.SeekToLast();
+  if (comparator_ != NULL && options_.iterate_upper_bound != NULL) {
+    // The first block whose index key is at or after the upper bound
+    // is the last one that may hold keys before it.
+    index_iter_.Seek(*options_.iterate_upper_bound);
+    if (!index_iter_.Valid() && index_iter_.status().ok()) {
+      index_iter_.SeekToLast();
+    }
+  } else {
+    index_iter_.SeekToLast();
+  }
+  if (index_iter_.Valid() && IndexBeforeLowerBound()) {
+    // Every block is before the lower bound
+    SetDataIterator(NULL);
+    return;
+  }
   InitDataBlock();
   if (data_iter_.iter() != NULL) data_iter_.SeekToLast();
   SkipEmptyDataBlocksBackward();
@@ -125,7 +165,7 @@ void TwoLevelIterator::Prev() {
 void TwoLevelIterator::SkipEmptyDataBlocksForward() {
   while (data_iter_.iter() == NULL || !data_iter_.Valid()) {
     // Move to next block
-    if (!index_iter_.Valid()) {
+    if (!index_iter_.Valid() || IndexAtOrPastUpperBound()) {
       SetDataIterator(NULL);
       return;
     }
@@ -143,6 +183,10 @@ void TwoLevelIterator::SkipEmptyDataBlocksBackward() {
       return;
     }
     index_iter_.Prev();
+    if (index_iter_.Valid() && IndexBeforeLowerBound()) {
+      SetDataIterator(NULL);
+      return;
+    }
     InitDataBlock();
     if (data_iter_.iter() != NULL) data_iter_.SeekToLast();
   }
@@ -175,8 +219,10 @@ Iterator* NewTwoLevelIterator(
     Iterator* index_iter,
     BlockFunction block_function,
     void* arg,
-    const ReadOptions& options) {
-  return new TwoLevelIterator(index_iter, block_function, arg, options);
+    const ReadOptions& options,
+    const Comparator* comparator) {
+  return new TwoLevelIterator(index_iter, block_function, arg, options,
+                              comparator);
 }
 
 }  // namespace leveldb
@@ -9,6 +9,7 @@
 
 namespace leveldb {
 
+class Comparator;
 struct ReadOptions;
 
 // Return a new two level iterator.  A two-level iterator contains an
@@ -20,6 +21,13 @@ struct ReadOptions;
 //
 // Uses a supplied function to convert an index_iter value into
 // an iterator over the contents of the corresponding block.
+//
+// Each index key must be at or after every key of its block and before
+// every key of the following blocks.  If "comparator" is non-NULL, it
+// orders the index keys against options.iterate_lower_bound and
+// options.iterate_upper_bound, and blocks that only hold keys outside
+// the bounds are skipped without calling "block_function".  Keys
+// outside the bounds from the blocks at the edges are still yielded.
 extern Iterator* NewTwoLevelIterator(
     Iterator* index_iter,
     Iterator* (*block_function)(
@@ -27,7 +35,8 @@ extern Iterator* NewTwoLevelIterator(
         const ReadOptions& options,
         const Slice& index_value),
     void* arg,
-    const ReadOptions& options);
+    const ReadOptions& options,
+    const Comparator* comparator);
 
 }  // namespace leveldb
 
@@ -4,12 +4,23 @@
 
 #include "util/arena.h"
 #include <assert.h>
+#include <new>
+#include "util/mutexlock.h"
 
 namespace leveldb {
 
 static const int kBlockSize = 4096;
 
-Arena::Arena() : memory_usage_(0) {
+// Header of a block used by concurrent allocations.  Threads claim the
+// bytes between "next" and "limit" by advancing "next" with
+// compare-and-swap; "next" never moves backwards, so a stale value can
+// only make the swap fail.
+struct Arena::SharedBlock {
+  port::AtomicPointer next;  // First unclaimed byte
+  char* limit;               // End of the block
+};
+
+Arena::Arena() : memory_usage_(0), shared_block_(NULL) {
   alloc_ptr_ = NULL;  // First allocation will allocate a block
   alloc_bytes_remaining_ = 0;
 }
@@ -57,6 +68,42 @@ char* Arena::AllocateAligned(size_t bytes) {
   return result;
 }
 
+char* Arena::AllocateShared(size_t bytes, size_t align) {
+  assert(bytes > 0);
+  assert((align & (align-1)) == 0);
+  if (bytes > kBlockSize / 4) {
+    // As in AllocateFallback(), large objects get a block of their own
+    MutexLock l(&mu_);
+    return AllocateNewBlock(bytes);
+  }
+  while (true) {
+    SharedBlock* block =
+        reinterpret_cast<SharedBlock*>(shared_block_.Acquire_Load());
+    if (block != NULL) {
+      char* next = reinterpret_cast<char*>(block->next.NoBarrier_Load());
+      size_t current_mod = reinterpret_cast<uintptr_t>(next) & (align-1);
+      size_t slop = (current_mod == 0 ? 0 : align - current_mod);
+      if (bytes + slop <= static_cast<size_t>(block->limit - next)) {
+        if (block->next.CompareAndSwap(next, next + slop + bytes)) {
+          return next + slop;
+        }
+        continue;  // Another thread claimed bytes first; retry
+      }
+    }
+
+    // The block is full: install a new one unless another thread has
+    // already done so.  The rest of the full block is wasted.
+    MutexLock l(&mu_);
+    if (shared_block_.NoBarrier_Load() == block) {
+      char* mem = AllocateNewBlock(kBlockSize);
+      SharedBlock* fresh = new (mem) SharedBlock;
+      fresh->next.NoBarrier_Store(mem + sizeof(SharedBlock));
+      fresh->limit = mem + kBlockSize;
+      shared_block_.Release_Store(fresh);
+    }
+  }
+}
+
 char* Arena::AllocateNewBlock(size_t block_bytes) {
   char* result = new char[block_bytes];
   blocks_.push_back(result);
@@ -24,6 +24,18 @@ class Arena {
   // Allocate memory with the normal alignment guarantees provided by malloc
   char* AllocateAligned(size_t bytes);
 
+  // Concurrent allocation mode: like Allocate() and AllocateAligned(),
+  // but may be called from several threads at the same time.  They must
+  // not overlap with calls to the unsynchronized versions.  Small
+  // allocations are carved out of a shared block with compare-and-swap;
+  // only allocating a new block takes a lock.
+  char* AllocateConcurrently(size_t bytes) {
+    return AllocateShared(bytes, 1);
+  }
+  char* AllocateAlignedConcurrently(size_t bytes) {
+    return AllocateShared(bytes, (sizeof(void*) > 8) ? sizeof(void*) : 8);
+  }
+
   // Returns an estimate of the total memory usage of data allocated
   // by the arena.
   size_t MemoryUsage() const {
@@ -31,8 +43,11 @@ class Arena {
   }
 
  private:
+  struct SharedBlock;
+
   char* AllocateFallback(size_t bytes);
   char* AllocateNewBlock(size_t block_bytes);
+  char* AllocateShared(size_t bytes, size_t align);
 
   // Allocation state
   char* alloc_ptr_;
@@ -44,6 +59,12 @@ class Arena {
   // Total memory usage of the arena.
   port::AtomicPointer memory_usage_;
 
+  // Block that concurrent allocations are carved out of (a SharedBlock*)
+  port::AtomicPointer shared_block_;
+
+  // Serializes concurrent allocations that need a new block
+  port::Mutex mu_;
+
   // No copying allowed
   Arena(const Arena&);
   void operator=(const Arena&);
@@ -0,0 +1,143 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "util/arena.h"
+
+#include <string.h>
+#include <vector>
+#include "leveldb/env.h"
+#include "port/port.h"
+#include "util/mutexlock.h"
+#include "util/random.h"
+#include "util/testharness.h"
+
+namespace leveldb {
+
+class ArenaTest { };
+
+TEST(ArenaTest, Empty) {
+  Arena arena;
+}
+
+TEST(ArenaTest, Simple) {
+  std::vector<std::pair<size_t, char*> > allocated;
+  Arena arena;
+  const int N = 100000;
+  size_t bytes = 0;
+  Random rnd(301);
+  for (int i = 0; i < N; i++) {
+    size_t s;
+    if (i % (N / 10) == 0) {
+      s = i;
+    } else {
+      s = rnd.OneIn(4000) ? rnd.Uniform(6000) :
+          (rnd.OneIn(10) ? rnd.Uniform(100) : rnd.Uniform(20));
+    }
+    if (s == 0) {
+      // Our arena disallows size 0 allocations.
+      s = 1;
+    }
+    char* r;
+    if (rnd.OneIn(10)) {
+      r = arena.AllocateAligned(s);
+    } else {
+      r = arena.Allocate(s);
+    }
+
+    for (size_t b = 0; b < s; b++) {
+      // Fill the "i"th allocation with a known bit pattern
+      r[b] = i % 256;
+    }
+    bytes += s;
+    allocated.push_back(std::make_pair(s, r));
+    ASSERT_GE(arena.MemoryUsage(), bytes);
+    if (i > N/10) {
+      ASSERT_LE(arena.MemoryUsage(), bytes * 1.10);
+    }
+  }
+  for (size_t i = 0; i < allocated.size(); i++) {
+    size_t num_bytes = allocated[i].first;
+    const char* p = allocated[i].second;
+    for (size_t b = 0; b < num_bytes; b++) {
+      // Check the "i"th allocation for the known bit pattern
+      ASSERT_EQ(int(p[b]) & 0xff, i % 256);
+    }
+  }
+}
+
+namespace {
+
+struct ConcurrentState {
+  Arena arena;
+  port::Mutex mu;
+  port::CondVar cv;
+  int running;
+  ConcurrentState() : cv(&mu), running(0) { }
+};
+
+struct ConcurrentThread {
+  ConcurrentState* state;
+  int id;
+  std::vector<std::pair<size_t, char*> > allocated;
+};
+
+static void ConcurrentAllocate(void* arg) {
+  ConcurrentThread* t = reinterpret_cast<ConcurrentThread*>(arg);
+  Random rnd(1000 + t->id);
+  for (int i = 0; i < 20000; i++) {
+    size_t s = rnd.OneIn(100) ? 1 + rnd.Uniform(3000) : 1 + rnd.Uniform(60);
+    char* r;
+    if (rnd.OneIn(2)) {
+      r = t->state->arena.AllocateAlignedConcurrently(s);
+      ASSERT_EQ(0, reinterpret_cast<uintptr_t>(r) & (sizeof(void*) - 1));
+    } else {
+      r = t->state->arena.AllocateConcurrently(s);
+    }
+    memset(r, t->id, s);
+    t->allocated.push_back(std::make_pair(s, r));
+  }
+  MutexLock l(&t->state->mu);
+  t->state->running--;
+  t->state->cv.Signal();
+}
+
+}  // namespace
+
+TEST(ArenaTest, Concurrent) {
+  const int kThreads = 8;
+  ConcurrentState state;
+  ConcurrentThread threads[kThreads];
+  state.running = kThreads;
+  for (int i = 0; i < kThreads; i++) {
+    threads[i].state = &state;
+    threads[i].id = i + 1;
+    Env::Default()->StartThread(ConcurrentAllocate, &threads[i]);
+  }
+  {
+    MutexLock l(&state.mu);
+    while (state.running > 0) {
+      state.cv.Wait();
+    }
+  }
+
+  // No two allocations overlap: each still holds its thread's pattern
+  size_t bytes = 0;
+  for (int i = 0; i < kThreads; i++) {
+    for (size_t j = 0; j < threads[i].allocated.size(); j++) {
+      const size_t n = threads[i].allocated[j].first;
+      const char* p = threads[i].allocated[j].second;
+      for (size_t b = 0; b < n; b++) {
+        ASSERT_EQ(threads[i].id, p[b]);
+      }
+      bytes += n;
+    }
+  }
+  ASSERT_GE(state.arena.MemoryUsage(), bytes);
+}
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  return leveldb::test::RunAllTests();
+}
@@ -0,0 +1,253 @@
+// Copyright (c) 2012 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "leveldb/filter_policy.h"
+
+#include "util/coding.h"
+#include "util/logging.h"
+#include "util/testharness.h"
+#include "util/testutil.h"
+
+namespace leveldb {
+
+static const int kVerbose = 1;
+
+static Slice Key(int i, char* buffer) {
+  EncodeFixed32(buffer, i);
+  return Slice(buffer, sizeof(uint32_t));
+}
+
+// Builds filters with a given policy and measures them
+class FilterTester {
+ private:
+  const FilterPolicy* policy_;
+  std::string filter_;
+  std::vector<std::string> keys_;
+
+ public:
+  explicit FilterTester(const FilterPolicy* policy) : policy_(policy) { }
+
+  ~FilterTester() {
+    delete policy_;
+  }
+
+  void Reset() {
+    keys_.clear();
+    filter_.clear();
+  }
+
+  void Add(const Slice& s) {
+    keys_.push_back(s.ToString());
+  }
+
+  void Build() {
+    std::vector<Slice> key_slices;
+    for (size_t i = 0; i < keys_.size(); i++) {
+      key_slices.push_back(Slice(keys_[i]));
+    }
+    filter_.clear();
+    policy_->CreateFilter(&key_slices[0], static_cast<int>(key_slices.size()),
+                          &filter_);
+    keys_.clear();
+    if (kVerbose >= 2) DumpFilter();
+  }
+
+  size_t FilterSize() const {
+    return filter_.size();
+  }
+
+  void DumpFilter() {
+    fprintf(stderr, "F(");
+    for (size_t i = 0; i+1 < filter_.size(); i++) {
+      const unsigned int c = static_cast<unsigned int>(filter_[i]);
+      for (int j = 0; j < 8; j++) {
+        fprintf(stderr, "%c", (c & (1 <<j)) ? '1' : '.');
+      }
+    }
+    fprintf(stderr, ")\n");
+  }
+
+  bool Matches(const Slice& s) {
+    if (!keys_.empty()) {
+      Build();
+    }
+    return policy_->KeyMayMatch(s, filter_);
+  }
+
+  double FalsePositiveRate() {
+    char buffer[sizeof(int)];
+    int result = 0;
+    for (int i = 0; i < 10000; i++) {
+      if (Matches(Key(i + 1000000000, buffer))) {
+        result++;
+      }
+    }
+    return result / 10000.0;
+  }
+
+  // Build filters over 1 to 10000 keys.  Check that every key matches
+  // (no false negatives), that a filter takes at most "bytes_per_key"
+  // bytes per key plus "overhead", and that no filter has a false
+  // positive rate above "max_rate".  Return the number of filters whose
+  // rate is above "mediocre_rate" minus a fifth of the others, which
+  // should not be positive.
+  int CheckVaryingLengths(double bytes_per_key, size_t overhead,
+                          double max_rate, double mediocre_rate) {
+    char buffer[sizeof(int)];
+
+    // Count number of filters that significantly exceed the false
+    // positive rate
+    int mediocre_filters = 0;
+    int good_filters = 0;
+
+    for (int length = 1; length <= 10000; length = NextLength(length)) {
+      Reset();
+      for (int i = 0; i < length; i++) {
+        Add(Key(i, buffer));
+      }
+      Build();
+
+      ASSERT_LE(FilterSize(),
+                static_cast<size_t>(length * bytes_per_key) + overhead);
+
+      // All added keys must match
+      for (int i = 0; i < length; i++) {
+        ASSERT_TRUE(Matches(Key(i, buffer)))
+            << "Length " << length << "; key " << i;
+      }
+
+      // Check false positive rate
+      double rate = FalsePositiveRate();
+      if (kVerbose >= 1) {
+        fprintf(stderr, "False positives: %5.2f%% @ length = %6d ; bytes = %6d\n",
+                rate*100.0, length, static_cast<int>(FilterSize()));
+      }
+      ASSERT_LE(rate, max_rate);
+      if (rate > mediocre_rate) mediocre_filters++;  // Allowed, but not too often
+      else good_filters++;
+    }
+    if (kVerbose >= 1) {
+      fprintf(stderr, "Filters: %d good, %d mediocre\n",
+              good_filters, mediocre_filters);
+    }
+    return mediocre_filters - good_filters / 5;
+  }
+
+ private:
+  static int NextLength(int length) {
+    if (length < 10) {
+      length += 1;
+    } else if (length < 100) {
+      length += 10;
+    } else if (length < 1000) {
+      length += 100;
+    } else {
+      length += 1000;
+    }
+    return length;
+  }
+};
+
+class BloomTest : public FilterTester {
+ public:
+  BloomTest() : FilterTester(NewBloomFilterPolicy(10)) { }
+};
+
+TEST(BloomTest, EmptyFilter) {
+  ASSERT_TRUE(! Matches("hello"));
+  ASSERT_TRUE(! Matches("world"));
+}
+
+TEST(BloomTest, Small) {
+  Add("hello");
+  Add("world");
+  ASSERT_TRUE(Matches("hello"));
+  ASSERT_TRUE(Matches("world"));
+  ASSERT_TRUE(! Matches("x"));
+  ASSERT_TRUE(! Matches("foo"));
+}
+
+TEST(BloomTest, VaryingLengths) {
+  ASSERT_LE(CheckVaryingLengths(10 / 8.0, 40, 0.02, 0.0125), 0);
+}
+
+class BlockedBloomTest : public FilterTester {
+ public:
+  BlockedBloomTest() : FilterTester(NewBlockedBloomFilterPolicy(10)) { }
+};
+
+TEST(BlockedBloomTest, BlockedEmptyFilter) {
+  ASSERT_TRUE(! Matches("hello"));
+  ASSERT_TRUE(! Matches("world"));
+}
+
+TEST(BlockedBloomTest, BlockedSmall) {
+  Add("hello");
+  Add("world");
+  ASSERT_TRUE(Matches("hello"));
+  ASSERT_TRUE(Matches("world"));
+  ASSERT_TRUE(! Matches("x"));
+  ASSERT_TRUE(! Matches("foo"));
+}
+
+TEST(BlockedBloomTest, BlockedVaryingLengths) {
+  // Each filter is rounded up to a whole 64-byte line
+  ASSERT_LE(CheckVaryingLengths(10 / 8.0, 64 + 1, 0.02, 0.0125), 0);
+}
+
+// Filters of one policy are not mistaken for those of the other
+TEST(BlockedBloomTest, DistinctName) {
+  const FilterPolicy* bloom = NewBloomFilterPolicy(10);
+  const FilterPolicy* blocked = NewBlockedBloomFilterPolicy(10);
+  ASSERT_NE(std::string(bloom->Name()), std::string(blocked->Name()));
+  delete blocked;
+  delete bloom;
+}
+
+class RibbonTest : public FilterTester {
+ public:
+  RibbonTest() : FilterTester(NewRibbonFilterPolicy(10)) { }
+};
+
+TEST(RibbonTest, RibbonEmptyFilter) {
+  ASSERT_TRUE(! Matches("hello"));
+  ASSERT_TRUE(! Matches("world"));
+}
+
+TEST(RibbonTest, RibbonSmall) {
+  Add("hello");
+  Add("world");
+  ASSERT_TRUE(Matches("hello"));
+  ASSERT_TRUE(Matches("world"));
+  ASSERT_TRUE(! Matches("x"));
+  ASSERT_TRUE(! Matches("foo"));
+}
+
+TEST(RibbonTest, RibbonVaryingLengths) {
+  // 7 fingerprint bits, for a false positive rate of 0.78%, in about
+  // 7.5 bits per key; at least one 64-slot block is added to each filter.
+  ASSERT_LE(CheckVaryingLengths(1.0, 2 * 64 * 7 / 8 + 2, 0.0125, 0.01), 0);
+}
+
+// A large ribbon filter is at least a fifth smaller than the bloom
+// filter with the same bits_per_key, for no more false positives
+TEST(RibbonTest, SmallerThanBloom) {
+  FilterTester bloom(NewBloomFilterPolicy(10));
+  char buffer[sizeof(int)];
+  for (int i = 0; i < 10000; i++) {
+    Add(Key(i, buffer));
+    bloom.Add(Key(i, buffer));
+  }
+  Build();
+  bloom.Build();
+  ASSERT_LT(FilterSize(), bloom.FilterSize() * 0.8);
+  ASSERT_LT(FalsePositiveRate(), 0.01);
+  ASSERT_LE(FalsePositiveRate(), bloom.FalsePositiveRate() + 0.002);
+}
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  return leveldb::test::RunAllTests();
+}
@@ -0,0 +1,164 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "leveldb/cache.h"
+
+#include <vector>
+#include "util/coding.h"
+#include "util/testharness.h"
+
+namespace leveldb {
+
+// Conversions between numeric keys/values and the types expected by Cache.
+static std::string EncodeKey(int k) {
+  std::string result;
+  PutFixed32(&result, k);
+  return result;
+}
+static int DecodeKey(const Slice& k) {
+  assert(k.size() == 4);
+  return DecodeFixed32(k.data());
+}
+static void* EncodeValue(uintptr_t v) { return reinterpret_cast<void*>(v); }
+static int DecodeValue(void* v) { return reinterpret_cast<uintptr_t>(v); }
+
+class CacheTest {
+ public:
+  static CacheTest* current_;
+
+  static void Deleter(const Slice& key, void* v) {
+    current_->deleted_keys_.push_back(DecodeKey(key));
+    current_->deleted_values_.push_back(DecodeValue(v));
+  }
+
+  static const int kCacheSize = 1600;
+  std::vector<int> deleted_keys_;
+  std::vector<int> deleted_values_;
+  Cache* cache_;
+
+  CacheTest() : cache_(NewLRUCache(kCacheSize, 0.5)) {
+    current_ = this;
+  }
+
+  ~CacheTest() {
+    delete cache_;
+  }
+
+  int Lookup(int key) {
+    Cache::Handle* handle = cache_->Lookup(EncodeKey(key));
+    const int r = (handle == NULL) ? -1 : DecodeValue(cache_->Value(handle));
+    if (handle != NULL) {
+      cache_->Release(handle);
+    }
+    return r;
+  }
+
+  void Insert(int key, int value, int charge = 1,
+              Cache::Priority priority = Cache::kLowPriority) {
+    cache_->Release(cache_->Insert(EncodeKey(key), EncodeValue(value), charge,
+                                   &CacheTest::Deleter, priority));
+  }
+
+  void Erase(int key) {
+    cache_->Erase(EncodeKey(key));
+  }
+};
+CacheTest* CacheTest::current_;
+
+TEST(CacheTest, HitAndMiss) {
+  ASSERT_EQ(-1, Lookup(100));
+
+  Insert(100, 101);
+  ASSERT_EQ(101, Lookup(100));
+  ASSERT_EQ(-1,  Lookup(200));
+  ASSERT_EQ(-1,  Lookup(300));
+
+  Insert(200, 201, 1, Cache::kHighPriority);
+  ASSERT_EQ(101, Lookup(100));
+  ASSERT_EQ(201, Lookup(200));
+  ASSERT_EQ(-1,  Lookup(300));
+
+  Insert(100, 102, 1, Cache::kHighPriority);
+  ASSERT_EQ(102, Lookup(100));
+  ASSERT_EQ(201, Lookup(200));
+
+  ASSERT_EQ(1, deleted_keys_.size());
+  ASSERT_EQ(100, deleted_keys_[0]);
+  ASSERT_EQ(101, deleted_values_[0]);
+}
+
+TEST(CacheTest, EraseHighPriority) {
+  Insert(100, 101, 1, Cache::kHighPriority);
+  Erase(100);
+  ASSERT_EQ(-1, Lookup(100));
+  ASSERT_EQ(1, deleted_keys_.size());
+  ASSERT_EQ(100, deleted_keys_[0]);
+  ASSERT_EQ(101, deleted_values_[0]);
+  ASSERT_EQ(0, cache_->TotalCharge());
+}
+
+// Low-priority entries are evicted before high-priority ones, however
+// much more recently they were used
+TEST(CacheTest, HighPriorityOutlivesLowPriority) {
+  for (int i = 0; i < 10; i++) {
+    Insert(i, 1000 + i, 1, Cache::kHighPriority);
+  }
+  for (int i = 100; i < 100 + 10 * kCacheSize; i++) {
+    Insert(i, 1000 + i);
+  }
+  for (int i = 0; i < 10; i++) {
+    ASSERT_EQ(1000 + i, Lookup(i));
+  }
+  ASSERT_LE(cache_->TotalCharge(), kCacheSize);
+}
+
+// Without a reserved pool, priorities are ignored
+TEST(CacheTest, NoHighPriorityPool) {
+  delete cache_;
+  cache_ = NewLRUCache(kCacheSize, 0);
+  for (int i = 0; i < 10; i++) {
+    Insert(i, 1000 + i, 1, Cache::kHighPriority);
+  }
+  for (int i = 100; i < 100 + 10 * kCacheSize; i++) {
+    Insert(i, 1000 + i);
+  }
+  for (int i = 0; i < 10; i++) {
+    ASSERT_EQ(-1, Lookup(i));
+  }
+}
+
+// High-priority entries beyond the reserved pool compete with the
+// low-priority ones, and the cache stays within its capacity
+TEST(CacheTest, HighPriorityPoolOverflow) {
+  for (int i = 0; i < 10 * kCacheSize; i++) {
+    Insert(i, 1000 + i, 1, Cache::kHighPriority);
+  }
+  ASSERT_LE(cache_->TotalCharge(), kCacheSize);
+  ASSERT_EQ(-1, Lookup(0));
+  ASSERT_EQ(1000 + 10 * kCacheSize - 1, Lookup(10 * kCacheSize - 1));
+
+  cache_->Prune();
+  ASSERT_EQ(0, cache_->TotalCharge());
+}
+
+TEST(CacheTest, PinnedHighPriorityEntries) {
+  Cache::Handle* h = cache_->Insert(EncodeKey(100), EncodeValue(101), 1,
+                                    &CacheTest::Deleter, Cache::kHighPriority);
+  for (int i = 0; i < 10 * kCacheSize; i++) {
+    Insert(1000 + i, 2000 + i, 1, Cache::kHighPriority);
+  }
+  ASSERT_EQ(101, Lookup(100));
+  cache_->Prune();
+  ASSERT_EQ(101, Lookup(100));
+  ASSERT_EQ(1, cache_->TotalCharge());
+  cache_->Release(h);
+  cache_->Prune();
+  ASSERT_EQ(-1, Lookup(100));
+}
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  return leveldb::test::RunAllTests();
+}
@@ -13,6 +13,17 @@ Status Env::NewAppendableFile(const std::string& fname, WritableFile** result) {
   return Status::NotSupported("NewAppendableFile", fname);
 }
 
+void Env::ScheduleWithPriority(void (*function)(void*), void* arg,
+                               Priority pri) {
+  Schedule(function, arg);
+}
+
+void Env::SetBackgroundThreads(int number, Priority pri) {
+}
+
+void Env::IncBackgroundThreadsIfNeeded(int number, Priority pri) {
+}
+
 SequentialFile::~SequentialFile() {
 }
 
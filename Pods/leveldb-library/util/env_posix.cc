@@ -323,6 +323,144 @@ class PosixLockTable {
   }
 };
 
+static void PthreadCall(const char* label, int result) {
+  if (result != 0) {
+    fprintf(stderr, "pthread %s: %s\n", label, strerror(result));
+    abort();
+  }
+}
+
+// A fixed-size set of background threads draining a FIFO queue of work
+// items.  Threads are started lazily as work is scheduled.  Lowering the
+// thread limit makes surplus threads exit once they are idle.
+class PosixThreadPool {
+ public:
+  PosixThreadPool() : total_threads_limit_(1), num_threads_(0) {
+    PthreadCall("mutex_init", pthread_mutex_init(&mu_, NULL));
+    PthreadCall("cvar_init", pthread_cond_init(&bgsignal_, NULL));
+  }
+
+  void Schedule(void (*function)(void*), void* arg);
+  void SetBackgroundThreads(int num) { SetThreadLimit(num, true); }
+  void IncBackgroundThreadsIfNeeded(int num) { SetThreadLimit(num, false); }
+
+ private:
+  void SetThreadLimit(int num, bool allow_reduce);
+
+  // BGThread() is the body of each background thread
+  void BGThread(int thread_id);
+  static void* BGThreadWrapper(void* arg);
+
+  // Start threads until num_threads_ == total_threads_limit_.
+  // REQUIRES: mu_ is held
+  void StartThreads();
+
+  // A thread whose id is at or past the limit exits, starting with the
+  // highest-numbered one so that ids stay dense.
+  // REQUIRES: mu_ is held
+  bool IsExcessThread(int thread_id) const {
+    return thread_id >= total_threads_limit_ &&
+           thread_id == num_threads_ - 1;
+  }
+
+  pthread_mutex_t mu_;
+  pthread_cond_t bgsignal_;
+  int total_threads_limit_;
+  int num_threads_;
+
+  // Entry per Schedule() call
+  struct BGItem { void* arg; void (*function)(void*); };
+  typedef std::deque<BGItem> BGQueue;
+  BGQueue queue_;
+};
+
+struct BGThreadState {
+  PosixThreadPool* pool;
+  int thread_id;
+};
+
+void* PosixThreadPool::BGThreadWrapper(void* arg) {
+  BGThreadState* state = reinterpret_cast<BGThreadState*>(arg);
+  PosixThreadPool* pool = state->pool;
+  int thread_id = state->thread_id;
+  delete state;
+  pool->BGThread(thread_id);
+  return NULL;
+}
+
+void PosixThreadPool::StartThreads() {
+  while (num_threads_ < total_threads_limit_) {
+    BGThreadState* state = new BGThreadState;
+    state->pool = this;
+    state->thread_id = num_threads_;
+    pthread_t t;
+    PthreadCall(
+        "create thread",
+        pthread_create(&t, NULL, &PosixThreadPool::BGThreadWrapper, state));
+    PthreadCall("detach thread", pthread_detach(t));
+    num_threads_++;
+  }
+}
+
+void PosixThreadPool::Schedule(void (*function)(void*), void* arg) {
+  PthreadCall("lock", pthread_mutex_lock(&mu_));
+
+  // Start background threads if necessary
+  StartThreads();
+
+  // Add to priority queue
+  queue_.push_back(BGItem());
+  queue_.back().function = function;
+  queue_.back().arg = arg;
+
+  // Wake up one idle thread to run the new item.
+  PthreadCall("signal", pthread_cond_signal(&bgsignal_));
+
+  PthreadCall("unlock", pthread_mutex_unlock(&mu_));
+}
+
+void PosixThreadPool::SetThreadLimit(int num, bool allow_reduce) {
+  if (num < 1) {
+    num = 1;
+  }
+  PthreadCall("lock", pthread_mutex_lock(&mu_));
+  if (num < total_threads_limit_ && !allow_reduce) {
+    PthreadCall("unlock", pthread_mutex_unlock(&mu_));
+    return;
+  }
+  total_threads_limit_ = num;
+  if (!queue_.empty()) {
+    StartThreads();
+  }
+  // Wake up all threads so that surplus ones notice that they should exit.
+  PthreadCall("broadcast", pthread_cond_broadcast(&bgsignal_));
+  PthreadCall("unlock", pthread_mutex_unlock(&mu_));
+}
+
+void PosixThreadPool::BGThread(int thread_id) {
+  while (true) {
+    // Wait until there is an item that is ready to run
+    PthreadCall("lock", pthread_mutex_lock(&mu_));
+    while (queue_.empty() && !IsExcessThread(thread_id)) {
+      PthreadCall("wait", pthread_cond_wait(&bgsignal_, &mu_));
+    }
+    if (IsExcessThread(thread_id)) {
+      num_threads_--;
+      // The next highest-numbered thread may now be excess as well.
+      PthreadCall("broadcast", pthread_cond_broadcast(&bgsignal_));
+      PthreadCall("unlock", pthread_mutex_unlock(&mu_));
+      break;
+    }
+
+    void (*function)(void*) = queue_.front().function;
+    void* arg = queue_.front().arg;
+    queue_.pop_front();
+
+    PthreadCall("unlock", pthread_mutex_unlock(&mu_));
+    (*function)(arg);
+  }
+}
+
 class PosixEnv : public Env {
  public:
   PosixEnv();
@@ -495,7 +633,25 @@ class PosixEnv : public Env {
     return result;
   }
 
-  virtual void Schedule(void (*function)(void*), void* arg);
+  virtual void Schedule(void (*function)(void*), void* arg) {
+    ScheduleWithPriority(function, arg, LOW);
+  }
+
+  virtual void ScheduleWithPriority(void (*function)(void*), void* arg,
+                                    Priority pri) {
+    assert(pri >= LOW && pri < TOTAL);
+    thread_pools_[pri].Schedule(function, arg);
+  }
+
+  virtual void SetBackgroundThreads(int number, Priority pri) {
+    assert(pri >= LOW && pri < TOTAL);
+    thread_pools_[pri].SetBackgroundThreads(number);
+  }
+
+  virtual void IncBackgroundThreadsIfNeeded(int number, Priority pri) {
+    assert(pri >= LOW && pri < TOTAL);
+    thread_pools_[pri].IncBackgroundThreadsIfNeeded(number);
+  }
 
   virtual void StartThread(void (*function)(void* arg), void* arg);
 
@@ -542,29 +698,8 @@ class PosixEnv : public Env {
   }
 
  private:
-  void PthreadCall(const char* label, int result) {
-    if (result != 0) {
-      fprintf(stderr, "pthread %s: %s\n", label, strerror(result));
-      abort();
-    }
-  }
-
-  // BGThread() is the body of the background thread
-  void BGThread();
-  static void* BGThreadWrapper(void* arg) {
-    reinterpret_cast<PosixEnv*>(arg)->BGThread();
-    return NULL;
-  }
-
-  pthread_mutex_t mu_;
-  pthread_cond_t bgsignal_;
-  pthread_t bgthread_;
-  bool started_bgthread_;
-
-  // Entry per Schedule() call
-  struct BGItem { void* arg; void (*function)(void*); };
-  typedef std::deque<BGItem> BGQueue;
-  BGQueue queue_;
+  // One pool per Priority, each with a single thread by default
+  PosixThreadPool thread_pools_[TOTAL];
 
   PosixLockTable locks_;
   Limiter mmap_limit_;
@@ -600,53 +735,8 @@ static intptr_t MaxOpenFiles() {
 }
 
 PosixEnv::PosixEnv()
-    : started_bgthread_(false),
-      mmap_limit_(MaxMmaps()),
+    : mmap_limit_(MaxMmaps()),
       fd_limit_(MaxOpenFiles()) {
-  PthreadCall("mutex_init", pthread_mutex_init(&mu_, NULL));
-  PthreadCall("cvar_init", pthread_cond_init(&bgsignal_, NULL));
-}
-
-void PosixEnv::Schedule(void (*function)(void*), void* arg) {
-  PthreadCall("lock", pthread_mutex_lock(&mu_));
-
-  // Start background thread if necessary
-  if (!started_bgthread_) {
-    started_bgthread_ = true;
-    PthreadCall(
-        "create thread",
-        pthread_create(&bgthread_, NULL,  &PosixEnv::BGThreadWrapper, this));
-  }
-
-  // If the queue is currently empty, the background thread may currently be
-  // waiting.
-  if (queue_.empty()) {
-    PthreadCall("signal", pthread_cond_signal(&bgsignal_));
-  }
-
-  // Add to priority queue
-  queue_.push_back(BGItem());
-  queue_.back().function = function;
-  queue_.back().arg = arg;
-
-  PthreadCall("unlock", pthread_mutex_unlock(&mu_));
-}
-
-void PosixEnv::BGThread() {
-  while (true) {
-    // Wait until there is an item that is ready to run
-    PthreadCall("lock", pthread_mutex_lock(&mu_));
-    while (queue_.empty()) {
-      PthreadCall("wait", pthread_cond_wait(&bgsignal_, &mu_));
-    }
-
-    void (*function)(void*) = queue_.front().function;
-    void* arg = queue_.front().arg;
-    queue_.pop_front();
-
-    PthreadCall("unlock", pthread_mutex_unlock(&mu_));
-    (*function)(arg);
-  }
 }
 
 namespace {
@@ -0,0 +1,140 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "leveldb/env.h"
+
+#include "port/port.h"
+#include "util/mutexlock.h"
+#include "util/testharness.h"
+
+namespace leveldb {
+
+static const int kDelayMicros = 100000;
+
+class EnvTest {
+ public:
+  Env* env_;
+  EnvTest() : env_(Env::Default()) { }
+};
+
+static void SetBool(void* ptr) {
+  reinterpret_cast<port::AtomicPointer*>(ptr)->NoBarrier_Store(ptr);
+}
+
+TEST(EnvTest, RunImmediately) {
+  port::AtomicPointer called (NULL);
+  env_->Schedule(&SetBool, &called);
+  env_->SleepForMicroseconds(kDelayMicros);
+  ASSERT_TRUE(called.NoBarrier_Load() != NULL);
+}
+
+TEST(EnvTest, RunWithPriority) {
+  port::AtomicPointer low(NULL);
+  port::AtomicPointer high(NULL);
+  env_->ScheduleWithPriority(&SetBool, &low, Env::LOW);
+  env_->ScheduleWithPriority(&SetBool, &high, Env::HIGH);
+  env_->SleepForMicroseconds(kDelayMicros);
+  ASSERT_TRUE(low.NoBarrier_Load() != NULL);
+  ASSERT_TRUE(high.NoBarrier_Load() != NULL);
+}
+
+struct BlockState {
+  port::AtomicPointer release;
+  port::AtomicPointer done;
+};
+
+static void BlockUntilReleased(void* arg) {
+  BlockState* state = reinterpret_cast<BlockState*>(arg);
+  while (state->release.Acquire_Load() == NULL) {
+    Env::Default()->SleepForMicroseconds(1000);
+  }
+  state->done.Release_Store(state);
+}
+
+TEST(EnvTest, HighPriorityNotQueuedBehindLow) {
+  // Occupy every thread of the LOW pool, then queue one more LOW job
+  env_->SetBackgroundThreads(1, Env::LOW);
+  BlockState blocker;
+  blocker.release.Release_Store(NULL);
+  blocker.done.Release_Store(NULL);
+  port::AtomicPointer low(NULL);
+  env_->ScheduleWithPriority(&BlockUntilReleased, &blocker, Env::LOW);
+  env_->ScheduleWithPriority(&SetBool, &low, Env::LOW);
+
+  port::AtomicPointer high(NULL);
+  env_->ScheduleWithPriority(&SetBool, &high, Env::HIGH);
+  env_->SleepForMicroseconds(kDelayMicros);
+  ASSERT_TRUE(high.NoBarrier_Load() != NULL);
+  ASSERT_TRUE(low.NoBarrier_Load() == NULL);
+
+  blocker.release.Release_Store(&blocker);
+  env_->SleepForMicroseconds(kDelayMicros);
+  ASSERT_TRUE(blocker.done.Acquire_Load() != NULL);
+  ASSERT_TRUE(low.NoBarrier_Load() != NULL);
+}
+
+// Jobs that each wait, for a while, until "expected" of them run at the
+// same time
+struct GatherState {
+  port::Mutex mu;
+  port::CondVar cv;
+  int expected;
+  int running;   // Jobs currently running
+  int peak;      // Most jobs seen running at the same time
+  int finished;
+  explicit GatherState(int n)
+      : cv(&mu), expected(n), running(0), peak(0), finished(0) { }
+};
+
+static void Gather(void* arg) {
+  GatherState* state = reinterpret_cast<GatherState*>(arg);
+  MutexLock l(&state->mu);
+  state->running++;
+  if (state->running > state->peak) {
+    state->peak = state->running;
+  }
+  const uint64_t deadline = Env::Default()->NowMicros() + 10 * kDelayMicros;
+  while (state->peak < state->expected &&
+         Env::Default()->NowMicros() < deadline) {
+    state->mu.Unlock();
+    Env::Default()->SleepForMicroseconds(1000);
+    state->mu.Lock();
+  }
+  state->running--;
+  state->finished++;
+  state->cv.SignalAll();
+}
+
+static int RunGather(Env* env, int jobs) {
+  GatherState state(jobs);
+  for (int i = 0; i < jobs; i++) {
+    env->ScheduleWithPriority(&Gather, &state, Env::LOW);
+  }
+  MutexLock l(&state.mu);
+  while (state.finished < jobs) {
+    state.cv.Wait();
+  }
+  return state.peak;
+}
+
+TEST(EnvTest, IncBackgroundThreadsIfNeeded) {
+  // Three jobs only run side by side once the pool has three threads
+  env_->IncBackgroundThreadsIfNeeded(3, Env::LOW);
+  ASSERT_EQ(3, RunGather(env_, 3));
+
+  // Asking for fewer threads leaves the pool as it is
+  env_->IncBackgroundThreadsIfNeeded(1, Env::LOW);
+  ASSERT_EQ(3, RunGather(env_, 3));
+
+  // SetBackgroundThreads() can lower it again, once surplus threads exit
+  env_->SetBackgroundThreads(1, Env::LOW);
+  env_->SleepForMicroseconds(kDelayMicros);
+  ASSERT_EQ(1, RunGather(env_, 2));
+}
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  return leveldb::test::RunAllTests();
+}
@@ -0,0 +1,128 @@
+// Copyright (c) 2012 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// Compares the filter policies on the space they take and on the cost
+// of building them and of positive and negative lookups.
+//
+// Usage: filter_bench [--num=N] [--bits_per_key=B] [--queries=Q]
+//
+//   --num          number of keys in each filter
+//   --bits_per_key bits per key passed to each policy (for the Ribbon
+//                  policy: bits per key of the bloom filter to match)
+//   --queries      number of lookups of keys that are not in the filter
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "leveldb/env.h"
+#include "leveldb/filter_policy.h"
+#include "leveldb/slice.h"
+#include "util/coding.h"
+
+namespace leveldb {
+
+namespace {
+
+int FLAGS_num = 1000000;
+int FLAGS_bits_per_key = 10;
+int FLAGS_queries = 1000000;
+
+// 16-byte user keys: a scrambled and a plain copy of the key's index.
+static void MakeKey(int i, std::string* key) {
+  char buf[16];
+  EncodeFixed64(buf, i * 0x9e3779b97f4a7c15ULL);
+  EncodeFixed64(buf + 8, i);
+  key->assign(buf, sizeof(buf));
+}
+
+static void Run(const char* label, const FilterPolicy* policy) {
+  Env* env = Env::Default();
+  std::vector<std::string> keys(FLAGS_num);
+  for (int i = 0; i < FLAGS_num; i++) {
+    MakeKey(i, &keys[i]);
+  }
+  std::vector<Slice> slices(keys.begin(), keys.end());
+
+  std::string filter;
+  uint64_t start = env->NowMicros();
+  policy->CreateFilter(&slices[0], FLAGS_num, &filter);
+  const uint64_t build_micros = env->NowMicros() - start;
+
+  start = env->NowMicros();
+  for (int i = 0; i < FLAGS_num; i++) {
+    if (!policy->KeyMayMatch(slices[i], filter)) {
+      fprintf(stderr, "%s: false negative for key %d\n", label, i);
+      exit(1);
+    }
+  }
+  const uint64_t positive_micros = env->NowMicros() - start;
+
+  std::vector<std::string> absent(FLAGS_queries);
+  for (int i = 0; i < FLAGS_queries; i++) {
+    MakeKey(FLAGS_num + i, &absent[i]);
+  }
+  int false_positives = 0;
+  start = env->NowMicros();
+  for (int i = 0; i < FLAGS_queries; i++) {
+    if (policy->KeyMayMatch(absent[i], filter)) {
+      false_positives++;
+    }
+  }
+  const uint64_t negative_micros = env->NowMicros() - start;
+
+  fprintf(stdout,
+          "%-14s : %6.2f bits/key  %6.3f%% fp  %7.1f ns/key build"
+          "  %6.1f ns hit  %6.1f ns miss\n",
+          label,
+          filter.size() * 8.0 / FLAGS_num,
+          false_positives * 100.0 / FLAGS_queries,
+          build_micros * 1e3 / FLAGS_num,
+          positive_micros * 1e3 / FLAGS_num,
+          negative_micros * 1e3 / FLAGS_queries);
+}
+
+}  // namespace
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  for (int i = 1; i < argc; i++) {
+    int n;
+    char junk;
+    if (sscanf(argv[i], "--num=%d%c", &n, &junk) == 1) {
+      leveldb::FLAGS_num = n;
+    } else if (sscanf(argv[i], "--bits_per_key=%d%c", &n, &junk) == 1) {
+      leveldb::FLAGS_bits_per_key = n;
+    } else if (sscanf(argv[i], "--queries=%d%c", &n, &junk) == 1) {
+      leveldb::FLAGS_queries = n;
+    } else {
+      fprintf(stderr, "Invalid flag '%s'\n", argv[i]);
+      exit(1);
+    }
+  }
+  if (leveldb::FLAGS_num < 1 || leveldb::FLAGS_queries < 1) {
+    fprintf(stderr, "--num and --queries must be positive\n");
+    exit(1);
+  }
+
+  fprintf(stdout, "Keys:       %d\n", leveldb::FLAGS_num);
+  fprintf(stdout, "Bits/key:   %d\n", leveldb::FLAGS_bits_per_key);
+  fprintf(stdout, "Queries:    %d\n", leveldb::FLAGS_queries);
+  fprintf(stdout, "------------------------------------------------\n");
+
+  const int bits = leveldb::FLAGS_bits_per_key;
+  const leveldb::FilterPolicy* bloom = leveldb::NewBloomFilterPolicy(bits);
+  const leveldb::FilterPolicy* blocked =
+      leveldb::NewBlockedBloomFilterPolicy(bits);
+  const leveldb::FilterPolicy* ribbon = leveldb::NewRibbonFilterPolicy(bits);
+  leveldb::Run("bloom", bloom);
+  leveldb::Run("blocked bloom", blocked);
+  leveldb::Run("ribbon", ribbon);
+  delete ribbon;
+  delete blocked;
+  delete bloom;
+  return 0;
+}
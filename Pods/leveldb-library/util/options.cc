@@ -17,14 +17,31 @@ Options::Options()
       env(Env::Default()),
       info_log(NULL),
       write_buffer_size(4<<20),
+      max_write_buffer_number(2),
+      allow_concurrent_memtable_write(false),
+      enable_pipelined_write(false),
+      log_sync_interval_micros(0),
+      log_sync_bytes(0),
       max_open_files(1000),
+      max_background_compactions(1),
+      delayed_write_rate(16 << 20),
+      soft_pending_compaction_bytes_limit(0),
+      max_subcompactions(1),
+      pipelined_compaction(false),
       block_cache(NULL),
+      cache_index_and_filter_blocks(false),
+      pin_l0_filter_and_index_blocks_in_cache(false),
+      row_cache(NULL),
       block_size(4096),
       block_restart_interval(16),
+      index_partition_size(0),
       max_file_size(2<<20),
       compression(kSnappyCompression),
       reuse_logs(false),
-      filter_policy(NULL) {
+      filter_policy(NULL),
+      full_filter(false),
+      prefix_extractor(NULL),
+      merge_operator(NULL) {
 }
 
 }  // namespace leveldb
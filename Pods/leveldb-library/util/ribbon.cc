@@ -0,0 +1,254 @@
+// Copyright (c) 2012 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// A filter policy based on a Standard Ribbon static retrieval structure
+// (Dillinger & Walzer, "Ribbon filter: practically smaller than Bloom
+// and Xor", 2021).
+//
+// Each key is hashed to a start slot s, a 64-bit coefficient row c (with
+// bit 0 set) and an r-bit fingerprint f.  Building the filter solves
+// the linear system over GF(2) that asks, for every key, that the
+// XOR of the r-bit solution values S[s+j] over the set bits j of c be
+// f.  A query recomputes that XOR and compares it with f: a key that was
+// added always matches, and any other key matches with probability
+// 2^-r.  The solution takes little more than r bits per key, where a
+// bloom filter needs about 1.44*r bits for the same false positive rate.
+//
+// The system is banded: keys are sorted into place by Gaussian
+// elimination that only touches the 64 slots after their start ("on the
+// fly" insertion), and the solution is then found by back substitution.
+// The solution is stored interleaved: for every block of 64 slots, r
+// 64-bit words hold one bit column each, so a query reads r words from
+// each of at most two adjacent blocks.
+//
+// Filter format:
+//    solution: uint64[num_blocks * r]  (little-endian)
+//    seed: uint8   Hash seed that let the system be solved
+//    r: uint8      Number of fingerprint bits, 1..16
+
+#include "leveldb/filter_policy.h"
+
+#include <math.h>
+#include <vector>
+#include "leveldb/slice.h"
+#include "util/coding.h"
+#include "util/hash.h"
+
+namespace leveldb {
+
+namespace {
+
+static const size_t kRibbonWidth = 64;
+
+// Number of hash seeds tried before the filter is given more slots
+static const int kRibbonSeedsPerSize = 8;
+
+static inline int CountTrailingZeros(uint64_t x) {
+#if defined(__GNUC__)
+  return __builtin_ctzll(x);
+#else
+  int n = 0;
+  while ((x & 1) == 0) {
+    x >>= 1;
+    n++;
+  }
+  return n;
+#endif
+}
+
+static inline uint32_t Parity(uint64_t x) {
+#if defined(__GNUC__)
+  return static_cast<uint32_t>(__builtin_parityll(x));
+#else
+  x ^= x >> 32;
+  x ^= x >> 16;
+  x ^= x >> 8;
+  x ^= x >> 4;
+  x ^= x >> 2;
+  x ^= x >> 1;
+  return static_cast<uint32_t>(x & 1);
+#endif
+}
+
+static inline uint64_t Mix64(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+static uint64_t RibbonKeyHash(const Slice& key) {
+  return (static_cast<uint64_t>(Hash(key.data(), key.size(), 0xbc9f1d34))
+          << 32) | Hash(key.data(), key.size(), 0x9ae16a3b);
+}
+
+// The row of the linear system for a key with hash "h".
+struct RibbonRow {
+  size_t start;
+  uint64_t coeff;
+  uint32_t result;
+};
+
+static inline void GetRibbonRow(uint64_t h, uint32_t seed,
+                                size_t num_starts, int r, RibbonRow* row) {
+  const uint64_t a = Mix64(h + seed * 0x9e3779b97f4a7c15ULL);
+  row->start = static_cast<size_t>(((a >> 32) * num_starts) >> 32);
+  row->coeff = Mix64(a) | 1;
+  row->result = static_cast<uint32_t>(a) & ((1u << r) - 1);
+}
+
+class RibbonFilterPolicy : public FilterPolicy {
+ private:
+  int r_;   // Fingerprint bits
+
+  // Try to solve the system for hashes[0,n-1] over "num_slots" slots
+  // with hash seed "seed", appending the solution to *dst.
+  bool Solve(const std::vector<uint64_t>& hashes, size_t num_slots,
+             uint32_t seed, std::string* dst) const {
+    const size_t num_starts = num_slots - kRibbonWidth + 1;
+    std::vector<uint64_t> coeff(num_slots, 0);
+    std::vector<uint32_t> result(num_slots, 0);
+    for (size_t k = 0; k < hashes.size(); k++) {
+      RibbonRow row;
+      GetRibbonRow(hashes[k], seed, num_starts, r_, &row);
+      size_t i = row.start;
+      uint64_t c = row.coeff;
+      uint32_t f = row.result;
+      while (true) {
+        if (coeff[i] == 0) {
+          coeff[i] = c;
+          result[i] = f;
+          break;
+        }
+        c ^= coeff[i];
+        f ^= result[i];
+        if (c == 0) {
+          if (f != 0) {
+            return false;  // Inconsistent: try again with another seed
+          }
+          break;  // Redundant, e.g. a duplicate key
+        }
+        const int shift = CountTrailingZeros(c);
+        i += shift;
+        c >>= shift;
+      }
+    }
+
+    // Back substitution.  state[j] holds bit column j of the solution
+    // for slots i..i+63, with slot i in bit 0.
+    const size_t num_blocks = num_slots / kRibbonWidth;
+    const size_t init_size = dst->size();
+    dst->resize(init_size + num_blocks * r_ * 8);
+    char* out = &(*dst)[init_size];
+    uint64_t state[16] = { 0 };
+    for (size_t i = num_slots; i-- > 0; ) {
+      const uint64_t c = coeff[i];
+      const uint32_t f = result[i];
+      for (int j = 0; j < r_; j++) {
+        state[j] <<= 1;
+        // Slots without a row are free; leave their solution bits zero
+        state[j] |= (Parity(c & state[j]) ^ (f >> j)) & (c != 0 ? 1 : 0);
+      }
+      if (i % kRibbonWidth == 0) {
+        char* block = out + (i / kRibbonWidth) * r_ * 8;
+        for (int j = 0; j < r_; j++) {
+          EncodeFixed64(block + j * 8, state[j]);
+        }
+      }
+    }
+    return true;
+  }
+
+ public:
+  explicit RibbonFilterPolicy(int bloom_equivalent_bits_per_key) {
+    // Match the false positive rate of NewBloomFilterPolicy() with the
+    // same number of bits per key, rounding towards fewer false positives.
+    const double bits = (bloom_equivalent_bits_per_key < 1)
+                        ? 1 : bloom_equivalent_bits_per_key;
+    int k = static_cast<int>(bits * 0.69);
+    if (k < 1) k = 1;
+    if (k > 30) k = 30;
+    const double fp_rate = pow(1.0 - exp(-k / bits), k);
+    r_ = static_cast<int>(ceil(-log(fp_rate) / log(2.0) - 0.01));
+    if (r_ < 1) r_ = 1;
+    if (r_ > 16) r_ = 16;
+  }
+
+  virtual const char* Name() const {
+    return "leveldb.RibbonFilter";
+  }
+
+  virtual void CreateFilter(const Slice* keys, int n, std::string* dst) const {
+    std::vector<uint64_t> hashes(n);
+    for (int i = 0; i < n; i++) {
+      hashes[i] = RibbonKeyHash(keys[i]);
+    }
+
+    // The number of extra slots needed for the system to be solvable
+    // with good probability grows with log(n): about 3% for a thousand
+    // keys, 7% for ten thousand, 11% for a hundred thousand, 15% for a
+    // million.  Each retry with another seed is independent, and after
+    // a few failures we add more slots.
+    double overhead = 0.03;
+    if (n > 1000) {
+      overhead += 0.012 * log(n / 1000.0) / log(2.0);
+    }
+    size_t num_slots = n + static_cast<size_t>(n * overhead) + kRibbonWidth;
+    const size_t init_size = dst->size();
+    while (true) {
+      num_slots = (num_slots + kRibbonWidth - 1) / kRibbonWidth * kRibbonWidth;
+      for (uint32_t seed = 0; seed < kRibbonSeedsPerSize; seed++) {
+        if (Solve(hashes, num_slots, seed, dst)) {
+          dst->push_back(static_cast<char>(seed));
+          dst->push_back(static_cast<char>(r_));
+          return;
+        }
+        dst->resize(init_size);
+      }
+      num_slots += num_slots / 32 + kRibbonWidth;
+    }
+  }
+
+  virtual bool KeyMayMatch(const Slice& key, const Slice& filter) const {
+    const size_t len = filter.size();
+    if (len < 2) return false;
+
+    const char* array = filter.data();
+    const uint32_t seed = static_cast<unsigned char>(array[len-2]);
+    const int r = static_cast<unsigned char>(array[len-1]);
+    if (r < 1 || r > 16 || (len - 2) % (r * 8) != 0) {
+      // Reserved for potentially new encodings.  Consider it a match.
+      return true;
+    }
+    const size_t num_blocks = (len - 2) / (r * 8);
+    if (num_blocks == 0) return false;
+
+    RibbonRow row;
+    GetRibbonRow(RibbonKeyHash(key), seed,
+                 num_blocks * kRibbonWidth - kRibbonWidth + 1, r, &row);
+    const size_t offset = row.start % kRibbonWidth;
+    const char* lo = array + (row.start / kRibbonWidth) * r * 8;
+    const char* hi = lo + r * 8;  // Only read if offset > 0
+    for (int j = 0; j < r; j++) {
+      uint64_t window = DecodeFixed64(lo + j * 8) >> offset;
+      if (offset > 0) {
+        window |= DecodeFixed64(hi + j * 8) << (kRibbonWidth - offset);
+      }
+      if (Parity(window & row.coeff) != ((row.result >> j) & 1)) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+}  // namespace
+
+const FilterPolicy* NewRibbonFilterPolicy(int bloom_equivalent_bits_per_key) {
+  return new RibbonFilterPolicy(bloom_equivalent_bits_per_key);
+}
+
+}  // namespace leveldb
@@ -0,0 +1,77 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "leveldb/slice_transform.h"
+
+#include <assert.h>
+#include <stdio.h>
+
+namespace leveldb {
+
+SliceTransform::~SliceTransform() { }
+
+namespace {
+
+class FixedPrefixTransform : public SliceTransform {
+ private:
+  size_t prefix_len_;
+  char name_[40];
+
+ public:
+  explicit FixedPrefixTransform(size_t prefix_len)
+      : prefix_len_(prefix_len) {
+    snprintf(name_, sizeof(name_), "leveldb.FixedPrefix.%llu",
+             static_cast<unsigned long long>(prefix_len));
+  }
+
+  virtual const char* Name() const {
+    return name_;
+  }
+
+  virtual Slice Transform(const Slice& key) const {
+    assert(InDomain(key));
+    return Slice(key.data(), prefix_len_);
+  }
+
+  virtual bool InDomain(const Slice& key) const {
+    return key.size() >= prefix_len_;
+  }
+};
+
+class CappedPrefixTransform : public SliceTransform {
+ private:
+  size_t cap_len_;
+  char name_[40];
+
+ public:
+  explicit CappedPrefixTransform(size_t cap_len)
+      : cap_len_(cap_len) {
+    snprintf(name_, sizeof(name_), "leveldb.CappedPrefix.%llu",
+             static_cast<unsigned long long>(cap_len));
+  }
+
+  virtual const char* Name() const {
+    return name_;
+  }
+
+  virtual Slice Transform(const Slice& key) const {
+    return Slice(key.data(), key.size() < cap_len_ ? key.size() : cap_len_);
+  }
+
+  virtual bool InDomain(const Slice& key) const {
+    return true;
+  }
+};
+
+}  // namespace
+
+const SliceTransform* NewFixedPrefixTransform(size_t prefix_len) {
+  return new FixedPrefixTransform(prefix_len);
+}
+
+const SliceTransform* NewCappedPrefixTransform(size_t cap_len) {
+  return new CappedPrefixTransform(cap_len);
+}
+
+}  // namespace leveldb